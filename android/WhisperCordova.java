@@ -8,7 +8,9 @@ import java.io.IOException;
 import java.nio.channels.FileChannel;
 
 import java.text.SimpleDateFormat;
+import java.util.ArrayList;
 import java.util.Date;
+import java.util.List;
 
 import org.apache.cordova.CallbackContext;
 import org.apache.cordova.CordovaPlugin;
@@ -17,11 +19,14 @@ import org.json.JSONArray;
 import org.json.JSONException;
 
 import android.Manifest;
+import android.content.Context;
 import android.content.Intent;
 import android.content.pm.PackageManager;
 import android.content.res.AssetManager;
 import android.net.Uri;
 import android.os.Environment;
+import android.os.Handler;
+import android.os.Looper;
 import android.util.Base64;
 import android.util.Log;
 
@@ -31,11 +36,44 @@ import android.util.Log;
 public class WhisperCordova extends CordovaPlugin {
     public static final int WRITE_PERM_REQUEST_CODE = 1;
     private final String ACTION = "decodeChunkAudio";
+    private final String ACTION_SET_FRONTEND = "setFrontend";
+    private final String ACTION_SET_PROFILING = "setProfiling";
+    private final String ACTION_GET_PROFILE = "getProfile";
+    private final String ACTION_SET_SHARED_ARENA = "setSharedArena";
+    private final String ACTION_SET_IDLE_RELEASE = "setIdleRelease";
+    private final String ACTION_GET_MEMORY_STATS = "getMemoryStats";
+    private final String ACTION_PREPARE = "prepare";
+    private final String ACTION_SET_TIMESTAMPS = "setTimestamps";
+    private final String ACTION_GET_TIMESTAMPS = "getTimestamps";
+    private final String ACTION_DETECT_LANGUAGE = "detectLanguage";
+    private final String ACTION_SET_LANGUAGE = "setLanguage";
     private final String WRITE_EXTERNAL_STORAGE = Manifest.permission.WRITE_EXTERNAL_STORAGE;
     private CallbackContext callbackContext;
     private String filePath;
     private int isBase64 = 0;
     private float fromTime = 0;
+    private boolean detectPending = false;
+    private int idleReleaseSeconds = 0;
+    private final Object prepareLock = new Object();
+    private boolean prepareRunning = false;
+    private boolean prepared = false;
+    private final List<CallbackContext> prepareCallbacks = new ArrayList<CallbackContext>();
+    private final Handler idleHandler = new Handler(Looper.getMainLooper());
+    // the countdown runs on the main looper, the release itself off it: the native side skips
+    // it when a transcription holds the interpreters
+    private final Runnable idleRelease = new Runnable() {
+        @Override
+        public void run() {
+            cordova.getThreadPool().execute(new Runnable() {
+                @Override
+                public void run() {
+                    if (releaseIdleJNI()) {
+                        Log.d("whispercordova", "released the interpreter arenas while idle");
+                    }
+                }
+            });
+        }
+    };
 
     static {
       Log.d("whispercordova", "trying to load static lib");
@@ -43,12 +81,73 @@ public class WhisperCordova extends CordovaPlugin {
       Log.d("whispercordova", "done load static lib");
     }
 
+    /**
+     * Point the native side at the directory compressed model assets are extracted to,
+     * the app update time tells copies of an older install apart
+     */
+    @Override
+    protected void pluginInitialize() {
+      Context context = this.cordova.getActivity().getApplicationContext();
+      File cacheDir = new File(context.getNoBackupFilesDir(), "whisper-models");
+      cacheDir.mkdirs();
+      String key = "0";
+      try {
+        key = Long.toString(context.getPackageManager().getPackageInfo(context.getPackageName(), 0).lastUpdateTime);
+      } catch (PackageManager.NameNotFoundException e) {
+        Log.d("whispercordova", "package info not found, model copies are keyed on their size and hash only");
+      }
+      setModelCacheJNI(cacheDir.getAbsolutePath(), key);
+      if (preferences.getBoolean("WhisperPrepareOnLoad", false)) {
+        prepare(null);
+      }
+    }
+
     @Override
     public boolean execute(String action, JSONArray args, CallbackContext callbackContext) throws JSONException {
       Log.d("whispercordova", "execute function");
         if (action.equals(ACTION)) {
             decodeChunkAudio(args, callbackContext);
             return true;
+        } else if (action.equals(ACTION_SET_FRONTEND)) {
+            setFrontend(args, callbackContext);
+            return true;
+        } else if (action.equals(ACTION_SET_PROFILING)) {
+            setProfilingJNI(args.getBoolean(0));
+            callbackContext.success();
+            return true;
+        } else if (action.equals(ACTION_GET_PROFILE)) {
+            callbackContext.success(getProfileJNI());
+            return true;
+        } else if (action.equals(ACTION_SET_SHARED_ARENA)) {
+            // lowers the peak memory of the loop decoder, which plans an arena as large as a fifth of the
+            // encoder one; the step decoder's arena is too small to gain anything
+            setSharedArenaJNI(args.getBoolean(0));
+            callbackContext.success();
+            return true;
+        } else if (action.equals(ACTION_SET_IDLE_RELEASE)) {
+            idleReleaseSeconds = Math.max(0, args.getInt(0));
+            setIdleReleaseJNI(idleReleaseSeconds);
+            scheduleIdleRelease();
+            callbackContext.success();
+            return true;
+        } else if (action.equals(ACTION_PREPARE)) {
+            prepare(callbackContext);
+            return true;
+        } else if (action.equals(ACTION_SET_TIMESTAMPS)) {
+            setTimestamps(args, callbackContext);
+            return true;
+        } else if (action.equals(ACTION_GET_TIMESTAMPS)) {
+            callbackContext.success(getTimestampsJNI());
+            return true;
+        } else if (action.equals(ACTION_DETECT_LANGUAGE)) {
+            detectLanguage(args, callbackContext);
+            return true;
+        } else if (action.equals(ACTION_SET_LANGUAGE)) {
+            setLanguage(args, callbackContext);
+            return true;
+        } else if (action.equals(ACTION_GET_MEMORY_STATS)) {
+            callbackContext.success(getMemoryStatsJNI());
+            return true;
         } else {
             return false;
         }
@@ -57,9 +156,23 @@ public class WhisperCordova extends CordovaPlugin {
     // Load model by TF Lite C++ API
         private native String loadModelJNI(AssetManager assetManager, String fileName, int isBase64, float fromTime);
         private native int  freeModelJNI();
+        private native int  setFrontendJNI(String frontendName);
+        private native void setProfilingJNI(boolean enable);
+        private native String getProfileJNI();
+        private native void setSharedArenaJNI(boolean enable);
+        private native void setIdleReleaseJNI(int seconds);
+        private native boolean releaseIdleJNI();
+        private native String getMemoryStatsJNI();
+        private native void setModelCacheJNI(String dir, String key);
+        private native boolean prepareJNI(AssetManager assetManager);
+        private native int  setTimestampsJNI(String modeName);
+        private native String getTimestampsJNI();
+        private native int  setLanguageJNI(String languageCode);
+        private native String detectLanguageJNI(AssetManager assetManager, String fileName, float fromTime);
         @Override
             public void onDestroy() {
                 super.onDestroy();
+                idleHandler.removeCallbacks(idleRelease);
                 freeModelJNI();
             }
     /**
@@ -79,6 +192,7 @@ public class WhisperCordova extends CordovaPlugin {
       this.fromTime = Float.parseFloat(args.getString(2));
       Log.d("whispercordova", "executing decodeChunkAudio 3");
     	this.callbackContext = callback;
+        this.detectPending = false;
         Log.d("whispercordova", "DecodeChunkAudio in filePath: " + filePath);
 
         if (filePath == null || filePath.equals("")) {
@@ -88,13 +202,163 @@ public class WhisperCordova extends CordovaPlugin {
 
         if (PermissionHelper.hasPermission(this, WRITE_EXTERNAL_STORAGE)) {
         	Log.d("whispercordova", "Permissions already granted, or Android version is lower than 6");
-        	loadModelJNI(this.cordova.getActivity().getApplicationContext().getAssets(), this.filePath, this.isBase64, this.fromTime);
+        	transcribe();
         } else {
         	Log.d("whispercordova", "Requesting permissions for WRITE_EXTERNAL_STORAGE");
         	PermissionHelper.requestPermission(this, WRITE_PERM_REQUEST_CODE, WRITE_EXTERNAL_STORAGE);
         }
     }
 
+    /**
+     * Run the native pipeline on the pending chunk and report the text
+     */
+    private void transcribe() {
+      idleHandler.removeCallbacks(idleRelease);
+      String text = loadModelJNI(this.cordova.getActivity().getApplicationContext().getAssets(), this.filePath, this.isBase64, this.fromTime);
+      scheduleIdleRelease();
+      if (text == null) {
+        callbackContext.error("Transcription failed");
+        return;
+      }
+      callbackContext.success(text);
+    }
+
+    /**
+     * Rank the languages of a chunk, its encoder output is kept for a decodeChunkAudio of the same chunk
+     *
+     * args[0] filePath         path of the WAV/MP3 file
+     * args[1] fromTime         start of the 30 second chunk in seconds
+     */
+    private void detectLanguage(JSONArray args, CallbackContext callback) throws JSONException {
+      this.filePath = args.getString(0);
+      this.fromTime = Float.parseFloat(args.getString(1));
+      this.callbackContext = callback;
+      this.detectPending = true;
+      if (filePath == null || filePath.equals("")) {
+        callback.error("Missing filePath variable");
+        return;
+      }
+      if (PermissionHelper.hasPermission(this, WRITE_EXTERNAL_STORAGE)) {
+        runDetectLanguage();
+      } else {
+        PermissionHelper.requestPermission(this, WRITE_PERM_REQUEST_CODE, WRITE_EXTERNAL_STORAGE);
+      }
+    }
+
+    /**
+     * Run the language detection on the pending chunk and report the ranked languages as JSON
+     */
+    private void runDetectLanguage() {
+      idleHandler.removeCallbacks(idleRelease);
+      String ranked = detectLanguageJNI(this.cordova.getActivity().getApplicationContext().getAssets(), this.filePath, this.fromTime);
+      scheduleIdleRelease();
+      if (ranked == null) {
+        callbackContext.error("Language detection failed");
+        return;
+      }
+      callbackContext.success(ranked);
+    }
+
+    /**
+     * Select the language of the next decodeChunkAudio calls
+     *
+     * args[0] languageCode     code of a language of the multilingual models, e.g. "en" or "de"
+     */
+    private void setLanguage(JSONArray args, CallbackContext callback) throws JSONException {
+      String languageCode = args.getString(0);
+      if (setLanguageJNI(languageCode) != 0) {
+        callback.error("Unknown language: " + languageCode);
+        return;
+      }
+      callback.success(languageCode);
+    }
+
+    /**
+     * Load and warm up the models on a background thread, the callback fires once they are ready;
+     * calls while it runs wait for the same pass, calls after it succeed right away
+     *
+     * @param callback          readiness callback, null when started by WhisperPrepareOnLoad
+     */
+    private void prepare(CallbackContext callback) {
+      idleHandler.removeCallbacks(idleRelease);
+      synchronized (prepareLock) {
+        if (prepared) {
+          if (callback != null) {
+            callback.success();
+          }
+          return;
+        }
+        if (callback != null) {
+          prepareCallbacks.add(callback);
+        }
+        if (prepareRunning) {
+          return;
+        }
+        prepareRunning = true;
+      }
+      final AssetManager assets = this.cordova.getActivity().getApplicationContext().getAssets();
+      this.cordova.getThreadPool().execute(new Runnable() {
+        @Override
+        public void run() {
+          boolean ok = prepareJNI(assets);
+          List<CallbackContext> callbacks;
+          synchronized (prepareLock) {
+            prepareRunning = false;
+            prepared = ok;
+            callbacks = new ArrayList<CallbackContext>(prepareCallbacks);
+            prepareCallbacks.clear();
+          }
+          scheduleIdleRelease();
+          for (CallbackContext pending : callbacks) {
+            if (ok) {
+              pending.success();
+            } else {
+              pending.error("Model preparation failed");
+            }
+          }
+        }
+      });
+    }
+
+    /**
+     * Restart the idle countdown, the native side frees the arenas once it runs out
+     */
+    private void scheduleIdleRelease() {
+      idleHandler.removeCallbacks(idleRelease);
+      if (idleReleaseSeconds > 0) {
+        idleHandler.postDelayed(idleRelease, idleReleaseSeconds * 1000L);
+      }
+    }
+
+    /**
+     * Select the mel spectrogram frontend used by the next decodeChunkAudio calls
+     *
+     * args[0] frontendName     "reference", "spectrogram", "fixed" or "micro" (when built with WHISPER_MICROFRONTEND)
+     */
+    private void setFrontend(JSONArray args, CallbackContext callback) throws JSONException {
+      String frontendName = args.getString(0);
+      if (setFrontendJNI(frontendName) != 0) {
+        callback.error("Frontend not available: " + frontendName);
+        return;
+      }
+      callback.success(frontendName);
+    }
+
+    /**
+     * Select the timestamps of the next decodeChunkAudio calls, read back with getTimestamps
+     *
+     * args[0] modeName         "none", "segments" (from the timestamp tokens) or "words"
+     *                          (segments, and words when the decoder was built with --alignment-heads)
+     */
+    private void setTimestamps(JSONArray args, CallbackContext callback) throws JSONException {
+      String modeName = args.getString(0);
+      if (setTimestampsJNI(modeName) != 0) {
+        callback.error("Unknown timestamps mode: " + modeName);
+        return;
+      }
+      callback.success(modeName);
+    }
+
     /**
      * Callback from PermissionHelper.requestPermission method
      */
@@ -110,7 +374,11 @@ public class WhisperCordova extends CordovaPlugin {
 		switch (requestCode) {
 		case WRITE_PERM_REQUEST_CODE:
 			Log.d("whispercordova", "User granted the permission for WRITE_EXTERNAL_STORAGE");
-			loadModelJNI(this.cordova.getActivity().getApplicationContext().getAssets(), this.filePath, this.isBase64, this.fromTime);
+			if (detectPending) {
+				runDetectLanguage();
+			} else {
+				transcribe();
+			}
 			break;
 		}
 	}
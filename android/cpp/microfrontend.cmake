@@ -0,0 +1,35 @@
+# Static library with tensorflow/lite/experimental/microfrontend/lib and the
+# 16 bit fixed point kissfft it is built on. kissfft is not vendored, set
+# KISSFFT_DIR to a checkout of https://github.com/mborgerding/kissfft.
+
+# kiss_fftr.c moved from tools/ to the top level in kissfft 131
+find_file( KISSFFTR_SOURCE kiss_fftr.c PATHS ${KISSFFT_DIR} ${KISSFFT_DIR}/tools NO_DEFAULT_PATH )
+if(NOT EXISTS ${KISSFFT_DIR}/kiss_fft.c OR NOT KISSFFTR_SOURCE)
+    message(FATAL_ERROR "WHISPER_MICROFRONTEND needs KISSFFT_DIR pointing at the kissfft sources")
+endif()
+
+set(MICROFRONTEND_DIR
+        ${CMAKE_CURRENT_LIST_DIR}/tf-lite-api/tensorflow_src/tensorflow/lite/experimental/microfrontend/lib)
+
+add_library( microfrontend STATIC
+        ${MICROFRONTEND_DIR}/fft.cc
+        ${MICROFRONTEND_DIR}/fft_util.cc
+        ${MICROFRONTEND_DIR}/filterbank.c
+        ${MICROFRONTEND_DIR}/filterbank_util.c
+        ${MICROFRONTEND_DIR}/frontend.c
+        ${MICROFRONTEND_DIR}/frontend_util.c
+        ${MICROFRONTEND_DIR}/log_lut.c
+        ${MICROFRONTEND_DIR}/log_scale.c
+        ${MICROFRONTEND_DIR}/log_scale_util.c
+        ${MICROFRONTEND_DIR}/noise_reduction.c
+        ${MICROFRONTEND_DIR}/noise_reduction_util.c
+        ${MICROFRONTEND_DIR}/pcan_gain_control.c
+        ${MICROFRONTEND_DIR}/pcan_gain_control_util.c
+        ${MICROFRONTEND_DIR}/window.c
+        ${MICROFRONTEND_DIR}/window_util.c
+        ${KISSFFT_DIR}/kiss_fft.c
+        ${KISSFFTR_SOURCE} )
+target_compile_definitions( microfrontend PRIVATE FIXED_POINT=16 )
+target_include_directories( microfrontend PRIVATE
+        ${KISSFFT_DIR} ${KISSFFT_DIR}/tools
+        ${CMAKE_CURRENT_LIST_DIR}/tf-lite-api/tensorflow_src )
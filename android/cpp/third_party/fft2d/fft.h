@@ -0,0 +1,23 @@
+// Declarations from Ooura's FFT package (http://www.kurims.kyoto-u.ac.jp/~ooura/fft.html).
+// tensorflow/lite/kernels/internal/spectrogram.h includes this header; the
+// implementation itself is already linked into libtensorflowlite.so, so only
+// the prototypes are needed to build against the prebuilt library.
+#ifndef FFT2D_FFT_H__
+#define FFT2D_FFT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void cdft(int, int, double *, int *, double *);
+extern void rdft(int, int, double *, int *, double *);
+extern void ddct(int, int, double *, int *, double *);
+extern void ddst(int, int, double *, int *, double *);
+extern void dfct(int, double *, double *, int *, double *);
+extern void dfst(int, double *, double *, int *, double *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FFT2D_FFT_H__
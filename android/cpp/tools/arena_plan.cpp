@@ -0,0 +1,513 @@
+//Computes an offline tensor arena plan for every signature of a plugin model
+//and stores it in the model metadata (whisper_arena_plan.h), so the pipeline
+//binds those tensors to one pool at load and the online ArenaPlanner only
+//places what is left. The interpreter is built like whisper_init_interpreter()
+//does, XNNPACK delegate included, and the lifetimes are taken from the
+//delegated execution plan the same way ArenaPlanner::PlanAllocations() takes
+//them. Planned are the activations of the primary and the signature
+//subgraphs whose size does not follow a resizable input (probed by resizing
+//the inputs with a -1 dimension); op temporaries, dynamic tensors and control
+//flow bodies stay online.
+//
+//Offsets are placed best-fit, like the online planner, over several orders
+//(its own, by size, by lifetime, by size x lifetime, by first use); the
+//smallest is kept and compared with the lower bound, the most bytes live at
+//one node.
+//
+//  whisper-plan in.tflite out.tflite [options]
+//    --threads N   interpreter threads (default: hardware concurrency)
+//    --repeat N    timed re-plans of each model (default: 20)
+//    --force       write the plan even when the pool and the arena left online take more
+//                  than the online arena alone
+//
+//Prints JSON: per subgraph the planned tensors, the online arena, the offline
+//pool with its order and lower bound and the arena left online, then for the
+//whole model the arena bytes and the median AllocateTensors() time of a
+//re-plan with and without the plan, whether the plan was written, and the
+//largest output difference of one Invoke() of every signature on the same
+//inputs. Without a plan out.tflite is the input model, any earlier plan removed.
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "whisper.h"
+#include "whisper_frontend.h"
+#include "whisper_pipeline.h"
+#include "whisper_model_edit.h"
+#include "whisper_tool_common.h"
+
+struct plan_item {
+    int tensor = 0;
+    int first = 0;      // node that allocates it
+    int last = INT_MAX; // node of its last use, INT_MAX when it lives to the end
+    size_t bytes = 0;   // aligned
+    size_t offset = 0;
+};
+
+struct plan_subgraph_report {
+    int subgraph = 0;
+    std::string name;
+    int n_tensors = 0;
+    size_t online = 0;    // arena of the online planner
+    size_t pool = 0;      // offline plan
+    size_t bound = 0;     // most planned bytes live at one node
+    size_t residual = 0;  // arena left online with the plan bound
+    std::string order;
+};
+
+//interpreter over a copy of the file, built the pipeline way
+static bool plan_build(const std::vector<uint8_t> & bytes, whisper_tflite & params, whisper_arena_plan & plan,
+                       const bool use_plan) {
+    params.buffer = (char *) malloc(bytes.size());
+    memcpy(params.buffer, bytes.data(), bytes.size());
+    params.size = bytes.size();
+    g_whisper_use_arena_plan = use_plan;
+    whisper_model_profile profile;
+    if (!whisper_init_interpreter(params, profile, plan)) {
+        return false;
+    }
+    //signature subgraphs are planned by their first AllocateTensors()
+    for (const std::string * key : params.interpreter->signature_keys()) {
+        tflite::SignatureRunner * runner = params.interpreter->GetSignatureRunner(key->c_str());
+        if (runner == nullptr || runner->AllocateTensors() != kTfLiteOk) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void plan_free(whisper_tflite & params, whisper_arena_plan & plan) {
+    params.interpreter.reset();
+    params.model.reset();
+    free(params.buffer);
+    params.buffer = nullptr;
+    whisper_arena_plan_release(plan);
+}
+
+//primary subgraph and the subgraphs of the signatures
+static std::vector<int> plan_subgraphs(const tflite::Interpreter & interpreter) {
+    std::vector<int> subgraphs = {0};
+    for (const std::string * key : interpreter.signature_keys()) {
+        subgraphs.push_back(interpreter.GetSubgraphIndexFromSignature(key->c_str()));
+    }
+    std::sort(subgraphs.begin(), subgraphs.end());
+    subgraphs.erase(std::unique(subgraphs.begin(), subgraphs.end()), subgraphs.end());
+    return subgraphs;
+}
+
+static size_t plan_arena_bytes(const tflite::Subgraph & subgraph) {
+    tflite::Subgraph::SubgraphAllocInfo info;
+    subgraph.GetMemoryAllocInfo(&info);
+    return info.arena_size;
+}
+
+//tensors whose size changes when the inputs with a -1 dimension are resized
+static std::vector<bool> plan_resizable(tflite::Subgraph & subgraph) {
+    std::vector<bool> resizable(subgraph.tensors_size(), false);
+    std::vector<size_t> before(subgraph.tensors_size());
+    for (size_t i = 0; i < subgraph.tensors_size(); i++) {
+        before[i] = subgraph.tensor(i)->bytes;
+    }
+    std::vector<std::pair<int, std::vector<int>>> resized;
+    for (const int input : subgraph.inputs()) {
+        const TfLiteTensor * t = subgraph.tensor(input);
+        if (t->dims_signature == nullptr) {
+            continue;
+        }
+        std::vector<int> dims(t->dims->data, t->dims->data + t->dims->size);
+        std::vector<int> probe = dims;
+        bool dynamic = false;
+        for (int d = 0; d < t->dims_signature->size; d++) {
+            if (t->dims_signature->data[d] == -1) {
+                probe[d] = dims[d] + 3;
+                dynamic = true;
+            }
+        }
+        if (dynamic) {
+            resized.push_back({input, dims});
+            subgraph.ResizeInputTensor(input, probe);
+        }
+    }
+    if (resized.empty()) {
+        return resizable;
+    }
+    //a resized input marks every tensor it reaches, allocated or not yet sized
+    if (subgraph.AllocateTensors() != kTfLiteOk) {
+        resizable.assign(resizable.size(), true);
+    }
+    for (size_t i = 0; i < subgraph.tensors_size(); i++) {
+        resizable[i] = resizable[i] || subgraph.tensor(i)->bytes != before[i];
+    }
+    for (const auto & it : resized) {
+        subgraph.ResizeInputTensor(it.first, it.second);
+    }
+    subgraph.AllocateTensors();
+    return resizable;
+}
+
+//lifetimes of the planned tensors, as ArenaPlanner::PlanAllocations() sets them
+static std::vector<plan_item> plan_lifetimes(const tflite::Subgraph & subgraph, const std::vector<bool> & resizable) {
+    const size_t n_tensors = subgraph.tensors_size();
+    const std::vector<int> & nodes = subgraph.execution_plan();
+    std::vector<int> first(n_tensors, -1);
+    std::vector<int> last(n_tensors, INT_MAX);
+    std::vector<int> refcounts(n_tensors, 0);
+    std::vector<bool> temporary(n_tensors, false);
+    for (const int t : subgraph.outputs()) {
+        refcounts[t]++;
+    }
+    for (const int t : subgraph.inputs()) {
+        if (t != kTfLiteOptionalTensor) {
+            refcounts[t]++;
+            first[t] = 0;
+        }
+    }
+    for (const int n : nodes) {
+        const TfLiteNode & node = subgraph.node_and_registration(n)->first;
+        for (int j = 0; j < node.inputs->size; j++) {
+            if (node.inputs->data[j] != kTfLiteOptionalTensor) {
+                refcounts[node.inputs->data[j]]++;
+            }
+        }
+        for (int j = 0; j < node.temporaries->size; j++) {
+            temporary[node.temporaries->data[j]] = true;
+        }
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const TfLiteNode & node = subgraph.node_and_registration(nodes[i])->first;
+        for (int j = 0; j < node.outputs->size; j++) {
+            const int t = node.outputs->data[j];
+            first[t] = first[t] == -1 ? (int) i : first[t];
+        }
+        for (int j = 0; j < node.inputs->size; j++) {
+            const int t = node.inputs->data[j];
+            if (t != kTfLiteOptionalTensor && --refcounts[t] == 0 && first[t] != -1) {
+                last[t] = (int) i;
+            }
+        }
+    }
+    std::vector<plan_item> items;
+    for (size_t t = 0; t < n_tensors; t++) {
+        const TfLiteTensor * tensor = subgraph.tensor(t);
+        if (first[t] == -1 || temporary[t] || resizable[t] || tensor->allocation_type != kTfLiteArenaRw ||
+            tensor->data.raw == nullptr || tensor->bytes == 0) {
+            continue;
+        }
+        plan_item item;
+        item.tensor = (int) t;
+        item.first = first[t];
+        item.last = last[t];
+        item.bytes = whisper_arena_plan_align(tensor->bytes);
+        items.push_back(item);
+    }
+    return items;
+}
+
+//best-fit placement in the given order, returns the pool size
+static size_t plan_place(std::vector<plan_item> & items, const std::vector<int> & order) {
+    std::vector<const plan_item *> placed;
+    size_t size = 0;
+    for (const int k : order) {
+        plan_item & item = items[k];
+        size_t offset = 0;
+        size_t best = SIZE_MAX;
+        size_t best_gap = SIZE_MAX;
+        for (const plan_item * p : placed) {
+            if (p->last < item.first || p->first > item.last) {
+                continue;
+            }
+            if (p->offset >= offset + item.bytes && p->offset - offset < best_gap) {
+                best = offset;
+                best_gap = p->offset - offset;
+            }
+            offset = std::max(offset, p->offset + p->bytes);
+        }
+        item.offset = best != SIZE_MAX ? best : offset;
+        size = std::max(size, item.offset + item.bytes);
+        placed.insert(std::upper_bound(placed.begin(), placed.end(), &item,
+                                       [](const plan_item * a, const plan_item * b) { return a->offset < b->offset; }),
+                      &item);
+    }
+    return size;
+}
+
+//most bytes live at one node, no placement goes below it
+static size_t plan_lower_bound(const std::vector<plan_item> & items, const int n_nodes) {
+    std::vector<int64_t> delta(n_nodes + 2, 0);
+    for (const plan_item & item : items) {
+        delta[item.first] += item.bytes;
+        delta[std::min(item.last, n_nodes) + 1] -= item.bytes;
+    }
+    int64_t live = 0;
+    int64_t bound = 0;
+    for (const int64_t d : delta) {
+        live += d;
+        bound = std::max(bound, live);
+    }
+    return bound;
+}
+
+//smallest placement over the candidate orders, the items keep its offsets
+static size_t plan_best(std::vector<plan_item> & items, std::string & order_name) {
+    using compare = std::function<bool(const plan_item &, const plan_item &)>;
+    auto length = [](const plan_item & a) {
+        return (int64_t) std::min(a.last, 1 << 20) - a.first + 1;
+    };
+    const std::vector<std::pair<const char *, compare>> orders = {
+        //ArenaPlanner: whole run tensors first, then by size
+        {"online", [](const plan_item & a, const plan_item & b) {
+            const bool wa = a.first == 0 && a.last == INT_MAX;
+            const bool wb = b.first == 0 && b.last == INT_MAX;
+            if (wa != wb) {
+                return wa;
+            }
+            return wa ? a.tensor < b.tensor : a.bytes > b.bytes;
+        }},
+        {"size", [](const plan_item & a, const plan_item & b) {
+            return a.bytes > b.bytes;
+        }},
+        {"lifetime", [&](const plan_item & a, const plan_item & b) {
+            return length(a) != length(b) ? length(a) > length(b) : a.bytes > b.bytes;
+        }},
+        {"area", [&](const plan_item & a, const plan_item & b) {
+            return (double) a.bytes*length(a) > (double) b.bytes*length(b);
+        }},
+        {"first_use", [](const plan_item & a, const plan_item & b) {
+            return a.first != b.first ? a.first < b.first : a.bytes > b.bytes;
+        }},
+    };
+    size_t best = SIZE_MAX;
+    std::vector<size_t> offsets;
+    for (const auto & it : orders) {
+        std::vector<int> order(items.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+            return it.second(items[a], items[b]);
+        });
+        const size_t size = plan_place(items, order);
+        if (size < best) {
+            best = size;
+            order_name = it.first;
+            offsets.clear();
+            for (const plan_item & item : items) {
+                offsets.push_back(item.offset);
+            }
+        }
+    }
+    for (size_t i = 0; i < items.size(); i++) {
+        items[i].offset = offsets[i];
+    }
+    return items.empty() ? 0 : best;
+}
+
+//median ms of releasing and planning again the arenas of the planned subgraphs
+static double plan_time_replan(tflite::Interpreter & interpreter, const std::vector<int> & subgraphs, const int repeat) {
+    std::vector<double> ms;
+    for (int r = 0; r < repeat; r++) {
+        for (const int s : subgraphs) {
+            interpreter.subgraph(s)->ReleaseNonPersistentMemory();
+        }
+        const auto t_start = std::chrono::steady_clock::now();
+        for (const int s : subgraphs) {
+            interpreter.subgraph(s)->AllocateTensors();
+        }
+        ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count());
+    }
+    return percentile(ms, 50);
+}
+
+static size_t plan_total_arena(const tflite::Interpreter & interpreter, const whisper_arena_plan & plan) {
+    size_t bytes = plan.pool != nullptr ? plan.pool_bytes : 0;
+    for (size_t i = 0; i < interpreter.subgraphs_size(); i++) {
+        bytes += plan_arena_bytes(*interpreter.subgraph(i));
+    }
+    return bytes;
+}
+
+//the same inputs for both interpreters: small integers (token 0, beam 0) and a fixed float pattern
+static void plan_fill_inputs(tflite::Subgraph & subgraph) {
+    for (const int input : subgraph.inputs()) {
+        TfLiteTensor * t = subgraph.tensor(input);
+        if (t->data.raw == nullptr) {
+            continue;
+        }
+        if (t->type == kTfLiteFloat32) {
+            for (size_t i = 0; i < t->bytes/sizeof(float); i++) {
+                t->data.f[i] = 0.5f*sinf(0.01f*i);
+            }
+        } else {
+            memset(t->data.raw, 0, t->bytes);
+        }
+    }
+}
+
+//largest difference of the float outputs of every planned subgraph, -1 when one fails;
+//"init" runs first, it assigns the KV cache variables the other decoder signatures read
+static double plan_compare(tflite::Interpreter & a, tflite::Interpreter & b, std::vector<int> subgraphs) {
+    const int init = a.GetSubgraphIndexFromSignature(WHISPER_DECODER_INIT_SIGNATURE);
+    std::stable_partition(subgraphs.begin(), subgraphs.end(), [init](const int s) { return s == init; });
+    double diff = 0.0;
+    for (const int s : subgraphs) {
+        tflite::Subgraph & sa = *a.subgraph(s);
+        tflite::Subgraph & sb = *b.subgraph(s);
+        plan_fill_inputs(sa);
+        plan_fill_inputs(sb);
+        if (sa.Invoke() != kTfLiteOk || sb.Invoke() != kTfLiteOk) {
+            return -1.0;
+        }
+        for (const int output : sa.outputs()) {
+            const TfLiteTensor * ta = sa.tensor(output);
+            const TfLiteTensor * tb = sb.tensor(output);
+            if (ta->type != kTfLiteFloat32 || ta->bytes != tb->bytes) {
+                diff = ta->bytes != tb->bytes ? INFINITY : diff;
+                continue;
+            }
+            for (size_t i = 0; i < ta->bytes/sizeof(float); i++) {
+                diff = std::max(diff, (double) fabsf(ta->data.f[i] - tb->data.f[i]));
+            }
+        }
+    }
+    return diff;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s in.tflite out.tflite [--threads N] [--repeat N] [--force]\n", argv[0]);
+        return 1;
+    }
+    int repeat = 20;
+    bool force = false;
+    for (int i = 3; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            g_whisper_n_threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--force") {
+            force = true;
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> bytes;
+    std::unique_ptr<tflite::ModelT> model = whisper_model_load(argv[1]);
+    if (model == nullptr || !whisper_model_read(argv[1], bytes)) {
+        fprintf(stderr, "failed to read model '%s'\n", argv[1]);
+        return 1;
+    }
+    whisper_tflite online;
+    whisper_arena_plan no_plan;
+    if (!plan_build(bytes, online, no_plan, false)) {
+        fprintf(stderr, "failed to build the interpreter of '%s'\n", argv[1]);
+        return 1;
+    }
+    tflite::Interpreter & interpreter = *online.interpreter;
+    const std::vector<int> subgraphs = plan_subgraphs(interpreter);
+
+    whisper_arena_plan plan;
+    std::vector<plan_subgraph_report> reports;
+    for (const int s : subgraphs) {
+        tflite::Subgraph & subgraph = *interpreter.subgraph(s);
+        const std::vector<bool> resizable = plan_resizable(subgraph);
+        std::vector<plan_item> items = plan_lifetimes(subgraph, resizable);
+        plan_subgraph_report report;
+        report.subgraph = s;
+        report.name = subgraph.GetName();
+        report.n_tensors = (int) items.size();
+        report.online = plan_arena_bytes(subgraph);
+        report.pool = plan_best(items, report.order);
+        report.bound = plan_lower_bound(items, (int) subgraph.execution_plan().size());
+        reports.push_back(report);
+        if (items.empty()) {
+            continue;
+        }
+        whisper_arena_plan_subgraph planned;
+        planned.subgraph = s;
+        planned.fingerprint = whisper_arena_plan_fingerprint(subgraph);
+        planned.pool_bytes = (int32_t) report.pool;
+        for (const plan_item & item : items) {
+            whisper_arena_plan_tensor t;
+            t.tensor = item.tensor;
+            t.offset = (int32_t) item.offset;
+            t.bytes = (int32_t) subgraph.tensor(item.tensor)->bytes;
+            planned.tensors.push_back(t);
+        }
+        plan.subgraphs.push_back(planned);
+    }
+
+    //a plan of an earlier run is replaced
+    for (auto & m : model->metadata) {
+        if (m->name == WHISPER_METADATA_ARENA_PLAN) {
+            model->buffers[m->buffer]->data.clear();
+        }
+    }
+    model->metadata.erase(std::remove_if(model->metadata.begin(), model->metadata.end(),
+                                         [](const std::unique_ptr<tflite::MetadataT> & m) {
+                                             return m->name == WHISPER_METADATA_ARENA_PLAN;
+                                         }),
+                          model->metadata.end());
+    const size_t n_metadata = model->metadata.size();
+    whisper_model_add_metadata(*model, WHISPER_METADATA_ARENA_PLAN, whisper_arena_plan_serialize(plan));
+    std::vector<uint8_t> planned_bytes;
+    whisper_model_pack(*model, planned_bytes);
+
+    //the planned model, loaded the way the pipeline loads it
+    whisper_tflite offline;
+    whisper_arena_plan bound;
+    if (!plan_build(planned_bytes, offline, bound, true) || bound.rejected || bound.pool == nullptr) {
+        fprintf(stderr, "the plan of '%s' is not accepted at load\n", argv[1]);
+        return 1;
+    }
+    for (plan_subgraph_report & report : reports) {
+        report.residual = plan_arena_bytes(*offline.interpreter->subgraph(report.subgraph));
+    }
+    const size_t online_bytes = plan_total_arena(interpreter, no_plan);
+    const size_t offline_bytes = plan_total_arena(*offline.interpreter, bound);
+    const double diff = plan_compare(interpreter, *offline.interpreter, subgraphs);
+    const double online_ms = plan_time_replan(interpreter, subgraphs, repeat);
+    const double offline_ms = plan_time_replan(*offline.interpreter, subgraphs, repeat);
+
+    //the pool and the arena left online never share memory, unlike the temporaries
+    //and activations of one online arena; a plan that grows the total is left out
+    const bool written = force || offline_bytes <= online_bytes;
+    if (!written) {
+        model->metadata.resize(n_metadata);
+        model->buffers.pop_back();
+    }
+    if (!whisper_model_save(*model, argv[2])) {
+        fprintf(stderr, "failed to write '%s'\n", argv[2]);
+        return 1;
+    }
+
+    printf("{\n  \"subgraphs\": [\n");
+    for (size_t i = 0; i < reports.size(); i++) {
+        const plan_subgraph_report & r = reports[i];
+        printf("    {\"subgraph\": %d, \"name\": \"%s\", \"tensors\": %d, \"online_mb\": %.3f, \"pool_mb\": %.3f, "
+               "\"lower_bound_mb\": %.3f, \"order\": \"%s\", \"residual_mb\": %.3f}%s\n",
+               r.subgraph, json_escape(r.name).c_str(), r.n_tensors, r.online/1048576.0, r.pool/1048576.0,
+               r.bound/1048576.0, r.order.c_str(), r.residual/1048576.0, i + 1 == reports.size() ? "" : ",");
+    }
+    printf("  ],\n  \"arena_mb\": {\"online\": %.3f, \"planned\": %.3f},\n"
+           "  \"replan_ms\": {\"online\": %.3f, \"planned\": %.3f},\n  \"plan_written\": %s,\n",
+           online_bytes/1048576.0, offline_bytes/1048576.0, online_ms, offline_ms, written ? "true" : "false");
+    if (diff < 0.0) {
+        printf("  \"max_output_diff\": null\n}\n");
+    } else {
+        printf("  \"max_output_diff\": %g\n}\n", diff);
+    }
+    plan_free(offline, bound);
+    plan_free(online, no_plan);
+    return 0;
+}
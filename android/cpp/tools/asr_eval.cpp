@@ -0,0 +1,329 @@
+//ASR evaluation of the plugin pipeline (whisper_pipeline.h) on Linux: word and
+//character error rate against reference transcripts together with the
+//real-time factor, so a kernel, quantization or frontend change is judged on
+//accuracy and speed by one command. Every utterance goes through the same
+//stages as in the app: audio decoding -> mel frontend -> encoder -> greedy
+//decoder, one 30 second chunk at a time, then scoring (whisper_score.h).
+//
+//  whisper-eval model_dir [options] manifest.tsv|audio.wav|audio.mp3 ...
+//    model_dir       directory holding the plugin assets (encoder, decoder, filters/vocab)
+//    manifest.tsv    one utterance per line, "audio path<TAB>reference transcript"; relative
+//                    paths are resolved against the manifest directory, # starts a comment
+//    audio           an utterance whose reference is audio.txt next to it
+//    --threads N     interpreter and frontend threads (default: hardware concurrency)
+//    --frontend F    mel frontend, see whisper_frontend_name() (default: reference)
+//    --compare-frontend F
+//                    transcribe the utterances again with frontend F (the fixed point one
+//                    against the float ones) and report its WER, CER and RTF, their
+//                    difference to the --frontend run, and the WER of its hypotheses
+//                    against the --frontend ones, which needs no references
+//    --encoder NAME  encoder file in model_dir (default: the plugin encoder asset)
+//    --decoder NAME  decoder file in model_dir (default: the plugin decoder asset)
+//    --shortlist N   score only the N first text tokens, see whisper-bench
+//    --limit N       evaluate the first N utterances only
+//    --summary       leave the per utterance results out of the output
+//    --verbose       print the plugin log to stderr
+//
+//The first utterance is transcribed once untimed, so model loading and the
+//first allocation of the arenas stay out of the stage latencies. Prints JSON:
+//corpus WER and CER with their substitutions, deletions and insertions,
+//real-time factor, per chunk stage latency percentiles, and per utterance
+//errors, RTF and hypothesis.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "whisper.h"
+#include "whisper_frontend.h"
+#include "whisper_pipeline.h"
+#include "whisper_score.h"
+#include "whisper_tool_common.h"
+
+struct eval_utterance {
+    std::string audio;
+    std::string reference;
+    std::string hypothesis;
+    double audio_seconds = 0.0;
+    double ms = 0.0;
+    score_errors wer;
+    score_errors cer;
+};
+
+struct eval_stages {
+    std::vector<double> audio, mel, encoder, decoder, total;
+};
+
+//corpus totals of one pass over the utterances
+struct eval_corpus {
+    eval_stages stages;
+    score_errors wer;
+    score_errors cer;
+    double audio_seconds = 0.0;
+    double total_ms = 0.0;
+
+    double rtf() const {
+        return audio_seconds > 0.0 ? total_ms/1000.0/audio_seconds : 0.0;
+    }
+};
+
+static bool eval_is_audio(const std::string & path) {
+    const size_t dot = path.find_last_of('.');
+    const std::string ext = dot == std::string::npos ? "" : path.substr(dot);
+    return ext == ".wav" || ext == ".mp3" || ext == ".WAV" || ext == ".MP3";
+}
+
+static bool eval_read_text(const std::string & path, std::string & text) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static bool eval_read_manifest(const std::string & path, std::vector<eval_utterance> & utterances) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "failed to open manifest '%s'\n", path.c_str());
+        return false;
+    }
+    const size_t slash = path.find_last_of('/');
+    const std::string dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    int line_no = 0;
+    for (std::string line; std::getline(in, line);) {
+        line_no++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        const size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+            fprintf(stderr, "%s:%d: expected 'audio<TAB>reference'\n", path.c_str(), line_no);
+            return false;
+        }
+        eval_utterance u;
+        u.audio = line.substr(0, tab);
+        u.audio = u.audio[0] == '/' ? u.audio : dir + u.audio;
+        u.reference = line.substr(tab + 1);
+        utterances.push_back(u);
+    }
+    return true;
+}
+
+//every 30 second chunk of the utterance, the stage timings of each chunk appended to `stages`
+static bool eval_transcribe(eval_utterance & u, eval_stages * stages) {
+    u.hypothesis.clear();
+    u.audio_seconds = 0.0;
+    u.ms = 0.0;
+    for (int chunk = 0;; chunk++) {
+        std::string text;
+        const int64_t t_start = whisper_time_us();
+        if (!whisper_transcribe(u.audio.c_str(), (float) chunk*WHISPER_CHUNK_SIZE, text)) {
+            fprintf(stderr, "failed to transcribe '%s'\n", u.audio.c_str());
+            return false;
+        }
+        const double ms = (whisper_time_us() - t_start)/1000.0;
+        const whisper_timings & t = g_whisper_timings;
+        if (t.n_samples <= 0) {
+            break;
+        }
+        u.hypothesis += text;
+        u.audio_seconds += double(t.n_samples)/WHISPER_SAMPLE_RATE;
+        u.ms += ms;
+        if (stages != nullptr) {
+            stages->audio.push_back(t.audio_us/1000.0);
+            stages->mel.push_back(t.mel_us/1000.0);
+            stages->encoder.push_back(t.encode_us/1000.0);
+            stages->decoder.push_back(t.decode_us/1000.0);
+            stages->total.push_back(ms);
+        }
+        if (t.n_samples < WHISPER_SAMPLE_RATE*WHISPER_CHUNK_SIZE) {
+            break;
+        }
+    }
+    return true;
+}
+
+//transcribes and scores every utterance with the current frontend
+static bool eval_run(std::vector<eval_utterance> & utterances, eval_corpus & corpus) {
+    for (eval_utterance & u : utterances) {
+        if (!eval_transcribe(u, &corpus.stages)) {
+            return false;
+        }
+        u.wer = score_wer(u.reference, u.hypothesis);
+        u.cer = score_cer(u.reference, u.hypothesis);
+        corpus.wer += u.wer;
+        corpus.cer += u.cer;
+        corpus.audio_seconds += u.audio_seconds;
+        corpus.total_ms += u.ms;
+    }
+    return true;
+}
+
+static bool eval_frontend(const char * name, whisper_frontend_type * type) {
+    if (!whisper_frontend_from_name(name, type) || !whisper_frontend_available(*type)) {
+        fprintf(stderr, "frontend '%s' is not available\n", name);
+        return false;
+    }
+    return true;
+}
+
+static void eval_print_errors(const char * name, const score_errors & e, const bool last) {
+    printf("  \"%s\": {\"rate\": %.4f, \"substitutions\": %ld, \"deletions\": %ld, \"insertions\": %ld, \"reference\": %ld}%s\n",
+           name, e.rate(), e.substitutions, e.deletions, e.insertions, e.n_ref, last ? "" : ",");
+}
+
+static void eval_print_stage(const char * name, const std::vector<double> & ms, const bool last) {
+    printf("    \"%s\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f}%s\n",
+           name, percentile(ms, 50), percentile(ms, 90), percentile(ms, 99), last ? "" : ",");
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s model_dir [--threads N] [--frontend F] [--compare-frontend F] [--encoder NAME] [--decoder NAME] [--shortlist N] [--limit N] [--summary] [--verbose] manifest.tsv|audio ...\n", argv[0]);
+        return 1;
+    }
+    int n_shortlist = 0;
+    size_t n_limit = 0;
+    bool summary = false;
+    bool compare = false;
+    whisper_frontend_type compare_frontend = WHISPER_FRONTEND_REFERENCE;
+    std::vector<eval_utterance> utterances;
+    for (int i = 2; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            g_whisper_n_threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--frontend" && i + 1 < argc) {
+            if (!eval_frontend(argv[++i], &g_whisper_frontend)) {
+                return 1;
+            }
+        } else if (arg == "--compare-frontend" && i + 1 < argc) {
+            if (!eval_frontend(argv[++i], &compare_frontend)) {
+                return 1;
+            }
+            compare = true;
+        } else if (arg == "--encoder" && i + 1 < argc) {
+            g_whisper_encoder_asset = argv[++i];
+        } else if (arg == "--decoder" && i + 1 < argc) {
+            g_whisper_decoder_asset = argv[++i];
+        } else if (arg == "--shortlist" && i + 1 < argc) {
+            n_shortlist = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--limit" && i + 1 < argc) {
+            n_limit = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--summary") {
+            summary = true;
+        } else if (arg == "--verbose") {
+            g_android_log_enabled = true;
+        } else if (eval_is_audio(arg)) {
+            eval_utterance u;
+            u.audio = arg;
+            if (!eval_read_text(arg.substr(0, arg.find_last_of('.')) + ".txt", u.reference)) {
+                fprintf(stderr, "no reference transcript for '%s'\n", arg.c_str());
+                return 1;
+            }
+            utterances.push_back(u);
+        } else if (!eval_read_manifest(arg, utterances)) {
+            return 1;
+        }
+    }
+    if (n_limit > 0 && utterances.size() > n_limit) {
+        utterances.resize(n_limit);
+    }
+    if (utterances.empty()) {
+        fprintf(stderr, "no utterances given\n");
+        return 1;
+    }
+
+    AAssetManager mgr = {argv[1]};
+    if (!whisper_load(&mgr)) {
+        fprintf(stderr, "failed to load the models from '%s'\n", argv[1]);
+        return 1;
+    }
+    const double load_ms = g_whisper_timings.load_us/1000.0;
+    if (compare && g_whisper_tflite_params.pcm_input) {
+        fprintf(stderr, "the encoder computes the mel spectrogram itself, --compare-frontend has nothing to compare\n");
+        return 1;
+    }
+    if (n_shortlist > 0) {
+        std::vector<whisper_vocab::id> ids(std::min(n_shortlist, g_vocab.token_eot));
+        for (size_t i = 0; i < ids.size(); i++) {
+            ids[i] = i;
+        }
+        whisper_set_shortlist(ids);
+    }
+
+    eval_utterance warm_up = utterances[0];
+    if (!eval_transcribe(warm_up, nullptr)) {
+        return 1;
+    }
+    eval_corpus corpus;
+    if (!eval_run(utterances, corpus)) {
+        return 1;
+    }
+    const eval_stages & stages = corpus.stages;
+    //the same utterances through the other frontend, scored against the references and the first hypotheses
+    const whisper_frontend_type frontend = g_whisper_frontend;
+    std::vector<eval_utterance> compared = utterances;
+    eval_corpus compare_corpus;
+    score_errors agreement;
+    if (compare) {
+        g_whisper_frontend = compare_frontend;
+        if (!eval_run(compared, compare_corpus)) {
+            return 1;
+        }
+        for (size_t i = 0; i < utterances.size(); i++) {
+            agreement += score_wer(utterances[i].hypothesis, compared[i].hypothesis);
+        }
+        g_whisper_frontend = frontend;
+    }
+
+    printf("{\n  \"threads\": %d,\n  \"frontend\": \"%s\",\n  \"encoder\": \"%s\",\n  \"decoder\": \"%s\",\n"
+           "  \"utterances\": %zu,\n  \"chunks\": %zu,\n  \"audio_seconds\": %.3f,\n  \"load_ms\": %.3f,\n",
+           whisper_n_threads(),
+           g_whisper_tflite_params.pcm_input ? "graph" : whisper_frontend_name(g_whisper_frontend),
+           json_escape(g_whisper_encoder_asset).c_str(), json_escape(g_whisper_decoder_asset).c_str(),
+           utterances.size(), stages.total.size(), corpus.audio_seconds, load_ms);
+    eval_print_errors("wer", corpus.wer, false);
+    eval_print_errors("cer", corpus.cer, false);
+    printf("  \"rtf\": %.4f,\n  \"stages_ms\": {\n", corpus.rtf());
+    eval_print_stage("audio", stages.audio, false);
+    eval_print_stage("mel", stages.mel, false);
+    eval_print_stage("encoder", stages.encoder, false);
+    eval_print_stage("decoder", stages.decoder, false);
+    eval_print_stage("total", stages.total, true);
+    printf("  }%s\n", compare || !summary ? "," : "\n}");
+    if (compare) {
+        printf("  \"compare\": {\"frontend\": \"%s\", \"wer\": %.4f, \"cer\": %.4f, \"rtf\": %.4f, \"mel_p50\": %.3f,\n"
+               "    \"wer_delta\": %.4f, \"cer_delta\": %.4f, \"mel_p50_delta\": %.3f, \"hypothesis_wer\": %.4f}%s\n",
+               whisper_frontend_name(compare_frontend), compare_corpus.wer.rate(), compare_corpus.cer.rate(),
+               compare_corpus.rtf(), percentile(compare_corpus.stages.mel, 50),
+               compare_corpus.wer.rate() - corpus.wer.rate(), compare_corpus.cer.rate() - corpus.cer.rate(),
+               percentile(compare_corpus.stages.mel, 50) - percentile(stages.mel, 50), agreement.rate(),
+               summary ? "\n}" : ",");
+    }
+    if (summary) {
+        return 0;
+    }
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < utterances.size(); i++) {
+        const eval_utterance & u = utterances[i];
+        printf("    {\"audio\": \"%s\", \"wer\": %.4f, \"cer\": %.4f, \"rtf\": %.4f, \"hypothesis\": \"%s\"",
+               json_escape(u.audio).c_str(), u.wer.rate(), u.cer.rate(),
+               u.audio_seconds > 0.0 ? u.ms/1000.0/u.audio_seconds : 0.0, json_escape(u.hypothesis).c_str());
+        if (compare) {
+            printf(", \"compare_wer\": %.4f, \"compare_hypothesis\": \"%s\"", compared[i].wer.rate(),
+                   json_escape(compared[i].hypothesis).c_str());
+        }
+        printf("}%s\n", i + 1 == utterances.size() ? "" : ",");
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
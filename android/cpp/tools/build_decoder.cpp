@@ -0,0 +1,1347 @@
+//Rebuilds the converted Whisper decoder as a cached decoder whose greedy
+//loop runs inside the graph, so the plugin decodes a chunk with a single
+//Invoke(). The onnx-tf export recomputes every position for every token and
+//has no KV cache; this tool takes its weights (hybrid int8 matrices, float
+//norms and biases) and emits new subgraphs around them.
+//
+//  whisper-build-decoder decoder.tflite out.tflite [options]
+//    --step          emit a host stepped model ("init"/"step" signatures) instead of the loop
+//    --beams N       self attention cache slots of a --step model (default: 1)
+//    --top-k N       the "step" signature of a --step model also outputs the N best
+//                    "ids" and their "logprobs" (WhisperLogits of whisper_logits.h)
+//    --shortlist     a --step model also gets "shortlist"/"step_shortlist" signatures, logits
+//                    of a token subset from its rows of the logits matrix gathered once
+//    --alignment-heads auto|L.H,...
+//                    the step signatures of a --step model also output "alignment", the
+//                    cross attention weights of these heads (layer.head) for word timestamps;
+//                    auto takes the heads OpenAI found for the model size, or every head
+//                    of the upper half of the layers for other sizes
+//    --kv inplace    KV cache ops of whisper_kv_cache.h, rows written in place (default)
+//    --kv copy       builtin READ_VARIABLE/DYNAMIC_UPDATE_SLICE/ASSIGN_VARIABLE, whole cache copied per token
+//    --check N       decode N tokens from a synthetic encoder output with host
+//                    stepping over decoder.tflite and with out.tflite, print
+//                    timings, cache bytes copied per token and token agreement as JSON
+//
+//Model: inputs  hidden_states [1, n_audio_ctx, n_state] float
+//               prompt [n] int32 (resizable, at least one token)
+//               limit [1] int32, total tokens including the prompt, at most n_text_ctx
+//       outputs tokens [n_text_ctx] int32, the prompt followed by the generated tokens
+//               last [1] int32, index of the last token in tokens (EOT when it stopped on it)
+//Subgraph 0 (main): cross attention K/V of every layer from hidden_states into resource
+//    variables (VAR_HANDLE/ASSIGN_VARIABLE), self attention caches zeroed, WHILE
+//Subgraph 1 (cond): last + 1 < limit && token != EOT
+//Subgraph 2 (body): one token at position `last`: embeddings, per layer K/V written into
+//    the caches, attention over the cache rows up to `last`, logits, ARG_MAX; prompt tokens
+//    are forced until consumed. With --kv copy the caches go through DYNAMIC_UPDATE_SLICE
+//    and attention covers all n_text_ctx rows with the later positions masked.
+//The --step model runs the body's step() once per Invoke() of its "step" signature and
+//leaves the token choice, and the beam bookkeeping (whisper_kv_fork/reorder), to the host.
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "whisper.h"
+#include "whisper_flex_ops.h"
+#include "whisper_kv_cache.h"
+#include "whisper_logits.h"
+#include "whisper_tool_common.h"
+#include "whisper_model_edit.h"
+
+//whisper attention heads are 64 wide for every model size
+#define DECODER_HEAD_DIM 64
+
+//constant tensor of the converted model, transposed when it feeds a
+//BATCH_MATMUL ([in, out]) rather than a FULLY_CONNECTED ([out, in])
+struct src_weight {
+    int tensor = -1;
+    bool transposed = false;
+};
+
+struct src_layer {
+    src_weight attn_ln_w, attn_ln_b, q_w, q_b, k_w, v_w, v_b, o_w, o_b;
+    src_weight cross_ln_w, cross_ln_b, cq_w, cq_b, ck_w, ck_b, cv_w, cv_b, co_w, co_b;
+    src_weight mlp_ln_w, mlp_ln_b, fc1_w, fc1_b, fc2_w, fc2_b;
+};
+
+struct src_decoder {
+    int n_audio_ctx = 0;
+    int n_text_ctx = 0;
+    int n_state = 0;
+    int n_head = 0;
+    int n_vocab = 0;
+    src_weight token_embedding, positional_embedding, ln_w, ln_b, logits_w;
+    std::vector<src_layer> layers;
+};
+
+//`key` followed by the end of the name, a digit or ';' (tensor names are
+//"onnx_tf_prefix_/blocks.0/attn/query/MatMul", "...key/MatMul2;...")
+static bool name_has(const std::string & name, const std::string & key) {
+    for (size_t pos = name.find(key); pos != std::string::npos; pos = name.find(key, pos + 1)) {
+        const size_t end = pos + key.size();
+        if (end == name.size() || name[end] == ';' || isdigit((unsigned char) name[end])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const tflite::OperatorT * find_op(const tflite::ModelT & model, const std::string & key) {
+    const tflite::SubGraphT & sg = *model.subgraphs[0];
+    for (const auto & op : sg.operators) {
+        if (!op->outputs.empty() && name_has(sg.tensors[op->outputs[0]]->name, key)) {
+            return op.get();
+        }
+    }
+    return nullptr;
+}
+
+static tflite::BuiltinOperator op_code(const tflite::ModelT & model, const tflite::OperatorT & op) {
+    return tflite::GetBuiltinCode(model.operator_codes[op.opcode_index].get());
+}
+
+static bool is_const(const tflite::ModelT & model, const int tensor) {
+    return tensor >= 0 && !model.buffers[model.subgraphs[0]->tensors[tensor]->buffer]->data.empty();
+}
+
+//constant operand of an ADD/MUL, e.g. a bias or a layer norm weight
+static bool find_const(const tflite::ModelT & model, const std::string & key, src_weight & w) {
+    const tflite::OperatorT * op = find_op(model, key);
+    for (size_t i = 0; op != nullptr && i < op->inputs.size(); i++) {
+        if (is_const(model, op->inputs[i])) {
+            w.tensor = op->inputs[i];
+            w.transposed = false;
+            return true;
+        }
+    }
+    fprintf(stderr, "decoder: no constant operand for '%s'\n", key.c_str());
+    return false;
+}
+
+//weights of a FULLY_CONNECTED or BATCH_MATMUL, the bias of a FULLY_CONNECTED when it has one
+static bool find_matmul(const tflite::ModelT & model, const std::string & key, src_weight & w, src_weight * b = nullptr) {
+    const tflite::OperatorT * op = find_op(model, key);
+    if (op == nullptr || op->inputs.size() < 2 || !is_const(model, op->inputs[1])) {
+        fprintf(stderr, "decoder: no matmul '%s'\n", key.c_str());
+        return false;
+    }
+    w.tensor = op->inputs[1];
+    w.transposed = op_code(model, *op) == tflite::BuiltinOperator_BATCH_MATMUL;
+    if (b != nullptr && op_code(model, *op) == tflite::BuiltinOperator_FULLY_CONNECTED &&
+        op->inputs.size() > 2 && op->inputs[2] >= 0) {
+        b->tensor = op->inputs[2];
+        b->transposed = false;
+    }
+    return true;
+}
+
+static bool find_decoder_weights(const tflite::ModelT & model, src_decoder & dec) {
+    using namespace tflite;
+    const SubGraphT & sg = *model.subgraphs[0];
+    if (sg.inputs.size() != 2) {
+        fprintf(stderr, "decoder: expected the hidden_states and tokens inputs\n");
+        return false;
+    }
+    for (const int input : sg.inputs) {
+        const TensorT & t = *sg.tensors[input];
+        if (t.type == TensorType_FLOAT32 && t.shape.size() == 3) {
+            dec.n_audio_ctx = t.shape[1];
+        }
+    }
+    const OperatorT * embedding = find_op(model, "/token_embedding/Gather");
+    if (embedding == nullptr || !is_const(model, embedding->inputs[0])) {
+        fprintf(stderr, "decoder: token embedding not found\n");
+        return false;
+    }
+    dec.token_embedding.tensor = embedding->inputs[0];
+    dec.n_vocab = sg.tensors[dec.token_embedding.tensor]->shape[0];
+    dec.n_state = sg.tensors[dec.token_embedding.tensor]->shape[1];
+    dec.n_head = dec.n_state/DECODER_HEAD_DIM;
+
+    //positional embedding [n_text_ctx, n_state], sliced to the token count
+    for (const auto & op : sg.operators) {
+        const int in = op->inputs.empty() ? -1 : op->inputs[0];
+        if (op_code(model, *op) == BuiltinOperator_STRIDED_SLICE && is_const(model, in) &&
+            sg.tensors[in]->type == TensorType_FLOAT32 && sg.tensors[in]->shape.size() == 2 &&
+            sg.tensors[in]->shape[1] == dec.n_state) {
+            dec.positional_embedding.tensor = in;
+            dec.n_text_ctx = sg.tensors[in]->shape[0];
+        }
+    }
+    //logits, the matmul producing the graph output
+    for (const auto & op : sg.operators) {
+        if (!op->outputs.empty() && op->outputs[0] == sg.outputs[0] && op->inputs.size() > 1 &&
+            is_const(model, op->inputs[1])) {
+            dec.logits_w.tensor = op->inputs[1];
+            dec.logits_w.transposed = op_code(model, *op) == BuiltinOperator_BATCH_MATMUL;
+        }
+    }
+    if (dec.n_audio_ctx == 0 || dec.positional_embedding.tensor < 0 || dec.logits_w.tensor < 0) {
+        fprintf(stderr, "decoder: hidden_states, positional embedding or logits not found\n");
+        return false;
+    }
+
+    for (int il = 0; find_op(model, "/blocks." + std::to_string(il) + "/attn/query/MatMul") != nullptr; il++) {
+        const std::string p = "/blocks." + std::to_string(il) + "/";
+        src_layer l;
+        bool ok = find_const(model, p + "attn_ln/Mul", l.attn_ln_w) && find_const(model, p + "attn_ln/Add_1", l.attn_ln_b) &&
+                  find_matmul(model, p + "attn/query/MatMul", l.q_w) && find_const(model, p + "attn/query/Add", l.q_b) &&
+                  find_matmul(model, p + "attn/key/MatMul", l.k_w) &&
+                  find_matmul(model, p + "attn/value/MatMul", l.v_w) && find_const(model, p + "attn/value/Add", l.v_b) &&
+                  find_matmul(model, p + "attn/out/MatMul", l.o_w) && find_const(model, p + "attn/out/Add", l.o_b) &&
+                  find_const(model, p + "cross_attn_ln/Mul", l.cross_ln_w) &&
+                  find_const(model, p + "cross_attn_ln/Add_1", l.cross_ln_b) &&
+                  find_matmul(model, p + "cross_attn/query/MatMul", l.cq_w) &&
+                  find_const(model, p + "cross_attn/query/Add", l.cq_b) &&
+                  find_matmul(model, p + "cross_attn/key/MatMul", l.ck_w, &l.ck_b) &&
+                  find_matmul(model, p + "cross_attn/value/MatMul", l.cv_w, &l.cv_b) &&
+                  find_matmul(model, p + "cross_attn/out/MatMul", l.co_w) &&
+                  find_const(model, p + "cross_attn/out/Add", l.co_b) &&
+                  find_const(model, p + "mlp_ln/Mul", l.mlp_ln_w) && find_const(model, p + "mlp_ln/Add_1", l.mlp_ln_b) &&
+                  find_matmul(model, p + "mlp/mlp.0/MatMul", l.fc1_w) && find_const(model, p + "mlp/mlp.0/Add", l.fc1_b) &&
+                  find_matmul(model, p + "mlp/mlp.2/MatMul", l.fc2_w) && find_const(model, p + "mlp/mlp.2/Add", l.fc2_b);
+        //a BATCH_MATMUL cross value projection keeps its bias in a separate ADD
+        if (ok && l.cv_b.tensor < 0) {
+            ok = find_const(model, p + "cross_attn/value/Add", l.cv_b);
+        }
+        if (!ok) {
+            return false;
+        }
+        dec.layers.push_back(l);
+    }
+    if (dec.layers.empty() || !find_const(model, "/ln/Mul", dec.ln_w) || !find_const(model, "/ln/Add_1", dec.ln_b)) {
+        fprintf(stderr, "decoder: blocks or final layer norm not found\n");
+        return false;
+    }
+    return true;
+}
+
+//emits the operators of one subgraph of the new model, weights are copied
+//from the converted decoder on first use and shared between subgraphs
+struct decoder_builder {
+    const tflite::ModelT & src;
+    const src_decoder & dec;
+    tflite::ModelT & model;
+    std::map<std::pair<int, bool>, int> buffers;   // (source tensor, transposed) -> buffer
+    int subgraph_index = -1;
+    tflite::SubGraphT * sg = nullptr;
+    std::vector<std::unique_ptr<tflite::OperatorT>> ops;
+    std::map<std::string, int> tensors;            // weights and shared constants of the subgraph
+    bool inplace = true;                           // KV cache ops of whisper_kv_cache.h, builtin copies otherwise
+    int n_slots = 1;                               // self attention cache slots (beams), inplace only
+    std::vector<std::pair<int, int>> alignment_heads; // (layer, head) whose cross attention step() outputs
+    int alignment = -1;                            // [n_heads, n_audio_ctx] of the last step(), -1 without heads
+
+    decoder_builder(const tflite::ModelT & src, const src_decoder & dec, tflite::ModelT & model)
+        : src(src), dec(dec), model(model) {}
+
+    void begin(const int index, const char * name) {
+        while ((int) model.subgraphs.size() <= index) {
+            model.subgraphs.emplace_back(new tflite::SubGraphT);
+        }
+        subgraph_index = index;
+        sg = model.subgraphs[index].get();
+        sg->name = name;
+        ops.clear();
+        tensors.clear();
+    }
+
+    void end(const std::vector<int> & inputs, const std::vector<int> & outputs) {
+        sg->inputs = inputs;
+        sg->outputs = outputs;
+        sg->operators = std::move(ops);
+    }
+
+    int tensor(const std::string & name, const tflite::TensorType type, const std::vector<int> & shape) {
+        return whisper_model_tensor(model, *sg, name, type, shape);
+    }
+
+    template <typename T>
+    int constant(const std::string & name, const tflite::TensorType type, const std::vector<int> & shape,
+                 const std::vector<T> & values) {
+        auto it = tensors.find(name);
+        if (it != tensors.end()) {
+            return it->second;
+        }
+        return tensors[name] = whisper_model_const<T>(model, *sg, name, type, shape, values);
+    }
+
+    int i32(const std::string & name, const std::vector<int32_t> & values) {
+        return constant<int32_t>(name, tflite::TensorType_INT32, {(int) values.size()}, values);
+    }
+
+    int f32(const std::string & name, const float value) {
+        return constant<float>(name, tflite::TensorType_FLOAT32, {}, {value});
+    }
+
+    tflite::OperatorT * op(const tflite::BuiltinOperator code, const std::vector<int> & inputs,
+                           const std::vector<int> & outputs) {
+        return whisper_model_op(ops, whisper_model_opcode(model, code), inputs, outputs);
+    }
+
+    tflite::OperatorT * custom(const char * name, const std::vector<int> & inputs, const std::vector<int> & outputs) {
+        return whisper_model_op(ops, whisper_model_custom_opcode(model, name), inputs, outputs);
+    }
+
+    //tensor of the subgraph holding a weight of the converted decoder
+    int weight(const src_weight & w, const std::string & name) {
+        auto it = tensors.find(name);
+        if (it != tensors.end()) {
+            return it->second;
+        }
+        const tflite::TensorT & t = *src.subgraphs[0]->tensors[w.tensor];
+        std::vector<int> shape = t.shape;
+        const std::pair<int, bool> key(w.tensor, w.transposed);
+        if (buffers.count(key) == 0) {
+            const std::vector<uint8_t> & data = src.buffers[t.buffer]->data;
+            std::unique_ptr<tflite::BufferT> buffer(new tflite::BufferT);
+            if (w.transposed) {
+                const int rows = t.shape[0];
+                const int cols = t.shape[1];
+                const size_t size = data.size()/((size_t) rows*cols);
+                buffer->data.resize(data.size());
+                for (int r = 0; r < rows; r++) {
+                    for (int c = 0; c < cols; c++) {
+                        memcpy(&buffer->data[((size_t) c*rows + r)*size], &data[((size_t) r*cols + c)*size], size);
+                    }
+                }
+            } else {
+                buffer->data = data;
+            }
+            //the logits matrix is usually the transposed token embedding
+            int index = -1;
+            for (const auto & b : buffers) {
+                if (model.buffers[b.second]->data == buffer->data) {
+                    index = b.second;
+                }
+            }
+            if (index < 0) {
+                model.buffers.push_back(std::move(buffer));
+                index = (int) model.buffers.size() - 1;
+            }
+            buffers[key] = index;
+        }
+        if (w.transposed) {
+            std::swap(shape[0], shape[1]);
+        }
+        const int index = tensor(name, t.type, shape);
+        tflite::TensorT & out = *sg->tensors[index];
+        out.buffer = buffers[key];
+        if (t.quantization != nullptr) {
+            out.quantization.reset(new tflite::QuantizationParametersT(*t.quantization));
+            if (w.transposed && out.quantization->scale.size() > 1) {
+                out.quantization->quantized_dimension = 1 - out.quantization->quantized_dimension;
+            }
+        }
+        return tensors[name] = index;
+    }
+
+    int binary(const tflite::BuiltinOperator code, const int a, const int b, const std::string & name,
+               const std::vector<int> & shape, const tflite::TensorType type = tflite::TensorType_FLOAT32) {
+        const int out = tensor(name, type, shape);
+        op(code, {a, b}, {out});
+        return out;
+    }
+
+    int reshape(const int x, const std::vector<int> & shape, const std::string & name) {
+        const int out = tensor(name, sg->tensors[x]->type, shape);
+        std::string shape_name = "shape";
+        for (const int d : shape) {
+            shape_name += "_" + std::to_string(d);
+        }
+        tflite::ReshapeOptionsT options;
+        options.new_shape = shape;
+        op(tflite::BuiltinOperator_RESHAPE, {x, i32(shape_name, shape)}, {out})->builtin_options.Set(options);
+        return out;
+    }
+
+    //[rows, in] -> [rows, out], hybrid int8 weights quantize the input per row
+    int fc(const int x, const src_weight & w, const src_weight & b, const std::string & name) {
+        const int weights = weight(w, name + "/weight");
+        const int bias = b.tensor >= 0 ? weight(b, name + "/bias") : -1;
+        const std::vector<int> & in_shape = sg->tensors[x]->shape;
+        int rows = 1;
+        for (size_t i = 0; i + 1 < in_shape.size(); i++) {
+            rows *= in_shape[i];
+        }
+        const int out = tensor(name, tflite::TensorType_FLOAT32, {rows, sg->tensors[weights]->shape[0]});
+        tflite::FullyConnectedOptionsT options;
+        options.keep_num_dims = false;
+        options.asymmetric_quantize_inputs = true;
+        op(tflite::BuiltinOperator_FULLY_CONNECTED, {x, weights, bias}, {out})->builtin_options.Set(options);
+        return out;
+    }
+
+    //[1, n_state] normalized over the last axis
+    int layer_norm(const int x, const src_weight & w, const src_weight & b, const std::string & name) {
+        using namespace tflite;
+        const std::vector<int> shape = sg->tensors[x]->shape;
+        const int axis = i32("axis_last", {-1});
+        ReducerOptionsT keep;
+        keep.keep_dims = true;
+        const int mean = tensor(name + "/mean", TensorType_FLOAT32, {1, 1});
+        op(BuiltinOperator_MEAN, {x, axis}, {mean})->builtin_options.Set(keep);
+        const int centered = binary(BuiltinOperator_SUB, x, mean, name + "/centered", shape);
+        const int square = binary(BuiltinOperator_MUL, centered, centered, name + "/square", shape);
+        const int var = tensor(name + "/var", TensorType_FLOAT32, {1, 1});
+        op(BuiltinOperator_MEAN, {square, axis}, {var})->builtin_options.Set(keep);
+        const int var_eps = binary(BuiltinOperator_ADD, var, f32("ln_eps", 1e-5f), name + "/var_eps", {1, 1});
+        const int rstd = tensor(name + "/rstd", TensorType_FLOAT32, {1, 1});
+        op(BuiltinOperator_RSQRT, {var_eps}, {rstd});
+        const int norm = binary(BuiltinOperator_MUL, centered, rstd, name + "/norm", shape);
+        const int scaled = binary(BuiltinOperator_MUL, norm, weight(w, name + "/weight"), name + "/scaled", shape);
+        return binary(BuiltinOperator_ADD, scaled, weight(b, name + "/bias"), name, shape);
+    }
+
+    int var_handle(const std::string & name) {
+        const int out = tensor(name + "/handle", tflite::TensorType_RESOURCE, {});
+        tflite::VarHandleOptionsT options;
+        options.shared_name = name;
+        op(tflite::BuiltinOperator_VAR_HANDLE, {}, {out})->builtin_options.Set(options);
+        return out;
+    }
+
+    int read_variable(const int handle, const std::vector<int> & shape, const std::string & name,
+                      const tflite::TensorType type = tflite::TensorType_FLOAT32) {
+        const int out = tensor(name, type, shape);
+        op(tflite::BuiltinOperator_READ_VARIABLE, {handle}, {out});
+        return out;
+    }
+
+    //softmax(q k^T + mask) v for every head; q [n_head, 1, 64], k [n_head, n, 64], v_t [n_head, 64, n]
+    int attention(const int q, const int k, const int v_t, const int mask, const std::string & name) {
+        using namespace tflite;
+        const int n_head = dec.n_head;
+        const int n = sg->tensors[k]->shape[1];
+        BatchMatMulOptionsT adj_y;
+        adj_y.adj_y = true;
+        const int scores = tensor(name + "/scores", TensorType_FLOAT32, {n_head, 1, n});
+        op(BuiltinOperator_BATCH_MATMUL, {q, k}, {scores})->builtin_options.Set(adj_y);
+        int logits = scores;
+        if (mask >= 0) {
+            logits = binary(BuiltinOperator_ADD, scores, mask, name + "/masked", {n_head, 1, n});
+        }
+        SoftmaxOptionsT softmax;
+        softmax.beta = 1.0f;
+        const int probs = tensor(name + "/probs", TensorType_FLOAT32, {n_head, 1, n});
+        op(BuiltinOperator_SOFTMAX, {logits}, {probs})->builtin_options.Set(softmax);
+        const int out = tensor(name + "/heads", TensorType_FLOAT32, {n_head, 1, DECODER_HEAD_DIM});
+        op(BuiltinOperator_BATCH_MATMUL, {probs, v_t}, {out})->builtin_options.Set(adj_y);
+        return reshape(out, {1, dec.n_state}, name + "/merged");
+    }
+
+    //softmax(q k^T) v over the first `length` rows of the cache variables, q [1, n_state];
+    //with `heads` (cross attention) their softmax(q k^T) rows go to `probs` [heads, n_audio_ctx]
+    int kv_attention(const int q, const int k, const int v, const int slot, const int length, const std::string & name,
+                     const std::vector<int32_t> & heads = {}, int * probs = nullptr) {
+        const int out = tensor(name + "/merged", tflite::TensorType_FLOAT32, {1, dec.n_state});
+        if (heads.empty()) {
+            custom(WHISPER_KV_ATTENTION_OP, {q, k, v, slot, length}, {out});
+            return out;
+        }
+        *probs = tensor(name + "/probs", tflite::TensorType_FLOAT32, {(int) heads.size(), dec.n_audio_ctx});
+        custom(WHISPER_KV_ATTENTION_OP, {q, k, v, slot, length, i32(name + "/heads", heads)}, {out, *probs});
+        return out;
+    }
+
+    //query projection scaled by 1/sqrt(64), split into heads for BATCH_MATMUL
+    int query(const int x, const src_weight & w, const src_weight & b, const std::string & name) {
+        const int q = fc(x, w, b, name);
+        const float scale = 1.0f/std::sqrt((float) DECODER_HEAD_DIM);
+        const int scaled = binary(tflite::BuiltinOperator_MUL, q, f32("q_scale", scale), name + "/scaled", {1, dec.n_state});
+        return inplace ? scaled : reshape(scaled, {dec.n_head, 1, DECODER_HEAD_DIM}, name + "/heads");
+    }
+
+    //writes `update` into the cache variable at `start` and returns the updated cache
+    int cache_update(const int handle, const std::vector<int> & shape, const int update, const int start,
+                     const std::string & name) {
+        const int cache = read_variable(handle, shape, name + "/read");
+        const int out = tensor(name, tflite::TensorType_FLOAT32, shape);
+        op(tflite::BuiltinOperator_DYNAMIC_UPDATE_SLICE, {cache, update, start}, {out});
+        op(tflite::BuiltinOperator_ASSIGN_VARIABLE, {handle, out}, {});
+        return out;
+    }
+
+    //rows of the logits matrix keep its quantization when it is per tensor,
+    //per row scales would have to be gathered too, such rows are dequantized
+    bool shortlist_int8() const {
+        const tflite::TensorT & t = *src.subgraphs[0]->tensors[dec.logits_w.tensor];
+        return t.type == tflite::TensorType_INT8 && t.quantization != nullptr && t.quantization->scale.size() == 1 &&
+               (t.quantization->zero_point.empty() || t.quantization->zero_point[0] == 0);
+    }
+
+    //"shortlist/weight" [n, n_state] from the logits matrix rows of `ids` [n],
+    //"shortlist/ids" keeps the ids; returns [1] holding n
+    int shortlist(const int ids) {
+        using namespace tflite;
+        const int table = weight(dec.logits_w, "logits/weight");
+        int rows = tensor("shortlist/rows", sg->tensors[table]->type, {1, dec.n_state});
+        if (sg->tensors[table]->quantization != nullptr) {
+            sg->tensors[rows]->quantization.reset(new QuantizationParametersT(*sg->tensors[table]->quantization));
+        }
+        GatherOptionsT gather;
+        gather.axis = 0;
+        op(BuiltinOperator_GATHER, {table, ids}, {rows})->builtin_options.Set(gather);
+        if (sg->tensors[table]->type != TensorType_FLOAT32 && !shortlist_int8()) {
+            const int rows_f = tensor("shortlist/rows_f32", TensorType_FLOAT32, {1, dec.n_state});
+            op(BuiltinOperator_DEQUANTIZE, {rows}, {rows_f});
+            rows = rows_f;
+        }
+        op(BuiltinOperator_ASSIGN_VARIABLE, {var_handle("shortlist/weight"), rows}, {});
+        op(BuiltinOperator_ASSIGN_VARIABLE, {var_handle("shortlist/ids"), ids}, {});
+        const int size = tensor("size", TensorType_INT32, {1});
+        ShapeOptionsT shape;
+        shape.out_type = TensorType_INT32;
+        op(BuiltinOperator_SHAPE, {ids}, {size})->builtin_options.Set(shape);
+        return size;
+    }
+
+    //logits [1, n] of the shortlist rows; the hybrid product quantizes x
+    //symmetrically since the row sums of asymmetric inputs are cached for
+    //constant weights only
+    int shortlist_logits(const int x) {
+        using namespace tflite;
+        const TensorT & t = *src.subgraphs[0]->tensors[dec.logits_w.tensor];
+        const bool int8 = shortlist_int8();
+        //unranked, READ_VARIABLE outputs take the variable shape only when dynamic
+        const int rows = read_variable(var_handle("shortlist/weight"), {}, "shortlist/weight",
+                                       int8 ? TensorType_INT8 : TensorType_FLOAT32);
+        if (int8) {
+            sg->tensors[rows]->quantization.reset(new QuantizationParametersT(*t.quantization));
+        }
+        const int out = tensor("logits", TensorType_FLOAT32, {1, 1});
+        FullyConnectedOptionsT options;
+        options.keep_num_dims = false;
+        options.asymmetric_quantize_inputs = false;
+        op(BuiltinOperator_FULLY_CONNECTED, {x, rows, -1}, {out})->builtin_options.Set(options);
+        return out;
+    }
+
+    //logits [1, n_vocab] of token `token` [1] at position `pos` [1], caches of
+    //`slot` [1] updated; [1, n] over the "shortlist/weight" rows with `shortlisted`
+    int step(const int token, const int pos, const int slot, const bool shortlisted = false) {
+        using namespace tflite;
+        const int n_state = dec.n_state;
+        const int n_head = dec.n_head;
+        const int n_ctx = dec.n_text_ctx;
+        const int n_audio = dec.n_audio_ctx;
+
+        //token embedding rows keep the int8 quantization of the table
+        const int table = weight(dec.token_embedding, "token_embedding");
+        const int row8 = tensor("token_embedding/row", sg->tensors[table]->type, {1, n_state});
+        if (sg->tensors[table]->quantization != nullptr) {
+            sg->tensors[row8]->quantization.reset(new QuantizationParametersT(*sg->tensors[table]->quantization));
+        }
+        GatherOptionsT gather;
+        gather.axis = 0;
+        op(BuiltinOperator_GATHER, {table, token}, {row8})->builtin_options.Set(gather);
+        int row = row8;
+        if (sg->tensors[table]->type != TensorType_FLOAT32) {
+            row = tensor("token_embedding/dequantized", TensorType_FLOAT32, {1, n_state});
+            op(BuiltinOperator_DEQUANTIZE, {row8}, {row});
+        }
+        const int positional = tensor("positional_embedding/row", TensorType_FLOAT32, {1, n_state});
+        op(BuiltinOperator_GATHER, {weight(dec.positional_embedding, "positional_embedding"), pos}, {positional})
+            ->builtin_options.Set(gather);
+        int x = binary(BuiltinOperator_ADD, row, positional, "embedding", {1, n_state});
+
+        const int zero = i32("zero_i32", {0});
+        std::vector<int> alignments;
+        int mask = -1;
+        int start_k = -1;
+        int start_v = -1;
+        int length = -1;
+        if (inplace) {
+            //rows [0, pos] of the self attention cache are attended
+            length = binary(BuiltinOperator_ADD, pos, i32("one", {1}), "cache/length", {1}, TensorType_INT32);
+        } else {
+            //positions after `pos` hold stale or zero cache rows
+            std::vector<int32_t> iota(n_ctx);
+            for (int i = 0; i < n_ctx; i++) {
+                iota[i] = i;
+            }
+            const int positions = constant<int32_t>("positions", TensorType_INT32, {n_ctx}, iota);
+            const int future = binary(BuiltinOperator_GREATER, positions, pos, "mask/future", {n_ctx}, TensorType_BOOL);
+            mask = tensor("mask", TensorType_FLOAT32, {n_ctx});
+            op(BuiltinOperator_SELECT_V2, {future, f32("minus_inf", -INFINITY), f32("zero", 0.0f)}, {mask});
+
+            //cache write offsets: keys [n_head, n_ctx, 64] at row pos, values [n_head, 64, n_ctx] at column pos
+            ConcatenationOptionsT concat;
+            concat.axis = 0;
+            start_k = tensor("cache/start_k", TensorType_INT32, {3});
+            op(BuiltinOperator_CONCATENATION, {zero, pos, zero}, {start_k})->builtin_options.Set(concat);
+            start_v = tensor("cache/start_v", TensorType_INT32, {3});
+            op(BuiltinOperator_CONCATENATION, {zero, zero, pos}, {start_v})->builtin_options.Set(concat);
+        }
+
+        for (size_t il = 0; il < dec.layers.size(); il++) {
+            const src_layer & l = dec.layers[il];
+            const std::string p = "blocks." + std::to_string(il) + "/";
+
+            int h = layer_norm(x, l.attn_ln_w, l.attn_ln_b, p + "attn_ln");
+            const int q = query(h, l.q_w, l.q_b, p + "attn/query");
+            const int k = fc(h, l.k_w, src_weight(), p + "attn/key");
+            const int v = fc(h, l.v_w, l.v_b, p + "attn/value");
+            int a = -1;
+            if (inplace) {
+                const int keys = var_handle(p + "self_k");
+                const int values = var_handle(p + "self_v");
+                custom(WHISPER_KV_UPDATE_OP, {keys, slot, pos, k}, {});
+                custom(WHISPER_KV_UPDATE_OP, {values, slot, pos, v}, {});
+                a = kv_attention(q, keys, values, slot, length, p + "attn");
+            } else {
+                const int k_heads = reshape(k, {n_head, 1, DECODER_HEAD_DIM}, p + "attn/key/heads");
+                const int v_heads = reshape(v, {n_head, DECODER_HEAD_DIM, 1}, p + "attn/value/heads");
+                const int keys = cache_update(var_handle(p + "self_k"), {n_head, n_ctx, DECODER_HEAD_DIM}, k_heads, start_k, p + "self_k");
+                const int values = cache_update(var_handle(p + "self_v"), {n_head, DECODER_HEAD_DIM, n_ctx}, v_heads, start_v, p + "self_v");
+                a = attention(q, keys, values, mask, p + "attn");
+            }
+            a = fc(a, l.o_w, l.o_b, p + "attn/out");
+            x = binary(BuiltinOperator_ADD, x, a, p + "attn/residual", {1, n_state});
+
+            h = layer_norm(x, l.cross_ln_w, l.cross_ln_b, p + "cross_attn_ln");
+            const int cq = query(h, l.cq_w, l.cq_b, p + "cross_attn/query");
+            if (inplace) {
+                std::vector<int32_t> heads;
+                for (const std::pair<int, int> & head : alignment_heads) {
+                    if (head.first == (int) il) {
+                        heads.push_back(head.second);
+                    }
+                }
+                //one cross attention cache shared by every slot
+                int probs = -1;
+                a = kv_attention(cq, var_handle(p + "cross_k"), var_handle(p + "cross_v"), zero,
+                                 i32("n_audio_ctx", {n_audio}), p + "cross_attn", heads, &probs);
+                if (probs >= 0) {
+                    alignments.push_back(probs);
+                }
+            } else {
+                const int ck = read_variable(var_handle(p + "cross_k"), {n_head, n_audio, DECODER_HEAD_DIM}, p + "cross_k");
+                const int cv = read_variable(var_handle(p + "cross_v"), {n_head, DECODER_HEAD_DIM, n_audio}, p + "cross_v");
+                a = attention(cq, ck, cv, -1, p + "cross_attn");
+            }
+            a = fc(a, l.co_w, l.co_b, p + "cross_attn/out");
+            x = binary(BuiltinOperator_ADD, x, a, p + "cross_attn/residual", {1, n_state});
+
+            h = layer_norm(x, l.mlp_ln_w, l.mlp_ln_b, p + "mlp_ln");
+            h = fc(h, l.fc1_w, l.fc1_b, p + "mlp/fc1");
+            const int gelu = tensor(p + "mlp/gelu", TensorType_FLOAT32, sg->tensors[h]->shape);
+            op(BuiltinOperator_GELU, {h}, {gelu})->builtin_options.Set(GeluOptionsT());
+            h = fc(gelu, l.fc2_w, l.fc2_b, p + "mlp/fc2");
+            x = binary(BuiltinOperator_ADD, x, h, p + "mlp/residual", {1, n_state});
+        }
+        alignment = -1;
+        if (!alignments.empty()) {
+            //the rows of every layer in the order of alignment_heads
+            alignment = tensor(WHISPER_DECODER_ALIGNMENT_OUTPUT, TensorType_FLOAT32,
+                               {(int) alignment_heads.size(), n_audio});
+            ConcatenationOptionsT concat;
+            concat.axis = 0;
+            op(BuiltinOperator_CONCATENATION, alignments, {alignment})->builtin_options.Set(concat);
+        }
+        x = layer_norm(x, dec.ln_w, dec.ln_b, "ln");
+        return shortlisted ? shortlist_logits(x) : fc(x, dec.logits_w, src_weight(), "logits");
+    }
+
+    //cross attention keys [n_head, n_audio_ctx, 64] and transposed values
+    //[n_head, 64, n_audio_ctx] of every layer into their variables, both
+    //[1, n_head, n_audio_ctx, 64] for the inplace ops
+    void cross_kv(const int hidden) {
+        using namespace tflite;
+        const int n_audio = dec.n_audio_ctx;
+        for (size_t il = 0; il < dec.layers.size(); il++) {
+            const src_layer & l = dec.layers[il];
+            const std::string p = "blocks." + std::to_string(il) + "/";
+            if (inplace) {
+                for (const char * kv : {"k", "v"}) {
+                    const bool is_k = kv[0] == 'k';
+                    const int x = reshape(fc(hidden, is_k ? l.ck_w : l.cv_w, is_k ? l.ck_b : l.cv_b, p + "cross_attn/" + kv),
+                                          {1, n_audio, dec.n_head, DECODER_HEAD_DIM}, p + "cross_attn/" + kv + "/split");
+                    const int heads = tensor(p + "cross_" + kv, TensorType_FLOAT32, {1, dec.n_head, n_audio, DECODER_HEAD_DIM});
+                    op(BuiltinOperator_TRANSPOSE, {x, i32("perm_0213", {0, 2, 1, 3})}, {heads})->builtin_options.Set(TransposeOptionsT());
+                    op(BuiltinOperator_ASSIGN_VARIABLE, {var_handle(p + "cross_" + kv), heads}, {});
+                }
+                continue;
+            }
+            const int k = reshape(fc(hidden, l.ck_w, l.ck_b, p + "cross_attn/key"),
+                                  {n_audio, dec.n_head, DECODER_HEAD_DIM}, p + "cross_attn/key/split");
+            const int v = reshape(fc(hidden, l.cv_w, l.cv_b, p + "cross_attn/value"),
+                                  {n_audio, dec.n_head, DECODER_HEAD_DIM}, p + "cross_attn/value/split");
+            const int k_t = tensor(p + "cross_k", TensorType_FLOAT32, {dec.n_head, n_audio, DECODER_HEAD_DIM});
+            op(BuiltinOperator_TRANSPOSE, {k, i32("perm_102", {1, 0, 2})}, {k_t})->builtin_options.Set(TransposeOptionsT());
+            const int v_t = tensor(p + "cross_v", TensorType_FLOAT32, {dec.n_head, DECODER_HEAD_DIM, n_audio});
+            op(BuiltinOperator_TRANSPOSE, {v, i32("perm_120", {1, 2, 0})}, {v_t})->builtin_options.Set(TransposeOptionsT());
+            op(BuiltinOperator_ASSIGN_VARIABLE, {var_handle(p + "cross_k"), k_t}, {});
+            op(BuiltinOperator_ASSIGN_VARIABLE, {var_handle(p + "cross_v"), v_t}, {});
+        }
+    }
+
+    //zeroed self attention caches, so masked rows never hold NaNs
+    void reset_caches() {
+        using namespace tflite;
+        const int n_head = dec.n_head;
+        const int n_ctx = dec.n_text_ctx;
+        const std::vector<int> shape_k = inplace ? std::vector<int>{n_slots, n_head, n_ctx, DECODER_HEAD_DIM}
+                                                 : std::vector<int>{n_head, n_ctx, DECODER_HEAD_DIM};
+        const std::vector<int> shape_v = inplace ? shape_k : std::vector<int>{n_head, DECODER_HEAD_DIM, n_ctx};
+        const int keys = tensor("self_k/zero", TensorType_FLOAT32, shape_k);
+        op(BuiltinOperator_FILL, {i32("self_k/shape", shape_k), f32("zero", 0.0f)}, {keys});
+        int values = keys;
+        if (shape_v != shape_k) {
+            values = tensor("self_v/zero", TensorType_FLOAT32, shape_v);
+            op(BuiltinOperator_FILL, {i32("self_v/shape", shape_v), f32("zero", 0.0f)}, {values});
+        }
+        for (size_t il = 0; il < dec.layers.size(); il++) {
+            const std::string p = "blocks." + std::to_string(il) + "/";
+            op(BuiltinOperator_ASSIGN_VARIABLE, {var_handle(p + "self_k"), keys}, {});
+            op(BuiltinOperator_ASSIGN_VARIABLE, {var_handle(p + "self_v"), values}, {});
+        }
+    }
+};
+
+//loop state shared by the three subgraphs: last, token, tokens, prompt, limit
+static std::vector<int> loop_state(decoder_builder & b) {
+    using namespace tflite;
+    return {
+        b.tensor("last", TensorType_INT32, {1}),
+        b.tensor("token", TensorType_INT32, {1}),
+        b.tensor("tokens", TensorType_INT32, {b.dec.n_text_ctx}),
+        b.tensor("prompt", TensorType_INT32, {1}),
+        b.tensor("limit", TensorType_INT32, {1}),
+    };
+}
+
+static std::unique_ptr<tflite::ModelT> build_loop_decoder(const tflite::ModelT & src, const src_decoder & dec,
+                                                          const int token_eot, const bool inplace) {
+    using namespace tflite;
+    std::unique_ptr<ModelT> model = whisper_model_create("whisper greedy decoder (in-graph loop, KV cache)");
+    whisper_model_add_metadata(*model, WHISPER_METADATA_N_VOCAB, std::to_string(dec.n_vocab));
+    decoder_builder b(src, dec, *model);
+    b.inplace = inplace;
+
+    //cond: last + 1 < limit && token != EOT
+    {
+        b.begin(1, "cond");
+        const std::vector<int> state = loop_state(b);
+        const int next = b.binary(BuiltinOperator_ADD, state[0], b.i32("one", {1}), "next", {1}, TensorType_INT32);
+        const int room = b.binary(BuiltinOperator_LESS, next, state[4], "room", {1}, TensorType_BOOL);
+        const int open = b.binary(BuiltinOperator_NOT_EQUAL, state[1], b.i32("eot", {token_eot}), "open", {1}, TensorType_BOOL);
+        const int cont = b.binary(BuiltinOperator_LOGICAL_AND, room, open, "continue", {1}, TensorType_BOOL);
+        b.end(state, {cont});
+    }
+
+    //body: decode `token` at position `last`, append the next token
+    {
+        b.begin(2, "body");
+        const std::vector<int> state = loop_state(b);
+        const int logits = b.step(state[1], state[0], b.i32("zero_i32", {0}));
+        const int best = b.tensor("argmax", TensorType_INT32, {1});
+        ArgMaxOptionsT argmax;
+        argmax.output_type = TensorType_INT32;
+        b.op(BuiltinOperator_ARG_MAX, {logits, b.i32("axis_vocab", {1})}, {best})->builtin_options.Set(argmax);
+
+        const int one = b.i32("one", {1});
+        const int next = b.binary(BuiltinOperator_ADD, state[0], one, "next", {1}, TensorType_INT32);
+        const int n_prompt = b.tensor("prompt/size", TensorType_INT32, {1});
+        ShapeOptionsT shape;
+        shape.out_type = TensorType_INT32;
+        b.op(BuiltinOperator_SHAPE, {state[3]}, {n_prompt})->builtin_options.Set(shape);
+        const int forced = b.binary(BuiltinOperator_LESS, next, n_prompt, "prompt/forced", {1}, TensorType_BOOL);
+        const int last_prompt = b.binary(BuiltinOperator_SUB, n_prompt, one, "prompt/last", {1}, TensorType_INT32);
+        const int index = b.binary(BuiltinOperator_MINIMUM, next, last_prompt, "prompt/index", {1}, TensorType_INT32);
+        const int prompt_token = b.binary(BuiltinOperator_GATHER, state[3], index, "prompt/token", {1}, TensorType_INT32);
+        const int token = b.tensor("next_token", TensorType_INT32, {1});
+        b.op(BuiltinOperator_SELECT_V2, {forced, prompt_token, best}, {token});
+        const int tokens = b.tensor("tokens/updated", TensorType_INT32, {dec.n_text_ctx});
+        b.op(BuiltinOperator_DYNAMIC_UPDATE_SLICE, {state[2], token, next}, {tokens});
+        b.end(state, {next, token, tokens, state[3], state[4]});
+    }
+
+    //main: cross attention K/V, cache reset, prompt into tokens, WHILE
+    {
+        b.begin(0, "main");
+        const int hidden = b.tensor("hidden_states", TensorType_FLOAT32, {1, dec.n_audio_ctx, dec.n_state});
+        const int prompt = b.tensor("prompt", TensorType_INT32, {4});
+        b.sg->tensors[prompt]->shape_signature = {-1};
+        const int limit = b.tensor("limit", TensorType_INT32, {1});
+        b.cross_kv(hidden);
+        b.reset_caches();
+
+        const int empty = b.tensor("tokens/empty", TensorType_INT32, {dec.n_text_ctx});
+        b.op(BuiltinOperator_FILL, {b.i32("tokens/shape", {dec.n_text_ctx}), b.constant<int32_t>("zero_scalar_i32", TensorType_INT32, {}, {0})},
+             {empty});
+        const int zero = b.i32("zero_i32", {0});
+        const int tokens = b.tensor("tokens/prompt", TensorType_INT32, {dec.n_text_ctx});
+        b.op(BuiltinOperator_DYNAMIC_UPDATE_SLICE, {empty, prompt, zero}, {tokens});
+        const int first = b.binary(BuiltinOperator_GATHER, prompt, zero, "first_token", {1}, TensorType_INT32);
+
+        std::vector<int> out;
+        for (const char * name : {"last", "token", "tokens", "prompt", "limit"}) {
+            out.push_back(b.tensor(std::string("while/") + name, TensorType_INT32, {std::string(name) == "tokens" ? dec.n_text_ctx : 1}));
+        }
+        WhileOptionsT loop;
+        loop.cond_subgraph_index = 1;
+        loop.body_subgraph_index = 2;
+        b.op(BuiltinOperator_WHILE, {zero, first, tokens, prompt, limit}, out)->builtin_options.Set(loop);
+        b.end({hidden, prompt, limit}, {out[2], out[0]});
+    }
+    return model;
+}
+
+static void add_signature(tflite::ModelT & model, const int subgraph_index, const char * key,
+                          const std::vector<int> & inputs, const std::vector<int> & outputs) {
+    const tflite::SubGraphT & sg = *model.subgraphs[subgraph_index];
+    std::unique_ptr<tflite::SignatureDefT> signature(new tflite::SignatureDefT);
+    signature->signature_key = key;
+    signature->subgraph_index = subgraph_index;
+    for (const int input : inputs) {
+        signature->inputs.emplace_back(new tflite::TensorMapT);
+        signature->inputs.back()->name = sg.tensors[input]->name;
+        signature->inputs.back()->tensor_index = input;
+    }
+    for (const int output : outputs) {
+        signature->outputs.emplace_back(new tflite::TensorMapT);
+        signature->outputs.back()->name = sg.tensors[output]->name;
+        signature->outputs.back()->tensor_index = output;
+    }
+    model.signature_defs.push_back(std::move(signature));
+}
+
+//host stepped decoder, signatures
+//  "init" (hidden_states) -> beams [1]: cross attention K/V into their variables, self attention
+//         caches zeroed; returns the number of cache slots (TFLite needs one output)
+//  "step" (token, position, beam) -> logits [1, n_vocab]: one token of one beam, its cache slot updated
+//         [, ids [1, top_k] int32, logprobs [1, top_k]: the best tokens of the logits]
+//         [, alignment [n_heads, n_audio_ctx]: cross attention weights of the alignment heads]
+//with a shortlist
+//  "shortlist" (ids [n] int32, resizable) -> size [1]: rows of the logits matrix gathered once
+//         into a variable, int8 when its quantization is per tensor
+//  "step_shortlist" (token, position, beam) -> logits [1, n] of the shortlisted tokens only
+//         [, ids [1, top_k] int32 token ids, logprobs [1, top_k] normalized over the shortlist]
+static std::unique_ptr<tflite::ModelT> build_step_decoder(const tflite::ModelT & src, const src_decoder & dec,
+                                                          const bool inplace, const int n_beams, const int top_k,
+                                                          const bool shortlist,
+                                                          const std::vector<std::pair<int, int>> & alignment_heads) {
+    using namespace tflite;
+    std::unique_ptr<ModelT> model = whisper_model_create("whisper decoder step (KV cache in resource variables)");
+    whisper_model_add_metadata(*model, WHISPER_METADATA_N_VOCAB, std::to_string(dec.n_vocab));
+    decoder_builder b(src, dec, *model);
+    b.inplace = inplace;
+    b.n_slots = n_beams;
+    b.alignment_heads = alignment_heads;
+    if (!alignment_heads.empty()) {
+        std::string heads;
+        for (const std::pair<int, int> & head : alignment_heads) {
+            heads += (heads.empty() ? "" : ",") + std::to_string(head.first) + "." + std::to_string(head.second);
+        }
+        whisper_model_add_metadata(*model, WHISPER_METADATA_ALIGNMENT_HEADS, heads);
+    }
+    auto step = [&](const int index, const char * key, const bool shortlisted) {
+        b.begin(index, key);
+        const int token = b.tensor("token", TensorType_INT32, {1});
+        const int position = b.tensor("position", TensorType_INT32, {1});
+        const int beam = b.tensor("beam", TensorType_INT32, {1});
+        const int logits = b.step(token, position, beam, shortlisted);
+        std::vector<int> outputs = {logits};
+        if (top_k > 0) {
+            int ids = b.tensor(shortlisted ? "rows" : "ids", TensorType_INT32, {1, top_k});
+            const int logprobs = b.tensor("logprobs", TensorType_FLOAT32, {1, top_k});
+            b.custom(WHISPER_LOGITS_OP, {logits}, {ids, logprobs})->custom_options =
+                whisper_model_custom_options([&](flexbuffers::Builder & fbb) {
+                    fbb.Int("k", top_k);
+                });
+            if (shortlisted) {
+                //shortlist rows back to token ids
+                const int rows = ids;
+                const int shortlist_ids = b.read_variable(b.var_handle("shortlist/ids"), {}, "shortlist/ids",
+                                                          TensorType_INT32);
+                ids = b.tensor("ids", TensorType_INT32, {1, top_k});
+                GatherOptionsT gather;
+                gather.axis = 0;
+                b.op(BuiltinOperator_GATHER, {shortlist_ids, rows}, {ids})->builtin_options.Set(gather);
+            }
+            outputs.push_back(ids);
+            outputs.push_back(logprobs);
+        }
+        if (b.alignment >= 0) {
+            outputs.push_back(b.alignment);
+        }
+        b.end({token, position, beam}, outputs);
+        add_signature(*model, index, key, {token, position, beam}, outputs);
+    };
+    step(0, WHISPER_DECODER_STEP_SIGNATURE, false);
+    {
+        b.begin(1, "init");
+        const int hidden = b.tensor("hidden_states", TensorType_FLOAT32, {1, dec.n_audio_ctx, dec.n_state});
+        b.cross_kv(hidden);
+        b.reset_caches();
+        const int beams = b.tensor("beams", TensorType_INT32, {1});
+        b.op(BuiltinOperator_ADD, {b.i32("n_slots", {n_beams}), b.i32("zero_i32", {0})}, {beams})->builtin_options.Set(AddOptionsT());
+        b.end({hidden}, {beams});
+        add_signature(*model, 1, WHISPER_DECODER_INIT_SIGNATURE, {hidden}, {beams});
+    }
+    if (shortlist) {
+        step(2, WHISPER_DECODER_STEP_SHORTLIST_SIGNATURE, true);
+        b.begin(3, "shortlist");
+        const int ids = b.tensor("ids", TensorType_INT32, {1});
+        const int size = b.shortlist(ids);
+        b.end({ids}, {size});
+        add_signature(*model, 3, WHISPER_DECODER_SHORTLIST_SIGNATURE, {ids}, {size});
+    }
+    return model;
+}
+
+//pseudo random encoder output, layer normalized like the real one
+static void synth_hidden(std::vector<float> & hidden) {
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    for (float & v : hidden) {
+        v = normal(rng);
+    }
+}
+
+static bool build_interpreter(const tflite::FlatBufferModel * model, tflite::ops::builtin::BuiltinOpResolver & resolver,
+                              std::unique_ptr<tflite::Interpreter> & interpreter) {
+    whisper_attention_register_ops(resolver);
+    whisper_flex_register_ops(resolver);
+    whisper_kv_register_ops(resolver);
+    whisper_logits_register_ops(resolver);
+    return model != nullptr && tflite::InterpreterBuilder(*model, resolver)(&interpreter) == kTfLiteOk &&
+           interpreter->AllocateTensors() == kTfLiteOk;
+}
+
+//one Invoke() of the loop decoder, tokens are the prompt and the generated ones
+static bool loop_decode(tflite::Interpreter & graph, const std::vector<float> & hidden, const std::vector<int32_t> & prompt,
+                        const int limit, std::vector<int32_t> & tokens) {
+    memcpy(graph.typed_input_tensor<float>(0), hidden.data(), hidden.size()*sizeof(float));
+    memcpy(graph.typed_input_tensor<int32_t>(1), prompt.data(), prompt.size()*sizeof(int32_t));
+    graph.typed_input_tensor<int32_t>(2)[0] = limit;
+    if (graph.Invoke() != kTfLiteOk) {
+        fprintf(stderr, "loop decoder failed\n");
+        return false;
+    }
+    const int32_t * out = graph.typed_output_tensor<int32_t>(0);
+    tokens.assign(out, out + graph.typed_output_tensor<int32_t>(1)[0] + 1);
+    return true;
+}
+
+//"init" then one "step" per token of beam 0, prompt tokens forced
+static bool step_decode(tflite::Interpreter & graph, const std::vector<float> & hidden, const std::vector<int32_t> & prompt,
+                        const int limit, const int token_eot, std::vector<int32_t> & tokens, double & init_ms) {
+    tflite::SignatureRunner * init = graph.GetSignatureRunner(WHISPER_DECODER_INIT_SIGNATURE);
+    tflite::SignatureRunner * step = graph.GetSignatureRunner(WHISPER_DECODER_STEP_SIGNATURE);
+    if (init == nullptr || step == nullptr || init->AllocateTensors() != kTfLiteOk || step->AllocateTensors() != kTfLiteOk) {
+        fprintf(stderr, "step decoder signatures missing\n");
+        return false;
+    }
+    const auto t0 = std::chrono::steady_clock::now();
+    memcpy(init->input_tensor("hidden_states")->data.f, hidden.data(), hidden.size()*sizeof(float));
+    if (init->Invoke() != kTfLiteOk) {
+        fprintf(stderr, "step decoder init failed\n");
+        return false;
+    }
+    init_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    const std::vector<const char *> & outputs = step->output_names();
+    const bool top_k = std::find_if(outputs.begin(), outputs.end(),
+                                    [](const char * name) { return std::string(name) == "ids"; }) != outputs.end();
+    tokens.assign(1, prompt[0]);
+    step->input_tensor("beam")->data.i32[0] = 0;
+    while ((int) tokens.size() < limit && tokens.back() != token_eot) {
+        step->input_tensor("token")->data.i32[0] = tokens.back();
+        step->input_tensor("position")->data.i32[0] = tokens.size() - 1;
+        if (step->Invoke() != kTfLiteOk) {
+            fprintf(stderr, "step decoder failed\n");
+            return false;
+        }
+        if (tokens.size() < prompt.size()) {
+            tokens.push_back(prompt[tokens.size()]);
+        } else if (top_k) {
+            tokens.push_back(step->output_tensor("ids")->data.i32[0]);
+        } else {
+            const TfLiteTensor * logits = step->output_tensor("logits");
+            const int n_vocab = logits->dims->data[1];
+            tokens.push_back(std::max_element(logits->data.f, logits->data.f + n_vocab) - logits->data.f);
+        }
+    }
+    return true;
+}
+
+//last token of beam 0 stepped again on beam 0 and on a fork of it into the last beam
+static bool check_fork(tflite::Interpreter & graph, const std::vector<int32_t> & tokens) {
+    tflite::SignatureRunner * step = graph.GetSignatureRunner(WHISPER_DECODER_STEP_SIGNATURE);
+    const int n_slots = whisper_kv_slots(graph);
+    std::vector<float> logits[2];
+    if (n_slots < 2 || !whisper_kv_fork(graph, 0, n_slots - 1)) {
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        step->input_tensor("token")->data.i32[0] = tokens[tokens.size() - 2];
+        step->input_tensor("position")->data.i32[0] = tokens.size() - 2;
+        step->input_tensor("beam")->data.i32[0] = i == 0 ? 0 : n_slots - 1;
+        if (step->Invoke() != kTfLiteOk) {
+            return false;
+        }
+        const TfLiteTensor * out = step->output_tensor("logits");
+        logits[i].assign(out->data.f, out->data.f + out->dims->data[1]);
+    }
+    return logits[0] == logits[1];
+}
+
+//shortlist of the --check tokens, every 25th text token and the special ones
+//stepped through "step" and "step_shortlist" with the tokens teacher forced
+struct shortlist_check {
+    int n_ids = 0;
+    int steps = 0;
+    int argmax_matches = 0;    // shortlist argmax == full logits argmax over the shortlist
+    double max_diff = 0.0;     // of the shortlisted logits against the full ones
+    double build_ms = 0.0;
+    double full_ms = 0.0;
+    double shortlist_ms = 0.0;
+};
+
+static bool check_shortlist(tflite::Interpreter & graph, const std::vector<float> & hidden,
+                            const std::vector<int32_t> & tokens, const int token_eot, const int n_vocab,
+                            shortlist_check & out) {
+    tflite::SignatureRunner * init = graph.GetSignatureRunner(WHISPER_DECODER_INIT_SIGNATURE);
+    tflite::SignatureRunner * step = graph.GetSignatureRunner(WHISPER_DECODER_STEP_SIGNATURE);
+    tflite::SignatureRunner * step_shortlist = graph.GetSignatureRunner(WHISPER_DECODER_STEP_SHORTLIST_SIGNATURE);
+    tflite::SignatureRunner * shortlist = graph.GetSignatureRunner(WHISPER_DECODER_SHORTLIST_SIGNATURE);
+    std::vector<int32_t> ids(tokens.begin(), tokens.end());
+    for (int id = 0; id < n_vocab; id++) {
+        if (id % 25 == 0 || id >= token_eot) {
+            ids.push_back(id);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    out.n_ids = ids.size();
+
+    const auto t0 = std::chrono::steady_clock::now();
+    if (shortlist->ResizeInputTensor("ids", {(int) ids.size()}) != kTfLiteOk || shortlist->AllocateTensors() != kTfLiteOk) {
+        return false;
+    }
+    std::copy(ids.begin(), ids.end(), shortlist->input_tensor("ids")->data.i32);
+    if (shortlist->Invoke() != kTfLiteOk || step_shortlist->AllocateTensors() != kTfLiteOk) {
+        fprintf(stderr, "shortlist failed\n");
+        return false;
+    }
+    out.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    memcpy(init->input_tensor("hidden_states")->data.f, hidden.data(), hidden.size()*sizeof(float));
+    if (init->Invoke() != kTfLiteOk) {
+        return false;
+    }
+    //both steps write the same cache row, the second one rewrites it unchanged
+    for (size_t i = 0; i + 1 < tokens.size(); i++) {
+        tflite::SignatureRunner * runners[2] = {step, step_shortlist};
+        double * ms[2] = {&out.full_ms, &out.shortlist_ms};
+        for (int r = 0; r < 2; r++) {
+            runners[r]->input_tensor("token")->data.i32[0] = tokens[i];
+            runners[r]->input_tensor("position")->data.i32[0] = i;
+            runners[r]->input_tensor("beam")->data.i32[0] = 0;
+            const auto t1 = std::chrono::steady_clock::now();
+            if (runners[r]->Invoke() != kTfLiteOk) {
+                fprintf(stderr, "shortlist step failed\n");
+                return false;
+            }
+            *ms[r] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t1).count();
+        }
+        const float * full = step->output_tensor("logits")->data.f;
+        const TfLiteTensor * logits = step_shortlist->output_tensor("logits");
+        if (logits->dims->data[1] != (int) ids.size()) {
+            return false;
+        }
+        size_t best_full = 0;
+        size_t best = 0;
+        for (size_t j = 0; j < ids.size(); j++) {
+            best_full = full[ids[j]] > full[ids[best_full]] ? j : best_full;
+            best = logits->data.f[j] > logits->data.f[best] ? j : best;
+            out.max_diff = std::max(out.max_diff, (double) std::fabs(logits->data.f[j] - full[ids[j]]));
+        }
+        out.argmax_matches += best == best_full;
+        out.steps++;
+    }
+    return true;
+}
+
+//host stepping over the converted decoder against the cached decoder
+static bool check_decoder(const char * src_path, const std::vector<uint8_t> & bytes, const src_decoder & dec,
+                          const int n_tokens, const int token_eot, const bool step_model) {
+    auto src_model = tflite::FlatBufferModel::BuildFromFile(src_path);
+    auto loop_model = tflite::FlatBufferModel::BuildFromBuffer((const char *) bytes.data(), bytes.size());
+    tflite::ops::builtin::BuiltinOpResolver src_resolver;
+    tflite::ops::builtin::BuiltinOpResolver loop_resolver;
+    std::unique_ptr<tflite::Interpreter> host;
+    std::unique_ptr<tflite::Interpreter> graph;
+    if (!build_interpreter(src_model.get(), src_resolver, host) ||
+        !build_interpreter(loop_model.get(), loop_resolver, graph)) {
+        fprintf(stderr, "failed to build the decoder interpreters\n");
+        return false;
+    }
+    std::vector<float> hidden((size_t) dec.n_audio_ctx*dec.n_state);
+    synth_hidden(hidden);
+    //<|startoftranscript|><|en|><|transcribe|><|notimestamps|> and forced text
+    //tokens, so the cache is exercised over more positions than a noise input decodes
+    std::vector<int32_t> prompt = {token_eot + 1, token_eot + 2, token_eot + 102, token_eot + 106};
+    for (int i = 0; i < 28; i++) {
+        prompt.push_back(1000 + 37*i);
+    }
+    const int limit = std::min<int>(prompt.size() + n_tokens, dec.n_text_ctx);
+
+    //host: one Invoke() over the whole sequence per token
+    int input_hidden = host->inputs()[0];
+    int input_tokens = host->inputs()[1];
+    if (host->tensor(input_hidden)->type == kTfLiteInt64) {
+        std::swap(input_hidden, input_tokens);
+    }
+    std::vector<int32_t> host_tokens = prompt;
+    const auto t0 = std::chrono::steady_clock::now();
+    while ((int) host_tokens.size() < limit) {
+        if (host->ResizeInputTensor(input_tokens, {1, (int) host_tokens.size()}) != kTfLiteOk ||
+            host->AllocateTensors() != kTfLiteOk) {
+            return false;
+        }
+        memcpy(host->tensor(input_hidden)->data.f, hidden.data(), hidden.size()*sizeof(float));
+        for (size_t i = 0; i < host_tokens.size(); i++) {
+            host->tensor(input_tokens)->data.i64[i] = host_tokens[i];
+        }
+        if (host->Invoke() != kTfLiteOk) {
+            fprintf(stderr, "converted decoder failed\n");
+            return false;
+        }
+        const TfLiteTensor * logits = host->output_tensor(0);
+        const int n_vocab = logits->dims->data[2];
+        const float * last = logits->data.f + (size_t) (logits->dims->data[1] - 1)*n_vocab;
+        host_tokens.push_back(std::max_element(last, last + n_vocab) - last);
+        if (host_tokens.back() == token_eot) {
+            break;
+        }
+    }
+    const double host_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    //graph: the cached decoder, second run timed
+    std::vector<int32_t> graph_tokens;
+    double graph_ms = 0.0;
+    double init_ms = 0.0;
+    if (!step_model && (graph->ResizeInputTensor(graph->inputs()[1], {(int) prompt.size()}) != kTfLiteOk ||
+                        graph->AllocateTensors() != kTfLiteOk)) {
+        return false;
+    }
+    for (int it = 0; it < 2; it++) {
+        const auto t1 = std::chrono::steady_clock::now();
+        if (step_model ? !step_decode(*graph, hidden, prompt, limit, token_eot, graph_tokens, init_ms)
+                       : !loop_decode(*graph, hidden, prompt, limit, graph_tokens)) {
+            return false;
+        }
+        graph_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t1).count();
+    }
+    shortlist_check sl;
+    const bool has_shortlist = step_model && graph->GetSignatureRunner(WHISPER_DECODER_SHORTLIST_SIGNATURE) != nullptr;
+    if (has_shortlist && !check_shortlist(*graph, hidden, graph_tokens, token_eot, dec.n_vocab, sl)) {
+        return false;
+    }
+    char shortlist[256] = "null";
+    if (has_shortlist) {
+        snprintf(shortlist, sizeof(shortlist),
+                 "{\"ids\": %d, \"build_ms\": %.3f, \"ms_per_step\": %.3f, \"full_ms_per_step\": %.3f,"
+                 " \"argmax_matches\": %d, \"steps\": %d, \"max_abs_diff\": %.6f}",
+                 sl.n_ids, sl.build_ms, sl.shortlist_ms/std::max(1, sl.steps), sl.full_ms/std::max(1, sl.steps),
+                 sl.argmax_matches, sl.steps, sl.max_diff);
+    }
+    const int64_t kv_bytes = whisper_kv_bytes_per_token(*graph);
+    const char * fork = step_model && whisper_kv_slots(*graph) > 1 ? (check_fork(*graph, graph_tokens) ? "true" : "false") : "null";
+
+    size_t match = 0;
+    while (match < host_tokens.size() && match < graph_tokens.size() && host_tokens[match] == graph_tokens[match]) {
+        match++;
+    }
+    //the free running sequences part at the first near tie (the converted model
+    //quantizes the activations of the whole sequence at once, the loop one row),
+    //so the graph tokens are also checked against the converted model fed the same prefix
+    int agree = 0;
+    if (graph_tokens.size() > 1) {
+        if (host->ResizeInputTensor(input_tokens, {1, (int) graph_tokens.size() - 1}) != kTfLiteOk ||
+            host->AllocateTensors() != kTfLiteOk) {
+            return false;
+        }
+        memcpy(host->tensor(input_hidden)->data.f, hidden.data(), hidden.size()*sizeof(float));
+        for (size_t i = 0; i + 1 < graph_tokens.size(); i++) {
+            host->tensor(input_tokens)->data.i64[i] = graph_tokens[i];
+        }
+        if (host->Invoke() != kTfLiteOk) {
+            fprintf(stderr, "converted decoder failed\n");
+            return false;
+        }
+        const TfLiteTensor * logits = host->output_tensor(0);
+        const int n_vocab = logits->dims->data[2];
+        for (size_t i = prompt.size(); i < graph_tokens.size(); i++) {
+            const float * row = logits->data.f + (i - 1)*n_vocab;
+            agree += (std::max_element(row, row + n_vocab) - row) == graph_tokens[i];
+        }
+    }
+    const int host_new = host_tokens.size() - prompt.size();
+    const int graph_new = graph_tokens.size() - prompt.size();
+    printf("{\"layers\": %zu, \"n_state\": %d, \"n_text_ctx\": %d, \"bytes\": %zu,\n"
+           " \"host\": {\"tokens\": %d, \"ms\": %.3f, \"ms_per_token\": %.3f, \"invokes\": %d},\n"
+           " \"graph\": {\"tokens\": %d, \"ms\": %.3f, \"init_ms\": %.3f, \"ms_per_step\": %.3f, \"invokes\": %d,"
+           " \"kv_bytes_per_token\": %lld},\n"
+           " \"matching_tokens\": %d, \"teacher_forced_agreement\": %d, \"fork_matches\": %s,\n"
+           " \"shortlist\": %s}\n",
+           dec.layers.size(), dec.n_state, dec.n_text_ctx, bytes.size(),
+           host_new, host_ms, host_new > 0 ? host_ms/host_new : 0.0, host_new,
+           graph_new, graph_ms, init_ms, (graph_ms - init_ms)/std::max<size_t>(1, graph_tokens.size() - 1),
+           step_model ? (int) graph_tokens.size() : 1, (long long) kv_bytes,
+           (int) match - (int) prompt.size(), agree, fork, shortlist);
+    return true;
+}
+
+//(layer, head) pairs OpenAI found to track the audio time best, per model size
+//(layers, width, multilingual); other sizes take every head of the upper half of the layers
+static std::vector<std::pair<int, int>> default_alignment_heads(const src_decoder & dec, const bool multilingual) {
+    struct preset {
+        int n_layer, n_state;
+        bool multilingual;
+        std::vector<std::pair<int, int>> heads;
+    };
+    static const std::vector<preset> presets = {
+        {4, 384, false, {{1, 0}, {2, 0}, {2, 5}, {3, 0}, {3, 1}, {3, 2}, {3, 3}, {3, 4}}},
+        {4, 384, true, {{2, 2}, {3, 0}, {3, 2}, {3, 3}, {3, 4}, {3, 5}}},
+        {6, 512, false, {{3, 3}, {4, 7}, {5, 1}, {5, 5}, {5, 7}}},
+        {6, 512, true, {{3, 1}, {4, 2}, {4, 3}, {4, 7}, {5, 1}, {5, 2}, {5, 4}, {5, 6}}},
+        {12, 768, true, {{5, 3}, {5, 9}, {8, 0}, {8, 4}, {8, 7}, {8, 8}, {9, 0}, {9, 7}, {9, 9}, {10, 5}}},
+    };
+    const int n_layer = (int) dec.layers.size();
+    for (const preset & p : presets) {
+        if (p.n_layer == n_layer && p.n_state == dec.n_state && p.multilingual == multilingual) {
+            return p.heads;
+        }
+    }
+    std::vector<std::pair<int, int>> heads;
+    for (int il = n_layer/2; il < n_layer; il++) {
+        for (int h = 0; h < dec.n_head; h++) {
+            heads.push_back({il, h});
+        }
+    }
+    return heads;
+}
+
+//"auto" or "L.H,...", sorted by layer and head as the rows of the alignment output
+static bool parse_alignment_heads(const std::string & spec, const src_decoder & dec, const bool multilingual,
+                                  std::vector<std::pair<int, int>> & heads) {
+    heads.clear();
+    if (spec == "auto") {
+        heads = default_alignment_heads(dec, multilingual);
+        return true;
+    }
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        int layer = -1;
+        int head = -1;
+        if (sscanf(spec.substr(pos, end - pos).c_str(), "%d.%d", &layer, &head) != 2 ||
+            layer < 0 || layer >= (int) dec.layers.size() || head < 0 || head >= dec.n_head) {
+            fprintf(stderr, "bad alignment head '%s' (%zu layers, %d heads)\n", spec.substr(pos, end - pos).c_str(),
+                    dec.layers.size(), dec.n_head);
+            return false;
+        }
+        heads.push_back({layer, head});
+        pos = end + 1;
+    }
+    std::sort(heads.begin(), heads.end());
+    heads.erase(std::unique(heads.begin(), heads.end()), heads.end());
+    return !heads.empty();
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s decoder.tflite out.tflite [--step] [--beams N] [--top-k N] [--shortlist] [--kv inplace|copy]"
+                " [--alignment-heads auto|L.H,...] [--check N]\n",
+                argv[0]);
+        return 1;
+    }
+    int n_check = 0;
+    bool step_model = false;
+    int n_beams = 1;
+    int top_k = 0;
+    bool shortlist = false;
+    bool inplace = true;
+    std::string alignment_spec;
+    for (int i = 3; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--check" && i + 1 < argc) {
+            n_check = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--step") {
+            step_model = true;
+        } else if (arg == "--beams" && i + 1 < argc) {
+            n_beams = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--top-k" && i + 1 < argc) {
+            top_k = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--shortlist") {
+            shortlist = true;
+        } else if (arg == "--alignment-heads" && i + 1 < argc) {
+            alignment_spec = argv[++i];
+        } else if (arg == "--kv" && i + 1 < argc && (std::string(argv[i + 1]) == "inplace" || std::string(argv[i + 1]) == "copy")) {
+            inplace = std::string(argv[++i]) == "inplace";
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", arg.c_str());
+            return 1;
+        }
+    }
+    std::unique_ptr<tflite::ModelT> src = whisper_model_load(argv[1]);
+    if (src == nullptr) {
+        fprintf(stderr, "failed to read model '%s'\n", argv[1]);
+        return 1;
+    }
+    src_decoder dec;
+    if (!find_decoder_weights(*src, dec)) {
+        return 1;
+    }
+    whisper_vocab vocab;
+    vocab.n_vocab = dec.n_vocab;
+    const int token_eot = vocab.token_eot + (vocab.is_multilingual() ? 1 : 0);
+
+    if (n_beams > 1 && !(step_model && inplace)) {
+        fprintf(stderr, "--beams needs --step and --kv inplace\n");
+        return 1;
+    }
+    if ((top_k > 0 || shortlist) && !step_model) {
+        fprintf(stderr, "--top-k and --shortlist need --step\n");
+        return 1;
+    }
+    std::vector<std::pair<int, int>> alignment_heads;
+    if (!alignment_spec.empty()) {
+        if (!(step_model && inplace)) {
+            fprintf(stderr, "--alignment-heads needs --step and --kv inplace\n");
+            return 1;
+        }
+        if (!parse_alignment_heads(alignment_spec, dec, vocab.is_multilingual(), alignment_heads)) {
+            return 1;
+        }
+    }
+
+    std::unique_ptr<tflite::ModelT> model = step_model ? build_step_decoder(*src, dec, inplace, n_beams, top_k, shortlist,
+                                                                          alignment_heads)
+                                                       : build_loop_decoder(*src, dec, token_eot, inplace);
+    std::vector<uint8_t> bytes;
+    whisper_model_pack(*model, bytes);
+    if (!whisper_model_save(*model, argv[2])) {
+        fprintf(stderr, "failed to write '%s'\n", argv[2]);
+        return 1;
+    }
+    if (n_check > 0 && !check_decoder(argv[1], bytes, dec, n_check, token_eot, step_model)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,354 @@
+//Folds the Whisper log-mel frontend into the encoder graph.
+//The rewritten encoder takes the 30 second 16 kHz PCM chunk ([1, 480000]
+//float) as input and computes the features with TFLite ops ahead of the
+//original encoder ops, so the interpreter plans every intermediate and the
+//plugin only copies samples in (see whisper_encoder_takes_pcm()).
+//
+//  whisper-fold-frontend filters_vocab.bin encoder.tflite out.tflite [options]
+//  whisper-fold-frontend filters_vocab.bin --frontend-only out.tflite [options]
+//    --stft dft          400 point DFT as a FULLY_CONNECTED over framed samples,
+//                        builtin ops only and the same grid as the reference (default)
+//    --stft spectrogram  AudioSpectrogram custom op, 512 point FFT, filters
+//                        resampled like the "spectrogram" frontend
+//    --check             run the frontend ops on a synthetic chunk and print
+//                        their parity with log_mel_spectrogram() as JSON
+//
+//Graph (spectrogram): PAD -> RESHAPE [n, 1] -> AudioSpectrogram -> FULLY_CONNECTED (mel)
+//Graph (dft):         PAD -> RESHAPE [3002, 160] -> SLICE x3 -> CONCATENATION [3000, 400]
+//                     -> FULLY_CONNECTED (re/im) -> MUL (square) -> FULLY_CONNECTED (mel)
+//Both then: MAXIMUM 1e-10 -> LOG -> MUL 1/ln(10) -> REDUCE_MAX -> SUB 8 -> MAXIMUM
+//           -> MUL 0.25 -> ADD 1 -> TRANSPOSE -> RESHAPE [1, 80, 3000]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "whisper.h"
+#include "whisper_frontend.h"
+#include "whisper_tool_common.h"
+#include "whisper_model_edit.h"
+
+enum fold_stft {
+    FOLD_STFT_SPECTROGRAM,
+    FOLD_STFT_DFT,
+};
+
+//frontend ops writing the normalized features into tensor `mel_tensor`,
+//returns the index of the new PCM input tensor
+static int fold_frontend(
+    tflite::ModelT & model,
+    const int subgraph_index,
+    const int mel_tensor,
+    const whisper_filters & filters,
+    const fold_stft stft,
+    std::vector<std::unique_ptr<tflite::OperatorT>> & ops) {
+    using namespace tflite;
+    SubGraphT & sg = *model.subgraphs[subgraph_index];
+
+    const int n_samples = WHISPER_SAMPLE_RATE*WHISPER_CHUNK_SIZE;
+    const int n_frames  = n_samples/WHISPER_HOP_LENGTH;
+    const int n_mel     = filters.n_mel;
+    const int n_fft     = 1 + WHISPER_N_FFT/2;
+
+    const int pcm = whisper_model_tensor(model, sg, "pcm", TensorType_FLOAT32, {1, n_samples});
+
+    int power = -1;
+    int mel_in_bins = 0;
+    std::vector<float> mel_weights;
+
+    if (stft == FOLD_STFT_SPECTROGRAM) {
+        //frame i starts at i*hop and the reference zero pads past the end:
+        //fft_size - hop extra samples give exactly n_frames windows
+        const int padded = n_samples + WHISPER_N_FFT - WHISPER_HOP_LENGTH;
+        const int pad = whisper_model_const<int32_t>(model, sg, "pcm/paddings", TensorType_INT32, {2, 2},
+                                                     {0, 0, 0, padded - n_samples});
+        const int pcm_padded = whisper_model_tensor(model, sg, "pcm/padded", TensorType_FLOAT32, {1, padded});
+        whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_PAD), {pcm, pad}, {pcm_padded})
+            ->builtin_options.Set(PadOptionsT());
+
+        const int shape = whisper_model_const<int32_t>(model, sg, "pcm/shape", TensorType_INT32, {2}, {padded, 1});
+        const int samples = whisper_model_tensor(model, sg, "pcm/samples", TensorType_FLOAT32, {padded, 1});
+        ReshapeOptionsT reshape;
+        reshape.new_shape = {padded, 1};
+        whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_RESHAPE), {pcm_padded, shape}, {samples})
+            ->builtin_options.Set(reshape);
+
+        tflite::internal::Spectrogram spectrogram;
+        spectrogram.Initialize(WHISPER_N_FFT, WHISPER_HOP_LENGTH);
+        const int n_bins = spectrogram.output_frequency_channels();
+        power = whisper_model_tensor(model, sg, "stft/power", TensorType_FLOAT32, {1, n_frames, n_bins});
+        OperatorT * op = whisper_model_op(ops, whisper_model_custom_opcode(model, WHISPER_GRAPH_SPECTROGRAM_OP),
+                                          {samples}, {power});
+        op->custom_options = whisper_model_custom_options([](flexbuffers::Builder & fbb) {
+            fbb.Int("window_size", WHISPER_N_FFT);
+            fbb.Int("stride", WHISPER_HOP_LENGTH);
+            fbb.Bool("magnitude_squared", true);
+        });
+        op->custom_options_format = CustomOptionsFormat_FLEXBUFFERS;
+
+        whisper_frontend_filters resampled;
+        whisper_frontend_resample_filters(filters, WHISPER_N_FFT, 2*(n_bins - 1), resampled);
+        mel_in_bins = n_bins;
+        mel_weights = resampled.data;
+    } else {
+        //frames as three shifted views of the chunk in rows of hop samples:
+        //frame i = rows i, i + 1 and the first 80 samples of row i + 2
+        const int hop = WHISPER_HOP_LENGTH;
+        const int n_rows = n_frames + 2;
+        const int padded = n_rows*hop;
+        const int pad = whisper_model_const<int32_t>(model, sg, "pcm/paddings", TensorType_INT32, {2, 2},
+                                                     {0, 0, 0, padded - n_samples});
+        const int pcm_padded = whisper_model_tensor(model, sg, "pcm/padded", TensorType_FLOAT32, {1, padded});
+        whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_PAD), {pcm, pad}, {pcm_padded})
+            ->builtin_options.Set(PadOptionsT());
+
+        const int shape = whisper_model_const<int32_t>(model, sg, "pcm/shape", TensorType_INT32, {2}, {n_rows, hop});
+        const int rows = whisper_model_tensor(model, sg, "pcm/rows", TensorType_FLOAT32, {n_rows, hop});
+        ReshapeOptionsT reshape;
+        reshape.new_shape = {n_rows, hop};
+        whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_RESHAPE), {pcm_padded, shape}, {rows})
+            ->builtin_options.Set(reshape);
+
+        std::vector<int> parts;
+        for (int s = 0; s < 3; s++) {
+            const int width = std::min(hop, WHISPER_N_FFT - s*hop);
+            const std::string name = "stft/frames_" + std::to_string(s);
+            const int begin = whisper_model_const<int32_t>(model, sg, name + "/begin", TensorType_INT32, {2}, {s, 0});
+            const int size = whisper_model_const<int32_t>(model, sg, name + "/size", TensorType_INT32, {2},
+                                                          {n_frames, width});
+            parts.push_back(whisper_model_tensor(model, sg, name, TensorType_FLOAT32, {n_frames, width}));
+            whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_SLICE), {rows, begin, size}, {parts.back()})
+                ->builtin_options.Set(SliceOptionsT());
+        }
+        const int frames = whisper_model_tensor(model, sg, "stft/frames", TensorType_FLOAT32, {n_frames, WHISPER_N_FFT});
+        ConcatenationOptionsT concat;
+        concat.axis = 1;
+        whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_CONCATENATION), parts, {frames})
+            ->builtin_options.Set(concat);
+
+        //windowed real DFT: rows 0 .. n_fft - 1 give the real parts, the rest the imaginary ones
+        std::vector<float> basis(2*n_fft*WHISPER_N_FFT);
+        for (int k = 0; k < n_fft; k++) {
+            for (int n = 0; n < WHISPER_N_FFT; n++) {
+                const double hann = 0.5*(1.0 - cos((2.0*M_PI*n)/WHISPER_N_FFT));
+                const double theta = (2.0*M_PI*(double) ((int64_t) k*n % WHISPER_N_FFT))/WHISPER_N_FFT;
+                basis[k*WHISPER_N_FFT + n]           = (float) (hann*cos(theta));
+                basis[(n_fft + k)*WHISPER_N_FFT + n] = (float) (-hann*sin(theta));
+            }
+        }
+        const int dft = whisper_model_const(model, sg, "stft/basis", TensorType_FLOAT32, {2*n_fft, WHISPER_N_FFT}, basis);
+        const int spectrum = whisper_model_tensor(model, sg, "stft/spectrum", TensorType_FLOAT32, {n_frames, 2*n_fft});
+        whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_FULLY_CONNECTED), {frames, dft, -1}, {spectrum})
+            ->builtin_options.Set(FullyConnectedOptionsT());
+
+        power = whisper_model_tensor(model, sg, "stft/power", TensorType_FLOAT32, {n_frames, 2*n_fft});
+        whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_MUL), {spectrum, spectrum}, {power})
+            ->builtin_options.Set(MulOptionsT());
+
+        //re^2 and im^2 share the filter weights, bins 1 .. n_fft - 2 carry the mirrored half
+        mel_in_bins = 2*n_fft;
+        mel_weights.assign(n_mel*mel_in_bins, 0.0f);
+        for (int j = 0; j < n_mel; j++) {
+            for (int k = 0; k < n_fft; k++) {
+                const float w = filters.data[j*filters.n_fft + k]*((k >= 1 && k < WHISPER_N_FFT/2) ? 2.0f : 1.0f);
+                mel_weights[j*mel_in_bins + k]         = w;
+                mel_weights[j*mel_in_bins + n_fft + k] = w;
+            }
+        }
+    }
+
+    const int mel_w = whisper_model_const(model, sg, "mel/filters", TensorType_FLOAT32, {n_mel, mel_in_bins}, mel_weights);
+    const int mel = whisper_model_tensor(model, sg, "mel/energy", TensorType_FLOAT32, {n_frames, n_mel});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_FULLY_CONNECTED), {power, mel_w, -1}, {mel})
+        ->builtin_options.Set(FullyConnectedOptionsT());
+
+    //log10(max(x, 1e-10)), then the clamp and scale of log_mel_normalize()
+    const int eps = whisper_model_const<float>(model, sg, "mel/eps", TensorType_FLOAT32, {1}, {1e-10f});
+    const int clamped = whisper_model_tensor(model, sg, "mel/clamped", TensorType_FLOAT32, {n_frames, n_mel});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_MAXIMUM), {mel, eps}, {clamped})
+        ->builtin_options.Set(MaximumMinimumOptionsT());
+
+    const int ln = whisper_model_tensor(model, sg, "mel/ln", TensorType_FLOAT32, {n_frames, n_mel});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_LOG), {clamped}, {ln});
+
+    const int inv_ln10 = whisper_model_const<float>(model, sg, "mel/inv_ln10", TensorType_FLOAT32, {1},
+                                                    {(float) (1.0/log(10.0))});
+    const int log10_t = whisper_model_tensor(model, sg, "mel/log10", TensorType_FLOAT32, {n_frames, n_mel});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_MUL), {ln, inv_ln10}, {log10_t})
+        ->builtin_options.Set(MulOptionsT());
+
+    const int axes = whisper_model_const<int32_t>(model, sg, "mel/axes", TensorType_INT32, {2}, {0, 1});
+    const int mmax = whisper_model_tensor(model, sg, "mel/max", TensorType_FLOAT32, {});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_REDUCE_MAX), {log10_t, axes}, {mmax})
+        ->builtin_options.Set(ReducerOptionsT());
+
+    const int range = whisper_model_const<float>(model, sg, "mel/range", TensorType_FLOAT32, {1}, {8.0f});
+    const int floor_t = whisper_model_tensor(model, sg, "mel/floor", TensorType_FLOAT32, {1});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_SUB), {mmax, range}, {floor_t})
+        ->builtin_options.Set(SubOptionsT());
+
+    const int ranged = whisper_model_tensor(model, sg, "mel/ranged", TensorType_FLOAT32, {n_frames, n_mel});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_MAXIMUM), {log10_t, floor_t}, {ranged})
+        ->builtin_options.Set(MaximumMinimumOptionsT());
+
+    //(x + 4)/4 == x*0.25 + 1
+    const int quarter = whisper_model_const<float>(model, sg, "mel/scale", TensorType_FLOAT32, {1}, {0.25f});
+    const int scaled = whisper_model_tensor(model, sg, "mel/scaled", TensorType_FLOAT32, {n_frames, n_mel});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_MUL), {ranged, quarter}, {scaled})
+        ->builtin_options.Set(MulOptionsT());
+
+    const int one = whisper_model_const<float>(model, sg, "mel/offset", TensorType_FLOAT32, {1}, {1.0f});
+    const int features = whisper_model_tensor(model, sg, "mel/features", TensorType_FLOAT32, {n_frames, n_mel});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_ADD), {scaled, one}, {features})
+        ->builtin_options.Set(AddOptionsT());
+
+    const int perm = whisper_model_const<int32_t>(model, sg, "mel/perm", TensorType_INT32, {2}, {1, 0});
+    const int transposed = whisper_model_tensor(model, sg, "mel/transposed", TensorType_FLOAT32, {n_mel, n_frames});
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_TRANSPOSE), {features, perm}, {transposed})
+        ->builtin_options.Set(TransposeOptionsT());
+
+    const int shape = whisper_model_const<int32_t>(model, sg, "mel/shape", TensorType_INT32, {3}, {1, n_mel, n_frames});
+    ReshapeOptionsT reshape;
+    reshape.new_shape = {1, n_mel, n_frames};
+    whisper_model_op(ops, whisper_model_opcode(model, BuiltinOperator_RESHAPE), {transposed, shape}, {mel_tensor})
+        ->builtin_options.Set(reshape);
+
+    return pcm;
+}
+
+//model whose only ops are the frontend, pcm -> [1, n_mel, n_frames]
+static std::unique_ptr<tflite::ModelT> frontend_model(const whisper_filters & filters, const fold_stft stft) {
+    std::unique_ptr<tflite::ModelT> model = whisper_model_create("whisper log-mel frontend");
+    tflite::SubGraphT & sg = *model->subgraphs[0];
+    const int mel = whisper_model_tensor(*model, sg, "input_features", tflite::TensorType_FLOAT32,
+                                         {1, filters.n_mel, WHISPER_MEL_LEN});
+    std::vector<std::unique_ptr<tflite::OperatorT>> ops;
+    sg.inputs = {fold_frontend(*model, 0, mel, filters, stft, ops)};
+    sg.outputs = {mel};
+    sg.operators = std::move(ops);
+    return model;
+}
+
+//rewrites the encoder in place, its first input becomes the PCM chunk
+static bool fold_encoder(tflite::ModelT & model, const whisper_filters & filters, const fold_stft stft) {
+    if (model.subgraphs.empty() || model.subgraphs[0]->inputs.size() != 1) {
+        fprintf(stderr, "expected an encoder with a single input\n");
+        return false;
+    }
+    tflite::SubGraphT & sg = *model.subgraphs[0];
+    const int mel = sg.inputs[0];
+    const std::vector<int> & shape = sg.tensors[mel]->shape;
+    if (sg.tensors[mel]->type != tflite::TensorType_FLOAT32 || shape.size() != 3 ||
+        shape[1] != filters.n_mel || shape[2] != WHISPER_MEL_LEN) {
+        fprintf(stderr, "encoder input is not [1, %d, %d] float features\n", filters.n_mel, WHISPER_MEL_LEN);
+        return false;
+    }
+    std::vector<std::unique_ptr<tflite::OperatorT>> ops;
+    const int pcm = fold_frontend(model, 0, mel, filters, stft, ops);
+    whisper_model_replace_input(model, 0, mel, pcm);
+    //frontend first, the original ops consume its output tensor
+    for (auto & op : sg.operators) {
+        ops.push_back(std::move(op));
+    }
+    sg.operators = std::move(ops);
+    return true;
+}
+
+//runs the frontend model on a synthetic chunk against log_mel_spectrogram()
+static bool check_frontend(const whisper_filters & filters, const fold_stft stft) {
+    std::vector<uint8_t> bytes;
+    whisper_model_pack(*frontend_model(filters, stft), bytes);
+    auto model = tflite::FlatBufferModel::BuildFromBuffer((const char *) bytes.data(), bytes.size());
+    tflite::ops::builtin::BuiltinOpResolver resolver;
+    whisper_frontend_register_ops(resolver);
+    std::unique_ptr<tflite::Interpreter> interpreter;
+    if (model == nullptr || tflite::InterpreterBuilder(*model, resolver)(&interpreter) != kTfLiteOk ||
+        interpreter->AllocateTensors() != kTfLiteOk) {
+        fprintf(stderr, "failed to build the frontend model\n");
+        return false;
+    }
+
+    std::vector<float> pcmf32;
+    synth_audio(pcmf32);
+    whisper_mel reference;
+    log_mel_spectrogram(pcmf32.data(), pcmf32.size(), WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH,
+                        WHISPER_N_MEL, std::max(1u, std::thread::hardware_concurrency()), filters, reference);
+
+    memcpy(interpreter->typed_input_tensor<float>(0), pcmf32.data(), pcmf32.size()*sizeof(float));
+    std::vector<double> ms;
+    for (int it = 0; it < 4; it++) {
+        const auto t0 = std::chrono::steady_clock::now();
+        if (interpreter->Invoke() != kTfLiteOk) {
+            fprintf(stderr, "frontend model failed\n");
+            return false;
+        }
+        ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    }
+    const TfLiteTensor * out = interpreter->output_tensor(0);
+    std::vector<float> features(out->data.f, out->data.f + out->bytes/sizeof(float));
+    double max_abs = 0.0;
+    double mean_abs = 0.0;
+    compare_features(features, reference.data, max_abs, mean_abs);
+    printf("{\"stft\": \"%s\", \"ops\": %zu, \"bytes\": %zu, \"median_ms\": %.3f, "
+           "\"max_abs_diff\": %.6f, \"mean_abs_diff\": %.6f}\n",
+           stft == FOLD_STFT_DFT ? "dft" : "spectrogram", interpreter->nodes_size(), bytes.size(),
+           median(ms), max_abs, mean_abs);
+    return features.size() == reference.data.size();
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s filters_vocab.bin (encoder.tflite|--frontend-only) out.tflite "
+                        "[--stft spectrogram|dft] [--check]\n", argv[0]);
+        return 1;
+    }
+    fold_stft stft = FOLD_STFT_DFT;
+    bool check = false;
+    for (int i = 4; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--stft" && i + 1 < argc) {
+            const std::string kind = argv[++i];
+            if (kind != "spectrogram" && kind != "dft") {
+                fprintf(stderr, "unknown --stft '%s'\n", kind.c_str());
+                return 1;
+            }
+            stft = kind == "dft" ? FOLD_STFT_DFT : FOLD_STFT_SPECTROGRAM;
+        } else if (arg == "--check") {
+            check = true;
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    if (!load_filters(argv[1], filters) || filters.n_fft != 1 + WHISPER_N_FFT/2) {
+        fprintf(stderr, "failed to read mel filters from '%s'\n", argv[1]);
+        return 1;
+    }
+
+    std::unique_ptr<tflite::ModelT> model;
+    if (strcmp(argv[2], "--frontend-only") == 0) {
+        model = frontend_model(filters, stft);
+    } else {
+        model = whisper_model_load(argv[2]);
+        if (model == nullptr) {
+            fprintf(stderr, "failed to read model '%s'\n", argv[2]);
+            return 1;
+        }
+        if (!fold_encoder(*model, filters, stft)) {
+            return 1;
+        }
+    }
+    if (!whisper_model_save(*model, argv[3])) {
+        fprintf(stderr, "failed to write '%s'\n", argv[3]);
+        return 1;
+    }
+    if (check && !check_frontend(filters, stft)) {
+        return 1;
+    }
+    return 0;
+}
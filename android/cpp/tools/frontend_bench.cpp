@@ -0,0 +1,132 @@
+//Speed and numerical parity of the mel frontends in whisper_frontend.h.
+//Every available frontend is timed on the same 30 second chunks and compared
+//to the reference (whisper.cpp) features; the report is printed as JSON.
+//
+//  whisper-frontend-bench filters_vocab_multilingual.bin [options] [audio.wav|audio.mp3 ...]
+//    --threads N     worker threads per frontend (default: hardware concurrency)
+//    --iters N       timed runs per chunk (default: 5)
+//    --tolerance T   max |diff| accepted against the reference (default: 0.05)
+//
+//Without audio files a deterministic synthetic signal (chirps + noise) is used.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "whisper.h"
+#include "whisper_frontend.h"
+#include "whisper_tool_common.h"
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s filters_vocab.bin [--threads N] [--iters N] [--tolerance T] [audio ...]\n", argv[0]);
+        return 1;
+    }
+    int n_threads = std::max(1u, std::thread::hardware_concurrency());
+    int n_iters = 5;
+    double tolerance = 0.05;
+    std::vector<std::string> inputs;
+    for (int i = 2; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            n_threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--iters" && i + 1 < argc) {
+            n_iters = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+
+    if (!load_filters(argv[1], filters)) {
+        fprintf(stderr, "failed to read mel filters from '%s'\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<std::vector<float>> chunks;
+    for (const auto & path : inputs) {
+        std::vector<float> pcmf32;
+        if (!load_audio(path.c_str(), pcmf32)) {
+            fprintf(stderr, "failed to open audio file '%s'\n", path.c_str());
+            return 1;
+        }
+        chunks.push_back(pcmf32);
+    }
+    if (chunks.empty()) {
+        chunks.emplace_back();
+        synth_audio(chunks.back());
+    }
+
+    struct result {
+        std::vector<double> ms;
+        double max_abs = 0.0;
+        double sum_abs = 0.0;
+        size_t n = 0;
+        bool ok = true;
+    };
+    std::map<int, result> results;
+
+    for (const auto & pcmf32 : chunks) {
+        whisper_mel reference;
+        if (!log_mel_spectrogram(pcmf32.data(), pcmf32.size(), WHISPER_SAMPLE_RATE, WHISPER_N_FFT,
+                                 WHISPER_HOP_LENGTH, WHISPER_N_MEL, n_threads, filters, reference)) {
+            fprintf(stderr, "reference frontend failed\n");
+            return 1;
+        }
+        for (int t = 0; t < WHISPER_FRONTEND_COUNT; t++) {
+            const whisper_frontend_type type = (whisper_frontend_type) t;
+            if (!whisper_frontend_available(type)) {
+                continue;
+            }
+            result & r = results[t];
+            whisper_mel out;
+            for (int it = 0; it < n_iters + 1; it++) {
+                const auto t0 = std::chrono::steady_clock::now();
+                r.ok = r.ok && whisper_compute_mel(type, pcmf32.data(), pcmf32.size(), n_threads, filters, out);
+                const auto t1 = std::chrono::steady_clock::now();
+                //first run builds lookup tables, keep it out of the timings
+                if (it > 0) {
+                    r.ms.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+                }
+            }
+            if (!r.ok || out.data.size() != reference.data.size()) {
+                r.ok = false;
+                continue;
+            }
+            for (size_t i = 0; i < out.data.size(); i++) {
+                const double d = fabs(double(out.data[i]) - reference.data[i]);
+                r.max_abs = std::max(r.max_abs, d);
+                r.sum_abs += d;
+            }
+            r.n += out.data.size();
+        }
+    }
+
+    const double ref_ms = median(results[WHISPER_FRONTEND_REFERENCE].ms);
+    int best = WHISPER_FRONTEND_REFERENCE;
+    printf("{\n  \"threads\": %d,\n  \"iterations\": %d,\n  \"chunks\": %zu,\n  \"tolerance\": %g,\n  \"frontends\": [\n",
+           n_threads, n_iters, chunks.size(), tolerance);
+    for (auto it = results.begin(); it != results.end(); ++it) {
+        const result & r = it->second;
+        const double ms = median(r.ms);
+        const bool within = r.ok && r.max_abs <= tolerance;
+        if (within && ms < median(results[best].ms)) {
+            best = it->first;
+        }
+        printf("    {\"name\": \"%s\", \"ok\": %s, \"median_ms\": %.3f, \"min_ms\": %.3f, \"speedup\": %.2f, "
+               "\"max_abs_diff\": %.6f, \"mean_abs_diff\": %.6f, \"within_tolerance\": %s}%s\n",
+               whisper_frontend_name((whisper_frontend_type) it->first), r.ok ? "true" : "false",
+               ms, r.ms.empty() ? 0.0 : *std::min_element(r.ms.begin(), r.ms.end()),
+               ms > 0.0 ? ref_ms/ms : 0.0, r.max_abs, r.n ? r.sum_abs/r.n : 0.0,
+               within ? "true" : "false", std::next(it) == results.end() ? "" : ",");
+    }
+    printf("  ],\n  \"recommended\": \"%s\"\n}\n", whisper_frontend_name((whisper_frontend_type) best));
+    return 0;
+}
@@ -0,0 +1,1136 @@
+//Rewrites the attention, LayerNorm and GELU of converted Whisper models into
+//the fused WhisperAttention (whisper_attention.h), WhisperLayerNorm and
+//WhisperGelu (whisper_norm.h) custom ops, so the score and probability
+//matrices never exist in the arena and the normalizations and activations
+//take one pass over memory instead of one per elementwise op, and the batch-1
+//hybrid FULLY_CONNECTEDs into WhisperFullyConnected (whisper_fully_connected.h),
+//which splits their output rows over threads.
+//
+//  whisper-fuse-ops in.tflite out.tflite [options]
+//    --check        run the original and the rewritten model on the same random
+//                   inputs and print their parity, node count, arena size,
+//                   activation bytes read and written, and latency as JSON
+//    --threads N    interpreter threads of --check (default: hardware concurrency)
+//    --seq N        size of the dynamic input dims in --check, e.g. the decoder
+//                   tokens (default: 8)
+//    --passes LIST  comma separated rewrites out of attention,layer_norm,gelu,
+//                   fully_connected (default: all of them)
+//    --no-xnnpack   run --check without the default XNNPACK delegate, its
+//                   partitions keep their intermediates out of the arena, so
+//                   only without it the arena and activation bytes compare
+//                   the whole graph
+//
+//Matched patterns, every intermediate must have no other consumer:
+//  batched:  BATCH_MATMUL (q, k) [-> MUL scalar] [-> ADD mask] -> SOFTMAX -> BATCH_MATMUL (p, v)
+//            as exported with dynamic shapes (decoder self and cross attention)
+//  per head: q, k and v of every head sliced out of the [n, n_state]
+//            projections by RESHAPE/TRANSPOSE/SPLIT/MUL scalar, FULLY_CONNECTED
+//            (q_h, k_h) -> PACK -> SOFTMAX -> SPLIT -> FULLY_CONNECTED (p_h, v_h)
+//            -> PACK -> RESHAPE/TRANSPOSE back to [n, n_state] (static encoder)
+//  layer norm: MEAN -> SUB -> MUL square (or SQUARED_DIFFERENCE) -> MEAN -> ADD eps
+//            -> RSQRT -> MUL [-> MUL gamma [-> ADD beta]], the affine part only
+//            where the converter did not fold it into the next projection
+//  GELU:     [MUL 1/sqrt(2) ->] FlexErf -> ADD 1 -> MUL [-> MUL 0.5], the
+//            scales may also sit in the two projections feeding it
+//  fully connected: FULLY_CONNECTED of one static float row and constant int8
+//            weights with one scale, dense or 1x16 block sparse (whisper-sparsify)
+//            [and a float bias], no fused activation (the decoder step models)
+//The per head layouts are verified by running the layout ops on element
+//indices, the projections then feed WhisperAttention with n_head set.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "whisper.h"
+#include "whisper_attention.h"
+#include "whisper_flex_ops.h"
+#include "whisper_fully_connected.h"
+#include "whisper_kv_cache.h"
+#include "whisper_logits.h"
+#include "whisper_norm.h"
+#include "whisper_tool_common.h"
+#include "whisper_model_edit.h"
+
+//producers and consumers of the tensors of a subgraph
+struct fuse_graph {
+    tflite::ModelT & model;
+    tflite::SubGraphT & sg;
+    std::vector<int> producer;
+    std::vector<std::vector<int>> consumers;
+    std::vector<bool> removed;
+
+    fuse_graph(tflite::ModelT & model, tflite::SubGraphT & sg) : model(model), sg(sg) {
+        removed.assign(sg.operators.size(), false);
+        update();
+    }
+
+    void update() {
+        producer.assign(sg.tensors.size(), -1);
+        consumers.assign(sg.tensors.size(), {});
+        for (size_t i = 0; i < sg.operators.size(); i++) {
+            if (removed[i]) {
+                continue;
+            }
+            for (const int t : sg.operators[i]->outputs) {
+                if (t >= 0) {
+                    producer[t] = (int) i;
+                }
+            }
+            for (const int t : sg.operators[i]->inputs) {
+                if (t >= 0) {
+                    consumers[t].push_back((int) i);
+                }
+            }
+        }
+        for (const int t : sg.outputs) {
+            consumers[t].push_back(-1);
+        }
+    }
+
+    tflite::OperatorT & op(const int i) const {
+        return *sg.operators[i];
+    }
+
+    tflite::BuiltinOperator code(const int i) const {
+        return tflite::GetBuiltinCode(model.operator_codes[op(i).opcode_index].get());
+    }
+
+    bool is_custom(const int i, const char * name) const {
+        return code(i) == tflite::BuiltinOperator_CUSTOM && model.operator_codes[op(i).opcode_index]->custom_code == name;
+    }
+
+    //ADD, SUB or MUL of two inputs without a fused activation
+    bool is_binary(const int i, const tflite::BuiltinOperator kind) const {
+        const tflite::OperatorT & o = op(i);
+        if (code(i) != kind || o.inputs.size() != 2) {
+            return false;
+        }
+        tflite::ActivationFunctionType activation = tflite::ActivationFunctionType_NONE;
+        if (const auto * options = o.builtin_options.AsAddOptions()) {
+            activation = options->fused_activation_function;
+        } else if (const auto * options = o.builtin_options.AsSubOptions()) {
+            activation = options->fused_activation_function;
+        } else if (const auto * options = o.builtin_options.AsMulOptions()) {
+            activation = options->fused_activation_function;
+        }
+        return activation == tflite::ActivationFunctionType_NONE;
+    }
+
+    //op producing t when it is of the given kind, -1 otherwise
+    int producer_of(const int t, const tflite::BuiltinOperator kind) const {
+        return t >= 0 && producer[t] >= 0 && code(producer[t]) == kind ? producer[t] : -1;
+    }
+
+    //only read by op i, and not a subgraph output
+    bool single_use(const int t, const int i) const {
+        return consumers[t].size() == 1 && consumers[t][0] == i;
+    }
+
+    const tflite::TensorT & tensor(const int t) const {
+        return *sg.tensors[t];
+    }
+
+    const std::vector<uint8_t> * data(const int t) const {
+        const uint32_t buffer = tensor(t).buffer;
+        if (buffer == 0 || buffer >= model.buffers.size() || model.buffers[buffer]->data.empty()) {
+            return nullptr;
+        }
+        return &model.buffers[buffer]->data;
+    }
+
+    bool is_float(const int t) const {
+        return t >= 0 && tensor(t).type == tflite::TensorType_FLOAT32 && data(t) == nullptr;
+    }
+
+    //shape known at conversion time
+    bool is_static(const int t) const {
+        const tflite::TensorT & x = tensor(t);
+        return !x.shape.empty() && std::find(x.shape_signature.begin(), x.shape_signature.end(), -1) == x.shape_signature.end();
+    }
+
+    int64_t elements(const int t) const {
+        int64_t n = 1;
+        for (const int d : tensor(t).shape) {
+            n *= d;
+        }
+        return n;
+    }
+
+    bool scalar_float(const int t, float & value) const {
+        const std::vector<uint8_t> * d = data(t);
+        if (d == nullptr || tensor(t).type != tflite::TensorType_FLOAT32 || d->size() != sizeof(float)) {
+            return false;
+        }
+        memcpy(&value, d->data(), sizeof(float));
+        return true;
+    }
+
+    bool const_ints(const int t, std::vector<int> & values) const {
+        const std::vector<uint8_t> * d = data(t);
+        if (d == nullptr || tensor(t).type != tflite::TensorType_INT32) {
+            return false;
+        }
+        values.resize(d->size()/sizeof(int32_t));
+        memcpy(values.data(), d->data(), values.size()*sizeof(int32_t));
+        return true;
+    }
+
+    //constant float vector of n values
+    bool const_floats(const int t, const int64_t n) const {
+        const std::vector<uint8_t> * d = data(t);
+        return d != nullptr && tensor(t).type == tflite::TensorType_FLOAT32 && d->size() == n*sizeof(float);
+    }
+
+    //ADD or MUL of a tensor and a scalar constant, returns the tensor
+    int scalar_input(const int i, const tflite::BuiltinOperator kind, float & value) const {
+        if (!is_binary(i, kind)) {
+            return -1;
+        }
+        const tflite::OperatorT & m = op(i);
+        if (scalar_float(m.inputs[1], value)) {
+            return m.inputs[0];
+        }
+        if (scalar_float(m.inputs[0], value)) {
+            return m.inputs[1];
+        }
+        return -1;
+    }
+
+    //MUL of t by a scalar constant, returns the other input
+    int scalar_mul_input(const int i, float & value) const {
+        return scalar_input(i, tflite::BuiltinOperator_MUL, value);
+    }
+
+    //the op reading t when it is its only reader, -1 otherwise
+    int only_consumer(const int t) const {
+        return consumers[t].size() == 1 ? consumers[t][0] : -1;
+    }
+};
+
+//tensor holding, for every element, its flat index into a base tensor
+struct fuse_layout {
+    std::vector<int> shape;
+    std::vector<int32_t> index;
+};
+
+static void fuse_layout_iota(fuse_layout & l, const std::vector<int> & shape) {
+    l.shape = shape;
+    int64_t n = 1;
+    for (const int d : shape) {
+        n *= d;
+    }
+    l.index.resize(n);
+    for (int64_t i = 0; i < n; i++) {
+        l.index[i] = (int32_t) i;
+    }
+}
+
+static bool fuse_layout_transpose(fuse_layout & l, const std::vector<int> & perm) {
+    const int rank = l.shape.size();
+    if ((int) perm.size() != rank) {
+        return false;
+    }
+    std::vector<int64_t> in_strides(rank, 1);
+    for (int i = rank - 2; i >= 0; i--) {
+        in_strides[i] = in_strides[i + 1]*l.shape[i + 1];
+    }
+    std::vector<int> shape(rank);
+    std::vector<int64_t> strides(rank);
+    for (int i = 0; i < rank; i++) {
+        if (perm[i] < 0 || perm[i] >= rank) {
+            return false;
+        }
+        shape[i] = l.shape[perm[i]];
+        strides[i] = in_strides[perm[i]];
+    }
+    std::vector<int32_t> index(l.index.size());
+    std::vector<int> pos(rank, 0);
+    for (size_t o = 0; o < index.size(); o++) {
+        int64_t src = 0;
+        for (int i = 0; i < rank; i++) {
+            src += pos[i]*strides[i];
+        }
+        index[o] = l.index[src];
+        for (int i = rank - 1; i >= 0 && ++pos[i] == shape[i]; i--) {
+            pos[i] = 0;
+        }
+    }
+    l.shape = shape;
+    l.index = std::move(index);
+    return true;
+}
+
+//part `k` of `n` equal parts along axis
+static bool fuse_layout_split(fuse_layout & l, int axis, const int n, const int k) {
+    const int rank = l.shape.size();
+    axis = axis < 0 ? axis + rank : axis;
+    if (axis < 0 || axis >= rank || n <= 0 || l.shape[axis] % n != 0) {
+        return false;
+    }
+    int64_t outer = 1;
+    int64_t inner = 1;
+    for (int i = 0; i < axis; i++) {
+        outer *= l.shape[i];
+    }
+    for (int i = axis + 1; i < rank; i++) {
+        inner *= l.shape[i];
+    }
+    const int64_t part = l.shape[axis]/n;
+    std::vector<int32_t> index;
+    index.reserve(outer*part*inner);
+    for (int64_t o = 0; o < outer; o++) {
+        const int32_t * src = l.index.data() + (o*l.shape[axis] + k*part)*inner;
+        index.insert(index.end(), src, src + part*inner);
+    }
+    l.shape[axis] = part;
+    l.index = std::move(index);
+    return true;
+}
+
+//applies the layout op i producing tensor out, scalar MULs go into scale
+static bool fuse_layout_apply(const fuse_graph & g, const int i, const int out, fuse_layout & l, float & scale) {
+    const tflite::OperatorT & op = g.op(i);
+    float value = 1.0f;
+    std::vector<int> ints;
+    switch (g.code(i)) {
+        case tflite::BuiltinOperator_RESHAPE:
+        case tflite::BuiltinOperator_SQUEEZE:
+        case tflite::BuiltinOperator_EXPAND_DIMS:
+            if (g.elements(out) != (int64_t) l.index.size()) {
+                return false;
+            }
+            l.shape = g.tensor(out).shape;
+            return true;
+        case tflite::BuiltinOperator_TRANSPOSE:
+            return g.const_ints(op.inputs[1], ints) && fuse_layout_transpose(l, ints);
+        case tflite::BuiltinOperator_SPLIT: {
+            const auto it = std::find(op.outputs.begin(), op.outputs.end(), out);
+            return g.const_ints(op.inputs[0], ints) && ints.size() == 1 && it != op.outputs.end() &&
+                   fuse_layout_split(l, ints[0], op.outputs.size(), it - op.outputs.begin());
+        }
+        case tflite::BuiltinOperator_MUL:
+            if (g.scalar_mul_input(i, value) < 0) {
+                return false;
+            }
+            scale *= value;
+            return true;
+        default:
+            return false;
+    }
+}
+
+//data input of a layout op, -1 for any other op
+static int fuse_layout_input(const fuse_graph & g, const int i) {
+    float value;
+    switch (g.code(i)) {
+        case tflite::BuiltinOperator_RESHAPE:
+        case tflite::BuiltinOperator_SQUEEZE:
+        case tflite::BuiltinOperator_EXPAND_DIMS:
+        case tflite::BuiltinOperator_TRANSPOSE:
+            return g.op(i).inputs[0];
+        case tflite::BuiltinOperator_SPLIT:
+            return g.op(i).inputs[1];
+        case tflite::BuiltinOperator_MUL:
+            return g.scalar_mul_input(i, value);
+        default:
+            return -1;
+    }
+}
+
+//walks t back through layout ops to the tensor they slice, l maps the
+//elements of t to that base tensor
+static int fuse_trace_back(const fuse_graph & g, const int t, fuse_layout & l, float & scale) {
+    std::vector<std::pair<int, int>> path;  // (op, output on the path)
+    int base = t;
+    while (g.producer[base] >= 0 && g.is_static(base)) {
+        const int input = fuse_layout_input(g, g.producer[base]);
+        if (input < 0 || !g.is_float(input)) {
+            break;
+        }
+        path.emplace_back(g.producer[base], base);
+        base = input;
+    }
+    if (!g.is_static(base)) {
+        return -1;
+    }
+    fuse_layout_iota(l, g.tensor(base).shape);
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        if (!fuse_layout_apply(g, it->first, it->second, l, scale)) {
+            return -1;
+        }
+    }
+    return base;
+}
+
+//element (row, col) of a [rows, cols] matrix view of l is column h*d + col
+//of row `row` of the [rows, n_head*d] base, col_major reads l as [cols, rows]
+static bool fuse_layout_is_head(const fuse_layout & l, const int rows, const int d, const int n_head, const int h,
+                                const bool col_major) {
+    if ((int64_t) l.index.size() != (int64_t) rows*d) {
+        return false;
+    }
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < d; c++) {
+            const int32_t index = col_major ? l.index[(size_t) c*rows + r] : l.index[(size_t) r*d + c];
+            if (index != (r*n_head + h)*d + c) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool fuse_fc_plain(const fuse_graph & g, const int i) {
+    const tflite::OperatorT & op = g.op(i);
+    const auto * options = op.builtin_options.AsFullyConnectedOptions();
+    return g.code(i) == tflite::BuiltinOperator_FULLY_CONNECTED && op.inputs.size() >= 2 &&
+           (op.inputs.size() < 3 || op.inputs[2] < 0) && g.is_float(op.inputs[0]) && g.is_float(op.inputs[1]) &&
+           (options == nullptr || options->fused_activation_function == tflite::ActivationFunctionType_NONE);
+}
+
+//input of the chain of RESHAPEs ending in t that keep the last dim
+static int fuse_skip_reshapes(const fuse_graph & g, int t, std::vector<int> & chain) {
+    int i;
+    while ((i = g.producer_of(t, tflite::BuiltinOperator_RESHAPE)) >= 0 && g.single_use(g.op(i).inputs[0], i)) {
+        chain.push_back(i);
+        t = g.op(i).inputs[0];
+    }
+    return t;
+}
+
+//the custom op replacing the op at position `at`, the ops it makes
+//unused go in fuse_remove_dead()
+template <typename F>
+static void fuse_custom_op(fuse_graph & g, const int at, const char * name, const std::vector<int> & inputs,
+                           const int output, F options) {
+    std::unique_ptr<tflite::OperatorT> op(new tflite::OperatorT);
+    op->opcode_index = whisper_model_custom_opcode(g.model, name);
+    op->inputs = inputs;
+    op->outputs = {output};
+    op->custom_options = whisper_model_custom_options(options);
+    g.sg.operators[at] = std::move(op);
+}
+
+static void fuse_attention_op(
+    fuse_graph & g, const int at, const std::vector<int> & inputs, const int output,
+    const int n_head, const float scale, const bool k_transposed) {
+    fuse_custom_op(g, at, WHISPER_ATTENTION_OP, inputs, output, [&](flexbuffers::Builder & fbb) {
+        fbb.Int("n_head", n_head);
+        fbb.Float("scale", scale);
+        fbb.Bool("k_transposed", k_transposed);
+    });
+}
+
+//BATCH_MATMUL (q, k) [-> MUL] [-> ADD mask] -> SOFTMAX -> BATCH_MATMUL (p, v)
+static bool fuse_attention_batched(fuse_graph & g, const int softmax) {
+    using namespace tflite;
+    const OperatorT & sm = g.op(softmax);
+    const int probs = sm.outputs[0];
+    if (g.consumers[probs].size() != 1 || g.consumers[probs][0] < 0) {
+        return false;
+    }
+    const int pv = g.consumers[probs][0];
+    const auto * pv_options = g.op(pv).builtin_options.AsBatchMatMulOptions();
+    if (g.code(pv) != BuiltinOperator_BATCH_MATMUL || g.op(pv).inputs[0] != probs ||
+        !g.is_float(g.op(pv).inputs[1]) || (pv_options != nullptr && (pv_options->adj_x || pv_options->adj_y))) {
+        return false;
+    }
+    float scale = sm.builtin_options.AsSoftmaxOptions() != nullptr ? sm.builtin_options.AsSoftmaxOptions()->beta : 1.0f;
+    int t = sm.inputs[0];
+    int mask = -1;
+    if (!g.single_use(t, softmax)) {
+        return false;
+    }
+    int i = g.producer_of(t, BuiltinOperator_ADD);
+    if (i >= 0) {
+        const auto * options = g.op(i).builtin_options.AsAddOptions();
+        if (options != nullptr && options->fused_activation_function != ActivationFunctionType_NONE) {
+            return false;
+        }
+        //the scores come out of the matmul, possibly scaled, the other input is the mask
+        const int a = g.op(i).inputs[0];
+        const int b = g.op(i).inputs[1];
+        const bool a_scores = g.producer_of(a, BuiltinOperator_BATCH_MATMUL) >= 0 || g.producer_of(a, BuiltinOperator_MUL) >= 0;
+        mask = a_scores ? b : a;
+        t = a_scores ? a : b;
+        if (g.tensor(mask).type != TensorType_FLOAT32 || !g.single_use(t, i)) {
+            return false;
+        }
+    }
+    float value = 1.0f;
+    if ((i = g.producer_of(t, BuiltinOperator_MUL)) >= 0) {
+        const int input = g.scalar_mul_input(i, value);
+        if (input < 0 || !g.single_use(input, i)) {
+            return false;
+        }
+        scale *= value;
+        t = input;
+    }
+    const int qk = g.producer_of(t, BuiltinOperator_BATCH_MATMUL);
+    if (qk < 0) {
+        return false;
+    }
+    const auto * qk_options = g.op(qk).builtin_options.AsBatchMatMulOptions();
+    const int q = g.op(qk).inputs[0];
+    const int k = g.op(qk).inputs[1];
+    if (!g.is_float(q) || !g.is_float(k) || (qk_options != nullptr && qk_options->adj_x)) {
+        return false;
+    }
+    const bool k_transposed = qk_options == nullptr || !qk_options->adj_y;
+    const int v = g.op(pv).inputs[1];
+    //the op broadcasts no batch dims, reject what can be told apart statically
+    if (g.is_static(q) && g.is_static(k) && g.is_static(v)) {
+        const auto & qs = g.tensor(q).shape;
+        const auto & ks = g.tensor(k).shape;
+        const auto & vs = g.tensor(v).shape;
+        if (qs.size() != ks.size() || qs.size() != vs.size() ||
+            !std::equal(qs.begin(), qs.end() - 2, ks.begin()) || !std::equal(qs.begin(), qs.end() - 2, vs.begin())) {
+            return false;
+        }
+    }
+    std::vector<int> inputs = {q, k, v};
+    if (mask >= 0) {
+        inputs.push_back(mask);
+    }
+    fuse_attention_op(g, pv, inputs, g.op(pv).outputs[0], 0, scale, k_transposed);
+    return true;
+}
+
+//per head FULLY_CONNECTED chains around a SOFTMAX over [n_head, n_q, n_kv]
+static bool fuse_attention_heads(fuse_graph & g, const int softmax) {
+    using namespace tflite;
+    const OperatorT & sm = g.op(softmax);
+    std::vector<int> chain;
+    if (!g.single_use(sm.inputs[0], softmax)) {
+        return false;
+    }
+    const int scores = fuse_skip_reshapes(g, sm.inputs[0], chain);
+    const int pack = g.producer_of(scores, BuiltinOperator_PACK);
+    if (pack < 0 || !g.is_static(scores) || g.tensor(scores).shape.size() != 3) {
+        return false;
+    }
+    const std::vector<int> & shape = g.tensor(scores).shape;
+    const int n_head = shape[0];
+    const int n_q = shape[1];
+    const int n_kv = shape[2];
+    const auto * pack_options = g.op(pack).builtin_options.AsPackOptions();
+    if (pack_options == nullptr || pack_options->axis != 0 || (int) g.op(pack).inputs.size() != n_head ||
+        g.tensor(sm.inputs[0]).shape.back() != n_kv) {
+        return false;
+    }
+    for (const int r : chain) {
+        if (g.tensor(g.op(r).outputs[0]).shape.back() != n_kv) {
+            return false;
+        }
+    }
+
+    //probabilities back to [n_head, n_q, n_kv] and split per head
+    int probs = sm.outputs[0];
+    while (g.consumers[probs].size() == 1 && g.consumers[probs][0] >= 0 &&
+           g.code(g.consumers[probs][0]) == BuiltinOperator_RESHAPE) {
+        probs = g.op(g.consumers[probs][0]).outputs[0];
+    }
+    if (g.consumers[probs].size() != 1 || g.consumers[probs][0] < 0) {
+        return false;
+    }
+    const int split = g.consumers[probs][0];
+    std::vector<int> axis;
+    if (g.code(split) != BuiltinOperator_SPLIT || g.op(split).inputs[1] != probs ||
+        g.tensor(probs).shape != shape || !g.const_ints(g.op(split).inputs[0], axis) || axis.size() != 1 ||
+        axis[0] != 0 || (int) g.op(split).outputs.size() != n_head) {
+        return false;
+    }
+
+    const float beta = sm.builtin_options.AsSoftmaxOptions() != nullptr ? sm.builtin_options.AsSoftmaxOptions()->beta : 1.0f;
+    float scale = 1.0f;
+    int q_base = -1;
+    int k_base = -1;
+    int v_base = -1;
+    int d = 0;
+    std::vector<int> outputs(n_head);
+    for (int h = 0; h < n_head; h++) {
+        //scores_h = q_h k_h^T
+        const int qk = g.producer[g.op(pack).inputs[h]];
+        if (qk < 0 || !fuse_fc_plain(g, qk) || !g.single_use(g.op(qk).outputs[0], pack)) {
+            return false;
+        }
+        //out_h = p_h v_h, v_h^T is the FULLY_CONNECTED weight
+        int p = g.op(split).outputs[h];
+        while (g.consumers[p].size() == 1 && g.consumers[p][0] >= 0 && g.code(g.consumers[p][0]) == BuiltinOperator_RESHAPE) {
+            p = g.op(g.consumers[p][0]).outputs[0];
+        }
+        if (g.consumers[p].size() != 1 || g.consumers[p][0] < 0 || !fuse_fc_plain(g, g.consumers[p][0]) ||
+            g.op(g.consumers[p][0]).inputs[0] != p) {
+            return false;
+        }
+        const int pv = g.consumers[p][0];
+        outputs[h] = g.op(pv).outputs[0];
+
+        const int k_h = g.op(qk).inputs[1];
+        const std::vector<int> & k_shape = g.tensor(k_h).shape;
+        if (k_shape.size() != 2 || k_shape[0] != n_kv || (d != 0 && k_shape[1] != d)) {
+            return false;
+        }
+        d = k_shape[1];
+        fuse_layout q_layout;
+        fuse_layout k_layout;
+        fuse_layout v_layout;
+        float q_scale = 1.0f;
+        float k_scale = 1.0f;
+        float v_scale = 1.0f;
+        const int q = fuse_trace_back(g, g.op(qk).inputs[0], q_layout, q_scale);
+        const int k = fuse_trace_back(g, k_h, k_layout, k_scale);
+        const int v = fuse_trace_back(g, g.op(pv).inputs[1], v_layout, v_scale);
+        if (q < 0 || k < 0 || v < 0 || v_scale != 1.0f ||
+            (h > 0 && (q != q_base || k != k_base || v != v_base || q_scale*k_scale != scale))) {
+            return false;
+        }
+        if (!fuse_layout_is_head(q_layout, n_q, d, n_head, h, false) ||
+            !fuse_layout_is_head(k_layout, n_kv, d, n_head, h, false) ||
+            !fuse_layout_is_head(v_layout, n_kv, d, n_head, h, true) ||
+            g.elements(q) != (int64_t) n_q*n_head*d || g.elements(k) != (int64_t) n_kv*n_head*d ||
+            g.elements(v) != (int64_t) n_kv*n_head*d) {
+            return false;
+        }
+        if (h == 0) {
+            q_base = q;
+            k_base = k;
+            v_base = v;
+            scale = q_scale*k_scale;
+        }
+    }
+
+    //outputs packed and laid out back to [.., n_q, n_head*d]
+    const int out_pack = g.consumers[outputs[0]].size() == 1 ? g.consumers[outputs[0]][0] : -1;
+    const auto * out_options = out_pack >= 0 ? g.op(out_pack).builtin_options.AsPackOptions() : nullptr;
+    if (out_pack < 0 || g.code(out_pack) != BuiltinOperator_PACK || out_options == nullptr || out_options->axis != 0 ||
+        g.op(out_pack).inputs != outputs) {
+        return false;
+    }
+    for (const int o : outputs) {
+        if (!g.single_use(o, out_pack)) {
+            return false;
+        }
+    }
+    fuse_layout l;
+    fuse_layout_iota(l, {n_head, n_q, d});
+    int t = g.op(out_pack).outputs[0];
+    int target = -1;
+    int at = -1;
+    float unused = 1.0f;
+    for (;;) {
+        bool merged = true;
+        for (int r = 0; r < n_q && merged; r++) {
+            for (int h = 0; h < n_head && merged; h++) {
+                for (int c = 0; c < d && merged; c++) {
+                    merged = l.index[((size_t) r*n_head + h)*d + c] == (h*n_q + r)*d + c;
+                }
+            }
+        }
+        if (merged) {
+            target = t;
+            at = g.producer[t];
+        }
+        if (g.consumers[t].size() != 1 || g.consumers[t][0] < 0) {
+            break;
+        }
+        const int next = g.consumers[t][0];
+        const tflite::BuiltinOperator kind = g.code(next);
+        if ((kind != BuiltinOperator_RESHAPE && kind != BuiltinOperator_TRANSPOSE &&
+             kind != BuiltinOperator_SQUEEZE && kind != BuiltinOperator_EXPAND_DIMS) ||
+            g.op(next).inputs[0] != t || !g.is_static(g.op(next).outputs[0]) ||
+            !fuse_layout_apply(g, next, g.op(next).outputs[0], l, unused)) {
+            break;
+        }
+        t = g.op(next).outputs[0];
+    }
+    if (target < 0) {
+        return false;
+    }
+    fuse_attention_op(g, at, {q_base, k_base, v_base}, target, n_head, beta*scale, false);
+    return true;
+}
+
+//MEAN over the last dim keeping it, returns its input
+static int fuse_mean_last(const fuse_graph & g, const int i) {
+    using namespace tflite;
+    std::vector<int> axis;
+    if (i < 0 || g.code(i) != BuiltinOperator_MEAN || g.op(i).inputs.size() != 2 ||
+        !g.const_ints(g.op(i).inputs[1], axis) || axis.size() != 1) {
+        return -1;
+    }
+    const auto * options = g.op(i).builtin_options.AsReducerOptions();
+    const int x = g.op(i).inputs[0];
+    const int rank = (int) g.tensor(x).shape.size();
+    if (options == nullptr || !options->keep_dims || !g.is_float(x) || (axis[0] != -1 && axis[0] != rank - 1)) {
+        return -1;
+    }
+    return x;
+}
+
+//MEAN -> SUB -> MUL (square) or SQUARED_DIFFERENCE -> MEAN -> ADD eps -> RSQRT
+//-> MUL [-> MUL gamma [-> ADD beta]] into WhisperLayerNorm
+static bool fuse_layer_norm(fuse_graph & g, const int rsqrt) {
+    using namespace tflite;
+    float eps;
+    const int add_eps = g.producer[g.op(rsqrt).inputs[0]];
+    const int var = add_eps >= 0 && g.single_use(g.op(rsqrt).inputs[0], rsqrt) ?
+                    g.scalar_input(add_eps, BuiltinOperator_ADD, eps) : -1;
+    const int var_mean = var >= 0 && g.single_use(var, add_eps) ? g.producer[var] : -1;
+    const int sq = fuse_mean_last(g, var_mean);
+    if (sq < 0 || !g.single_use(sq, var_mean)) {
+        return false;
+    }
+    //the centered input, squared by a MUL or recomputed by SQUARED_DIFFERENCE
+    const int square = g.producer[sq];
+    int d = -1;
+    int mean = -1;
+    if (square >= 0 && g.is_binary(square, BuiltinOperator_MUL) && g.op(square).inputs[0] == g.op(square).inputs[1]) {
+        d = g.op(square).inputs[0];
+    } else if (square >= 0 && g.code(square) == BuiltinOperator_SQUARED_DIFFERENCE) {
+        mean = g.op(square).inputs[1];
+    } else {
+        return false;
+    }
+    //d * rsqrt, the only other reader of d
+    const int r = g.op(rsqrt).outputs[0];
+    const int norm = g.only_consumer(r);
+    if (norm < 0 || !g.is_binary(norm, BuiltinOperator_MUL)) {
+        return false;
+    }
+    const int norm_d = g.op(norm).inputs[0] == r ? g.op(norm).inputs[1] : g.op(norm).inputs[0];
+    if (d >= 0 && norm_d != d) {
+        return false;
+    }
+    d = norm_d;
+    const int sub = g.producer[d];
+    if (sub < 0 || !g.is_binary(sub, BuiltinOperator_SUB)) {
+        return false;
+    }
+    const int x = g.op(sub).inputs[0];
+    if (mean >= 0 && (g.op(sub).inputs[1] != mean || g.op(square).inputs[0] != x)) {
+        return false;
+    }
+    mean = g.op(sub).inputs[1];
+    if (fuse_mean_last(g, g.producer[mean]) != x) {
+        return false;
+    }
+    //d and the mean feed the statistics and the normalization only
+    for (const int c : g.consumers[d]) {
+        if (c != square && c != norm) {
+            return false;
+        }
+    }
+    for (const int c : g.consumers[mean]) {
+        if (c != sub && c != square) {
+            return false;
+        }
+    }
+    //the affine part when the normalized tensor has no other reader
+    const int n = g.tensor(x).shape.back();
+    std::vector<int> inputs = {x};
+    int at = norm;
+    int output = g.op(norm).outputs[0];
+    const int gamma_op = g.only_consumer(output);
+    if (n > 0 && gamma_op >= 0 && g.is_binary(gamma_op, BuiltinOperator_MUL)) {
+        const int gamma = g.op(gamma_op).inputs[0] == output ? g.op(gamma_op).inputs[1] : g.op(gamma_op).inputs[0];
+        if (g.const_floats(gamma, n)) {
+            inputs.push_back(gamma);
+            at = gamma_op;
+            output = g.op(gamma_op).outputs[0];
+            const int beta_op = g.only_consumer(output);
+            if (beta_op >= 0 && g.is_binary(beta_op, BuiltinOperator_ADD)) {
+                const int beta = g.op(beta_op).inputs[0] == output ? g.op(beta_op).inputs[1] : g.op(beta_op).inputs[0];
+                if (g.const_floats(beta, n)) {
+                    inputs.push_back(beta);
+                    at = beta_op;
+                    output = g.op(beta_op).outputs[0];
+                }
+            }
+        }
+    }
+    fuse_custom_op(g, at, WHISPER_LAYER_NORM_OP, inputs, output, [&](flexbuffers::Builder & fbb) {
+        fbb.Float("eps", eps);
+    });
+    return true;
+}
+
+//[MUL beta ->] FlexErf -> ADD 1 -> MUL a [-> MUL alpha] into WhisperGelu
+static bool fuse_gelu(fuse_graph & g, const int erf) {
+    using namespace tflite;
+    float one;
+    float alpha = 1.0f;
+    float beta = 1.0f;
+    const int e = g.op(erf).outputs[0];
+    const int add = g.only_consumer(e);
+    if (add < 0 || g.scalar_input(add, BuiltinOperator_ADD, one) != e || one != 1.0f) {
+        return false;
+    }
+    const int plus = g.op(add).outputs[0];
+    const int mul = g.only_consumer(plus);
+    if (mul < 0 || !g.is_binary(mul, BuiltinOperator_MUL)) {
+        return false;
+    }
+    const int a = g.op(mul).inputs[0] == plus ? g.op(mul).inputs[1] : g.op(mul).inputs[0];
+    int b = g.op(erf).inputs[0];
+    const int scale = g.producer[b];
+    if (scale >= 0 && g.single_use(b, erf)) {
+        const int input = g.scalar_mul_input(scale, beta);
+        b = input >= 0 ? input : b;
+        beta = input >= 0 ? beta : 1.0f;
+    }
+    if (!g.is_float(a) || !g.is_float(b) || g.tensor(a).shape != g.tensor(b).shape) {
+        return false;
+    }
+    int at = mul;
+    int output = g.op(mul).outputs[0];
+    const int half = g.only_consumer(output);
+    if (half >= 0 && g.scalar_mul_input(half, alpha) == output) {
+        at = half;
+        output = g.op(half).outputs[0];
+    } else {
+        alpha = 1.0f;
+    }
+    //fuse_remove_dead() keeps custom ops, the erf goes here
+    g.removed[erf] = true;
+    fuse_custom_op(g, at, WHISPER_GELU_OP, a == b ? std::vector<int>{a} : std::vector<int>{a, b}, output,
+                   [&](flexbuffers::Builder & fbb) {
+        fbb.Float("alpha", alpha);
+        fbb.Float("beta", beta);
+    });
+    return true;
+}
+
+//dense weights or the 1x16 blocks of whisper-sparsify: dense rows, CSR column
+//blocks, dense 16 columns
+static bool fuse_fc_sparsity(const tflite::SparsityParametersT * s) {
+    using namespace tflite;
+    if (s == nullptr) {
+        return true;
+    }
+    return s->traversal_order == std::vector<int>({0, 1, 2}) && s->block_map == std::vector<int>({1}) &&
+           s->dim_metadata.size() == 3 && s->dim_metadata[0]->format == DimensionType_DENSE &&
+           s->dim_metadata[1]->format == DimensionType_SPARSE_CSR &&
+           s->dim_metadata[1]->array_segments.type == SparseIndexVector_Int32Vector &&
+           s->dim_metadata[1]->array_indices.type == SparseIndexVector_Int32Vector &&
+           s->dim_metadata[2]->format == DimensionType_DENSE && s->dim_metadata[2]->dense_size == WHISPER_FC_BLOCK;
+}
+
+//FULLY_CONNECTED of a single float row and hybrid int8 weights, the builtin
+//runs it on one thread
+static bool fuse_fully_connected(fuse_graph & g, const int i) {
+    const tflite::OperatorT & op = g.op(i);
+    const auto * options = op.builtin_options.AsFullyConnectedOptions();
+    if (g.code(i) != tflite::BuiltinOperator_FULLY_CONNECTED || options == nullptr ||
+        options->fused_activation_function != tflite::ActivationFunctionType_NONE ||
+        options->weights_format != tflite::FullyConnectedOptionsWeightsFormat_DEFAULT ||
+        op.inputs.size() < 2 || op.outputs.size() != 1 || !g.is_float(op.inputs[0]) || !g.is_static(op.inputs[0])) {
+        return false;
+    }
+    const int weights = op.inputs[1];
+    const tflite::TensorT & w = g.tensor(weights);
+    const tflite::QuantizationParametersT * q = w.quantization.get();
+    if (w.type != tflite::TensorType_INT8 || g.data(weights) == nullptr || w.shape.size() != 2 || !fuse_fc_sparsity(w.sparsity.get()) ||
+        q == nullptr || q->scale.size() != 1 || (!q->zero_point.empty() && q->zero_point[0] != 0) ||
+        g.elements(op.inputs[0]) != w.shape[1]) {
+        return false;
+    }
+    std::vector<int> inputs = {op.inputs[0], weights};
+    if (op.inputs.size() >= 3 && op.inputs[2] >= 0) {
+        if (!g.const_floats(op.inputs[2], w.shape[0])) {
+            return false;
+        }
+        inputs.push_back(op.inputs[2]);
+    }
+    const bool asymmetric = options->asymmetric_quantize_inputs;
+    const bool keep_num_dims = options->keep_num_dims;
+    fuse_custom_op(g, i, WHISPER_FULLY_CONNECTED_OP, inputs, op.outputs[0], [&](flexbuffers::Builder & fbb) {
+        fbb.Bool("asymmetric", asymmetric);
+        fbb.Bool("keep_num_dims", keep_num_dims);
+    });
+    return true;
+}
+
+//ops whose outputs nothing reads, control flow and stateful ops are kept
+static int fuse_remove_dead(fuse_graph & g) {
+    using namespace tflite;
+    int n_removed = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        g.update();
+        for (size_t i = 0; i < g.sg.operators.size(); i++) {
+            const BuiltinOperator kind = g.code(i);
+            if (g.removed[i] || g.op(i).outputs.empty() || kind == BuiltinOperator_CUSTOM ||
+                kind == BuiltinOperator_WHILE || kind == BuiltinOperator_IF ||
+                kind == BuiltinOperator_CALL_ONCE || kind == BuiltinOperator_VAR_HANDLE) {
+                continue;
+            }
+            bool used = false;
+            for (const int t : g.op(i).outputs) {
+                used = used || (t >= 0 && !g.consumers[t].empty());
+            }
+            if (!used) {
+                g.removed[i] = true;
+                changed = true;
+                n_removed++;
+            }
+        }
+    }
+    std::vector<std::unique_ptr<OperatorT>> ops;
+    for (size_t i = 0; i < g.sg.operators.size(); i++) {
+        if (!g.removed[i]) {
+            ops.push_back(std::move(g.sg.operators[i]));
+        }
+    }
+    g.sg.operators = std::move(ops);
+    g.removed.assign(g.sg.operators.size(), false);
+    g.update();
+    return n_removed;
+}
+
+//rewrites of a run, by pass
+struct fuse_passes {
+    bool attention = true;
+    bool layer_norm = true;
+    bool gelu = true;
+    bool fully_connected = true;
+};
+
+struct fuse_counts {
+    int attention = 0;
+    int layer_norm = 0;
+    int gelu = 0;
+    int fully_connected = 0;
+};
+
+//rewrites every subgraph
+static fuse_counts fuse_model(tflite::ModelT & model, const fuse_passes & passes) {
+    fuse_counts counts;
+    for (auto & sg : model.subgraphs) {
+        fuse_graph g(model, *sg);
+        int n = 0;
+        for (size_t i = 0; i < sg->operators.size(); i++) {
+            bool fused = false;
+            if (passes.attention && g.code(i) == tflite::BuiltinOperator_SOFTMAX &&
+                (fuse_attention_batched(g, i) || fuse_attention_heads(g, i))) {
+                counts.attention++;
+                fused = true;
+            } else if (passes.layer_norm && g.code(i) == tflite::BuiltinOperator_RSQRT && fuse_layer_norm(g, i)) {
+                counts.layer_norm++;
+                fused = true;
+            } else if (passes.gelu && g.is_custom(i, "FlexErf") && fuse_gelu(g, i)) {
+                counts.gelu++;
+                fused = true;
+            } else if (passes.fully_connected && fuse_fully_connected(g, i)) {
+                counts.fully_connected++;
+                fused = true;
+            }
+            if (fused) {
+                g.update();
+                n++;
+            }
+        }
+        if (n > 0) {
+            fuse_remove_dead(g);
+        }
+    }
+    return counts;
+}
+
+struct fuse_run {
+    std::unique_ptr<tflite::FlatBufferModel> model;
+    std::unique_ptr<tflite::Interpreter> interpreter;
+    std::vector<double> ms;
+};
+
+static bool fuse_build(const std::vector<uint8_t> & bytes, const int n_threads, const int seq, const bool xnnpack,
+                       fuse_run & run) {
+    run.model = tflite::FlatBufferModel::BuildFromBuffer((const char *) bytes.data(), bytes.size());
+    std::unique_ptr<tflite::ops::builtin::BuiltinOpResolver> resolver(xnnpack ?
+        new tflite::ops::builtin::BuiltinOpResolver : new tflite::ops::builtin::BuiltinOpResolverWithoutDefaultDelegates);
+    whisper_attention_register_ops(*resolver);
+    whisper_norm_register_ops(*resolver);
+    whisper_flex_register_ops(*resolver);
+    whisper_fc_register_ops(*resolver);
+    whisper_kv_register_ops(*resolver);
+    whisper_logits_register_ops(*resolver);
+    if (run.model == nullptr || tflite::InterpreterBuilder(*run.model, *resolver)(&run.interpreter) != kTfLiteOk) {
+        return false;
+    }
+    run.interpreter->SetNumThreads(n_threads);
+    for (const int input : run.interpreter->inputs()) {
+        const TfLiteTensor * t = run.interpreter->tensor(input);
+        if (t->dims_signature == nullptr) {
+            continue;
+        }
+        std::vector<int> dims(t->dims->data, t->dims->data + t->dims->size);
+        bool dynamic = false;
+        for (int i = 0; i < t->dims_signature->size; i++) {
+            if (t->dims_signature->data[i] == -1) {
+                dims[i] = seq;
+                dynamic = true;
+            }
+        }
+        if (dynamic && run.interpreter->ResizeInputTensor(input, dims) != kTfLiteOk) {
+            return false;
+        }
+    }
+    if (run.interpreter->AllocateTensors() != kTfLiteOk) {
+        return false;
+    }
+    //same pseudo random inputs for both models
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    for (const int input : run.interpreter->inputs()) {
+        TfLiteTensor * t = run.interpreter->tensor(input);
+        const int64_t n = tflite::NumElements(t);
+        for (int64_t i = 0; i < n; i++) {
+            switch (t->type) {
+                case kTfLiteFloat32: t->data.f[i] = uniform(rng); break;
+                case kTfLiteInt32:   t->data.i32[i] = rng() % 1000; break;
+                case kTfLiteInt64:   t->data.i64[i] = rng() % 1000; break;
+                default: break;
+            }
+        }
+    }
+    return true;
+}
+
+static bool fuse_invoke(fuse_run & run, const int n_iters) {
+    for (int it = 0; it <= n_iters; it++) {
+        const auto t0 = std::chrono::steady_clock::now();
+        if (run.interpreter->Invoke() != kTfLiteOk) {
+            return false;
+        }
+        //the first run warms up
+        if (it > 0) {
+            run.ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        }
+    }
+    return true;
+}
+
+static size_t fuse_arena_bytes(fuse_run & run) {
+    tflite::Subgraph::SubgraphAllocInfo info;
+    run.interpreter->subgraph(0)->GetMemoryAllocInfo(&info);
+    return info.arena_size;
+}
+
+//arena bytes the nodes of the main subgraph read and write per invoke, every
+//input read and every output written once: the activation memory traffic
+//left after caching, weights not counted
+static size_t fuse_activation_bytes(fuse_run & run) {
+    tflite::Subgraph & subgraph = *run.interpreter->subgraph(0);
+    size_t bytes = 0;
+    for (const int index : subgraph.execution_plan()) {
+        const TfLiteNode & node = subgraph.node_and_registration(index)->first;
+        for (const TfLiteIntArray * tensors : {node.inputs, node.outputs}) {
+            for (int i = 0; i < tensors->size; i++) {
+                const TfLiteTensor * t = tensors->data[i] >= 0 ? subgraph.tensor(tensors->data[i]) : nullptr;
+                if (t != nullptr && t->allocation_type == kTfLiteArenaRw) {
+                    bytes += t->bytes;
+                }
+            }
+        }
+    }
+    return bytes;
+}
+
+//runs both models on the same inputs and prints their parity as JSON
+static bool check_fused(const tflite::ModelT & original, const tflite::ModelT & fused, const fuse_counts & counts,
+                        const int n_threads, const int seq, const bool xnnpack) {
+    std::vector<uint8_t> original_bytes;
+    std::vector<uint8_t> fused_bytes;
+    whisper_model_pack(original, original_bytes);
+    whisper_model_pack(fused, fused_bytes);
+    fuse_run a;
+    fuse_run b;
+    if (!fuse_build(original_bytes, n_threads, seq, xnnpack, a) || !fuse_build(fused_bytes, n_threads, seq, xnnpack, b)) {
+        fprintf(stderr, "failed to build the interpreters\n");
+        return false;
+    }
+    if (!fuse_invoke(a, 3) || !fuse_invoke(b, 3)) {
+        fprintf(stderr, "failed to run the models\n");
+        return false;
+    }
+    double max_abs = 0.0;
+    for (size_t i = 0; i < a.interpreter->outputs().size(); i++) {
+        const TfLiteTensor * x = a.interpreter->output_tensor(i);
+        const TfLiteTensor * y = b.interpreter->output_tensor(i);
+        if (x->type != kTfLiteFloat32 || y->type != kTfLiteFloat32 || x->bytes != y->bytes) {
+            fprintf(stderr, "output %zu differs in type or size\n", i);
+            return false;
+        }
+        for (size_t j = 0; j < x->bytes/sizeof(float); j++) {
+            max_abs = std::max(max_abs, (double) std::fabs(x->data.f[j] - y->data.f[j]));
+        }
+    }
+    printf("{\"fused_attention\": %d, \"fused_layer_norm\": %d, \"fused_gelu\": %d, \"fused_fully_connected\": %d,\n"
+           " \"threads\": %d,\n"
+           " \"nodes\": [%zu, %zu],\n \"arena_bytes\": [%zu, %zu],\n \"activation_bytes\": [%zu, %zu],\n"
+           " \"median_ms\": [%.3f, %.3f],\n \"max_abs_diff\": %.6g}\n",
+           counts.attention, counts.layer_norm, counts.gelu, counts.fully_connected, n_threads,
+           a.interpreter->nodes_size(), b.interpreter->nodes_size(), fuse_arena_bytes(a), fuse_arena_bytes(b),
+           fuse_activation_bytes(a), fuse_activation_bytes(b), median(a.ms), median(b.ms), max_abs);
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s in.tflite out.tflite [--check] [--threads N] [--seq N] [--passes LIST] [--no-xnnpack]\n",
+                argv[0]);
+        return 1;
+    }
+    bool check = false;
+    bool xnnpack = true;
+    int n_threads = std::max(1u, std::thread::hardware_concurrency());
+    int seq = 8;
+    fuse_passes passes;
+    for (int i = 3; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--check") {
+            check = true;
+        } else if (arg == "--no-xnnpack") {
+            xnnpack = false;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            n_threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--seq" && i + 1 < argc) {
+            seq = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--passes" && i + 1 < argc) {
+            const std::string list = "," + std::string(argv[++i]) + ",";
+            passes.attention = list.find(",attention,") != std::string::npos;
+            passes.layer_norm = list.find(",layer_norm,") != std::string::npos;
+            passes.gelu = list.find(",gelu,") != std::string::npos;
+            passes.fully_connected = list.find(",fully_connected,") != std::string::npos;
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::unique_ptr<tflite::ModelT> model = whisper_model_load(argv[1]);
+    if (model == nullptr) {
+        fprintf(stderr, "failed to read model '%s'\n", argv[1]);
+        return 1;
+    }
+    std::unique_ptr<tflite::ModelT> original = check ? whisper_model_load(argv[1]) : nullptr;
+    const fuse_counts counts = fuse_model(*model, passes);
+    fprintf(stderr, "fused %d attention blocks, %d layer norms, %d GELUs, %d fully connected\n", counts.attention,
+            counts.layer_norm, counts.gelu, counts.fully_connected);
+    if (!whisper_model_save(*model, argv[2])) {
+        fprintf(stderr, "failed to write '%s'\n", argv[2]);
+        return 1;
+    }
+    if (check && !check_fused(*original, *model, counts, n_threads, seq, xnnpack)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,748 @@
+//Full integer post training quantization of the plugin models. The converted
+//models are hybrid: int8 weights and float activations, so every
+//FULLY_CONNECTED and CONV_2D quantizes its input on the fly and dequantizes
+//its output. This tool dequantizes their weights, records the activation
+//ranges of the float graph on real audio run through the plugin frontend
+//(calibration) and quantizes weights and activations with
+//tensorflow/lite/tools/optimize, so the kernels of
+//kernels/internal/optimized/integer_ops run from the first layer to the
+//last. Inputs and outputs stay float, the pipeline feeds the models as
+//before; ops without integer kernels (FlexErf, the fused custom ops) stay
+//float between DEQUANTIZE and QUANTIZE, and the projections kept float get
+//their hybrid weights back.
+//
+//Run it on the output of whisper-fuse-ops: a LayerNorm left as MEAN/SUB/RSQRT
+//loses its variance to the activation scale, WhisperLayerNorm stays float.
+//On whisper tiny per tensor int8 activations cost most of the output SNR
+//(residual stream outliers), 16x8 keeps it above 40 dB.
+//
+//  whisper-quantize model_dir [options] audio.wav|audio.mp3 ...
+//    model_dir         plugin assets: hybrid encoder, converted decoder, filters/vocab
+//    --out DIR         directory of the quantized models (default: model_dir), written as
+//                      whisper-encoder-int8.tflite and whisper-decoder-language-int8.tflite
+//                      (-16x8 with --16x8), see whisper-bench --encoder/--decoder
+//    --16x8            int16 activations with int8 weights, slower kernels, far smaller
+//                      activation error
+//    --float PATTERN   keep the ops whose output tensor name contains PATTERN in float,
+//                      may be repeated
+//    --quantize-outputs  also quantize the ops producing the model outputs (the decoder
+//                      logits projection, the encoder final layer norm), float by default
+//    --chunks N        30 second calibration chunks per audio file (default: 4)
+//    --layers N        layers listed per model in the report (default: 10)
+//    --frontend F      mel frontend of the calibration audio (default: reference)
+//    --threads N       interpreter threads (default: hardware concurrency)
+//
+//Prints a JSON report per model: operators quantized and kept float, size and
+//median latency of the hybrid and the quantized model, SNR of the quantized
+//output against the float model, and the FULLY_CONNECTED/CONV_2D/BATCH_MATMUL
+//layers with the lowest output SNR on the first chunk, worst first. The error
+//of a layer includes the one of the layers before it; a layer much worse
+//than its predecessors is the candidate for --float.
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "tensorflow/lite/core/api/profiler.h"
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "tensorflow/lite/stderr_reporter.h"
+#include "tensorflow/lite/tools/optimize/quantize_model.h"
+#include "whisper.h"
+#include "whisper_frontend.h"
+#include "whisper_pipeline.h"
+#include "whisper_model_edit.h"
+
+//values of the inputs of one Invoke(), in the order of the interpreter inputs
+struct quant_input {
+    std::vector<int> dims;
+    std::vector<uint8_t> data;
+};
+
+typedef std::vector<quant_input> quant_sample;
+
+struct quant_options {
+    bool int16 = false;
+    bool quantize_outputs = false;
+    std::vector<std::string> float_patterns;
+    int n_layers = 10;
+    int n_threads = 1;
+};
+
+//calls on_node after every operator of subgraph 0 during Invoke(), the node
+//outputs hold their values then; needs an interpreter without the default
+//delegate, so every operator is a node of its own
+struct quant_observer : public tflite::Profiler {
+    std::function<void(int node)> on_node;
+
+    uint32_t BeginEvent(const char *, EventType event_type, int64_t node, int64_t subgraph) override {
+        return event_type == EventType::OPERATOR_INVOKE_EVENT && subgraph == 0 ? (uint32_t) node + 1 : 0;
+    }
+
+    void EndEvent(uint32_t handle) override {
+        if (handle > 0 && on_node) {
+            on_node((int) handle - 1);
+        }
+    }
+};
+
+//the observer stays installed for the life of the interpreter, the prebuilt
+//Interpreter::SetProfiler(nullptr) leaves the subgraphs with a dangling one
+struct quant_run {
+    std::unique_ptr<tflite::FlatBufferModel> model;
+    std::unique_ptr<tflite::ops::builtin::BuiltinOpResolver> resolver;
+    quant_observer observer;
+    std::unique_ptr<tflite::Interpreter> interpreter;
+};
+
+static bool quant_build(const std::vector<uint8_t> & bytes, const bool xnnpack, const int n_threads, quant_run & run) {
+    run.model = tflite::FlatBufferModel::BuildFromBuffer((const char *) bytes.data(), bytes.size());
+    run.resolver.reset(xnnpack ? new tflite::ops::builtin::BuiltinOpResolver
+                               : new tflite::ops::builtin::BuiltinOpResolverWithoutDefaultDelegates);
+    whisper_attention_register_ops(*run.resolver);
+    whisper_flex_register_ops(*run.resolver);
+    whisper_frontend_register_ops(*run.resolver);
+    whisper_norm_register_ops(*run.resolver);
+    if (run.model == nullptr ||
+        tflite::InterpreterBuilder(*run.model, *run.resolver)(&run.interpreter, n_threads) != kTfLiteOk) {
+        return false;
+    }
+    run.interpreter->SetProfiler(&run.observer);
+    return true;
+}
+
+static bool quant_invoke(tflite::Interpreter & interpreter, const quant_sample & sample) {
+    for (size_t i = 0; i < sample.size(); i++) {
+        const TfLiteTensor * t = interpreter.input_tensor(i);
+        if (std::vector<int>(t->dims->data, t->dims->data + t->dims->size) != sample[i].dims &&
+            interpreter.ResizeInputTensor(interpreter.inputs()[i], sample[i].dims) != kTfLiteOk) {
+            return false;
+        }
+    }
+    if (interpreter.AllocateTensors() != kTfLiteOk) {
+        return false;
+    }
+    for (size_t i = 0; i < sample.size(); i++) {
+        TfLiteTensor * t = interpreter.input_tensor(i);
+        if (t->bytes != sample[i].data.size()) {
+            return false;
+        }
+        memcpy(t->data.raw, sample[i].data.data(), t->bytes);
+    }
+    return interpreter.Invoke() == kTfLiteOk;
+}
+
+static quant_input quant_capture(const TfLiteTensor * t) {
+    quant_input in;
+    in.dims.assign(t->dims->data, t->dims->data + t->dims->size);
+    in.data.assign(t->data.raw, t->data.raw + t->bytes);
+    return in;
+}
+
+static bool quant_is_const(const tflite::ModelT & model, const tflite::TensorT & t) {
+    return t.buffer > 0 && t.buffer < (int) model.buffers.size() && !model.buffers[t.buffer]->data.empty();
+}
+
+//a range an 8/16 bit scale can cover, the attention masks are -inf or -FLT_MAX
+static bool quant_bounded(const float min, const float max) {
+    return std::isfinite(min) && std::isfinite(max) && std::max(-min, max) < 1e6f;
+}
+
+//whether a float tensor of the model keeps to a bounded range, constants by their
+//values and activations by their calibrated min/max
+static bool quant_bounded(const tflite::ModelT & model, const tflite::TensorT & t, const int index,
+                          const std::vector<float> & min, const std::vector<float> & max) {
+    if (t.type != tflite::TensorType_FLOAT32) {
+        return true;
+    }
+    if (quant_is_const(model, t)) {
+        const std::vector<uint8_t> & data = model.buffers[t.buffer]->data;
+        const float * f = reinterpret_cast<const float *>(data.data());
+        const auto range = std::minmax_element(f, f + data.size()/sizeof(float));
+        return range.first == f + data.size()/sizeof(float) || quant_bounded(*range.first, *range.second);
+    }
+    return index >= (int) min.size() || !(min[index] <= max[index]) || quant_bounded(min[index], max[index]);
+}
+
+//the optimizer takes these to 16x8, the runtime has no int16 kernel for them:
+//RSQRT, and FULLY_CONNECTED with an activation (the attention products) as weights
+static bool quant_runs_16x8(const tflite::ModelT & model, const tflite::SubGraphT & sg, const tflite::OperatorT & op) {
+    switch (tflite::GetBuiltinCode(model.operator_codes[op.opcode_index].get())) {
+        case tflite::BuiltinOperator_RSQRT:
+            return false;
+        case tflite::BuiltinOperator_FULLY_CONNECTED:
+            return op.inputs.size() > 1 && quant_is_const(model, *sg.tensors[op.inputs[1]]);
+        default:
+            return true;
+    }
+}
+
+//float copy of a constant int8/uint8 tensor, per tensor or per axis scales
+static std::vector<uint8_t> quant_dequantize(const tflite::ModelT & model, const tflite::TensorT & t) {
+    const std::vector<uint8_t> & data = model.buffers[t.buffer]->data;
+    const tflite::QuantizationParametersT & q = *t.quantization;
+    const int axis = q.scale.size() > 1 ? q.quantized_dimension : -1;
+    size_t inner = 1;
+    for (int d = axis + 1; axis >= 0 && d < (int) t.shape.size(); d++) {
+        inner *= t.shape[d];
+    }
+    std::vector<uint8_t> out(data.size()*sizeof(float));
+    float * f = (float *) out.data();
+    for (size_t i = 0; i < data.size(); i++) {
+        const size_t c = axis >= 0 ? (i/inner) % q.scale.size() : 0;
+        const int32_t v = t.type == tflite::TensorType_INT8 ? (int32_t) (int8_t) data[i] : (int32_t) data[i];
+        const int64_t zero_point = c < q.zero_point.size() ? q.zero_point[c] : 0;
+        f[i] = q.scale[c]*(float) (v - zero_point);
+    }
+    return out;
+}
+
+//the hybrid model as a float one: int8 weights dequantized in place, their
+//DEQUANTIZE ops (directly or after a GATHER of embedding rows) dropped
+static void quant_float_weights(tflite::ModelT & model) {
+    using namespace tflite;
+    for (auto & sg : model.subgraphs) {
+        std::vector<bool> weight(sg->tensors.size(), false);
+        std::vector<const OperatorT *> producer(sg->tensors.size(), nullptr);
+        for (size_t i = 0; i < sg->operators.size(); i++) {
+            const OperatorT & op = *sg->operators[i];
+            for (const int output : op.outputs) {
+                producer[output] = &op;
+            }
+            for (const int input : op.inputs) {
+                const TensorT * t = input >= 0 ? sg->tensors[input].get() : nullptr;
+                if (t != nullptr && !weight[input] && (t->type == TensorType_INT8 || t->type == TensorType_UINT8) &&
+                    t->quantization != nullptr && !t->quantization->scale.empty() && quant_is_const(model, *t)) {
+                    weight[input] = true;
+                    std::unique_ptr<BufferT> buffer(new BufferT);
+                    buffer->data = quant_dequantize(model, *t);
+                    model.buffers.push_back(std::move(buffer));
+                    sg->tensors[input]->buffer = (int) model.buffers.size() - 1;
+                }
+            }
+        }
+        for (size_t i = 0; i < weight.size(); i++) {
+            if (weight[i]) {
+                sg->tensors[i]->type = TensorType_FLOAT32;
+                sg->tensors[i]->quantization.reset();
+            }
+        }
+        std::vector<int> replace(sg->tensors.size(), -1);
+        std::vector<std::unique_ptr<OperatorT>> ops;
+        for (auto & op : sg->operators) {
+            const BuiltinOperator code = GetBuiltinCode(model.operator_codes[op->opcode_index].get());
+            if (code == BuiltinOperator_DEQUANTIZE) {
+                const int in = op->inputs[0];
+                const OperatorT * gather = producer[in];
+                const bool gathered = gather != nullptr &&
+                    GetBuiltinCode(model.operator_codes[gather->opcode_index].get()) == BuiltinOperator_GATHER &&
+                    weight[gather->inputs[0]];
+                if (weight[in] || gathered) {
+                    sg->tensors[in]->type = TensorType_FLOAT32;
+                    sg->tensors[in]->quantization.reset();
+                    replace[op->outputs[0]] = in;
+                    continue;
+                }
+            }
+            for (int & input : op->inputs) {
+                input = input >= 0 && replace[input] >= 0 ? replace[input] : input;
+            }
+            ops.push_back(std::move(op));
+        }
+        for (int & output : sg->outputs) {
+            output = replace[output] >= 0 ? replace[output] : output;
+        }
+        sg->operators = std::move(ops);
+    }
+    //the int8 copies nothing points at anymore
+    std::vector<bool> used(model.buffers.size(), false);
+    for (const auto & sg : model.subgraphs) {
+        for (const auto & t : sg->tensors) {
+            used[t->buffer] = true;
+        }
+    }
+    for (const auto & m : model.metadata) {
+        used[m->buffer] = true;
+    }
+    for (size_t i = 1; i < model.buffers.size(); i++) {
+        if (!used[i]) {
+            model.buffers[i]->data.clear();
+        }
+    }
+}
+
+//the optimizer quantizes a constant in place for the first operator it
+//quantizes: every further use of a shared float constant (the LayerNorm
+//epsilon of every block) gets a copy of its own, float consumers stay float
+static void quant_unshare_constants(tflite::ModelT & model) {
+    using namespace tflite;
+    SubGraphT & sg = *model.subgraphs[0];
+    std::vector<int> uses(sg.tensors.size(), 0);
+    for (auto & op : sg.operators) {
+        for (int & input : op->inputs) {
+            if (input < 0 || sg.tensors[input]->type != TensorType_FLOAT32 || !quant_is_const(model, *sg.tensors[input]) ||
+                uses[input]++ == 0) {
+                continue;
+            }
+            const TensorT & t = *sg.tensors[input];
+            std::unique_ptr<BufferT> buffer(new BufferT);
+            buffer->data = model.buffers[t.buffer]->data;
+            model.buffers.push_back(std::move(buffer));
+            std::unique_ptr<TensorT> copy(new TensorT);
+            copy->name = t.name + "/" + std::to_string(uses[input] - 1);
+            copy->shape = t.shape;
+            copy->type = t.type;
+            copy->buffer = (int) model.buffers.size() - 1;
+            sg.tensors.push_back(std::move(copy));
+            input = (int) sg.tensors.size() - 1;
+        }
+    }
+}
+
+//the projections the optimizer left float get the int8 weights of the hybrid
+//model back, they run as hybrid as before instead of carrying float weights
+static int quant_restore_hybrid(tflite::ModelT & model, const tflite::ModelT & hybrid) {
+    using namespace tflite;
+    std::map<std::string, const TensorT *> weights;
+    for (const auto & t : hybrid.subgraphs[0]->tensors) {
+        if (t->type == TensorType_INT8 && t->quantization != nullptr && quant_is_const(hybrid, *t)) {
+            weights[t->name] = t.get();
+        }
+    }
+    int n_restored = 0;
+    SubGraphT & sg = *model.subgraphs[0];
+    for (const auto & op : sg.operators) {
+        const BuiltinOperator code = GetBuiltinCode(model.operator_codes[op->opcode_index].get());
+        if ((code != BuiltinOperator_FULLY_CONNECTED && code != BuiltinOperator_BATCH_MATMUL &&
+             code != BuiltinOperator_CONV_2D && code != BuiltinOperator_DEPTHWISE_CONV_2D) ||
+            op->inputs.size() < 2 || op->inputs[1] < 0) {
+            continue;
+        }
+        TensorT & t = *sg.tensors[op->inputs[1]];
+        const auto it = weights.find(t.name);
+        if (t.type != TensorType_FLOAT32 || !quant_is_const(model, t) || it == weights.end()) {
+            continue;
+        }
+        const QuantizationParametersT & q = *it->second->quantization;
+        t.type = TensorType_INT8;
+        t.quantization.reset(new QuantizationParametersT);
+        t.quantization->scale = q.scale;
+        t.quantization->zero_point = q.zero_point;
+        t.quantization->quantized_dimension = q.quantized_dimension;
+        model.buffers[t.buffer]->data = hybrid.buffers[it->second->buffer]->data;
+        n_restored++;
+    }
+    return n_restored;
+}
+
+//min/max of every float tensor of subgraph 0 over the samples
+static bool quant_calibrate(const std::vector<uint8_t> & bytes, const std::vector<quant_sample> & samples,
+                            const int n_threads, std::vector<float> & min, std::vector<float> & max) {
+    quant_run run;
+    if (!quant_build(bytes, false, n_threads, run)) {
+        return false;
+    }
+    tflite::Interpreter & interpreter = *run.interpreter;
+    min.assign(interpreter.tensors_size(), INFINITY);
+    max.assign(interpreter.tensors_size(), -INFINITY);
+    auto observe = [&](const int index) {
+        const TfLiteTensor * t = interpreter.tensor(index);
+        if (t == nullptr || t->type != kTfLiteFloat32 || t->data.f == nullptr) {
+            return;
+        }
+        const float * f = t->data.f;
+        const size_t n = t->bytes/sizeof(float);
+        for (size_t i = 0; i < n; i++) {
+            min[index] = std::min(min[index], f[i]);
+            max[index] = std::max(max[index], f[i]);
+        }
+    };
+    run.observer.on_node = [&](const int node) {
+        const TfLiteNode & n = interpreter.node_and_registration(node)->first;
+        for (int i = 0; i < n.outputs->size; i++) {
+            observe(n.outputs->data[i]);
+        }
+    };
+    for (const quant_sample & sample : samples) {
+        if (!quant_invoke(interpreter, sample)) {
+            return false;
+        }
+        for (const int input : interpreter.inputs()) {
+            observe(input);
+        }
+    }
+    return true;
+}
+
+static double quant_snr_db(const double signal, const double noise) {
+    return noise > 0.0 ? std::min(200.0, 10.0*std::log10(std::max(signal, 1e-30)/noise)) : 200.0;
+}
+
+static float quant_value(const TfLiteTensor * t, const size_t i) {
+    switch (t->type) {
+        case kTfLiteFloat32: return t->data.f[i];
+        case kTfLiteInt8:    return t->params.scale*(float) (t->data.int8[i] - t->params.zero_point);
+        case kTfLiteInt16:   return t->params.scale*(float) (t->data.i16[i] - t->params.zero_point);
+        default:             return 0.0f;
+    }
+}
+
+struct quant_layer {
+    std::string tensor;
+    std::string op;
+    double snr_db = 0.0;
+};
+
+//the float outputs of the projections of `ref`, then the quantized model on
+//the same sample: SNR of every projection output that was quantized
+static bool quant_layers(quant_run & ref, quant_run & quant, const quant_sample & sample,
+                         std::vector<quant_layer> & layers) {
+    std::map<std::string, std::vector<float>> outputs;
+    std::map<std::string, std::string> ops;
+    auto is_layer = [](const int code) {
+        return code == tflite::BuiltinOperator_FULLY_CONNECTED || code == tflite::BuiltinOperator_CONV_2D ||
+               code == tflite::BuiltinOperator_DEPTHWISE_CONV_2D || code == tflite::BuiltinOperator_BATCH_MATMUL;
+    };
+    ref.observer.on_node = [&](const int node) {
+        const auto * nr = ref.interpreter->node_and_registration(node);
+        if (!is_layer(nr->second.builtin_code)) {
+            return;
+        }
+        const TfLiteTensor * t = ref.interpreter->tensor(nr->first.outputs->data[0]);
+        outputs[t->name].assign(t->data.f, t->data.f + t->bytes/sizeof(float));
+        ops[t->name] = tflite::EnumNameBuiltinOperator((tflite::BuiltinOperator) nr->second.builtin_code);
+    };
+    const bool ok = quant_invoke(*ref.interpreter, sample);
+    ref.observer.on_node = nullptr;
+    if (!ok) {
+        return false;
+    }
+    quant.observer.on_node = [&](const int node) {
+        const auto * nr = quant.interpreter->node_and_registration(node);
+        const TfLiteTensor * t = quant.interpreter->tensor(nr->first.outputs->data[0]);
+        auto it = t->name != nullptr ? outputs.find(t->name) : outputs.end();
+        if (it == outputs.end() || t->type == kTfLiteFloat32 || tflite::NumElements(t) != (int64_t) it->second.size()) {
+            return;
+        }
+        double signal = 0.0;
+        double noise = 0.0;
+        for (size_t i = 0; i < it->second.size(); i++) {
+            const double d = it->second[i] - quant_value(t, i);
+            signal += (double) it->second[i]*it->second[i];
+            noise += d*d;
+        }
+        layers.push_back({it->first, ops[it->first], quant_snr_db(signal, noise)});
+        outputs.erase(it);
+    };
+    const bool quant_ok = quant_invoke(*quant.interpreter, sample);
+    quant.observer.on_node = nullptr;
+    std::sort(layers.begin(), layers.end(), [](const quant_layer & a, const quant_layer & b) {
+        return a.snr_db < b.snr_db;
+    });
+    return quant_ok;
+}
+
+static double quant_median_ms(tflite::Interpreter & interpreter, const quant_sample & sample) {
+    std::vector<double> ms;
+    for (int it = 0; it < 4; it++) {
+        const auto t0 = std::chrono::steady_clock::now();
+        if (!quant_invoke(interpreter, sample)) {
+            return -1.0;
+        }
+        //the first run warms up
+        if (it > 0) {
+            ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        }
+    }
+    std::sort(ms.begin(), ms.end());
+    return ms[ms.size()/2];
+}
+
+//quantizes model_dir/name into out_path and prints its report
+static bool quant_model(const std::string & name, const std::string & in_path, const std::string & out_path,
+                        const std::vector<quant_sample> & samples, const quant_options & options, const bool last) {
+    using namespace tflite;
+    std::vector<uint8_t> hybrid_bytes;
+    std::unique_ptr<ModelT> model = whisper_model_load(in_path.c_str());
+    if (model == nullptr || !whisper_model_read(in_path.c_str(), hybrid_bytes)) {
+        fprintf(stderr, "failed to read model '%s'\n", in_path.c_str());
+        return false;
+    }
+    quant_float_weights(*model);
+    quant_unshare_constants(*model);
+    std::vector<uint8_t> float_bytes;
+    whisper_model_pack(*model, float_bytes);
+
+    std::vector<float> min;
+    std::vector<float> max;
+    if (!quant_calibrate(float_bytes, samples, options.n_threads, min, max)) {
+        fprintf(stderr, "%s: calibration failed\n", name.c_str());
+        return false;
+    }
+    SubGraphT & sg = *model->subgraphs[0];
+    for (size_t i = 0; i < sg.tensors.size() && i < min.size(); i++) {
+        TensorT & t = *sg.tensors[i];
+        if (quant_is_const(*model, t)) {
+            continue;
+        }
+        //the optimizer asks for a range on every input of the operators it
+        //leaves float, the integer ones too (int64 positions into LESS under
+        //16x8); nothing reads it there
+        if (t.type != TensorType_FLOAT32) {
+            if (t.quantization == nullptr) {
+                t.quantization.reset(new QuantizationParametersT);
+            }
+            t.quantization->min = {0.0f};
+            t.quantization->max = {0.0f};
+            continue;
+        }
+        if (!(min[i] <= max[i])) {
+            continue;
+        }
+        //the optimizer wants a range even on the unbounded ones the operators below keep float
+        if (t.quantization == nullptr) {
+            t.quantization.reset(new QuantizationParametersT);
+        }
+        t.quantization->min = {std::max(min[i], -FLT_MAX)};
+        t.quantization->max = {std::min(max[i], FLT_MAX)};
+    }
+
+    //every operator by the name of its first output, minus the ones kept float:
+    //the graph outputs, the --float patterns and the ones with unbounded tensors
+    std::unordered_set<std::string> names;
+    std::vector<std::string> kept;
+    for (const auto & op : sg.operators) {
+        if (op->outputs.empty()) {
+            continue;
+        }
+        const std::string & out = sg.tensors[op->outputs[0]]->name;
+        bool keep = !options.quantize_outputs &&
+                    std::find(sg.outputs.begin(), sg.outputs.end(), op->outputs[0]) != sg.outputs.end();
+        keep = keep || (options.int16 && !quant_runs_16x8(*model, sg, *op));
+        for (const std::string & pattern : options.float_patterns) {
+            keep = keep || out.find(pattern) != std::string::npos;
+        }
+        for (const std::vector<int> * io : {&op->inputs, &op->outputs}) {
+            for (const int index : *io) {
+                keep = keep || (index >= 0 && !quant_bounded(*model, *sg.tensors[index], index, min, max));
+            }
+        }
+        if (keep) {
+            kept.push_back(out);
+        } else {
+            names.insert(out);
+        }
+    }
+    flatbuffers::FlatBufferBuilder fbb;
+    const TensorType activations = options.int16 ? TensorType_INT16 : TensorType_INT8;
+    const TensorType bias = options.int16 ? TensorType_INT64 : TensorType_INT32;
+    if (optimize::QuantizeModel(&fbb, model.get(), TensorType_FLOAT32, TensorType_FLOAT32, true, names,
+                                activations, bias, DefaultErrorReporter()) != kTfLiteOk) {
+        fprintf(stderr, "%s: quantization failed\n", name.c_str());
+        return false;
+    }
+    std::unique_ptr<ModelT> quant_model(GetModel(fbb.GetBufferPointer())->UnPack());
+    const int n_hybrid = quant_restore_hybrid(*quant_model, *whisper_model_load(in_path.c_str()));
+    std::vector<uint8_t> quant_bytes;
+    whisper_model_pack(*quant_model, quant_bytes);
+    FILE * f = fopen(out_path.c_str(), "wb");
+    if (f == nullptr || fwrite(quant_bytes.data(), 1, quant_bytes.size(), f) != quant_bytes.size() || fclose(f) != 0) {
+        fprintf(stderr, "failed to write '%s'\n", out_path.c_str());
+        return false;
+    }
+
+    //report: per layer SNR against the float graph, output SNR and latency against the hybrid one
+    quant_run ref;
+    quant_run quant;
+    std::vector<quant_layer> layers;
+    if (!quant_build(float_bytes, false, options.n_threads, ref) || !quant_build(quant_bytes, false, options.n_threads, quant) ||
+        !quant_layers(ref, quant, samples[0], layers)) {
+        fprintf(stderr, "%s: the quantized model does not run\n", name.c_str());
+        return false;
+    }
+    int n_quantized = 0;
+    for (const int index : quant.interpreter->execution_plan()) {
+        const TfLiteNode & node = quant.interpreter->node_and_registration(index)->first;
+        const TfLiteType type = node.outputs->size > 0 ? quant.interpreter->tensor(node.outputs->data[0])->type : kTfLiteNoType;
+        const int code = quant.interpreter->node_and_registration(index)->second.builtin_code;
+        n_quantized += (type == kTfLiteInt8 || type == kTfLiteInt16) && code != BuiltinOperator_QUANTIZE;
+    }
+    quant_run hybrid;
+    quant_run fast;
+    if (!quant_build(hybrid_bytes, true, options.n_threads, hybrid) || !quant_build(quant_bytes, true, options.n_threads, fast)) {
+        return false;
+    }
+    const double hybrid_ms = quant_median_ms(*hybrid.interpreter, samples[0]);
+    const double quant_ms = quant_median_ms(*fast.interpreter, samples[0]);
+
+    //outputs of every sample against the float model, and the argmax of the
+    //logits rows against the hybrid model
+    double signal = 0.0;
+    double noise = 0.0;
+    int64_t rows = 0;
+    int64_t agree = 0;
+    for (const quant_sample & sample : samples) {
+        if (!quant_invoke(*ref.interpreter, sample) || !quant_invoke(*fast.interpreter, sample) ||
+            !quant_invoke(*hybrid.interpreter, sample)) {
+            return false;
+        }
+        const TfLiteTensor * x = ref.interpreter->output_tensor(0);
+        const TfLiteTensor * y = fast.interpreter->output_tensor(0);
+        const TfLiteTensor * h = hybrid.interpreter->output_tensor(0);
+        const size_t n = x->bytes/sizeof(float);
+        for (size_t i = 0; i < n; i++) {
+            const double d = x->data.f[i] - quant_value(y, i);
+            signal += (double) x->data.f[i]*x->data.f[i];
+            noise += d*d;
+        }
+        if (name == "decoder") {
+            const int n_vocab = x->dims->data[x->dims->size - 1];
+            for (size_t r = 0; r < n/n_vocab; r++) {
+                const float * a = y->data.f + r*n_vocab;
+                const float * b = h->data.f + r*n_vocab;
+                agree += std::max_element(a, a + n_vocab) - a == std::max_element(b, b + n_vocab) - b;
+                rows++;
+            }
+        }
+    }
+
+    printf("  {\"model\": \"%s\", \"file\": \"%s\", \"activations\": \"%s\", \"samples\": %zu,\n"
+           "   \"nodes\": [%zu, %zu], \"quantized_nodes\": %d, \"hybrid_nodes\": %d, \"kept_float\": [",
+           name.c_str(), out_path.c_str(), options.int16 ? "int16" : "int8", samples.size(),
+           hybrid.interpreter->nodes_size(), quant.interpreter->nodes_size(), n_quantized, n_hybrid);
+    for (size_t i = 0; i < kept.size(); i++) {
+        printf("%s\"%s\"", i > 0 ? ", " : "", kept[i].c_str());
+    }
+    printf("],\n   \"bytes\": [%zu, %zu], \"median_ms\": [%.3f, %.3f], \"output_snr_db\": %.2f,",
+           hybrid_bytes.size(), quant_bytes.size(), hybrid_ms, quant_ms, quant_snr_db(signal, noise));
+    if (rows > 0) {
+        printf(" \"argmax_agreement\": [%lld, %lld],", (long long) agree, (long long) rows);
+    }
+    printf("\n   \"layers\": [\n");
+    const size_t n_layers = std::min<size_t>(layers.size(), options.n_layers);
+    for (size_t i = 0; i < n_layers; i++) {
+        printf("    {\"tensor\": \"%s\", \"op\": \"%s\", \"snr_db\": %.2f}%s\n", layers[i].tensor.c_str(),
+               layers[i].op.c_str(), layers[i].snr_db, i + 1 < n_layers ? "," : "");
+    }
+    printf("   ]}%s\n", last ? "" : ",");
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s model_dir [--out DIR] [--16x8] [--float PATTERN] [--quantize-outputs] [--chunks N]"
+                        " [--layers N] [--frontend F] [--threads N] audio ...\n", argv[0]);
+        return 1;
+    }
+    quant_options options;
+    std::string out_dir = argv[1];
+    int n_chunks = 4;
+    std::vector<std::string> inputs;
+    for (int i = 2; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--out" && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (arg == "--16x8") {
+            options.int16 = true;
+        } else if (arg == "--float" && i + 1 < argc) {
+            options.float_patterns.push_back(argv[++i]);
+        } else if (arg == "--quantize-outputs") {
+            options.quantize_outputs = true;
+        } else if (arg == "--chunks" && i + 1 < argc) {
+            n_chunks = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--layers" && i + 1 < argc) {
+            options.n_layers = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--frontend" && i + 1 < argc) {
+            whisper_frontend_type type;
+            if (!whisper_frontend_from_name(argv[++i], &type) || !whisper_frontend_available(type)) {
+                fprintf(stderr, "frontend '%s' is not available\n", argv[i]);
+                return 1;
+            }
+            g_whisper_frontend = type;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            g_whisper_n_threads = std::max(1, atoi(argv[++i]));
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "no calibration audio given\n");
+        return 1;
+    }
+    options.n_threads = whisper_n_threads();
+
+    AAssetManager mgr = {argv[1]};
+    if (!whisper_load(&mgr)) {
+        fprintf(stderr, "failed to load the models from '%s'\n", argv[1]);
+        return 1;
+    }
+    whisper_tflite & enc = g_whisper_tflite_params;
+    whisper_tflite & dec = g_whisper_tflite_decoder_params;
+    if (dec.decode_loop || dec.decode_step) {
+        fprintf(stderr, "the decoder must be the converted one, not a whisper-build-decoder model\n");
+        return 1;
+    }
+
+    //calibration inputs: the encoder input of every chunk, and the encoder
+    //output with the tokens the hybrid models decoded from it
+    std::vector<quant_sample> encoder_samples;
+    std::vector<quant_sample> decoder_samples;
+    for (const std::string & input : inputs) {
+        for (int chunk = 0; chunk < n_chunks; chunk++) {
+            std::vector<float> pcmf32;
+            std::vector<int16_t> pcm16mono;
+            if (whisper_read_audio(input.c_str(), (float) chunk*WHISPER_CHUNK_SIZE, pcmf32, pcm16mono) <= 0) {
+                break;
+            }
+            if (!whisper_encode(pcmf32, pcm16mono)) {
+                fprintf(stderr, "failed to encode '%s'\n", input.c_str());
+                return 1;
+            }
+            encoder_samples.push_back({quant_capture(enc.interpreter->input_tensor(0))});
+            std::vector<whisper_vocab::id> tokens = {g_vocab.token_sot};
+            if (g_vocab.is_multilingual()) {
+                tokens.push_back(g_vocab.token_sot + 1);
+                tokens.push_back(g_vocab.token_transcribe);
+            }
+            tokens.push_back(g_vocab.token_not);
+            if (!whisper_decode_greedy(tokens, WHISPER_MAX_DECODE_TOKENS)) {
+                fprintf(stderr, "failed to decode '%s'\n", input.c_str());
+                return 1;
+            }
+            //hidden_states [1, 1500, n_state] float and tokens [1, n] int64 in the input order
+            quant_input hidden = quant_capture(enc.interpreter->output_tensor(0));
+            quant_input ids;
+            ids.dims = {1, (int) tokens.size() - 1};
+            ids.data.resize((tokens.size() - 1)*sizeof(int64_t));
+            for (size_t i = 0; i + 1 < tokens.size(); i++) {
+                ((int64_t *) ids.data.data())[i] = tokens[i];
+            }
+            const bool hidden_first = dec.interpreter->input_tensor(0)->type == kTfLiteFloat32;
+            decoder_samples.push_back(hidden_first ? quant_sample{hidden, ids} : quant_sample{ids, hidden});
+        }
+    }
+    if (encoder_samples.empty()) {
+        fprintf(stderr, "no calibration audio could be read\n");
+        return 1;
+    }
+
+    const std::string suffix = options.int16 ? "-16x8.tflite" : "-int8.tflite";
+    const std::string model_dir = argv[1];
+    printf("[\n");
+    if (!quant_model("encoder", model_dir + "/" + g_whisper_encoder_asset, out_dir + "/whisper-encoder" + suffix,
+                     encoder_samples, options, false) ||
+        !quant_model("decoder", model_dir + "/" + g_whisper_decoder_asset, out_dir + "/whisper-decoder-language" + suffix,
+                     decoder_samples, options, true)) {
+        return 1;
+    }
+    printf("]\n");
+    return 0;
+}
@@ -0,0 +1,514 @@
+//Prunes the large hybrid int8 projections of a Whisper model to 1x16 block
+//sparsity and stores them in the TFLite sparse tensor format, so
+//FULLY_CONNECTED runs them on its sparse hybrid kernel and skips the zeroed
+//blocks. In every row the blocks with the smallest L1 norm are zeroed, the
+//same number per row so the rows of a batch-1 product split evenly across
+//threads. The weights are scaled by the RMS of the input column they multiply,
+//measured by decoding a few tokens of a synthetic encoder output, so a small
+//weight on a large activation survives: magnitude alone wrecks the logits
+//already at 10%.
+//
+//Run it on the output of whisper-build-decoder, whose projections are
+//FULLY_CONNECTED; the converted decoder multiplies with BATCH_MATMUL, which
+//has no sparse kernel. whisper-fuse-ops then moves the pruned layers, with the
+//dense ones, to WhisperFullyConnected, which splits the batch-1 rows the
+//builtin runs on one thread over the interpreter threads.
+//
+//  whisper-sparsify in.tflite out.tflite [options]
+//    --sparsity R   fraction of the 16 wide blocks of every row set to zero (default: 0.5)
+//    --ops LIST     comma separated substrings of the FULLY_CONNECTED output names to
+//                   prune (default: mlp/,logits, the MLP and vocabulary projections)
+//    --check N      step a --step model and the pruned one over the same N tokens from a
+//                   synthetic encoder output, the pruned model fed the tokens the original
+//                   one picked, and report their step latency and logits agreement
+//    --calibrate N  tokens decoded to measure the input activations, 0 prunes by weight
+//                   magnitude alone (default: 64, needs a --step model)
+//    --threads N    interpreter threads of --check and --calibrate (default: hardware concurrency)
+//
+//Only int8 weights with one scale (the sparse hybrid kernel has no per
+//channel scales) and at most 256 column blocks (its ledger holds the block
+//indices as bytes) are pruned. Prints a JSON report: the pruned matrices with
+//the fraction of their squared magnitude kept, and the weight bytes before
+//and after. The logits matrix shares its buffer with the token embedding,
+//which GATHER reads dense, so pruning it adds its packed copy to the file.
+//The speed against WER curve comes from whisper-eval --decoder over the
+//outputs of a few --sparsity values.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "whisper.h"
+#include "whisper_attention.h"
+#include "whisper_flex_ops.h"
+#include "whisper_kv_cache.h"
+#include "whisper_logits.h"
+#include "whisper_norm.h"
+#include "whisper_tool_common.h"
+#include "whisper_model_edit.h"
+
+//columns per block of the sparse hybrid FULLY_CONNECTED kernel
+#define SPARSIFY_BLOCK 16
+
+struct sparsify_matrix {
+    std::string name;
+    int rows = 0;
+    int cols = 0;
+    bool calibrated = false;
+    double kept_energy = 1.0;
+};
+
+struct sparsify_report {
+    std::vector<sparsify_matrix> matrices;
+    std::vector<std::string> skipped;
+    size_t bytes_dense = 0;
+    size_t bytes_sparse = 0;
+};
+
+static bool sparsify_matches(const std::string & name, const std::vector<std::string> & patterns) {
+    for (const std::string & p : patterns) {
+        if (name.find(p) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//why the weight cannot take the sparse hybrid kernel, empty when it can
+static std::string sparsify_unsupported(const tflite::ModelT & model, const tflite::SubGraphT & sg,
+                                        const tflite::OperatorT & op) {
+    if (op.inputs.size() < 2 || op.inputs[0] < 0 || op.inputs[1] < 0) {
+        return "no weights";
+    }
+    const tflite::TensorT & x = *sg.tensors[op.inputs[0]];
+    const tflite::TensorT & w = *sg.tensors[op.inputs[1]];
+    if (x.type != tflite::TensorType_FLOAT32 || w.type != tflite::TensorType_INT8) {
+        return "not a hybrid int8 product";
+    }
+    if (w.buffer == 0 || w.buffer >= model.buffers.size() || model.buffers[w.buffer]->data.empty()) {
+        return "weights are not constant";
+    }
+    if (w.sparsity != nullptr) {
+        return "already sparse";
+    }
+    if (w.shape.size() != 2 || w.shape[1] % SPARSIFY_BLOCK != 0 || w.shape[1]/SPARSIFY_BLOCK > 256) {
+        return "columns not a multiple of 16 or above 4096";
+    }
+    if (w.quantization == nullptr || w.quantization->scale.size() != 1 ||
+        (!w.quantization->zero_point.empty() && w.quantization->zero_point[0] != 0)) {
+        return "not one symmetric scale";
+    }
+    return "";
+}
+
+//decoder step run: `on_node` sees every FULLY_CONNECTED node after it ran
+struct sparsify_observer : public tflite::Profiler {
+    std::function<void(int subgraph, int node)> on_node;
+
+    uint32_t BeginEvent(const char *, EventType event_type, int64_t node, int64_t subgraph) override {
+        return event_type == EventType::OPERATOR_INVOKE_EVENT ? (uint32_t) ((subgraph << 20) | node) + 1 : 0;
+    }
+
+    void EndEvent(uint32_t handle) override {
+        if (handle > 0 && on_node) {
+            on_node((int) ((handle - 1) >> 20), (int) ((handle - 1) & 0xfffff));
+        }
+    }
+};
+
+//the observer outlives the interpreter, see quant_run of whisper-quantize
+struct sparsify_run {
+    std::unique_ptr<tflite::FlatBufferModel> model;
+    tflite::ops::builtin::BuiltinOpResolver resolver;
+    sparsify_observer observer;
+    std::unique_ptr<tflite::Interpreter> interpreter;
+    tflite::SignatureRunner * init = nullptr;
+    tflite::SignatureRunner * step = nullptr;
+    std::vector<double> ms;
+};
+
+static bool sparsify_build(const tflite::ModelT & model, const int n_threads, std::vector<uint8_t> & bytes,
+                           sparsify_run & run) {
+    whisper_model_pack(model, bytes);
+    run.model = tflite::FlatBufferModel::BuildFromBuffer((const char *) bytes.data(), bytes.size());
+    whisper_attention_register_ops(run.resolver);
+    whisper_norm_register_ops(run.resolver);
+    whisper_flex_register_ops(run.resolver);
+    whisper_kv_register_ops(run.resolver);
+    whisper_logits_register_ops(run.resolver);
+    if (run.model == nullptr || tflite::InterpreterBuilder(*run.model, run.resolver)(&run.interpreter) != kTfLiteOk) {
+        return false;
+    }
+    run.interpreter->SetNumThreads(n_threads);
+    run.interpreter->SetProfiler(&run.observer);
+    run.init = run.interpreter->GetSignatureRunner(WHISPER_DECODER_INIT_SIGNATURE);
+    run.step = run.interpreter->GetSignatureRunner(WHISPER_DECODER_STEP_SIGNATURE);
+    return run.init != nullptr && run.step != nullptr && run.init->AllocateTensors() == kTfLiteOk &&
+           run.step->AllocateTensors() == kTfLiteOk;
+}
+
+//"init" from a pseudo random encoder output, layer normalized like the real one
+static bool sparsify_init(sparsify_run & run) {
+    const TfLiteTensor * hidden = run.init->input_tensor("hidden_states");
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    for (size_t i = 0; i < hidden->bytes/sizeof(float); i++) {
+        hidden->data.f[i] = normal(rng);
+    }
+    return run.init->Invoke() == kTfLiteOk;
+}
+
+//<|startoftranscript|><|en|><|transcribe|><|notimestamps|> and forced text
+//tokens, as in whisper-build-decoder --check
+static std::vector<int32_t> sparsify_prompt(sparsify_run & run) {
+    whisper_vocab vocab;
+    vocab.n_vocab = run.step->output_tensor("logits")->dims->data[1];
+    const int token_eot = vocab.token_eot + (vocab.is_multilingual() ? 1 : 0);
+    std::vector<int32_t> tokens = {token_eot + 1, token_eot + 2, token_eot + 102, token_eot + 106};
+    for (int i = 0; i < 28; i++) {
+        tokens.push_back(1000 + 37*i);
+    }
+    return tokens;
+}
+
+//logits [1, n_vocab] of `token` at `position` on beam 0
+static const TfLiteTensor * sparsify_step(sparsify_run & run, const int token, const int position) {
+    run.step->input_tensor("beam")->data.i32[0] = 0;
+    run.step->input_tensor("token")->data.i32[0] = token;
+    run.step->input_tensor("position")->data.i32[0] = position;
+    const auto t0 = std::chrono::steady_clock::now();
+    if (run.step->Invoke() != kTfLiteOk) {
+        return nullptr;
+    }
+    run.ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    return run.step->output_tensor("logits");
+}
+
+static int sparsify_argmax(const TfLiteTensor * logits) {
+    const int n_vocab = logits->dims->data[1];
+    return std::max_element(logits->data.f, logits->data.f + n_vocab) - logits->data.f;
+}
+
+//RMS of every input column of the FULLY_CONNECTED ops, by output name, over
+//the prompt and `n_tokens` greedy tokens of a --step model; false for others
+static bool sparsify_calibrate(const tflite::ModelT & model, const int n_tokens, const int n_threads,
+                               std::map<std::string, std::vector<double>> & column_rms) {
+    std::vector<uint8_t> bytes;
+    sparsify_run run;
+    if (!sparsify_build(model, n_threads, bytes, run) || !sparsify_init(run)) {
+        return false;
+    }
+    std::map<std::string, int> n_rows;
+    run.observer.on_node = [&](const int subgraph, const int node) {
+        const auto * nr = run.interpreter->subgraph(subgraph)->node_and_registration(node);
+        if (nr == nullptr || nr->second.builtin_code != tflite::BuiltinOperator_FULLY_CONNECTED) {
+            return;
+        }
+        const TfLiteTensor * x = run.interpreter->subgraph(subgraph)->tensor(nr->first.inputs->data[0]);
+        const TfLiteTensor * y = run.interpreter->subgraph(subgraph)->tensor(nr->first.outputs->data[0]);
+        if (x->type != kTfLiteFloat32 || x->dims->size == 0 || y->name == nullptr) {
+            return;
+        }
+        const int cols = x->dims->data[x->dims->size - 1];
+        const int rows = (int) (tflite::NumElements(x)/cols);
+        std::vector<double> & sum = column_rms[y->name];
+        sum.resize(cols, 0.0);
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++) {
+                sum[c] += (double) x->data.f[r*cols + c]*x->data.f[r*cols + c];
+            }
+        }
+        n_rows[y->name] += rows;
+    };
+    std::vector<int32_t> tokens = sparsify_prompt(run);
+    const size_t n_prompt = tokens.size();
+    for (size_t i = 0; i + 1 < n_prompt + n_tokens; i++) {
+        const TfLiteTensor * logits = sparsify_step(run, tokens[i], i);
+        if (logits == nullptr) {
+            return false;
+        }
+        if (i + 1 >= n_prompt) {
+            tokens.push_back(sparsify_argmax(logits));
+        }
+    }
+    run.observer.on_node = nullptr;
+    for (auto & it : column_rms) {
+        for (double & v : it.second) {
+            v = std::sqrt(v/std::max(1, n_rows[it.first]));
+        }
+    }
+    return true;
+}
+
+//zeroes the `n_zero` least important blocks of every row and packs the kept
+//ones: dense rows, CSR over the column blocks, dense 16 columns per block. A
+//block weighs the sum of |w| times the RMS of its input column, so the outlier
+//channels of the residual stream keep their weights
+static void sparsify_pack(const std::vector<uint8_t> & dense, const int rows, const int cols, const int n_zero,
+                          const std::vector<double> & column_rms, std::vector<uint8_t> & values,
+                          tflite::SparsityParametersT & sparsity, double & kept_energy) {
+    using namespace tflite;
+    const int n_blocks = cols/SPARSIFY_BLOCK;
+    const int8_t * w = (const int8_t *) dense.data();
+    std::vector<int32_t> segments(1, 0);
+    std::vector<int32_t> indices;
+    std::vector<double> weight(n_blocks);
+    std::vector<double> energy(n_blocks);
+    std::vector<int> order(n_blocks);
+    std::vector<bool> keep(n_blocks);
+    double total = 0.0;
+    double kept = 0.0;
+    values.clear();
+    for (int r = 0; r < rows; r++) {
+        const int8_t * row = w + (size_t) r*cols;
+        for (int b = 0; b < n_blocks; b++) {
+            weight[b] = 0.0;
+            energy[b] = 0.0;
+            for (int c = b*SPARSIFY_BLOCK; c < (b + 1)*SPARSIFY_BLOCK; c++) {
+                const double x = column_rms.empty() ? 1.0 : column_rms[c];
+                weight[b] += std::abs(row[c])*x;
+                energy[b] += (double) row[c]*row[c]*x*x;
+            }
+            total += energy[b];
+        }
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) { return weight[a] < weight[b]; });
+        std::fill(keep.begin(), keep.end(), true);
+        for (int i = 0; i < n_zero; i++) {
+            keep[order[i]] = false;
+        }
+        for (int b = 0; b < n_blocks; b++) {
+            //blocks of zeros cost a multiply each and are dropped as well
+            if (!keep[b] || weight[b] == 0.0) {
+                continue;
+            }
+            kept += energy[b];
+            indices.push_back(b);
+            values.insert(values.end(), (const uint8_t *) row + b*SPARSIFY_BLOCK,
+                          (const uint8_t *) row + (b + 1)*SPARSIFY_BLOCK);
+        }
+        segments.push_back((int32_t) indices.size());
+    }
+    kept_energy = total > 0.0 ? kept/total : 1.0;
+
+    sparsity.traversal_order = {0, 1, 2};
+    sparsity.block_map = {1};
+    sparsity.dim_metadata.clear();
+    std::unique_ptr<DimensionMetadataT> d_rows(new DimensionMetadataT);
+    d_rows->format = DimensionType_DENSE;
+    d_rows->dense_size = rows;
+    std::unique_ptr<DimensionMetadataT> d_blocks(new DimensionMetadataT);
+    d_blocks->format = DimensionType_SPARSE_CSR;
+    d_blocks->array_segments.type = SparseIndexVector_Int32Vector;
+    d_blocks->array_segments.value = new Int32VectorT;
+    d_blocks->array_segments.AsInt32Vector()->values = segments;
+    d_blocks->array_indices.type = SparseIndexVector_Int32Vector;
+    d_blocks->array_indices.value = new Int32VectorT;
+    d_blocks->array_indices.AsInt32Vector()->values = indices;
+    std::unique_ptr<DimensionMetadataT> d_cols(new DimensionMetadataT);
+    d_cols->format = DimensionType_DENSE;
+    d_cols->dense_size = SPARSIFY_BLOCK;
+    sparsity.dim_metadata.push_back(std::move(d_rows));
+    sparsity.dim_metadata.push_back(std::move(d_blocks));
+    sparsity.dim_metadata.push_back(std::move(d_cols));
+}
+
+static sparsify_report sparsify_model(tflite::ModelT & model, const float ratio, const std::vector<std::string> & patterns,
+                                      const std::map<std::string, std::vector<double>> & column_rms) {
+    using namespace tflite;
+    sparsify_report report;
+    //weights shared by several subgraphs (the --step signatures) are packed once
+    std::map<uint32_t, std::pair<uint32_t, const SparsityParametersT *>> packed;
+    for (const auto & sg : model.subgraphs) {
+        for (const auto & op : sg->operators) {
+            if (GetBuiltinCode(model.operator_codes[op->opcode_index].get()) != BuiltinOperator_FULLY_CONNECTED ||
+                op->outputs.empty() || !sparsify_matches(sg->tensors[op->outputs[0]]->name, patterns)) {
+                continue;
+            }
+            const std::string & name = sg->tensors[op->outputs[0]]->name;
+            const std::string why = sparsify_unsupported(model, *sg, *op);
+            if (!why.empty()) {
+                report.skipped.push_back(name + ": " + why);
+                continue;
+            }
+            TensorT & w = *sg->tensors[op->inputs[1]];
+            const auto it = packed.find(w.buffer);
+            if (it != packed.end()) {
+                w.buffer = it->second.first;
+                w.sparsity.reset(new SparsityParametersT(*it->second.second));
+                continue;
+            }
+            sparsify_matrix m;
+            m.name = name;
+            m.rows = w.shape[0];
+            m.cols = w.shape[1];
+            const auto rms = column_rms.find(name);
+            m.calibrated = rms != column_rms.end() && (int) rms->second.size() == m.cols;
+            const int n_blocks = m.cols/SPARSIFY_BLOCK;
+            const int n_zero = std::min(n_blocks - 1, (int) (ratio*n_blocks + 0.5f));
+            std::unique_ptr<BufferT> buffer(new BufferT);
+            w.sparsity.reset(new SparsityParametersT);
+            sparsify_pack(model.buffers[w.buffer]->data, m.rows, m.cols, n_zero,
+                          m.calibrated ? rms->second : std::vector<double>(), buffer->data, *w.sparsity, m.kept_energy);
+            report.bytes_dense += model.buffers[w.buffer]->data.size();
+            report.bytes_sparse += buffer->data.size();
+            //the dense buffer may back other tensors, the token embedding GATHER
+            model.buffers.push_back(std::move(buffer));
+            packed[w.buffer] = {(uint32_t) model.buffers.size() - 1, w.sparsity.get()};
+            w.buffer = (uint32_t) model.buffers.size() - 1;
+            report.matrices.push_back(m);
+        }
+    }
+    //the dense weights nothing points at anymore
+    std::vector<bool> used(model.buffers.size(), false);
+    for (const auto & sg : model.subgraphs) {
+        for (const auto & t : sg->tensors) {
+            used[t->buffer] = true;
+        }
+    }
+    for (const auto & m : model.metadata) {
+        used[m->buffer] = true;
+    }
+    for (size_t i = 1; i < model.buffers.size(); i++) {
+        if (!used[i]) {
+            model.buffers[i]->data.clear();
+        }
+    }
+    return report;
+}
+
+//both step models over the tokens the original one decodes, prints their
+//step latency, the SNR of the pruned logits and how often both pick the same token
+static bool check_sparsified(const tflite::ModelT & original, const tflite::ModelT & pruned, const int n_tokens,
+                             const int n_threads) {
+    std::vector<uint8_t> original_bytes;
+    std::vector<uint8_t> pruned_bytes;
+    sparsify_run a;
+    sparsify_run b;
+    if (!sparsify_build(original, n_threads, original_bytes, a) || !sparsify_build(pruned, n_threads, pruned_bytes, b)) {
+        fprintf(stderr, "failed to build the interpreters, --check needs a whisper-build-decoder --step model\n");
+        return false;
+    }
+    if (!sparsify_init(a) || !sparsify_init(b)) {
+        fprintf(stderr, "decoder init failed\n");
+        return false;
+    }
+    std::vector<int32_t> tokens = sparsify_prompt(a);
+    const size_t n_prompt = tokens.size();
+    double signal = 0.0;
+    double noise = 0.0;
+    int agree = 0;
+    int n_steps = 0;
+    for (size_t i = 0; i + 1 < n_prompt + n_tokens; i++) {
+        const TfLiteTensor * x = sparsify_step(a, tokens[i], i);
+        const TfLiteTensor * y = sparsify_step(b, tokens[i], i);
+        if (x == nullptr || y == nullptr) {
+            fprintf(stderr, "decoder step failed\n");
+            return false;
+        }
+        for (int j = 0; j < x->dims->data[1]; j++) {
+            signal += (double) x->data.f[j]*x->data.f[j];
+            noise += (double) (x->data.f[j] - y->data.f[j])*(x->data.f[j] - y->data.f[j]);
+        }
+        const int best = sparsify_argmax(x);
+        agree += best == sparsify_argmax(y);
+        n_steps++;
+        if (i + 1 >= n_prompt) {
+            tokens.push_back(best);
+        }
+    }
+    printf("  \"check\": {\"threads\": %d, \"steps\": %d, \"step_ms\": [%.3f, %.3f], \"logits_snr_db\": %.2f, "
+           "\"top1_agreement\": %.4f},\n",
+           n_threads, n_steps, median(a.ms), median(b.ms), noise > 0.0 ? 10.0*std::log10(signal/noise) : INFINITY,
+           n_steps > 0 ? double(agree)/n_steps : 0.0);
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s in.tflite out.tflite [--sparsity R] [--ops LIST] [--calibrate N] [--check N] [--threads N]\n", argv[0]);
+        return 1;
+    }
+    float ratio = 0.5f;
+    int n_check = 0;
+    int n_calibrate = 64;
+    int n_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> patterns = {"mlp/", "logits"};
+    for (int i = 3; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--sparsity" && i + 1 < argc) {
+            ratio = std::min(1.0f, std::max(0.0f, (float) atof(argv[++i])));
+        } else if (arg == "--ops" && i + 1 < argc) {
+            patterns.clear();
+            const std::string list = argv[++i];
+            for (size_t start = 0; start <= list.size();) {
+                const size_t comma = std::min(list.find(',', start), list.size());
+                if (comma > start) {
+                    patterns.push_back(list.substr(start, comma - start));
+                }
+                start = comma + 1;
+            }
+        } else if (arg == "--check" && i + 1 < argc) {
+            //the prompt takes 32 of the 448 text positions
+            n_check = std::min(416, std::max(1, atoi(argv[++i])));
+        } else if (arg == "--calibrate" && i + 1 < argc) {
+            n_calibrate = std::min(416, std::max(0, atoi(argv[++i])));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            n_threads = std::max(1, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::unique_ptr<tflite::ModelT> model = whisper_model_load(argv[1]);
+    if (model == nullptr) {
+        fprintf(stderr, "failed to read model '%s'\n", argv[1]);
+        return 1;
+    }
+    std::unique_ptr<tflite::ModelT> original = n_check > 0 ? whisper_model_load(argv[1]) : nullptr;
+    std::map<std::string, std::vector<double>> column_rms;
+    if (n_calibrate > 0 && !sparsify_calibrate(*model, n_calibrate, n_threads, column_rms)) {
+        fprintf(stderr, "not a --step decoder, blocks are pruned by weight magnitude alone\n");
+        column_rms.clear();
+    }
+    const sparsify_report report = sparsify_model(*model, ratio, patterns, column_rms);
+    if (report.matrices.empty()) {
+        fprintf(stderr, "no FULLY_CONNECTED weights to prune, is '%s' a whisper-build-decoder model?\n", argv[1]);
+        return 1;
+    }
+    if (!whisper_model_save(*model, argv[2])) {
+        fprintf(stderr, "failed to write '%s'\n", argv[2]);
+        return 1;
+    }
+
+    printf("{\n  \"sparsity\": %.3f,\n  \"weight_bytes\": [%zu, %zu],\n  \"matrices\": [\n",
+           ratio, report.bytes_dense, report.bytes_sparse);
+    for (size_t i = 0; i < report.matrices.size(); i++) {
+        const sparsify_matrix & m = report.matrices[i];
+        printf("    {\"name\": \"%s\", \"shape\": [%d, %d], \"calibrated\": %s, \"kept_energy\": %.4f}%s\n",
+               m.name.c_str(), m.rows, m.cols, m.calibrated ? "true" : "false", m.kept_energy,
+               i + 1 == report.matrices.size() ? "" : ",");
+    }
+    printf("  ],\n");
+    if (n_check > 0 && !check_sparsified(*original, *model, n_check, n_threads)) {
+        return 1;
+    }
+    printf("  \"skipped\": [");
+    for (size_t i = 0; i < report.skipped.size(); i++) {
+        printf("%s\"%s\"", i == 0 ? "" : ", ", report.skipped[i].c_str());
+    }
+    printf("]\n}\n");
+    return 0;
+}
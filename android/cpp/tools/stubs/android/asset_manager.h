@@ -0,0 +1,59 @@
+//Linux stand-in for the NDK asset API used by the plugin sources.
+//An AAssetManager is a directory, assets are the files inside it.
+#pragma once
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+
+struct AAssetManager {
+    std::string root;
+};
+
+struct AAsset {
+    FILE * file;
+    long length;
+};
+
+enum {
+    AASSET_MODE_UNKNOWN   = 0,
+    AASSET_MODE_RANDOM    = 1,
+    AASSET_MODE_STREAMING = 2,
+    AASSET_MODE_BUFFER    = 3,
+};
+
+static inline AAsset * AAssetManager_open(AAssetManager * mgr, const char * filename, int mode) {
+    FILE * file = fopen((mgr->root + "/" + filename).c_str(), "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    fseek(file, 0, SEEK_END);
+    AAsset * asset = new AAsset{file, ftell(file)};
+    fseek(file, 0, SEEK_SET);
+    return asset;
+}
+
+static inline long AAsset_getLength(AAsset * asset) {
+    return asset->length;
+}
+
+static inline off64_t AAsset_getLength64(AAsset * asset) {
+    return asset->length;
+}
+
+//a file on disk is an asset stored uncompressed, starting at offset 0
+static inline int AAsset_openFileDescriptor64(AAsset * asset, off64_t * out_start, off64_t * out_length) {
+    *out_start = 0;
+    *out_length = asset->length;
+    return dup(fileno(asset->file));
+}
+
+static inline int AAsset_read(AAsset * asset, void * buf, size_t count) {
+    return (int) fread(buf, 1, count, asset->file);
+}
+
+static inline void AAsset_close(AAsset * asset) {
+    fclose(asset->file);
+    delete asset;
+}
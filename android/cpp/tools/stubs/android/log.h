@@ -0,0 +1,32 @@
+//Linux stand-in for the NDK logging API used by the plugin sources.
+//Messages go to stderr when g_android_log_enabled is set.
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+
+typedef enum android_LogPriority {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+} android_LogPriority;
+
+static bool g_android_log_enabled = false;
+
+static inline int __android_log_print(int prio, const char * tag, const char * fmt, ...) {
+    if (!g_android_log_enabled) {
+        return 0;
+    }
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%s: ", tag);
+    const int n = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return n;
+}
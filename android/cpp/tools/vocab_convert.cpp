@@ -0,0 +1,106 @@
+//Converts a filters_vocab_*.bin file to the v2 layout of whisper_vocab_file.h
+//(aligned blocks, token offset table, filter bands, checksum), so the plugin
+//takes filters and tokens from one mapping instead of parsing every token.
+//The plugin reads both versions; the output keeps the asset name it replaces.
+//
+//  whisper-vocab-convert in.bin out.bin [--repeat N]
+//    --repeat N  parses timed per version (default: 20)
+//
+//The output is parsed back and compared with the input before it is kept.
+//Prints the sizes and the parse times of both versions as JSON.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "whisper.h"
+#include "whisper_tool_common.h"
+
+static bool read_file(const char * path, std::string & data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+//median parse time of the file in ms
+static double parse_ms(const std::string & data, const int repeat) {
+    std::vector<double> ms;
+    for (int i = 0; i < repeat; i++) {
+        whisper_filters f;
+        whisper_vocab v;
+        std::string error;
+        const auto t_start = std::chrono::steady_clock::now();
+        whisper_vocab_file_parse(data.data(), data.size(), f, v, error);
+        ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count());
+    }
+    return median(ms);
+}
+
+static bool same_vocab(const whisper_filters & fa, const whisper_vocab & va,
+                       const whisper_filters & fb, const whisper_vocab & vb) {
+    return fa.n_mel == fb.n_mel && fa.n_fft == fb.n_fft && fa.data == fb.data &&
+           fa.begin == fb.begin && fa.end == fb.end && va.n_vocab == vb.n_vocab &&
+           va.token_offsets == vb.token_offsets && va.token_blob == vb.token_blob;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s in.bin out.bin [--repeat N]\n", argv[0]);
+        return 1;
+    }
+    int repeat = 20;
+    for (int i = 3; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::string in;
+    whisper_filters in_filters;
+    whisper_vocab in_vocab;
+    std::string error;
+    if (!read_file(argv[1], in)) {
+        fprintf(stderr, "failed to read '%s'\n", argv[1]);
+        return 1;
+    }
+    if (!whisper_vocab_file_parse(in.data(), in.size(), in_filters, in_vocab, error)) {
+        fprintf(stderr, "%s: %s\n", argv[1], error.c_str());
+        return 1;
+    }
+
+    const std::string out = whisper_vocab_file_write_v2(in_filters, in_vocab);
+    whisper_filters out_filters;
+    whisper_vocab out_vocab;
+    if (!whisper_vocab_file_parse(out.data(), out.size(), out_filters, out_vocab, error) ||
+        !same_vocab(in_filters, in_vocab, out_filters, out_vocab)) {
+        fprintf(stderr, "v2 output does not read back as the input\n");
+        return 1;
+    }
+    std::ofstream file(argv[2], std::ios::binary);
+    if (!file.write(out.data(), out.size())) {
+        fprintf(stderr, "failed to write '%s'\n", argv[2]);
+        return 1;
+    }
+
+    uint32_t magic = 0;
+    memcpy(&magic, in.data(), sizeof(magic));
+    printf("{\n  \"input\": {\"version\": %d, \"bytes\": %zu, \"parse_ms\": %.3f},\n"
+           "  \"output\": {\"version\": 2, \"bytes\": %zu, \"parse_ms\": %.3f},\n"
+           "  \"n_mel\": %d,\n  \"n_fft\": %d,\n  \"n_vocab\": %d\n}\n",
+           magic == WHISPER_VOCAB_MAGIC_V2 ? 2 : 1, in.size(), parse_ms(in, repeat),
+           out.size(), parse_ms(out, repeat), out_filters.n_mel, out_filters.n_fft, out_vocab.n_vocab);
+    return 0;
+}
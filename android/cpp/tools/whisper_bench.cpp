@@ -0,0 +1,331 @@
+//End-to-end benchmark of the plugin pipeline (whisper_pipeline.h) on Linux.
+//Runs audio decoding -> mel -> encoder -> greedy decoder over every 30 second
+//chunk of a corpus of WAV/MP3 files and prints per stage latency
+//percentiles, real-time factor, decoder tokens/sec, tensor arena sizes and
+//peak RSS as JSON.
+//
+//  whisper-bench model_dir [options] audio.wav|audio.mp3 ...
+//    model_dir       directory holding the plugin assets (encoder, decoder, filters/vocab)
+//    --threads N     interpreter and frontend threads (default: hardware concurrency)
+//    --iters N       timed passes over the corpus after one warm-up pass (default: 3)
+//    --frontend F    mel frontend, see whisper_frontend_name() (default: reference)
+//    --encoder NAME  encoder file in model_dir, e.g. the output of whisper-quantize
+//                    (default: the plugin encoder asset)
+//    --decoder NAME  decoder file in model_dir, e.g. the output of whisper-build-decoder
+//                    (default: the plugin decoder asset)
+//    --no-frozen-plan  run every decoder step through Subgraph::Invoke() (whisper_frozen_plan.h)
+//    --shortlist N   a --shortlist step decoder only scores the N first text tokens (the most
+//                    frequent BPE merges) and the special ones, see whisper_set_shortlist()
+//    --shared-arena  release the encoder and decoder tensor arenas after their stage, so
+//                    only the larger one is resident (g_whisper_shared_arena); pays off with
+//                    the loop decoder, the step decoder arena is small
+//    --no-arena-plan plan every tensor online, ignoring the offline plan of whisper-plan models
+//    --prepare       load through whisper_prepare(), which warms the models up over silence,
+//                    as the plugin prepare() call does before the first request
+//    --serial-load   build the encoder and decoder interpreters one after the other
+//                    (g_whisper_parallel_load)
+//    --no-mmap       read the models and the vocab into the heap instead of mapping them
+//                    (g_whisper_mmap_models), the plugin behavior before whisper_model_cache.h
+//    --timestamps M  "segments" or "words" (g_whisper_timestamps): the transcripts get their
+//                    timestamps, and the stages the DTW time of the word alignment
+//    --detect-language
+//                    run whisper_detect_language() on every chunk first and transcribe it
+//                    in the detected language, reusing the encoder output; the stages
+//                    get "detect" (encoder and one decoder step), the transcripts the
+//                    ranked languages of their first chunk
+//    --idle          release the arenas and scratch buffers before every timed pass as the
+//                    idle policy does (whisper_release_idle()), reports the RSS around the
+//                    release and the re-planning paid by the first chunk after it
+//    --profile       per operator encoder/decoder profile in the output (whisper_profiler.h),
+//                    the profiler adds its own overhead to the stage timings
+//    --verbose       print the plugin log to stderr
+//
+//When audio.txt (same name, .txt extension) exists next to an audio file its
+//content is taken as the reference transcript and the word error rate of
+//the warm-up pass is reported.
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "whisper.h"
+#include "whisper_frontend.h"
+#include "whisper_pipeline.h"
+#include "whisper_score.h"
+#include "whisper_tool_common.h"
+
+static bool read_text(const std::string & path, std::string & text) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    text = ss.str();
+    return true;
+}
+
+struct stage_stats {
+    std::vector<double> audio, mel, encoder, decoder, align, detect, total;
+};
+
+static void print_stage(const char * name, const std::vector<double> & ms, const bool last) {
+    printf("    \"%s\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f}%s\n",
+           name, percentile(ms, 50), percentile(ms, 90), percentile(ms, 99), last ? "" : ",");
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s model_dir [--threads N] [--iters N] [--frontend F] [--encoder NAME] [--decoder NAME] [--no-frozen-plan] [--shortlist N] [--shared-arena] [--no-arena-plan] [--no-mmap] [--prepare] [--serial-load] [--timestamps M] [--detect-language] [--idle] [--profile] [--verbose] audio ...\n", argv[0]);
+        return 1;
+    }
+    int n_iters = 3;
+    int n_shortlist = 0;
+    bool idle = false;
+    bool prepare = false;
+    bool detect = false;
+    std::vector<std::string> inputs;
+    for (int i = 2; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            g_whisper_n_threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--iters" && i + 1 < argc) {
+            n_iters = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--frontend" && i + 1 < argc) {
+            whisper_frontend_type type;
+            if (!whisper_frontend_from_name(argv[++i], &type) || !whisper_frontend_available(type)) {
+                fprintf(stderr, "frontend '%s' is not available\n", argv[i]);
+                return 1;
+            }
+            g_whisper_frontend = type;
+        } else if (arg == "--encoder" && i + 1 < argc) {
+            g_whisper_encoder_asset = argv[++i];
+        } else if (arg == "--decoder" && i + 1 < argc) {
+            g_whisper_decoder_asset = argv[++i];
+        } else if (arg == "--no-frozen-plan") {
+            g_whisper_frozen_plan = false;
+        } else if (arg == "--shortlist" && i + 1 < argc) {
+            n_shortlist = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--shared-arena") {
+            whisper_shared_arena_enable(true);
+        } else if (arg == "--no-arena-plan") {
+            g_whisper_use_arena_plan = false;
+        } else if (arg == "--prepare") {
+            prepare = true;
+        } else if (arg == "--serial-load") {
+            g_whisper_parallel_load = false;
+        } else if (arg == "--no-mmap") {
+            g_whisper_mmap_models = false;
+        } else if (arg == "--timestamps" && i + 1 < argc) {
+            if (!whisper_timestamps_from_name(argv[++i], &g_whisper_timestamps)) {
+                fprintf(stderr, "unknown timestamps mode '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--detect-language") {
+            detect = true;
+        } else if (arg == "--idle") {
+            idle = true;
+        } else if (arg == "--profile") {
+            whisper_profiling_enable(true);
+        } else if (arg == "--verbose") {
+            g_android_log_enabled = true;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "no audio files given\n");
+        return 1;
+    }
+
+    AAssetManager mgr = {argv[1]};
+    if (!(prepare ? whisper_prepare(&mgr) : whisper_load(&mgr))) {
+        fprintf(stderr, "failed to load the models from '%s'\n", argv[1]);
+        return 1;
+    }
+    const double load_ms = g_whisper_timings.load_us/1000.0;
+    const double warmup_ms = g_whisper_timings.warmup_us/1000.0;
+    //mapped model pages only count once they are touched
+    const int64_t load_rss = whisper_rss_bytes();
+    if (n_shortlist > 0) {
+        std::vector<whisper_vocab::id> ids(std::min(n_shortlist, g_vocab.token_eot));
+        for (size_t i = 0; i < ids.size(); i++) {
+            ids[i] = i;
+        }
+        whisper_set_shortlist(ids);
+    }
+
+    stage_stats stats;
+    double audio_seconds = 0.0;
+    double total_ms = 0.0;
+    double decode_ms = 0.0;
+    long n_tokens = 0;
+    int n_chunks = 0;
+    std::vector<std::string> transcripts(inputs.size());
+    std::vector<std::vector<whisper_segment>> segments(inputs.size());
+    std::vector<std::vector<whisper_language_prob>> languages(inputs.size());
+    double idle_rss_before = 0.0;
+    double idle_rss_after = 0.0;
+    double idle_replan_ms = 0.0;
+    double idle_first_ms = 0.0;
+    double first_chunk_ms = 0.0;
+
+    //pass 0 warms up and produces the transcripts, the others are timed
+    for (int it = 0; it <= n_iters; it++) {
+        //the profile covers the timed passes only
+        if (it == 1 && g_whisper_profiling) {
+            whisper_profiling_enable(true);
+        }
+        if (it > 0 && idle) {
+            whisper_release_idle(true);
+            idle_rss_before += g_whisper_idle.rss_before/1048576.0;
+            idle_rss_after += g_whisper_idle.rss_after/1048576.0;
+        }
+        for (size_t f = 0; f < inputs.size(); f++) {
+            for (int chunk = 0;; chunk++) {
+                std::string text;
+                const int64_t t_start = whisper_time_us();
+                std::vector<whisper_language_prob> ranked;
+                double detect_ms = 0.0;
+                if (detect) {
+                    if (!whisper_detect_language(inputs[f].c_str(), (float) chunk*WHISPER_CHUNK_SIZE, ranked)) {
+                        fprintf(stderr, "failed to detect the language of '%s'\n", inputs[f].c_str());
+                        return 1;
+                    }
+                    detect_ms = (whisper_time_us() - t_start)/1000.0;
+                    g_whisper_language = ranked[0].language;
+                }
+                if (!whisper_transcribe(inputs[f].c_str(), (float) chunk*WHISPER_CHUNK_SIZE, text)) {
+                    fprintf(stderr, "failed to transcribe '%s'\n", inputs[f].c_str());
+                    return 1;
+                }
+                const double ms = (whisper_time_us() - t_start)/1000.0;
+                const whisper_timings & t = g_whisper_timings;
+                if (t.n_samples <= 0) {
+                    break;
+                }
+                if (it == 0) {
+                    if (chunk == 0) {
+                        languages[f] = ranked;
+                    }
+                    transcripts[f] += text;
+                    segments[f].insert(segments[f].end(), g_whisper_segments.begin(), g_whisper_segments.end());
+                    if (f == 0 && chunk == 0) {
+                        first_chunk_ms = ms;
+                    }
+                } else {
+                    stats.audio.push_back(t.audio_us/1000.0);
+                    stats.mel.push_back(t.mel_us/1000.0);
+                    stats.encoder.push_back(t.encode_us/1000.0);
+                    stats.decoder.push_back(t.decode_us/1000.0);
+                    stats.align.push_back(t.align_us/1000.0);
+                    stats.detect.push_back(detect_ms);
+                    stats.total.push_back(ms);
+                    audio_seconds += double(t.n_samples)/WHISPER_SAMPLE_RATE;
+                    total_ms += ms;
+                    decode_ms += t.decode_us/1000.0;
+                    n_tokens += t.n_tokens;
+                    n_chunks++;
+                    if (idle && f == 0 && chunk == 0) {
+                        idle_replan_ms += g_whisper_idle.replan_us/1000.0;
+                        idle_first_ms += ms;
+                    }
+                }
+                if (t.n_samples < WHISPER_SAMPLE_RATE*WHISPER_CHUNK_SIZE) {
+                    break;
+                }
+            }
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\n  \"threads\": %d,\n  \"iterations\": %d,\n  \"frontend\": \"%s\",\n  \"decoder\": \"%s\",\n"
+           "  \"files\": %zu,\n  \"chunks\": %d,\n",
+           whisper_n_threads(), n_iters,
+           g_whisper_tflite_params.pcm_input ? "graph" : whisper_frontend_name(g_whisper_frontend),
+           g_whisper_tflite_decoder_params.decode_loop ? "graph" : g_whisper_tflite_decoder_params.decode_step ? "step" : "host",
+           inputs.size(), n_chunks);
+    //KV cache bytes copied per decoded token, the converted decoder has no cache
+    if (g_whisper_tflite_decoder_params.decode_loop || g_whisper_tflite_decoder_params.decode_step) {
+        printf("  \"kv_bytes_per_token\": %lld,\n",
+               (long long) whisper_kv_bytes_per_token(*g_whisper_tflite_decoder_params.interpreter));
+    } else {
+        printf("  \"kv_bytes_per_token\": null,\n");
+    }
+    printf("  \"audio_seconds\": %.3f,\n  \"load_ms\": %.3f,\n  \"load_rss_mb\": %.1f,\n  \"models\": %s,\n"
+           "  \"warmup_ms\": %.3f,\n  \"first_chunk_ms\": %.3f,\n  \"stages_ms\": {\n",
+           audio_seconds, load_ms, load_rss/1048576.0, whisper_model_cache_json().c_str(), warmup_ms, first_chunk_ms);
+    print_stage("audio", stats.audio, false);
+    print_stage("mel", stats.mel, false);
+    print_stage("encoder", stats.encoder, false);
+    print_stage("decoder", stats.decoder, false);
+    if (g_whisper_timestamps != WHISPER_TIMESTAMPS_NONE) {
+        print_stage("align", stats.align, false);
+    }
+    if (detect) {
+        print_stage("detect", stats.detect, false);
+    }
+    print_stage("total", stats.total, true);
+    //the arenas are resident together unless they are shared
+    const whisper_arenas & arenas = g_whisper_arenas;
+    printf("  },\n  \"rtf\": %.4f,\n  \"tokens_per_second\": %.3f,\n"
+           "  \"arena_mb\": {\"encoder\": %.1f, \"decoder\": %.1f, \"shared\": %s, \"resident\": %.1f},\n"
+           "  \"peak_rss_mb\": %.1f,\n",
+           audio_seconds > 0.0 ? total_ms/1000.0/audio_seconds : 0.0,
+           decode_ms > 0.0 ? n_tokens/(decode_ms/1000.0) : 0.0,
+           arenas.encoder/1048576.0, arenas.decoder/1048576.0, g_whisper_shared_arena ? "true" : "false",
+           (g_whisper_shared_arena ? std::max(arenas.encoder, arenas.decoder) : arenas.encoder + arenas.decoder)/1048576.0,
+           usage.ru_maxrss/1024.0);
+    //averages over the releases, one per timed pass
+    if (idle) {
+        printf("  \"idle\": {\"releases\": %d, \"rss_before_mb\": %.1f, \"rss_after_mb\": %.1f, "
+               "\"replan_ms\": %.3f, \"first_chunk_ms\": %.3f},\n",
+               g_whisper_idle.releases, idle_rss_before/n_iters, idle_rss_after/n_iters,
+               idle_replan_ms/n_iters, idle_first_ms/n_iters);
+    }
+
+    score_errors wer;
+    printf("  \"transcripts\": [\n");
+    for (size_t f = 0; f < inputs.size(); f++) {
+        const size_t dot = inputs[f].find_last_of('.');
+        std::string reference;
+        printf("    {\"file\": \"%s\", \"text\": \"%s\"", json_escape(inputs[f]).c_str(),
+               json_escape(transcripts[f]).c_str());
+        if (read_text(inputs[f].substr(0, dot) + ".txt", reference)) {
+            const score_errors e = score_wer(reference, transcripts[f]);
+            wer += e;
+            printf(", \"wer\": %.4f", e.rate());
+        }
+        if (g_whisper_timestamps != WHISPER_TIMESTAMPS_NONE) {
+            printf(", \"timestamps\": %s", whisper_timestamps_json(segments[f]).c_str());
+        }
+        if (detect) {
+            //the five likeliest
+            languages[f].resize(std::min<size_t>(languages[f].size(), 5));
+            printf(", \"languages\": %s", whisper_language_json(languages[f]).c_str());
+        }
+        printf("}%s\n", f + 1 == inputs.size() ? "" : ",");
+    }
+    printf("  ],\n");
+    if (g_whisper_profiling) {
+        printf("  \"profile\": %s,\n", whisper_profile_json().c_str());
+    }
+    if (wer.n_ref > 0) {
+        printf("  \"wer\": %.4f\n}\n", wer.rate());
+    } else {
+        printf("  \"wer\": null\n}\n");
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+//Small helpers to rewrite .tflite models through the flatbuffers object API
+//(tflite::ModelT from schema_generated.h). Used by the host model tools.
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flatbuffers/flexbuffers.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "tensorflow/lite/schema/schema_utils.h"
+
+bool whisper_model_read(const char * path, std::vector<uint8_t> & bytes) {
+    FILE * f = fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    bytes.resize(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    const bool ok = fread(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    fclose(f);
+    return ok;
+}
+
+std::unique_ptr<tflite::ModelT> whisper_model_load(const char * path) {
+    std::vector<uint8_t> bytes;
+    if (!whisper_model_read(path, bytes)) {
+        return nullptr;
+    }
+    flatbuffers::Verifier verifier(bytes.data(), bytes.size());
+    if (!tflite::VerifyModelBuffer(verifier)) {
+        return nullptr;
+    }
+    return std::unique_ptr<tflite::ModelT>(tflite::GetModel(bytes.data())->UnPack());
+}
+
+//serialized model, with the "TFL3" file identifier
+void whisper_model_pack(const tflite::ModelT & model, std::vector<uint8_t> & bytes) {
+    flatbuffers::FlatBufferBuilder fbb;
+    tflite::FinishModelBuffer(fbb, tflite::Model::Pack(fbb, &model));
+    bytes.assign(fbb.GetBufferPointer(), fbb.GetBufferPointer() + fbb.GetSize());
+}
+
+bool whisper_model_save(const tflite::ModelT & model, const char * path) {
+    std::vector<uint8_t> bytes;
+    whisper_model_pack(model, bytes);
+    FILE * f = fopen(path, "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    const bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return fclose(f) == 0 && ok;
+}
+
+//empty model with the mandatory empty buffer 0 and one subgraph
+std::unique_ptr<tflite::ModelT> whisper_model_create(const char * description) {
+    std::unique_ptr<tflite::ModelT> model(new tflite::ModelT);
+    model->version = 3;
+    model->description = description;
+    model->buffers.emplace_back(new tflite::BufferT);
+    model->subgraphs.emplace_back(new tflite::SubGraphT);
+    model->subgraphs[0]->name = "main";
+    return model;
+}
+
+//index of the operator code, reusing an existing entry of the model
+int whisper_model_opcode(tflite::ModelT & model, tflite::BuiltinOperator op, int version = 1) {
+    for (size_t i = 0; i < model.operator_codes.size(); i++) {
+        if (tflite::GetBuiltinCode(model.operator_codes[i].get()) == op) {
+            return (int) i;
+        }
+    }
+    std::unique_ptr<tflite::OperatorCodeT> code(new tflite::OperatorCodeT);
+    code->builtin_code = op;
+    code->deprecated_builtin_code = (int8_t) std::min<int>(op, tflite::BuiltinOperator_PLACEHOLDER_FOR_GREATER_OP_CODES);
+    code->version = version;
+    model.operator_codes.push_back(std::move(code));
+    return (int) model.operator_codes.size() - 1;
+}
+
+int whisper_model_custom_opcode(tflite::ModelT & model, const char * name) {
+    for (size_t i = 0; i < model.operator_codes.size(); i++) {
+        const tflite::OperatorCodeT & code = *model.operator_codes[i];
+        if (tflite::GetBuiltinCode(&code) == tflite::BuiltinOperator_CUSTOM && code.custom_code == name) {
+            return (int) i;
+        }
+    }
+    std::unique_ptr<tflite::OperatorCodeT> code(new tflite::OperatorCodeT);
+    code->builtin_code = tflite::BuiltinOperator_CUSTOM;
+    code->deprecated_builtin_code = tflite::BuiltinOperator_CUSTOM;
+    code->custom_code = name;
+    model.operator_codes.push_back(std::move(code));
+    return (int) model.operator_codes.size() - 1;
+}
+
+//activation tensor of the subgraph, returns its index
+int whisper_model_tensor(
+    tflite::ModelT & model,
+    tflite::SubGraphT & subgraph,
+    const std::string & name,
+    tflite::TensorType type,
+    const std::vector<int> & shape) {
+    std::unique_ptr<tflite::TensorT> tensor(new tflite::TensorT);
+    tensor->name = name;
+    tensor->type = type;
+    tensor->shape = shape;
+    tensor->buffer = 0;
+    subgraph.tensors.push_back(std::move(tensor));
+    return (int) subgraph.tensors.size() - 1;
+}
+
+//constant tensor backed by a new buffer
+template <typename T>
+int whisper_model_const(
+    tflite::ModelT & model,
+    tflite::SubGraphT & subgraph,
+    const std::string & name,
+    tflite::TensorType type,
+    const std::vector<int> & shape,
+    const std::vector<T> & values) {
+    std::unique_ptr<tflite::BufferT> buffer(new tflite::BufferT);
+    buffer->data.resize(values.size()*sizeof(T));
+    memcpy(buffer->data.data(), values.data(), buffer->data.size());
+    model.buffers.push_back(std::move(buffer));
+    const int index = whisper_model_tensor(model, subgraph, name, type, shape);
+    subgraph.tensors[index]->buffer = (uint32_t) model.buffers.size() - 1;
+    return index;
+}
+
+//appends an operator to ops, builtin options are set by the caller
+tflite::OperatorT * whisper_model_op(
+    std::vector<std::unique_ptr<tflite::OperatorT>> & ops,
+    const int opcode,
+    const std::vector<int> & inputs,
+    const std::vector<int> & outputs) {
+    std::unique_ptr<tflite::OperatorT> op(new tflite::OperatorT);
+    op->opcode_index = opcode;
+    op->inputs = inputs;
+    op->outputs = outputs;
+    ops.push_back(std::move(op));
+    return ops.back().get();
+}
+
+//flexbuffer map used as custom_options by custom ops such as AudioSpectrogram
+template <typename F>
+std::vector<uint8_t> whisper_model_custom_options(F fill) {
+    flexbuffers::Builder fbb;
+    fbb.Map([&]() { fill(fbb); });
+    fbb.Finish();
+    return fbb.GetBuffer();
+}
+
+//string metadata entry, read back with FlatBufferModel::ReadAllMetadata()
+void whisper_model_add_metadata(tflite::ModelT & model, const std::string & name, const std::string & value) {
+    std::unique_ptr<tflite::BufferT> buffer(new tflite::BufferT);
+    buffer->data.assign(value.begin(), value.end());
+    model.buffers.push_back(std::move(buffer));
+    std::unique_ptr<tflite::MetadataT> metadata(new tflite::MetadataT);
+    metadata->name = name;
+    metadata->buffer = (uint32_t) model.buffers.size() - 1;
+    model.metadata.push_back(std::move(metadata));
+}
+
+//replaces tensor `from` by `to` in the subgraph inputs and in the signatures
+void whisper_model_replace_input(tflite::ModelT & model, const int subgraph_index, const int from, const int to) {
+    tflite::SubGraphT & subgraph = *model.subgraphs[subgraph_index];
+    for (auto & input : subgraph.inputs) {
+        if (input == from) {
+            input = to;
+        }
+    }
+    for (auto & signature : model.signature_defs) {
+        if ((int) signature->subgraph_index != subgraph_index) {
+            continue;
+        }
+        for (auto & input : signature->inputs) {
+            if ((int) input->tensor_index == from) {
+                input->tensor_index = to;
+                input->name = subgraph.tensors[to]->name;
+            }
+        }
+    }
+}
@@ -0,0 +1,118 @@
+//Transcript scoring shared by the host tools: text normalization and the
+//word (WER) and character (CER) edit distance against a reference, split
+//into substitutions, deletions and insertions like sclite reports them.
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct score_errors {
+    long n_ref = 0;
+    long substitutions = 0;
+    long deletions = 0;
+    long insertions = 0;
+
+    long errors() const {
+        return substitutions + deletions + insertions;
+    }
+
+    double rate() const {
+        return n_ref > 0 ? double(errors())/n_ref : 0.0;
+    }
+
+    score_errors & operator+=(const score_errors & other) {
+        n_ref += other.n_ref;
+        substitutions += other.substitutions;
+        deletions += other.deletions;
+        insertions += other.insertions;
+        return *this;
+    }
+};
+
+//lower case words without punctuation, apostrophes and UTF-8 bytes kept; the
+//non-speech annotations whisper emits, "(music)" or "[BLANK_AUDIO]", are dropped
+inline std::vector<std::string> score_words(const std::string & text) {
+    std::string clean;
+    int depth = 0;
+    for (const unsigned char c : text) {
+        if (c == '(' || c == '[') {
+            depth++;
+        } else if ((c == ')' || c == ']') && depth > 0) {
+            depth--;
+            clean += ' ';
+        } else if (depth == 0) {
+            clean += (std::isalnum(c) || c == '\'' || c >= 0x80) ? (char) std::tolower(c) : ' ';
+        }
+    }
+    std::vector<std::string> words;
+    std::istringstream in(clean);
+    for (std::string w; in >> w;) {
+        words.push_back(w);
+    }
+    return words;
+}
+
+//the normalized words joined by one space, split into UTF-8 characters
+inline std::vector<std::string> score_chars(const std::string & text) {
+    std::string joined;
+    for (const std::string & w : score_words(text)) {
+        joined += joined.empty() ? w : " " + w;
+    }
+    std::vector<std::string> chars;
+    for (size_t i = 0; i < joined.size();) {
+        size_t n = 1;
+        while (i + n < joined.size() && ((unsigned char) joined[i + n] & 0xc0) == 0x80) {
+            n++;
+        }
+        chars.push_back(joined.substr(i, n));
+        i += n;
+    }
+    return chars;
+}
+
+//Levenshtein alignment of two token sequences, the errors split by the
+//backtrace; ties prefer a substitution, then a deletion
+inline score_errors score_align(const std::vector<std::string> & ref, const std::vector<std::string> & hyp) {
+    const size_t n = ref.size();
+    const size_t m = hyp.size();
+    std::vector<int> d((n + 1)*(m + 1));
+    auto at = [&](const size_t i, const size_t j) -> int & {
+        return d[i*(m + 1) + j];
+    };
+    for (size_t i = 0; i <= n; i++) {
+        at(i, 0) = i;
+    }
+    for (size_t j = 0; j <= m; j++) {
+        at(0, j) = j;
+    }
+    for (size_t i = 1; i <= n; i++) {
+        for (size_t j = 1; j <= m; j++) {
+            at(i, j) = std::min({at(i - 1, j - 1) + (ref[i - 1] == hyp[j - 1] ? 0 : 1), at(i - 1, j) + 1, at(i, j - 1) + 1});
+        }
+    }
+    score_errors e;
+    e.n_ref = n;
+    for (size_t i = n, j = m; i > 0 || j > 0;) {
+        if (i > 0 && j > 0 && at(i, j) == at(i - 1, j - 1) + (ref[i - 1] == hyp[j - 1] ? 0 : 1)) {
+            e.substitutions += ref[i - 1] != hyp[j - 1];
+            i--;
+            j--;
+        } else if (i > 0 && at(i, j) == at(i - 1, j) + 1) {
+            e.deletions++;
+            i--;
+        } else {
+            e.insertions++;
+            j--;
+        }
+    }
+    return e;
+}
+
+inline score_errors score_wer(const std::string & reference, const std::string & hypothesis) {
+    return score_align(score_words(reference), score_words(hypothesis));
+}
+
+inline score_errors score_cer(const std::string & reference, const std::string & hypothesis) {
+    return score_align(score_chars(reference), score_chars(hypothesis));
+}
@@ -0,0 +1,126 @@
+//Helpers shared by the host tools: filters/vocab file, audio files, a
+//synthetic test signal and the JSON report. Include after whisper.h.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "whisper_vocab_file.h"
+
+//mel filters of filters_vocab_*.bin, v1 or v2
+inline bool load_filters(const char * path, whisper_filters & filters) {
+    std::ifstream file(path, std::ios::binary);
+    const std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    whisper_vocab vocab;
+    std::string error;
+    if (!whisper_vocab_file_parse(data.data(), data.size(), filters, vocab, error)) {
+        fprintf(stderr, "%s: %s\n", path, error.c_str());
+        return false;
+    }
+    return true;
+}
+
+//first 30 seconds of a 16 kHz file, mixed down to mono like native-lib.cpp
+inline bool load_audio(const char * path, std::vector<float> & pcmf32) {
+    const int n = WHISPER_SAMPLE_RATE*WHISPER_CHUNK_SIZE;
+    std::vector<int16_t> pcm16;
+    int channels = 0;
+    size_t frames = 0;
+    if (strstr(path, ".mp3") != nullptr) {
+        drmp3 mp3;
+        if (!drmp3_init_file(&mp3, path, NULL)) {
+            return false;
+        }
+        channels = mp3.channels;
+        pcm16.resize(n*channels);
+        frames = drmp3_read_pcm_frames_s16(&mp3, n, pcm16.data());
+        drmp3_uninit(&mp3);
+    } else {
+        drwav wav;
+        if (!drwav_init_file(&wav, path, NULL)) {
+            return false;
+        }
+        channels = wav.channels;
+        pcm16.resize(n*channels);
+        frames = drwav_read_pcm_frames_s16(&wav, n, pcm16.data());
+        drwav_uninit(&wav);
+    }
+    pcmf32.assign(n, 0.0f);
+    for (size_t i = 0; i < frames; i++) {
+        pcmf32[i] = channels == 1 ? float(pcm16[i])/32768.0f
+                                  : float(pcm16[2*i] + pcm16[2*i + 1])/65536.0f;
+    }
+    return true;
+}
+
+//deterministic 30 second test signal
+inline void synth_audio(std::vector<float> & pcmf32) {
+    const int n = WHISPER_SAMPLE_RATE*WHISPER_CHUNK_SIZE;
+    pcmf32.resize(n);
+    uint32_t seed = 12345;
+    double phase = 0.0;
+    for (int i = 0; i < n; i++) {
+        const double t = double(i)/WHISPER_SAMPLE_RATE;
+        //100 Hz -> 6 kHz chirp every 3 seconds, amplitude modulated, over white noise
+        const double f = 100.0 + 5900.0*fmod(t, 3.0)/3.0;
+        phase += 2.0*M_PI*f/WHISPER_SAMPLE_RATE;
+        seed = seed*1664525u + 1013904223u;
+        const double noise = (double(seed >> 8)/double(1 << 24) - 0.5)*0.02;
+        pcmf32[i] = (float) (0.3*(0.6 + 0.4*sin(2.0*M_PI*2.0*t))*sin(phase) + noise);
+    }
+}
+
+inline double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v.empty() ? 0.0 : v[v.size()/2];
+}
+
+//max and mean absolute difference of two feature sets
+inline void compare_features(const std::vector<float> & a, const std::vector<float> & b,
+                             double & max_abs, double & mean_abs) {
+    max_abs = 0.0;
+    double sum = 0.0;
+    const size_t n = std::min(a.size(), b.size());
+    for (size_t i = 0; i < n; i++) {
+        const double d = fabs(double(a[i]) - b[i]);
+        max_abs = std::max(max_abs, d);
+        sum += d;
+    }
+    mean_abs = n ? sum/n : 0.0;
+}
+
+//nearest rank percentile
+inline double percentile(std::vector<double> v, const double p) {
+    if (v.empty()) {
+        return 0.0;
+    }
+    std::sort(v.begin(), v.end());
+    const size_t rank = (size_t) std::ceil(p/100.0*v.size());
+    return v[std::min(v.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+inline std::string json_escape(const std::string & s) {
+    std::string out;
+    for (const unsigned char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += (char) c;
+                }
+        }
+    }
+    return out;
+}
@@ -18,6 +18,11 @@ struct whisper_vocab {
     int n_vocab = 51864;
 
 
+    //text tokens of the vocab file: token i is the NUL terminated string at
+    //token_blob[token_offsets[i]], see whisper_vocab_file.h
+    std::vector<uint32_t> token_offsets;
+    std::vector<char> token_blob;
+    //names of the special tokens after them, see whisper_vocab_set_size()
     std::map<id, token> id_to_token;
 
     id token_eot  = 50256;
@@ -27,14 +32,18 @@ struct whisper_vocab {
     id token_not  = 50362; // no timestamps
     id token_beg  = 50363;
 
-    // available tasks
-    static const id token_translwordate  = 50358;
-    static const id token_transcribe = 50359;
+    // available tasks, multilingual models only
+    id token_translate  = 50357;
+    id token_transcribe = 50358;
 
     bool is_multilingual() const {
         return n_vocab == 51865;
     }
 
+    int n_text() const {
+        return token_offsets.empty() ? 0 : (int) token_offsets.size() - 1;
+    }
+
 };
 
 //whisper vocab global variable
@@ -50,8 +59,27 @@ struct whisper_tflite {
     float *input2;
     float* inputOriginal;
     bool is_whisper_tflite_initialized=false;
+    bool pcm_input=false; // encoder computes the mel features itself, see whisper_frontend.h
+    bool decode_loop=false; // decoder runs the greedy loop in the graph, see tools/build_decoder.cpp
+    bool decode_step=false; // decoder steps one token per Invoke() over a KV cache, see whisper_kv_cache.h
 };
 
+//metadata entry of the whisper-build-decoder models holding the vocabulary size
+#define WHISPER_METADATA_N_VOCAB "whisper_n_vocab"
+
+//signatures of the whisper-build-decoder --step models
+#define WHISPER_DECODER_INIT_SIGNATURE "init"
+#define WHISPER_DECODER_STEP_SIGNATURE "step"
+//optional pair of a --shortlist model: "shortlist" gathers the logits matrix
+//rows of a token subset once, "step_shortlist" projects onto those rows only
+#define WHISPER_DECODER_SHORTLIST_SIGNATURE      "shortlist"
+#define WHISPER_DECODER_STEP_SHORTLIST_SIGNATURE "step_shortlist"
+//output of the step signatures of an --alignment-heads model: the cross attention
+//weights [n_heads, n_audio_ctx] of the alignment heads for the stepped token
+#define WHISPER_DECODER_ALIGNMENT_OUTPUT "alignment"
+//metadata entry listing those heads as "layer.head,..."
+#define WHISPER_METADATA_ALIGNMENT_HEADS "whisper_alignment_heads"
+
 whisper_tflite g_whisper_tflite_params;
 
 whisper_tflite g_whisper_tflite_decoder_params;
@@ -71,6 +99,8 @@ struct whisper_filters {
     int32_t n_fft;
 
     std::vector<float> data;
+    std::vector<int32_t> begin; // first non-zero weight of each filter
+    std::vector<int32_t> end;   // one past the last one
 };
 
 struct whisper_mel {
@@ -89,6 +119,9 @@ void print(std::vector <float> const &a) {
 }
 
 const char * whisper_token_to_str(int token) {
+    if (token >= 0 && token < g_vocab.n_text()) {
+        return g_vocab.token_blob.data() + g_vocab.token_offsets[token];
+    }
     return g_vocab.id_to_token.at(token).c_str();
 }
 
@@ -169,6 +202,8 @@ void fft(const std::vector<float> & in, std::vector<float> & out) {
     }
 }
 
+void log_mel_normalize(whisper_mel & mel);
+
 // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L92-L124
 bool log_mel_spectrogram(
     const float * samples,
@@ -243,7 +278,10 @@ bool log_mel_spectrogram(
                 for (int j = 0; j < mel.n_mel; j++) {
                     double sum = 0.0;
 
-                    for (int k = 0; k < n_fft; k++) {
+                    //zero weights outside the band add nothing
+                    const int k_begin = filters.begin.empty() ? 0 : filters.begin[j];
+                    const int k_end = filters.end.empty() ? n_fft : filters.end[j];
+                    for (int k = k_begin; k < k_end; k++) {
                         sum += fft_out[k]*filters.data[j*n_fft + k];
                     }
                     if (sum < 1e-10) {
@@ -262,7 +300,13 @@ bool log_mel_spectrogram(
         workers[iw].join();
     }
 
-    // clamping and normalization
+    log_mel_normalize(mel);
+
+    return true;
+}
+
+// clamping and normalization, shared by every frontend in whisper_frontend.h
+void log_mel_normalize(whisper_mel & mel) {
     double mmax = -1e20;
     for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
         if (mel.data[i] > mmax) {
@@ -280,6 +324,4 @@ bool log_mel_spectrogram(
 
         mel.data[i] = (mel.data[i] + 4.0)/4.0;
     }
-
-    return true;
 }
@@ -0,0 +1,182 @@
+//Offline tensor arena plans written by tools/arena_plan.cpp (whisper-plan).
+//The tool places the fixed size activations of each subgraph at offsets of
+//one pool and stores them in the model metadata; at load the pool is
+//allocated once and each planned tensor is bound to its slice with
+//SetCustomAllocationForTensor(), so the ArenaPlanner only places what is left
+//(op temporaries and tensors whose size follows a resized input).
+//TFLite's ArenaPlanner has no OfflineMemoryAllocation hook like TFLM's
+//planner, custom allocations are the entry point the runtime does honor.
+//
+//Metadata WHISPER_METADATA_ARENA_PLAN, int32 little endian:
+//  version, number of subgraphs, then per subgraph
+//  subgraph index, fingerprint, pool bytes, number of tensors, (tensor, offset, bytes) ...
+//The fingerprint hashes the delegated execution plan; a plan taken on another
+//graph (other delegates or ops) is dropped at load.
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/core/subgraph.h"
+#include "tensorflow/lite/model.h"
+
+#define WHISPER_METADATA_ARENA_PLAN "whisper_arena_plan"
+#define WHISPER_ARENA_PLAN_VERSION 1
+//kDefaultTensorAlignment, the alignment SetCustomAllocationForTensor() checks
+#define WHISPER_ARENA_PLAN_ALIGNMENT 64
+
+struct whisper_arena_plan_tensor {
+    int32_t tensor = 0;
+    int32_t offset = 0; // in the pool slice of the subgraph
+    int32_t bytes  = 0;
+};
+
+struct whisper_arena_plan_subgraph {
+    int32_t subgraph = 0;
+    uint32_t fingerprint = 0;
+    int32_t pool_bytes = 0;
+    size_t pool_offset = 0; // of the slice in whisper_arena_plan::pool
+    std::vector<whisper_arena_plan_tensor> tensors;
+};
+
+struct whisper_arena_plan {
+    std::vector<whisper_arena_plan_subgraph> subgraphs;
+    size_t pool_bytes = 0;
+    char * pool = nullptr; // bound to the tensors while not nullptr
+    bool rejected = false; // did not match the graph, the interpreter plans online
+};
+
+inline size_t whisper_arena_plan_align(const size_t bytes) {
+    return (bytes + WHISPER_ARENA_PLAN_ALIGNMENT - 1)/WHISPER_ARENA_PLAN_ALIGNMENT*WHISPER_ARENA_PLAN_ALIGNMENT;
+}
+
+//FNV-1a over the op and the input/output tensors of every node in execution order
+inline uint32_t whisper_arena_plan_fingerprint(const tflite::Subgraph & subgraph) {
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](const int32_t value) {
+        for (int i = 0; i < 4; i++) {
+            hash = (hash ^ ((uint32_t) value >> (8*i) & 0xff))*16777619u;
+        }
+    };
+    for (const int node_index : subgraph.execution_plan()) {
+        const auto * node_and_reg = subgraph.node_and_registration(node_index);
+        const TfLiteNode & node = node_and_reg->first;
+        mix(node_and_reg->second.builtin_code);
+        for (const TfLiteIntArray * tensors : {node.inputs, node.outputs}) {
+            mix(tensors->size);
+            for (int i = 0; i < tensors->size; i++) {
+                mix(tensors->data[i]);
+            }
+        }
+    }
+    return hash;
+}
+
+inline std::string whisper_arena_plan_serialize(const whisper_arena_plan & plan) {
+    std::vector<int32_t> words = {WHISPER_ARENA_PLAN_VERSION, (int32_t) plan.subgraphs.size()};
+    for (const whisper_arena_plan_subgraph & s : plan.subgraphs) {
+        words.insert(words.end(), {s.subgraph, (int32_t) s.fingerprint, s.pool_bytes, (int32_t) s.tensors.size()});
+        for (const whisper_arena_plan_tensor & t : s.tensors) {
+            words.insert(words.end(), {t.tensor, t.offset, t.bytes});
+        }
+    }
+    return std::string((const char *) words.data(), words.size()*sizeof(int32_t));
+}
+
+//false when the model has no plan or it is malformed
+inline bool whisper_arena_plan_parse(const std::string & data, whisper_arena_plan & plan) {
+    plan.subgraphs.clear();
+    plan.pool_bytes = 0;
+    std::vector<int32_t> words(data.size()/sizeof(int32_t));
+    memcpy(words.data(), data.data(), words.size()*sizeof(int32_t));
+    size_t i = 2;
+    if (words.size() < i || words[0] != WHISPER_ARENA_PLAN_VERSION) {
+        return false;
+    }
+    for (int32_t n = 0; n < words[1]; n++) {
+        if (words.size() < i + 4) {
+            return false;
+        }
+        whisper_arena_plan_subgraph s;
+        s.subgraph = words[i];
+        s.fingerprint = (uint32_t) words[i + 1];
+        s.pool_bytes = words[i + 2];
+        s.pool_offset = plan.pool_bytes;
+        const int32_t n_tensors = words[i + 3];
+        i += 4;
+        if (n_tensors < 0 || s.pool_bytes < 0 || words.size() < i + 3*(size_t) n_tensors) {
+            return false;
+        }
+        for (int32_t k = 0; k < n_tensors; k++, i += 3) {
+            whisper_arena_plan_tensor t;
+            t.tensor = words[i];
+            t.offset = words[i + 1];
+            t.bytes = words[i + 2];
+            if (t.offset < 0 || t.bytes < 0 || (int64_t) t.offset + t.bytes > s.pool_bytes) {
+                return false;
+            }
+            s.tensors.push_back(t);
+        }
+        plan.pool_bytes += whisper_arena_plan_align(s.pool_bytes);
+        plan.subgraphs.push_back(s);
+    }
+    return true;
+}
+
+inline bool whisper_arena_plan_read(const tflite::FlatBufferModel & model, whisper_arena_plan & plan) {
+    const std::map<std::string, std::string> metadata = model.ReadAllMetadata();
+    auto it = metadata.find(WHISPER_METADATA_ARENA_PLAN);
+    return it != metadata.end() && whisper_arena_plan_parse(it->second, plan);
+}
+
+//allocates the pool and binds the planned tensors to it, a no-op while bound;
+//AllocateTensors() has to run afterwards
+inline bool whisper_arena_plan_acquire(tflite::Interpreter & interpreter, whisper_arena_plan & plan) {
+    if (plan.pool != nullptr || plan.subgraphs.empty()) {
+        return true;
+    }
+    void * pool = nullptr;
+    if (posix_memalign(&pool, WHISPER_ARENA_PLAN_ALIGNMENT, plan.pool_bytes) != 0) {
+        return false;
+    }
+    plan.pool = (char *) pool;
+    for (const whisper_arena_plan_subgraph & s : plan.subgraphs) {
+        if (s.subgraph < 0 || s.subgraph >= (int) interpreter.subgraphs_size()) {
+            return false;
+        }
+        tflite::Subgraph & subgraph = *interpreter.subgraph(s.subgraph);
+        for (const whisper_arena_plan_tensor & t : s.tensors) {
+            if (t.tensor < 0 || t.tensor >= (int) subgraph.tensors_size()) {
+                return false;
+            }
+            TfLiteCustomAllocation allocation = {plan.pool + s.pool_offset + t.offset, (size_t) t.bytes};
+            if (subgraph.SetCustomAllocationForTensor(t.tensor, allocation) != kTfLiteOk) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//frees the pool, the tensors are bound again by the next acquire
+inline void whisper_arena_plan_release(whisper_arena_plan & plan) {
+    free(plan.pool);
+    plan.pool = nullptr;
+}
+
+//whether the delegated graph is still the one the plan was made for
+inline bool whisper_arena_plan_check(const tflite::Interpreter & interpreter, const whisper_arena_plan & plan) {
+    for (const whisper_arena_plan_subgraph & s : plan.subgraphs) {
+        if (s.subgraph >= (int) interpreter.subgraphs_size() ||
+            whisper_arena_plan_fingerprint(*interpreter.subgraph(s.subgraph)) != s.fingerprint) {
+            return false;
+        }
+    }
+    return true;
+}
+
+whisper_arena_plan g_whisper_encoder_plan;
+whisper_arena_plan g_whisper_decoder_plan;
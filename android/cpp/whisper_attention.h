@@ -0,0 +1,657 @@
+//Fused scaled dot product attention, softmax(scale*q k^T + mask) v, as the
+//WhisperAttention custom op. The converted models compute it as
+//BATCH_MATMUL/FULLY_CONNECTED -> MUL -> ADD -> SOFTMAX -> BATCH_MATMUL with
+//the whole [heads, n_q, n_kv] score matrix in the arena (6 x 1500 x 1500
+//floats, twice, per encoder layer). Here the keys and values are walked in
+//tiles with an online softmax (running row max and sum, flash attention
+//style), so only a tile of scores per thread exists at any time.
+//tools/fuse_ops.cpp rewrites the models to use it.
+//
+//  WhisperAttention (q, k, v[, mask]) -> out, custom options (flexbuffer map):
+//    n_head        0: q [.., n_q, d], k/v [.., n_kv, d], leading dims are the heads
+//                  N: q [.., n_q, N*d], k/v [.., n_kv, N*d], heads interleaved per row
+//                     (the [batch, seq, n_state] layout of the projections)
+//    scale         applied to q k^T before the mask (default 1)
+//    k_transposed  k is [.., d, n_kv] (n_head 0 only)
+//  mask broadcasts against [heads, n_q, n_kv] (e.g. the causal [n_q, n_kv] mask),
+//  out has the layout of q.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "flatbuffers/flexbuffers.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/mutable_op_resolver.h"
+
+#define WHISPER_ATTENTION_OP "WhisperAttention"
+
+//query rows and key/value rows of a tile, a 64 wide head keeps q, the k and v
+//tiles and the output rows of a tile within 48 KB
+#define WHISPER_ATTENTION_TILE_Q  16
+#define WHISPER_ATTENTION_TILE_KV 64
+
+//multiply-accumulates below which another thread does not pay for itself
+#define WHISPER_ATTENTION_MIN_MACS_PER_THREAD (1 << 20)
+
+//SIMD vector of the target: NEON, AVX2 with FMA, SSE2 or a plain float
+#if defined(__ARM_NEON)
+#define WHISPER_ATTENTION_LANES 4
+typedef float32x4_t whisper_attention_vec;
+static inline whisper_attention_vec whisper_attention_load(const float * p) { return vld1q_f32(p); }
+static inline void whisper_attention_store(float * p, const whisper_attention_vec v) { vst1q_f32(p, v); }
+static inline whisper_attention_vec whisper_attention_splat(const float x) { return vdupq_n_f32(x); }
+//acc + a*b
+static inline whisper_attention_vec whisper_attention_fma(
+    const whisper_attention_vec acc, const whisper_attention_vec a, const whisper_attention_vec b) {
+#if defined(__aarch64__)
+    return vfmaq_f32(acc, a, b);
+#else
+    return vmlaq_f32(acc, a, b);
+#endif
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+#define WHISPER_ATTENTION_LANES 8
+typedef __m256 whisper_attention_vec;
+static inline whisper_attention_vec whisper_attention_load(const float * p) { return _mm256_loadu_ps(p); }
+static inline void whisper_attention_store(float * p, const whisper_attention_vec v) { _mm256_storeu_ps(p, v); }
+static inline whisper_attention_vec whisper_attention_splat(const float x) { return _mm256_set1_ps(x); }
+static inline whisper_attention_vec whisper_attention_fma(
+    const whisper_attention_vec acc, const whisper_attention_vec a, const whisper_attention_vec b) {
+    return _mm256_fmadd_ps(a, b, acc);
+}
+#elif defined(__SSE2__)
+#define WHISPER_ATTENTION_LANES 4
+typedef __m128 whisper_attention_vec;
+static inline whisper_attention_vec whisper_attention_load(const float * p) { return _mm_loadu_ps(p); }
+static inline void whisper_attention_store(float * p, const whisper_attention_vec v) { _mm_storeu_ps(p, v); }
+static inline whisper_attention_vec whisper_attention_splat(const float x) { return _mm_set1_ps(x); }
+static inline whisper_attention_vec whisper_attention_fma(
+    const whisper_attention_vec acc, const whisper_attention_vec a, const whisper_attention_vec b) {
+    return _mm_add_ps(acc, _mm_mul_ps(a, b));
+}
+#else
+#define WHISPER_ATTENTION_LANES 1
+typedef float whisper_attention_vec;
+static inline whisper_attention_vec whisper_attention_load(const float * p) { return *p; }
+static inline void whisper_attention_store(float * p, const whisper_attention_vec v) { *p = v; }
+static inline whisper_attention_vec whisper_attention_splat(const float x) { return x; }
+static inline whisper_attention_vec whisper_attention_fma(
+    const whisper_attention_vec acc, const whisper_attention_vec a, const whisper_attention_vec b) {
+    return acc + a*b;
+}
+#endif
+
+//the rest of the arithmetic of a vector, for the row and elementwise kernels
+//of whisper_norm.h
+#if defined(__ARM_NEON)
+static inline whisper_attention_vec whisper_attention_add(const whisper_attention_vec a, const whisper_attention_vec b) { return vaddq_f32(a, b); }
+static inline whisper_attention_vec whisper_attention_sub(const whisper_attention_vec a, const whisper_attention_vec b) { return vsubq_f32(a, b); }
+static inline whisper_attention_vec whisper_attention_mul(const whisper_attention_vec a, const whisper_attention_vec b) { return vmulq_f32(a, b); }
+static inline whisper_attention_vec whisper_attention_min(const whisper_attention_vec a, const whisper_attention_vec b) { return vminq_f32(a, b); }
+static inline whisper_attention_vec whisper_attention_max(const whisper_attention_vec a, const whisper_attention_vec b) { return vmaxq_f32(a, b); }
+static inline whisper_attention_vec whisper_attention_div(const whisper_attention_vec a, const whisper_attention_vec b) {
+#if defined(__aarch64__)
+    return vdivq_f32(a, b);
+#else
+    //reciprocal estimate refined by two Newton-Raphson steps
+    float32x4_t r = vrecpeq_f32(b);
+    r = vmulq_f32(vrecpsq_f32(b, r), r);
+    r = vmulq_f32(vrecpsq_f32(b, r), r);
+    return vmulq_f32(a, r);
+#endif
+}
+static inline float whisper_attention_sum(const whisper_attention_vec v) {
+#if defined(__aarch64__)
+    return vaddvq_f32(v);
+#else
+    const float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+static inline whisper_attention_vec whisper_attention_add(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm256_add_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_sub(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm256_sub_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_mul(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm256_mul_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_min(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm256_min_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_max(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm256_max_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_div(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm256_div_ps(a, b); }
+static inline float whisper_attention_sum(const whisper_attention_vec v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+}
+#elif defined(__SSE2__)
+static inline whisper_attention_vec whisper_attention_add(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm_add_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_sub(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm_sub_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_mul(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm_mul_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_min(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm_min_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_max(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm_max_ps(a, b); }
+static inline whisper_attention_vec whisper_attention_div(const whisper_attention_vec a, const whisper_attention_vec b) { return _mm_div_ps(a, b); }
+static inline float whisper_attention_sum(const whisper_attention_vec v) {
+    const __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+}
+#else
+static inline whisper_attention_vec whisper_attention_add(const whisper_attention_vec a, const whisper_attention_vec b) { return a + b; }
+static inline whisper_attention_vec whisper_attention_sub(const whisper_attention_vec a, const whisper_attention_vec b) { return a - b; }
+static inline whisper_attention_vec whisper_attention_mul(const whisper_attention_vec a, const whisper_attention_vec b) { return a*b; }
+static inline whisper_attention_vec whisper_attention_min(const whisper_attention_vec a, const whisper_attention_vec b) { return std::min(a, b); }
+static inline whisper_attention_vec whisper_attention_max(const whisper_attention_vec a, const whisper_attention_vec b) { return std::max(a, b); }
+static inline whisper_attention_vec whisper_attention_div(const whisper_attention_vec a, const whisper_attention_vec b) { return a/b; }
+static inline float whisper_attention_sum(const whisper_attention_vec v) { return v; }
+#endif
+
+//exp(x) for x <= 0, as in the softmax of a tile: range reduction to
+//2^n*exp(r), |r| <= ln(2)/2, and the polynomial of the Cephes expf. Below
+//-87 (and for the -inf of masked scores) the result is 0.
+#define WHISPER_ATTENTION_EXP_MIN   -87.0f
+#define WHISPER_ATTENTION_EXP_ROUND 12582912.0f  // 1.5*2^23, rounds to an integer when added
+
+static inline float whisper_attention_exp1(const float x) {
+    const float v = std::max(x, WHISPER_ATTENTION_EXP_MIN);
+    const float k = (v*1.44269504f + WHISPER_ATTENTION_EXP_ROUND) - WHISPER_ATTENTION_EXP_ROUND;
+    const float r = (v - k*0.693359375f) + k*2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+    p = p*r + 1.3981999507e-3f;
+    p = p*r + 8.3334519073e-3f;
+    p = p*r + 4.1665795894e-2f;
+    p = p*r + 1.6666665459e-1f;
+    p = p*r + 5.0000001201e-1f;
+    p = p*r*r + r + 1.0f;
+    const int32_t bits = ((int32_t) k + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return x < WHISPER_ATTENTION_EXP_MIN ? 0.0f : p*scale;
+}
+
+//x[i] = exp(x[i]), x[i] <= 0
+static inline void whisper_attention_exp(float * x, const int n) {
+    int i = 0;
+#if defined(__ARM_NEON) || (defined(__AVX2__) && defined(__FMA__)) || defined(__SSE2__)
+    const whisper_attention_vec lo = whisper_attention_splat(WHISPER_ATTENTION_EXP_MIN);
+    const whisper_attention_vec round = whisper_attention_splat(WHISPER_ATTENTION_EXP_ROUND);
+    for (; i + WHISPER_ATTENTION_LANES <= n; i += WHISPER_ATTENTION_LANES) {
+        const whisper_attention_vec x0 = whisper_attention_load(x + i);
+#if defined(__ARM_NEON)
+        const float32x4_t v = vmaxq_f32(x0, lo);
+        const float32x4_t k = vsubq_f32(whisper_attention_fma(round, v, vdupq_n_f32(1.44269504f)), round);
+        const float32x4_t r = whisper_attention_fma(whisper_attention_fma(v, k, vdupq_n_f32(-0.693359375f)),
+                                                    k, vdupq_n_f32(2.12194440e-4f));
+        float32x4_t p = vdupq_n_f32(1.9875691500e-4f);
+        p = whisper_attention_fma(vdupq_n_f32(1.3981999507e-3f), p, r);
+        p = whisper_attention_fma(vdupq_n_f32(8.3334519073e-3f), p, r);
+        p = whisper_attention_fma(vdupq_n_f32(4.1665795894e-2f), p, r);
+        p = whisper_attention_fma(vdupq_n_f32(1.6666665459e-1f), p, r);
+        p = whisper_attention_fma(vdupq_n_f32(5.0000001201e-1f), p, r);
+        p = whisper_attention_fma(vaddq_f32(r, vdupq_n_f32(1.0f)), p, vmulq_f32(r, r));
+        const int32x4_t bits = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(k), vdupq_n_s32(127)), 23);
+        const float32x4_t e = vmulq_f32(p, vreinterpretq_f32_s32(bits));
+        vst1q_f32(x + i, vbslq_f32(vcltq_f32(x0, lo), vdupq_n_f32(0.0f), e));
+#elif defined(__AVX2__) && defined(__FMA__)
+        const __m256 v = _mm256_max_ps(x0, lo);
+        const __m256 k = _mm256_sub_ps(_mm256_fmadd_ps(v, _mm256_set1_ps(1.44269504f), round), round);
+        const __m256 r = _mm256_fmadd_ps(k, _mm256_set1_ps(2.12194440e-4f),
+                                         _mm256_fnmadd_ps(k, _mm256_set1_ps(0.693359375f), v));
+        __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+        p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+        const __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(k), _mm256_set1_epi32(127)), 23);
+        const __m256 e = _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+        _mm256_storeu_ps(x + i, _mm256_andnot_ps(_mm256_cmp_ps(x0, lo, _CMP_LT_OQ), e));
+#else
+        const __m128 v = _mm_max_ps(x0, lo);
+        const __m128 k = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(1.44269504f)), round), round);
+        const __m128 r = _mm_add_ps(_mm_sub_ps(v, _mm_mul_ps(k, _mm_set1_ps(0.693359375f))),
+                                    _mm_mul_ps(k, _mm_set1_ps(2.12194440e-4f)));
+        __m128 p = _mm_set1_ps(1.9875691500e-4f);
+        p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.3981999507e-3f));
+        p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(8.3334519073e-3f));
+        p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(4.1665795894e-2f));
+        p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.6666665459e-1f));
+        p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(5.0000001201e-1f));
+        p = _mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), _mm_add_ps(r, _mm_set1_ps(1.0f)));
+        const __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(k), _mm_set1_epi32(127)), 23);
+        const __m128 e = _mm_mul_ps(p, _mm_castsi128_ps(bits));
+        _mm_storeu_ps(x + i, _mm_andnot_ps(_mm_cmplt_ps(x0, lo), e));
+#endif
+    }
+#endif
+    for (; i < n; i++) {
+        x[i] = whisper_attention_exp1(x[i]);
+    }
+}
+
+//c[r][j] += sum_k a[r][k]*b[k][j] for R rows and j < n: the score tile
+//(q times k^T) and the value accumulation (p times v) of a tile. Each block of
+//R x 16 sums stays in registers over the k loop, so b is read once for R rows.
+template <int R>
+static inline void whisper_attention_kernel(
+    const float * a, const int64_t lda, const float * b, const int64_t ldb, const int n_k,
+    float * c, const int64_t ldc, const int n) {
+    const int V = 16/WHISPER_ATTENTION_LANES;
+    int j0 = 0;
+    for (; j0 + 16 <= n; j0 += 16) {
+        whisper_attention_vec acc[R][V];
+        for (int r = 0; r < R; r++) {
+            for (int v = 0; v < V; v++) {
+                acc[r][v] = whisper_attention_load(c + r*ldc + j0 + v*WHISPER_ATTENTION_LANES);
+            }
+        }
+        for (int k = 0; k < n_k; k++) {
+            whisper_attention_vec bk[V];
+            for (int v = 0; v < V; v++) {
+                bk[v] = whisper_attention_load(b + k*ldb + j0 + v*WHISPER_ATTENTION_LANES);
+            }
+            for (int r = 0; r < R; r++) {
+                const whisper_attention_vec ar = whisper_attention_splat(a[r*lda + k]);
+                for (int v = 0; v < V; v++) {
+                    acc[r][v] = whisper_attention_fma(acc[r][v], ar, bk[v]);
+                }
+            }
+        }
+        for (int r = 0; r < R; r++) {
+            for (int v = 0; v < V; v++) {
+                whisper_attention_store(c + r*ldc + j0 + v*WHISPER_ATTENTION_LANES, acc[r][v]);
+            }
+        }
+    }
+    for (int r = 0; r < R; r++) {
+        for (int j = j0; j < n; j++) {
+            float sum = c[r*ldc + j];
+            for (int k = 0; k < n_k; k++) {
+                sum += a[r*lda + k]*b[k*ldb + j];
+            }
+            c[r*ldc + j] = sum;
+        }
+    }
+}
+
+//rows of a kernel block: R*16/LANES sums plus 16/LANES b vectors fit the 32
+//registers of aarch64 and AVX2's 16 at 4 rows, the 16 of SSE and armv7 at 2
+#if (defined(__ARM_NEON) && defined(__aarch64__)) || (defined(__AVX2__) && defined(__FMA__))
+#define WHISPER_ATTENTION_ROWS 4
+#else
+#define WHISPER_ATTENTION_ROWS 2
+#endif
+
+//the kernel over any number of rows
+static inline void whisper_attention_gemm(
+    const float * a, const int64_t lda, const float * b, const int64_t ldb, const int n_k,
+    float * c, const int64_t ldc, const int n_rows, const int n) {
+    int r = 0;
+    for (; r + WHISPER_ATTENTION_ROWS <= n_rows; r += WHISPER_ATTENTION_ROWS) {
+        whisper_attention_kernel<WHISPER_ATTENTION_ROWS>(a + r*lda, lda, b, ldb, n_k, c + r*ldc, ldc, n);
+    }
+    for (; r < n_rows; r++) {
+        whisper_attention_kernel<1>(a + r*lda, lda, b, ldb, n_k, c + r*ldc, ldc, n);
+    }
+}
+
+//one head: element (row, col) of a matrix is at data[row*row_stride + col*col_stride]
+struct whisper_attention_matrix {
+    const float * data = nullptr;
+    int64_t row_stride = 0;
+    int64_t col_stride = 1;
+};
+
+//attention of one head, the scalars are shared by every head of a call
+struct whisper_attention_head {
+    whisper_attention_matrix q, k, v;        // [n_q, d], [n_kv, d], [n_kv, d]
+    whisper_attention_matrix mask;           // [n_q, n_kv], data nullptr without mask
+    float * out = nullptr;                   // [n_q, d] rows out_row_stride apart
+    int64_t out_row_stride = 0;
+};
+
+//per thread tiles
+struct whisper_attention_scratch {
+    std::vector<float> q;       // [TILE_Q, d], the query rows times scale
+    std::vector<float> k;       // [d, TILE_KV], the key tile transposed
+    std::vector<float> scores;  // [TILE_Q, TILE_KV]
+    std::vector<float> acc;     // [TILE_Q, d]
+    std::vector<float> max;     // [TILE_Q]
+    std::vector<float> sum;     // [TILE_Q]
+
+    void reserve(const int d) {
+        q.resize((size_t) WHISPER_ATTENTION_TILE_Q*d);
+        k.resize((size_t) d*WHISPER_ATTENTION_TILE_KV);
+        scores.resize(WHISPER_ATTENTION_TILE_Q*WHISPER_ATTENTION_TILE_KV);
+        acc.resize((size_t) WHISPER_ATTENTION_TILE_Q*d);
+        max.resize(WHISPER_ATTENTION_TILE_Q);
+        sum.resize(WHISPER_ATTENTION_TILE_Q);
+    }
+};
+
+//query rows [r0, r1) of a head, at most WHISPER_ATTENTION_TILE_Q of them
+static void whisper_attention_rows(
+    const whisper_attention_head & h,
+    const int r0, const int r1, const int n_kv, const int d, const float scale,
+    whisper_attention_scratch & s) {
+    const int n_rows = r1 - r0;
+    const int tile = WHISPER_ATTENTION_TILE_KV;
+    for (int r = 0; r < n_rows; r++) {
+        const float * q = h.q.data + (r0 + r)*h.q.row_stride;
+        for (int i = 0; i < d; i++) {
+            s.q[(size_t) r*d + i] = scale*q[i];
+        }
+    }
+    std::fill(s.acc.begin(), s.acc.begin() + (size_t) n_rows*d, 0.0f);
+    std::fill(s.max.begin(), s.max.begin() + n_rows, -INFINITY);
+    std::fill(s.sum.begin(), s.sum.begin() + n_rows, 0.0f);
+
+    for (int c0 = 0; c0 < n_kv; c0 += tile) {
+        const int n_cols = std::min(tile, n_kv - c0);
+        //k^T of the tile, the scores are then a plain [rows, d] x [d, n_cols]
+        //product. Stored transposed (row_stride 1) it is read in place.
+        const float * k = h.k.data + c0;
+        int64_t ldk = h.k.col_stride;
+        if (h.k.row_stride != 1) {
+            for (int c = 0; c < n_cols; c++) {
+                const float * src = h.k.data + (c0 + c)*h.k.row_stride;
+                for (int i = 0; i < d; i++) {
+                    s.k[(size_t) i*tile + c] = src[i*h.k.col_stride];
+                }
+            }
+            k = s.k.data();
+            ldk = tile;
+        }
+        std::fill(s.scores.begin(), s.scores.begin() + n_rows*tile, 0.0f);
+        whisper_attention_gemm(s.q.data(), d, k, ldk, d, s.scores.data(), tile, n_rows, n_cols);
+
+        for (int r = 0; r < n_rows; r++) {
+            float * scores = s.scores.data() + r*tile;
+            if (h.mask.data != nullptr) {
+                const float * mask = h.mask.data + (r0 + r)*h.mask.row_stride + c0*h.mask.col_stride;
+                for (int c = 0; c < n_cols; c++) {
+                    scores[c] += mask[c*h.mask.col_stride];
+                }
+            }
+            float max = s.max[r];
+            for (int c = 0; c < n_cols; c++) {
+                max = std::max(max, scores[c]);
+            }
+            if (max == -INFINITY) {
+                //every key so far is masked out
+                std::fill(scores, scores + n_cols, 0.0f);
+                continue;
+            }
+            for (int c = 0; c < n_cols; c++) {
+                scores[c] -= max;
+            }
+            whisper_attention_exp(scores, n_cols);
+            float sum = 0.0f;
+            for (int c = 0; c < n_cols; c++) {
+                sum += scores[c];
+            }
+            //rescale what was accumulated under the previous max
+            const float correction = std::exp(s.max[r] - max);
+            if (correction != 1.0f) {
+                float * acc = s.acc.data() + (size_t) r*d;
+                for (int i = 0; i < d; i++) {
+                    acc[i] *= correction;
+                }
+            }
+            s.max[r] = max;
+            s.sum[r] = s.sum[r]*correction + sum;
+        }
+        //acc += p v over the value rows of the tile
+        whisper_attention_gemm(s.scores.data(), tile, h.v.data + c0*h.v.row_stride, h.v.row_stride, n_cols,
+                               s.acc.data(), d, n_rows, d);
+    }
+    for (int r = 0; r < n_rows; r++) {
+        float * out = h.out + (r0 + r)*h.out_row_stride;
+        const float inv = s.sum[r] > 0.0f ? 1.0f/s.sum[r] : 0.0f;
+        const float * acc = s.acc.data() + (size_t) r*d;
+        for (int i = 0; i < d; i++) {
+            out[i] = acc[i]*inv;
+        }
+    }
+}
+
+//every head of a call, split in tiles of query rows over up to n_threads threads
+static void whisper_attention_run(
+    const std::vector<whisper_attention_head> & heads,
+    const int n_q, const int n_kv, const int d, const float scale, const int n_threads) {
+    const int tiles_per_head = (n_q + WHISPER_ATTENTION_TILE_Q - 1)/WHISPER_ATTENTION_TILE_Q;
+    const int n_tiles = (int) heads.size()*tiles_per_head;
+    const double macs = 2.0*heads.size()*n_q*n_kv*d;
+    const int n_workers = std::max(1, std::min({n_threads, n_tiles, (int) (macs/WHISPER_ATTENTION_MIN_MACS_PER_THREAD)}));
+    //keys of the heads read by more than one tile are transposed once here
+    //instead of once per tile, [d, n_kv] per head
+    std::vector<whisper_attention_head> transposed;
+    std::vector<float> keys;
+    if (tiles_per_head > 1 && heads[0].k.row_stride != 1) {
+        transposed = heads;
+        keys.resize(heads.size()*d*n_kv);
+        for (size_t h = 0; h < heads.size(); h++) {
+            float * dst = keys.data() + h*d*n_kv;
+            const whisper_attention_matrix & k = heads[h].k;
+            for (int c = 0; c < n_kv; c++) {
+                for (int i = 0; i < d; i++) {
+                    dst[(size_t) i*n_kv + c] = k.data[c*k.row_stride + i*k.col_stride];
+                }
+            }
+            transposed[h].k = {dst, 1, n_kv};
+        }
+    }
+    const std::vector<whisper_attention_head> & tiles = keys.empty() ? heads : transposed;
+    auto work = [&](const int ith) {
+        whisper_attention_scratch scratch;
+        scratch.reserve(d);
+        for (int t = ith; t < n_tiles; t += n_workers) {
+            const int r0 = (t % tiles_per_head)*WHISPER_ATTENTION_TILE_Q;
+            whisper_attention_rows(tiles[t/tiles_per_head], r0, std::min(n_q, r0 + WHISPER_ATTENTION_TILE_Q),
+                                   n_kv, d, scale, scratch);
+        }
+    };
+    if (n_workers == 1) {
+        work(0);
+        return;
+    }
+    std::vector<std::thread> workers(n_workers - 1);
+    for (int iw = 1; iw < n_workers; ++iw) {
+        workers[iw - 1] = std::thread(work, iw);
+    }
+    work(0);
+    for (auto & w : workers) {
+        w.join();
+    }
+}
+
+struct whisper_attention_params {
+    int n_head = 0;
+    float scale = 1.0f;
+    bool k_transposed = false;
+};
+
+static void * whisper_attention_init(TfLiteContext *, const char * buffer, size_t length) {
+    whisper_attention_params * params = new whisper_attention_params;
+    if (buffer != nullptr && length > 0) {
+        const flexbuffers::Map & m = flexbuffers::GetRoot(reinterpret_cast<const uint8_t *>(buffer), length).AsMap();
+        params->n_head = m["n_head"].AsInt32();
+        params->scale = m["scale"].IsNull() ? 1.0f : m["scale"].AsFloat();
+        params->k_transposed = m["k_transposed"].AsBool();
+    }
+    return params;
+}
+
+static void whisper_attention_free(TfLiteContext *, void * buffer) {
+    delete reinterpret_cast<whisper_attention_params *>(buffer);
+}
+
+//sizes of a call, from the tensor shapes
+struct whisper_attention_dims {
+    int n_batch = 0;  // leading dims of n_head > 0 layouts, heads otherwise
+    int n_head = 0;   // heads per batch entry
+    int n_q = 0;
+    int n_kv = 0;
+    int d = 0;
+};
+
+static int64_t whisper_attention_leading(const TfLiteTensor * t) {
+    int64_t n = 1;
+    for (int i = 0; i + 2 < t->dims->size; i++) {
+        n *= t->dims->data[i];
+    }
+    return n;
+}
+
+static TfLiteStatus whisper_attention_get_dims(
+    TfLiteContext * context, TfLiteNode * node, const whisper_attention_params & params,
+    whisper_attention_dims & dims) {
+    const TfLiteTensor * q;
+    const TfLiteTensor * k;
+    const TfLiteTensor * v;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &q));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 1, &k));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 2, &v));
+    //ranks may differ as long as the leading dims hold the same heads, e.g. q
+    //[1, n_q, n_state] next to k [n_kv, n_state] out of a FULLY_CONNECTED
+    TF_LITE_ENSURE(context, q->dims->size >= 2 && k->dims->size >= 2 && v->dims->size >= 2);
+    TF_LITE_ENSURE(context, whisper_attention_leading(k) == whisper_attention_leading(q) &&
+                            whisper_attention_leading(v) == whisper_attention_leading(q));
+    const int q_rank = q->dims->size;
+    const int k_rank = k->dims->size;
+    const int v_rank = v->dims->size;
+    const int q_cols = q->dims->data[q_rank - 1];
+    dims.n_q = q->dims->data[q_rank - 2];
+    dims.n_kv = v->dims->data[v_rank - 2];
+    if (params.n_head > 0) {
+        TF_LITE_ENSURE(context, !params.k_transposed && q_cols % params.n_head == 0);
+        dims.n_batch = (int) whisper_attention_leading(q);
+        dims.n_head = params.n_head;
+        dims.d = q_cols/params.n_head;
+    } else {
+        dims.n_batch = (int) whisper_attention_leading(q);
+        dims.n_head = 1;
+        dims.d = q_cols;
+    }
+    const int k_rows = params.k_transposed ? k->dims->data[k_rank - 1] : k->dims->data[k_rank - 2];
+    const int k_cols = params.k_transposed ? k->dims->data[k_rank - 2] : k->dims->data[k_rank - 1];
+    TF_LITE_ENSURE_EQ(context, k_rows, dims.n_kv);
+    TF_LITE_ENSURE_EQ(context, k_cols, q_cols);
+    TF_LITE_ENSURE_EQ(context, v->dims->data[v_rank - 1], q_cols);
+    return kTfLiteOk;
+}
+
+//mask dims right aligned against [heads, n_q, n_kv], each 1 or the full size
+static TfLiteStatus whisper_attention_check_mask(
+    TfLiteContext * context, const TfLiteTensor * mask, const whisper_attention_dims & dims) {
+    TF_LITE_ENSURE_TYPES_EQ(context, mask->type, kTfLiteFloat32);
+    TF_LITE_ENSURE(context, mask->dims->size >= 1);
+    const int rank = mask->dims->size;
+    const int n_kv = mask->dims->data[rank - 1];
+    const int n_q = rank >= 2 ? mask->dims->data[rank - 2] : 1;
+    const int64_t n_heads = rank >= 3 ? whisper_attention_leading(mask) : 1;
+    TF_LITE_ENSURE(context, n_kv == 1 || n_kv == dims.n_kv);
+    TF_LITE_ENSURE(context, n_q == 1 || n_q == dims.n_q);
+    TF_LITE_ENSURE(context, n_heads == 1 || n_heads == (int64_t) dims.n_batch*dims.n_head);
+    return kTfLiteOk;
+}
+
+static TfLiteStatus whisper_attention_prepare(TfLiteContext * context, TfLiteNode * node) {
+    const auto & params = *reinterpret_cast<const whisper_attention_params *>(node->user_data);
+    TF_LITE_ENSURE(context, tflite::NumInputs(node) == 3 || tflite::NumInputs(node) == 4);
+    TF_LITE_ENSURE_EQ(context, tflite::NumOutputs(node), 1);
+    for (int i = 0; i < tflite::NumInputs(node); i++) {
+        const TfLiteTensor * input;
+        TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, i, &input));
+        TF_LITE_ENSURE_TYPES_EQ(context, input->type, kTfLiteFloat32);
+    }
+    const TfLiteTensor * q;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &q));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    whisper_attention_dims dims;
+    TF_LITE_ENSURE_OK(context, whisper_attention_get_dims(context, node, params, dims));
+    if (tflite::NumInputs(node) == 4) {
+        TF_LITE_ENSURE_OK(context, whisper_attention_check_mask(context, tflite::GetInput(context, node, 3), dims));
+    }
+    //the fused output keeps the shape it had in the graph, e.g. [n_q, n_state]
+    //ahead of the output projection, when it holds the same elements
+    if (output->dims != nullptr && output->dims->size > 0 && tflite::NumElements(output) == tflite::NumElements(q)) {
+        return kTfLiteOk;
+    }
+    return context->ResizeTensor(context, output, TfLiteIntArrayCopy(q->dims));
+}
+
+static TfLiteStatus whisper_attention_eval(TfLiteContext * context, TfLiteNode * node) {
+    const auto & params = *reinterpret_cast<const whisper_attention_params *>(node->user_data);
+    const TfLiteTensor * q;
+    const TfLiteTensor * k;
+    const TfLiteTensor * v;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &q));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 1, &k));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 2, &v));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    const TfLiteTensor * mask = tflite::NumInputs(node) == 4 ? tflite::GetInput(context, node, 3) : nullptr;
+    whisper_attention_dims dims;
+    TF_LITE_ENSURE_OK(context, whisper_attention_get_dims(context, node, params, dims));
+
+    //strides of one head, heads of a batch entry are d apart in the interleaved layout
+    const int64_t cols = (int64_t) dims.n_head*dims.d;
+    const int64_t q_batch = (int64_t) dims.n_q*cols;
+    const int64_t kv_batch = (int64_t) dims.n_kv*cols;
+    int64_t mask_head = 0;
+    whisper_attention_matrix mask_matrix;
+    if (mask != nullptr) {
+        const int rank = mask->dims->size;
+        const int m_kv = mask->dims->data[rank - 1];
+        const int m_q = rank >= 2 ? mask->dims->data[rank - 2] : 1;
+        mask_matrix.data = mask->data.f;
+        mask_matrix.col_stride = m_kv == 1 ? 0 : 1;
+        mask_matrix.row_stride = m_q == 1 ? 0 : m_kv;
+        mask_head = tflite::NumElements(mask) == (int64_t) m_q*m_kv ? 0 : (int64_t) m_q*m_kv;
+    }
+    std::vector<whisper_attention_head> heads(dims.n_batch*dims.n_head);
+    for (int b = 0; b < dims.n_batch; b++) {
+        for (int n = 0; n < dims.n_head; n++) {
+            whisper_attention_head & h = heads[b*dims.n_head + n];
+            h.q.data = q->data.f + b*q_batch + n*dims.d;
+            h.q.row_stride = cols;
+            h.v.data = v->data.f + b*kv_batch + n*dims.d;
+            h.v.row_stride = cols;
+            h.k.data = k->data.f + b*kv_batch + n*dims.d;
+            if (params.k_transposed) {
+                h.k.row_stride = 1;
+                h.k.col_stride = dims.n_kv;
+            } else {
+                h.k.row_stride = cols;
+            }
+            h.out = output->data.f + b*q_batch + n*dims.d;
+            h.out_row_stride = cols;
+            if (mask != nullptr) {
+                h.mask = mask_matrix;
+                h.mask.data += (b*dims.n_head + n)*mask_head;
+            }
+        }
+    }
+    whisper_attention_run(heads, dims.n_q, dims.n_kv, dims.d, params.scale,
+                          std::max(1, context->recommended_num_threads));
+    return kTfLiteOk;
+}
+
+void whisper_attention_register_ops(tflite::MutableOpResolver & resolver) {
+    TfLiteRegistration attention = {};
+    attention.init = whisper_attention_init;
+    attention.free = whisper_attention_free;
+    attention.prepare = whisper_attention_prepare;
+    attention.invoke = whisper_attention_eval;
+    resolver.AddCustom(WHISPER_ATTENTION_OP, &attention);
+}
@@ -0,0 +1,136 @@
+//Builtin replacements for the TensorFlow (Flex) ops left in the converted
+//Whisper models. The prebuilt libtensorflowlite.so has no Flex delegate, so
+//without these the interpreters cannot be built:
+//  FlexErf      (encoder, decoder)  GELU of the MLP blocks
+//  FlexCast     (decoder)           int64 <-> float64 around the position ids
+//  FlexRealDiv  (decoder)           float64 scalar division of the same
+//The serialized NodeDef in custom_options is ignored, types come from the tensors.
+#include <cmath>
+
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/mutable_op_resolver.h"
+
+static TfLiteStatus whisper_flex_prepare_unary(TfLiteContext * context, TfLiteNode * node) {
+    const TfLiteTensor * input;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &input));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    return context->ResizeTensor(context, output, TfLiteIntArrayCopy(input->dims));
+}
+
+static TfLiteStatus whisper_flex_erf_eval(TfLiteContext * context, TfLiteNode * node) {
+    const TfLiteTensor * input;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &input));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    TF_LITE_ENSURE_TYPES_EQ(context, input->type, kTfLiteFloat32);
+    const int64_t n = tflite::NumElements(input);
+    for (int64_t i = 0; i < n; i++) {
+        output->data.f[i] = std::erf(input->data.f[i]);
+    }
+    return kTfLiteOk;
+}
+
+template <typename T>
+static T * whisper_flex_data(const TfLiteTensor * tensor) {
+    return reinterpret_cast<T *>(tensor->data.raw);
+}
+
+template <typename From, typename To>
+static void whisper_flex_copy(const TfLiteTensor * input, TfLiteTensor * output, const int64_t n) {
+    const From * in = whisper_flex_data<From>(input);
+    To * out = whisper_flex_data<To>(output);
+    for (int64_t i = 0; i < n; i++) {
+        out[i] = static_cast<To>(in[i]);
+    }
+}
+
+template <typename From>
+static TfLiteStatus whisper_flex_cast_from(TfLiteContext * context, const TfLiteTensor * input, TfLiteTensor * output) {
+    const int64_t n = tflite::NumElements(input);
+    switch (output->type) {
+        case kTfLiteFloat32: whisper_flex_copy<From, float>(input, output, n);   break;
+        case kTfLiteFloat64: whisper_flex_copy<From, double>(input, output, n);  break;
+        case kTfLiteInt32:   whisper_flex_copy<From, int32_t>(input, output, n); break;
+        case kTfLiteInt64:   whisper_flex_copy<From, int64_t>(input, output, n); break;
+        default:
+            TF_LITE_KERNEL_LOG(context, "FlexCast: unsupported output type %s", TfLiteTypeGetName(output->type));
+            return kTfLiteError;
+    }
+    return kTfLiteOk;
+}
+
+static TfLiteStatus whisper_flex_cast_eval(TfLiteContext * context, TfLiteNode * node) {
+    const TfLiteTensor * input;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &input));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    switch (input->type) {
+        case kTfLiteFloat32: return whisper_flex_cast_from<float>(context, input, output);
+        case kTfLiteFloat64: return whisper_flex_cast_from<double>(context, input, output);
+        case kTfLiteInt32:   return whisper_flex_cast_from<int32_t>(context, input, output);
+        case kTfLiteInt64:   return whisper_flex_cast_from<int64_t>(context, input, output);
+        default:
+            TF_LITE_KERNEL_LOG(context, "FlexCast: unsupported input type %s", TfLiteTypeGetName(input->type));
+            return kTfLiteError;
+    }
+}
+
+//element-wise division, either side may be a single value
+static TfLiteStatus whisper_flex_div_prepare(TfLiteContext * context, TfLiteNode * node) {
+    const TfLiteTensor * a;
+    const TfLiteTensor * b;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &a));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 1, &b));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    TF_LITE_ENSURE_TYPES_EQ(context, a->type, b->type);
+    const int64_t na = tflite::NumElements(a);
+    const int64_t nb = tflite::NumElements(b);
+    TF_LITE_ENSURE(context, na == nb || na == 1 || nb == 1);
+    return context->ResizeTensor(context, output, TfLiteIntArrayCopy(na >= nb ? a->dims : b->dims));
+}
+
+template <typename T>
+static void whisper_flex_div(const TfLiteTensor * a, const TfLiteTensor * b, TfLiteTensor * output) {
+    const T * pa = whisper_flex_data<T>(a);
+    const T * pb = whisper_flex_data<T>(b);
+    T * out = whisper_flex_data<T>(output);
+    const int64_t sa = tflite::NumElements(a) == 1 ? 0 : 1;
+    const int64_t sb = tflite::NumElements(b) == 1 ? 0 : 1;
+    const int64_t n = tflite::NumElements(output);
+    for (int64_t i = 0; i < n; i++) {
+        out[i] = pa[i*sa]/pb[i*sb];
+    }
+}
+
+static TfLiteStatus whisper_flex_div_eval(TfLiteContext * context, TfLiteNode * node) {
+    const TfLiteTensor * a;
+    const TfLiteTensor * b;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &a));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 1, &b));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    switch (a->type) {
+        case kTfLiteFloat32: whisper_flex_div<float>(a, b, output);  return kTfLiteOk;
+        case kTfLiteFloat64: whisper_flex_div<double>(a, b, output); return kTfLiteOk;
+        default:
+            TF_LITE_KERNEL_LOG(context, "FlexRealDiv: unsupported type %s", TfLiteTypeGetName(a->type));
+            return kTfLiteError;
+    }
+}
+
+void whisper_flex_register_ops(tflite::MutableOpResolver & resolver) {
+    TfLiteRegistration erf = {};
+    erf.prepare = whisper_flex_prepare_unary;
+    erf.invoke = whisper_flex_erf_eval;
+    TfLiteRegistration cast = {};
+    cast.prepare = whisper_flex_prepare_unary;
+    cast.invoke = whisper_flex_cast_eval;
+    TfLiteRegistration div = {};
+    div.prepare = whisper_flex_div_prepare;
+    div.invoke = whisper_flex_div_eval;
+    resolver.AddCustom("FlexErf", &erf);
+    resolver.AddCustom("FlexCast", &cast);
+    resolver.AddCustom("FlexRealDiv", &div);
+}
@@ -0,0 +1,400 @@
+//Pluggable audio front ends producing the Whisper log-mel input features.
+//All of them fill a whisper_mel of n_mel x (n_samples / hop) values, clamped
+//and normalized exactly like log_mel_spectrogram() in whisper.h, so the
+//encoder input does not depend on which one is selected.
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/kernels/internal/spectrogram.h"
+#include "tensorflow/lite/mutable_op_resolver.h"
+
+#include "whisper_frontend_fixed.h"
+
+#ifdef WHISPER_MICROFRONTEND
+#include "tensorflow/lite/experimental/microfrontend/lib/frontend.h"
+#include "tensorflow/lite/experimental/microfrontend/lib/frontend_util.h"
+#endif
+
+enum whisper_frontend_type {
+    WHISPER_FRONTEND_REFERENCE = 0, // whisper.cpp port, log_mel_spectrogram() in whisper.h
+    WHISPER_FRONTEND_SPECTROGRAM,   // tflite::internal::Spectrogram (Ooura rdft, 512 point)
+    WHISPER_FRONTEND_MICRO,         // experimental/microfrontend, int16 kissfft + own filterbank
+    WHISPER_FRONTEND_FIXED,         // int32 fixed point port of the reference, whisper_frontend_fixed.h
+    WHISPER_FRONTEND_COUNT,
+};
+
+const char * whisper_frontend_name(whisper_frontend_type type) {
+    switch (type) {
+        case WHISPER_FRONTEND_REFERENCE:   return "reference";
+        case WHISPER_FRONTEND_SPECTROGRAM: return "spectrogram";
+        case WHISPER_FRONTEND_MICRO:       return "micro";
+        case WHISPER_FRONTEND_FIXED:       return "fixed";
+        default:                           return "unknown";
+    }
+}
+
+bool whisper_frontend_from_name(const char * name, whisper_frontend_type * type) {
+    for (int i = 0; i < WHISPER_FRONTEND_COUNT; i++) {
+        if (strcmp(name, whisper_frontend_name((whisper_frontend_type) i)) == 0) {
+            *type = (whisper_frontend_type) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool whisper_frontend_available(whisper_frontend_type type) {
+#ifndef WHISPER_MICROFRONTEND
+    if (type == WHISPER_FRONTEND_MICRO) {
+        return false;
+    }
+#endif
+    return type >= 0 && type < WHISPER_FRONTEND_COUNT;
+}
+
+//frontend selected for the plugin, see setFrontendJNI
+whisper_frontend_type g_whisper_frontend = WHISPER_FRONTEND_REFERENCE;
+
+// Mel filters resampled onto the spectrum of a power-of-two FFT.
+// The Whisper filters are defined on the 1 + n_fft/2 bins of a 400 point FFT,
+// while Spectrogram and the microfrontend zero pad the window to 512 points.
+// Zero padding samples the same spectrum more densely, so the filters are
+// linearly interpolated at the new bin frequencies and scaled by the bin
+// density ratio. The reference also folds the mirrored half of the spectrum
+// into bins 1 .. n_fft/2 - 1, that doubling is baked into the weights here.
+struct whisper_frontend_filters {
+    int n_mel  = 0;
+    int n_bins = 0;
+    const whisper_filters * source = nullptr; // loaded filters these were built from
+
+    std::vector<float> data;  // n_mel x n_bins
+    std::vector<int> begin;   // first non-zero bin of each mel band
+    std::vector<int> end;     // one past the last non-zero bin
+};
+
+//filters of the spectrogram frontend, built on first use from the loaded
+//filters; whisper_free() drops them, the next load may bring other filters
+whisper_frontend_filters g_whisper_frontend_filters;
+
+void whisper_frontend_resample_filters(
+    const whisper_filters & filters,
+    const int fft_size,
+    const int fft_length,
+    whisper_frontend_filters & out) {
+
+    const int n_fft = filters.n_fft;
+    out.n_mel  = filters.n_mel;
+    out.n_bins = fft_length/2 + 1;
+    out.source = &filters;
+    out.data.assign(out.n_mel*out.n_bins, 0.0f);
+    out.begin.assign(out.n_mel, 0);
+    out.end.assign(out.n_mel, 0);
+
+    const double density = double(fft_size)/fft_length;
+    for (int j = 0; j < out.n_mel; j++) {
+        const float * w = filters.data.data() + j*n_fft;
+        int b = out.n_bins;
+        int e = 0;
+        for (int k = 0; k < out.n_bins; k++) {
+            const double p = k*density;
+            const int k0 = std::min((int) p, n_fft - 1);
+            const int k1 = std::min(k0 + 1, n_fft - 1);
+            const double t = p - k0;
+            const double w0 = w[k0]*((k0 >= 1 && k0 < fft_size/2) ? 2.0 : 1.0);
+            const double w1 = w[k1]*((k1 >= 1 && k1 < fft_size/2) ? 2.0 : 1.0);
+            const float v = (float) (((1.0 - t)*w0 + t*w1)*density);
+            out.data[j*out.n_bins + k] = v;
+            if (v != 0.0f) {
+                b = std::min(b, k);
+                e = k + 1;
+            }
+        }
+        out.begin[j] = b < e ? b : 0;
+        out.end[j]   = e;
+    }
+}
+
+//power spectrum frame -> log10 mel column i
+static void whisper_frontend_mel_column(
+    const whisper_frontend_filters & filters,
+    const float * power,
+    const int i,
+    whisper_mel & mel) {
+    for (int j = 0; j < filters.n_mel; j++) {
+        const float * w = filters.data.data() + j*filters.n_bins;
+        double sum = 0.0;
+        for (int k = filters.begin[j]; k < filters.end[j]; k++) {
+            sum += power[k]*w[k];
+        }
+        if (sum < 1e-10) {
+            sum = 1e-10;
+        }
+        mel.data[j*mel.n_len + i] = log10(sum);
+    }
+}
+
+//samples of frames [f0, f1), zero padded past the end of the input like the reference
+static void whisper_frontend_frame_samples(
+    const float * samples,
+    const int n_samples,
+    const int fft_size,
+    const int fft_step,
+    const int f0,
+    const int f1,
+    std::vector<float> & out) {
+    const int offset = f0*fft_step;
+    out.assign((f1 - f0 - 1)*fft_step + fft_size, 0.0f);
+    const int n = std::max(0, std::min((int) out.size(), n_samples - offset));
+    if (n > 0) {
+        memcpy(out.data(), samples + offset, n*sizeof(float));
+    }
+}
+
+bool log_mel_spectrogram_tflite(
+    const float * samples,
+    const int n_samples,
+    const int fft_size,
+    const int fft_step,
+    const int n_mel,
+    const int n_threads,
+    const whisper_filters & filters,
+    whisper_mel & mel) {
+
+    tflite::internal::Spectrogram probe;
+    if (!probe.Initialize(fft_size, fft_step)) {
+        return false;
+    }
+    const int fft_length = 2*(probe.output_frequency_channels() - 1);
+
+    whisper_frontend_filters & resampled = g_whisper_frontend_filters;
+    if (resampled.source != &filters || resampled.n_bins != fft_length/2 + 1) {
+        whisper_frontend_resample_filters(filters, fft_size, fft_length, resampled);
+    }
+
+    mel.n_mel = n_mel;
+    mel.n_len = n_samples/fft_step;
+    mel.data.resize(mel.n_mel*mel.n_len);
+
+    //contiguous frame ranges per thread, Spectrogram is a streaming object
+    const int per_thread = (mel.n_len + n_threads - 1)/n_threads;
+    std::vector<int> ok(n_threads, 1);
+    std::vector<std::thread> workers(n_threads);
+    for (int iw = 0; iw < n_threads; ++iw) {
+        workers[iw] = std::thread([&](int ith) {
+            const int f0 = ith*per_thread;
+            const int f1 = std::min(mel.n_len, f0 + per_thread);
+            if (f0 >= f1) {
+                return;
+            }
+            tflite::internal::Spectrogram spectrogram;
+            std::vector<float> input;
+            std::vector<std::vector<float>> power;
+            whisper_frontend_frame_samples(samples, n_samples, fft_size, fft_step, f0, f1, input);
+            if (!spectrogram.Initialize(fft_size, fft_step) ||
+                !spectrogram.ComputeSquaredMagnitudeSpectrogram(input, &power) ||
+                (int) power.size() != f1 - f0) {
+                ok[ith] = 0;
+                return;
+            }
+            for (int i = f0; i < f1; i++) {
+                whisper_frontend_mel_column(resampled, power[i - f0].data(), i, mel);
+            }
+        }, iw);
+    }
+
+    for (int iw = 0; iw < n_threads; ++iw) {
+        workers[iw].join();
+    }
+    for (int iw = 0; iw < n_threads; ++iw) {
+        if (!ok[iw]) {
+            return false;
+        }
+    }
+
+    log_mel_normalize(mel);
+
+    return true;
+}
+
+#ifdef WHISPER_MICROFRONTEND
+// The microfrontend emits round(2^scale_shift * ln(sqrt(E))) per channel, with E
+// the filterbank energy of the int16 window in its own fixed point scale:
+// 2^15 input scale, kissfft's 1/N forward scaling and the Q12 filterbank
+// weights, followed by the 2 correction bits of a 512 point FFT. That puts
+// log10(E) 2*log10(2^14) above the float power the reference computes.
+#define WHISPER_MICRO_SCALE_SHIFT  6
+#define WHISPER_MICRO_LOG10_OFFSET (2.0*14.0*0.30102999566398)
+
+bool log_mel_spectrogram_micro(
+    const float * samples,
+    const int n_samples,
+    const int sample_rate,
+    const int fft_size,
+    const int fft_step,
+    const int n_mel,
+    const int n_threads,
+    whisper_mel & mel) {
+
+    struct FrontendConfig config;
+    FrontendFillConfigWithDefaults(&config);
+    config.window.size_ms = fft_size*1000/sample_rate;
+    config.window.step_size_ms = fft_step*1000/sample_rate;
+    config.filterbank.num_channels = n_mel;
+    config.filterbank.lower_band_limit = 0.0f;
+    config.filterbank.upper_band_limit = sample_rate/2.0f;
+    //no noise subtraction or gain control, Whisper expects the raw log energies
+    config.noise_reduction.even_smoothing = 0.0f;
+    config.noise_reduction.odd_smoothing = 0.0f;
+    config.noise_reduction.min_signal_remaining = 1.0f;
+    config.pcan_gain_control.enable_pcan = 0;
+    config.log_scale.enable_log = 1;
+    config.log_scale.scale_shift = WHISPER_MICRO_SCALE_SHIFT;
+
+    mel.n_mel = n_mel;
+    mel.n_len = n_samples/fft_step;
+    mel.data.resize(mel.n_mel*mel.n_len);
+
+    const double to_log10 = 2.0/((1 << WHISPER_MICRO_SCALE_SHIFT)*M_LN10);
+
+    const int per_thread = (mel.n_len + n_threads - 1)/n_threads;
+    std::vector<int> ok(n_threads, 1);
+    std::vector<std::thread> workers(n_threads);
+    for (int iw = 0; iw < n_threads; ++iw) {
+        workers[iw] = std::thread([&](int ith) {
+            const int f0 = ith*per_thread;
+            const int f1 = std::min(mel.n_len, f0 + per_thread);
+            if (f0 >= f1) {
+                return;
+            }
+            struct FrontendState state;
+            if (!FrontendPopulateState(&config, &state, sample_rate)) {
+                ok[ith] = 0;
+                return;
+            }
+            std::vector<float> input;
+            whisper_frontend_frame_samples(samples, n_samples, fft_size, fft_step, f0, f1, input);
+            std::vector<int16_t> pcm16(input.size());
+            for (size_t k = 0; k < input.size(); k++) {
+                const float v = std::max(-1.0f, std::min(1.0f, input[k]));
+                pcm16[k] = (int16_t) lrintf(v*32767.0f);
+            }
+
+            const int16_t * in = pcm16.data();
+            size_t remaining = pcm16.size();
+            int i = f0;
+            while (remaining > 0 && i < f1) {
+                size_t read = 0;
+                struct FrontendOutput output = FrontendProcessSamples(&state, in, remaining, &read);
+                in += read;
+                remaining -= read;
+                if (output.values == nullptr) {
+                    continue;
+                }
+                for (int j = 0; j < n_mel; j++) {
+                    double v = output.values[j]*to_log10 - WHISPER_MICRO_LOG10_OFFSET;
+                    mel.data[j*mel.n_len + i] = std::max(v, -10.0);
+                }
+                i++;
+            }
+            FrontendFreeStateContents(&state);
+            if (i != f1) {
+                ok[ith] = 0;
+            }
+        }, iw);
+    }
+
+    for (int iw = 0; iw < n_threads; ++iw) {
+        workers[iw].join();
+    }
+    for (int iw = 0; iw < n_threads; ++iw) {
+        if (!ok[iw]) {
+            return false;
+        }
+    }
+
+    log_mel_normalize(mel);
+
+    return true;
+}
+#endif
+
+//entry points used by the plugin, dispatch to the selected frontend
+bool whisper_compute_mel(
+    whisper_frontend_type type,
+    const float * samples,
+    const int n_samples,
+    const int n_threads,
+    const whisper_filters & filters,
+    whisper_mel & mel) {
+    switch (type) {
+        case WHISPER_FRONTEND_REFERENCE:
+            return log_mel_spectrogram(samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT,
+                                       WHISPER_HOP_LENGTH, WHISPER_N_MEL, n_threads, filters, mel);
+        case WHISPER_FRONTEND_SPECTROGRAM:
+            return log_mel_spectrogram_tflite(samples, n_samples, WHISPER_N_FFT, WHISPER_HOP_LENGTH,
+                                              WHISPER_N_MEL, n_threads, filters, mel);
+#ifdef WHISPER_MICROFRONTEND
+        case WHISPER_FRONTEND_MICRO:
+            return log_mel_spectrogram_micro(samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT,
+                                             WHISPER_HOP_LENGTH, WHISPER_N_MEL, n_threads, mel);
+#endif
+        case WHISPER_FRONTEND_FIXED: {
+            std::vector<int16_t> pcm16(n_samples);
+            for (int i = 0; i < n_samples; i++) {
+                pcm16[i] = (int16_t) std::max(-32768.0f, std::min(32767.0f, floorf(samples[i]*32768.0f + 0.5f)));
+            }
+            return log_mel_spectrogram_fixed(pcm16.data(), n_samples, WHISPER_N_FFT, WHISPER_HOP_LENGTH,
+                                             WHISPER_N_MEL, n_threads, filters, mel);
+        }
+        default:
+            return false;
+    }
+}
+
+//16 bit PCM input, the fixed point frontend consumes it without any float pass
+bool whisper_compute_mel(
+    whisper_frontend_type type,
+    const int16_t * samples,
+    const int n_samples,
+    const int n_threads,
+    const whisper_filters & filters,
+    whisper_mel & mel) {
+    if (type == WHISPER_FRONTEND_FIXED) {
+        return log_mel_spectrogram_fixed(samples, n_samples, WHISPER_N_FFT, WHISPER_HOP_LENGTH,
+                                         WHISPER_N_MEL, n_threads, filters, mel);
+    }
+    std::vector<float> pcmf32(n_samples);
+    for (int i = 0; i < n_samples; i++) {
+        pcmf32[i] = float(samples[i])/32768.0f;
+    }
+    return whisper_compute_mel(type, pcmf32.data(), n_samples, n_threads, filters, mel);
+}
+
+// In-graph frontend: encoders rewritten by tools/fold_frontend.cpp take the
+// 30 second 16 kHz PCM chunk as input and compute the log-mel features with
+// TFLite ops, so the host only copies samples in. The STFT of those models
+// may use the AudioSpectrogram custom op, which has to be registered.
+namespace tflite {
+namespace ops {
+namespace custom {
+TfLiteRegistration* Register_AUDIO_SPECTROGRAM();
+}  // namespace custom
+}  // namespace ops
+}  // namespace tflite
+
+#define WHISPER_GRAPH_SPECTROGRAM_OP "AudioSpectrogram"
+
+void whisper_frontend_register_ops(tflite::MutableOpResolver & resolver) {
+    resolver.AddCustom(WHISPER_GRAPH_SPECTROGRAM_OP, tflite::ops::custom::Register_AUDIO_SPECTROGRAM());
+}
+
+//true when the encoder input is a [1, 30 s of samples] float tensor instead of mel features
+bool whisper_encoder_takes_pcm(tflite::Interpreter & interpreter) {
+    const TfLiteTensor * input = interpreter.input_tensor(0);
+    return input != nullptr && input->type == kTfLiteFloat32 && input->dims->size == 2 &&
+           input->dims->data[0] == 1 && input->dims->data[1] == WHISPER_SAMPLE_RATE*WHISPER_CHUNK_SIZE;
+}
@@ -0,0 +1,384 @@
+//Fixed point log-mel frontend for devices with slow floating point (armeabi-v7a).
+//Modeled on experimental/microfrontend: integer window, a kissfft style
+//mixed radix FFT, a sparse integer filterbank and the kLogLut log2
+//approximation of log_scale.c. Unlike the microfrontend it keeps the exact
+//400 point Whisper FFT grid and the Whisper filters, so it tracks the
+//reference closely. Everything stays in int16/int32/int64 until the final
+//conversion to the float features copied into the encoder input.
+#include <cstdint>
+#include <vector>
+
+#include "tensorflow/lite/experimental/microfrontend/lib/log_lut.h"
+
+struct whisper_cpx32 {
+    int32_t r;
+    int32_t i;
+};
+
+struct whisper_cpx16 {
+    int16_t r;
+    int16_t i;
+};
+
+//real FFT of n points through an n/2 point complex FFT, kiss_fftr layout
+struct whisper_fixed_fft {
+    int n = 0;
+    int ncfft = 0;
+    std::vector<int> factors;                  // radix, remaining length pairs
+    std::vector<whisper_cpx16> twiddles;       // Q15 exp(-2*pi*i*k/ncfft)
+    std::vector<whisper_cpx16> super_twiddles; // Q15 real FFT post-processing
+};
+
+//Whisper filters in the sparse integer layout: weights of band j are the
+//bins [begin[j], end[j]) scaled by 2^qbits[j], the per band exponent keeps
+//15 significant bits for narrow and wide filters alike
+struct whisper_fixed_filters {
+    const whisper_filters * source = nullptr; // loaded filters these were built from
+    int n_mel = 0;
+    int n_fft = 0;
+
+    std::vector<int> begin;
+    std::vector<int> end;
+    std::vector<int> offset;
+    std::vector<int> qbits;
+    std::vector<uint16_t> weights;
+};
+
+//filters of the fixed point frontend, built on first use from the loaded
+//filters; whisper_free() drops them, the next load may bring other filters
+whisper_fixed_filters g_whisper_fixed_filters;
+
+//power spectrum is shifted down before the filterbank so 64 bit accumulators
+//cannot overflow: 2^49 max power >> 8, * 2^15 weights, * 64 bins < 2^63
+#define WHISPER_FIXED_POWER_SHIFT 8
+//window coefficients are Q15 with 1.0 == 32768
+#define WHISPER_FIXED_WINDOW_BITS 15
+//log2(1e-10), the floor applied by the reference, in Q16
+#define WHISPER_FIXED_LOG2_FLOOR  (-2177059)
+//8 decades (log10) in log2 Q16, the dynamic range kept by log_mel_normalize()
+#define WHISPER_FIXED_LOG2_RANGE  1741647
+
+static whisper_cpx16 whisper_fixed_q15(double phase) {
+    whisper_cpx16 c;
+    c.r = (int16_t) std::max(-32767.0, std::min(32767.0, floor(cos(phase)*32768.0 + 0.5)));
+    c.i = (int16_t) std::max(-32767.0, std::min(32767.0, floor(sin(phase)*32768.0 + 0.5)));
+    return c;
+}
+
+bool whisper_fixed_fft_init(whisper_fixed_fft & st, int n) {
+    if (n <= 0 || n % 2 != 0) {
+        return false;
+    }
+    st.n = n;
+    st.ncfft = n/2;
+
+    // same factorization as kf_factor() in kissfft: 4s first, then 2, 3, 5, ...
+    st.factors.clear();
+    int m = st.ncfft;
+    int p = 4;
+    const int floor_sqrt = (int) floor(sqrt((double) m));
+    do {
+        while (m % p) {
+            switch (p) {
+                case 4: p = 2; break;
+                case 2: p = 3; break;
+                default: p += 2; break;
+            }
+            if (p > floor_sqrt) {
+                p = m;
+            }
+        }
+        //radix butterflies use a fixed size scratch buffer
+        if (p > 16) {
+            return false;
+        }
+        m /= p;
+        st.factors.push_back(p);
+        st.factors.push_back(m);
+    } while (m > 1);
+
+    st.twiddles.resize(st.ncfft);
+    for (int k = 0; k < st.ncfft; k++) {
+        st.twiddles[k] = whisper_fixed_q15(-2.0*M_PI*k/st.ncfft);
+    }
+    st.super_twiddles.resize(st.ncfft/2);
+    for (int k = 0; k < st.ncfft/2; k++) {
+        st.super_twiddles[k] = whisper_fixed_q15(-M_PI*((double) (k + 1)/st.ncfft + 0.5));
+    }
+    return true;
+}
+
+static inline whisper_cpx32 whisper_fixed_mul(const whisper_cpx32 & a, const whisper_cpx16 & b) {
+    whisper_cpx32 c;
+    c.r = (int32_t) (((int64_t) a.r*b.r - (int64_t) a.i*b.i + (1 << 14)) >> 15);
+    c.i = (int32_t) (((int64_t) a.r*b.i + (int64_t) a.i*b.r + (1 << 14)) >> 15);
+    return c;
+}
+
+//kf_bfly_generic without the per stage down scaling of kissfft's FIXED_POINT
+//mode: inputs carry at most 16 significant bits and int32 holds the growth
+static void whisper_fixed_bfly(
+    whisper_cpx32 * out,
+    const int fstride,
+    const whisper_fixed_fft & st,
+    const int m,
+    const int p,
+    whisper_cpx32 * scratch) {
+    for (int u = 0; u < m; u++) {
+        int k = u;
+        for (int q1 = 0; q1 < p; q1++) {
+            scratch[q1] = out[k];
+            k += m;
+        }
+        k = u;
+        for (int q1 = 0; q1 < p; q1++) {
+            int twidx = 0;
+            whisper_cpx32 acc = scratch[0];
+            for (int q = 1; q < p; q++) {
+                twidx += fstride*k;
+                if (twidx >= st.ncfft) {
+                    twidx -= st.ncfft;
+                }
+                const whisper_cpx32 t = whisper_fixed_mul(scratch[q], st.twiddles[twidx]);
+                acc.r += t.r;
+                acc.i += t.i;
+            }
+            out[k] = acc;
+            k += m;
+        }
+    }
+}
+
+static void whisper_fixed_work(
+    whisper_cpx32 * out,
+    const whisper_cpx32 * f,
+    const int fstride,
+    const int * factors,
+    const whisper_fixed_fft & st,
+    whisper_cpx32 * scratch) {
+    const int p = *factors++;
+    const int m = *factors++;
+    whisper_cpx32 * out_beg = out;
+    const whisper_cpx32 * out_end = out + p*m;
+    if (m == 1) {
+        do {
+            *out = *f;
+            f += fstride;
+        } while (++out != out_end);
+    } else {
+        do {
+            whisper_fixed_work(out, f, fstride*p, factors, st, scratch);
+            f += fstride;
+        } while ((out += m) != out_end);
+    }
+    whisper_fixed_bfly(out_beg, fstride, st, m, p, scratch);
+}
+
+//real input of st.n points -> st.n/2 + 1 bins of 2*X[k], kiss_fftr() without the halving
+void whisper_fixed_rfft(
+    const whisper_fixed_fft & st,
+    const int32_t * in,
+    whisper_cpx32 * tmp,
+    whisper_cpx32 * out) {
+    whisper_cpx32 scratch[16];
+    //real pairs as complex samples
+    whisper_fixed_work(tmp, (const whisper_cpx32 *) in, 1, st.factors.data(), st, scratch);
+
+    const whisper_cpx32 tdc = tmp[0];
+    out[0].r = 2*(tdc.r + tdc.i);
+    out[0].i = 0;
+    out[st.ncfft].r = 2*(tdc.r - tdc.i);
+    out[st.ncfft].i = 0;
+
+    for (int k = 1; k <= st.ncfft/2; k++) {
+        const whisper_cpx32 fpk = tmp[k];
+        const whisper_cpx32 fpnk = { tmp[st.ncfft - k].r, -tmp[st.ncfft - k].i };
+        const whisper_cpx32 f1k = { fpk.r + fpnk.r, fpk.i + fpnk.i };
+        const whisper_cpx32 f2k = { fpk.r - fpnk.r, fpk.i - fpnk.i };
+        const whisper_cpx32 tw = whisper_fixed_mul(f2k, st.super_twiddles[k - 1]);
+        out[k].r = f1k.r + tw.r;
+        out[k].i = f1k.i + tw.i;
+        out[st.ncfft - k].r = f1k.r - tw.r;
+        out[st.ncfft - k].i = tw.i - f1k.i;
+    }
+}
+
+void whisper_fixed_quantize_filters(
+    const whisper_filters & filters,
+    const int fft_size,
+    whisper_fixed_filters & out) {
+    out.source = &filters;
+    out.n_mel = filters.n_mel;
+    out.n_fft = filters.n_fft;
+    out.begin.assign(out.n_mel, 0);
+    out.end.assign(out.n_mel, 0);
+    out.offset.assign(out.n_mel, 0);
+    out.qbits.assign(out.n_mel, 0);
+    out.weights.clear();
+
+    for (int j = 0; j < out.n_mel; j++) {
+        const float * w = filters.data.data() + j*out.n_fft;
+        int b = out.n_fft;
+        int e = 0;
+        double wmax = 0.0;
+        for (int k = 0; k < out.n_fft; k++) {
+            if (w[k] != 0.0f) {
+                b = std::min(b, k);
+                e = k + 1;
+            }
+            //mirrored half of the spectrum, folded into bins 1 .. n_fft/2 - 1 by the reference
+            wmax = std::max(wmax, fabs(w[k])*((k >= 1 && k < fft_size/2) ? 2.0 : 1.0));
+        }
+        out.offset[j] = out.weights.size();
+        if (b >= e || wmax == 0.0) {
+            continue;
+        }
+        //largest exponent that keeps the biggest weight below 2^15
+        int q = 0;
+        while (wmax*ldexp(1.0, q + 1) < 32768.0) {
+            q++;
+        }
+        while (q > -31 && wmax*ldexp(1.0, q) >= 32768.0) {
+            q--;
+        }
+        out.begin[j] = b;
+        out.end[j] = e;
+        out.qbits[j] = q;
+        for (int k = b; k < e; k++) {
+            const double v = std::max(0.0f, w[k])*((k >= 1 && k < fft_size/2) ? 2.0 : 1.0);
+            out.weights.push_back((uint16_t) floor(ldexp(v, q) + 0.5));
+        }
+    }
+}
+
+//count of significant bits, MostSignificantBit32() in microfrontend/lib/bits.h
+static inline int whisper_fixed_msb32(uint32_t x) {
+    return x ? 32 - __builtin_clz(x) : 0;
+}
+
+//log2(x) in Q16 for x > 0, Log2FractionPart() from log_scale.c on a 64 bit input
+static int32_t whisper_fixed_log2(uint64_t x) {
+    const int integer = 63 - __builtin_clzll(x);
+    //mantissa with the leading one at bit 31
+    const uint32_t mantissa = integer > 31 ? (uint32_t) (x >> (integer - 31))
+                                           : (uint32_t) (x << (31 - integer));
+    const int32_t frac = (int32_t) ((mantissa - 0x80000000u) >> (31 - kLogScaleLog2));
+    const uint32_t base_seg = frac >> (kLogScaleLog2 - kLogSegmentsLog2);
+    const uint32_t seg_unit = (((uint32_t) 1) << kLogScaleLog2) >> kLogSegmentsLog2;
+    const int32_t c0 = kLogLut[base_seg];
+    const int32_t c1 = kLogLut[base_seg + 1];
+    const int32_t seg_base = seg_unit*base_seg;
+    const int32_t rel_pos = ((c1 - c0)*(frac - seg_base)) >> kLogScaleLog2;
+    return (integer << kLogScaleLog2) + frac + c0 + rel_pos;
+}
+
+bool log_mel_spectrogram_fixed(
+    const int16_t * samples,
+    const int n_samples,
+    const int fft_size,
+    const int fft_step,
+    const int n_mel,
+    const int n_threads,
+    const whisper_filters & filters,
+    whisper_mel & mel) {
+
+    static whisper_fixed_fft fft;
+    static std::vector<int32_t> hann;
+    whisper_fixed_filters & fixed_filters = g_whisper_fixed_filters;
+    if (fft.n != fft_size) {
+        if (!whisper_fixed_fft_init(fft, fft_size)) {
+            return false;
+        }
+        hann.resize(fft_size);
+        for (int i = 0; i < fft_size; i++) {
+            hann[i] = (int32_t) floor(0.5*(1.0 - cos((2.0*M_PI*i)/fft_size))*(1 << WHISPER_FIXED_WINDOW_BITS) + 0.5);
+        }
+    }
+    if (fixed_filters.source != &filters || filters.n_fft != fft_size/2 + 1) {
+        if (filters.n_fft != fft_size/2 + 1 || filters.n_mel != n_mel) {
+            return false;
+        }
+        whisper_fixed_quantize_filters(filters, fft_size, fixed_filters);
+    }
+
+    mel.n_mel = n_mel;
+    mel.n_len = n_samples/fft_step;
+    std::vector<int32_t> log2_mel(mel.n_mel*mel.n_len);
+
+    std::vector<int32_t> frame_max(n_threads, INT32_MIN);
+    std::vector<std::thread> workers(n_threads);
+    for (int iw = 0; iw < n_threads; ++iw) {
+        workers[iw] = std::thread([&](int ith) {
+            std::vector<int32_t> in(fft_size);
+            std::vector<whisper_cpx32> tmp(fft.ncfft);
+            std::vector<whisper_cpx32> spectrum(fft.ncfft + 1);
+            std::vector<uint64_t> power(fft.ncfft + 1);
+            int32_t local_max = INT32_MIN;
+
+            for (int i = ith; i < mel.n_len; i += n_threads) {
+                const int offset = i*fft_step;
+
+                // Q15 window, then keep 15 significant bits (block floating point)
+                uint32_t max_abs = 0;
+                for (int j = 0; j < fft_size; j++) {
+                    const int32_t v = offset + j < n_samples ? samples[offset + j]*hann[j] : 0;
+                    in[j] = v;
+                    max_abs = std::max(max_abs, (uint32_t) (v < 0 ? -v : v));
+                }
+                const int shift = std::max(0, whisper_fixed_msb32(max_abs) - 15);
+                if (shift > 0) {
+                    const int32_t round = 1 << (shift - 1);
+                    for (int j = 0; j < fft_size; j++) {
+                        in[j] = (in[j] + round) >> shift;
+                    }
+                }
+
+                whisper_fixed_rfft(fft, in.data(), tmp.data(), spectrum.data());
+                for (int k = 0; k <= fft.ncfft; k++) {
+                    const int64_t re = spectrum[k].r;
+                    const int64_t im = spectrum[k].i;
+                    power[k] = (uint64_t) (re*re + im*im) >> WHISPER_FIXED_POWER_SHIFT;
+                }
+
+                // samples are s*2^15, the window 2^15, the data was shifted down by
+                // shift and the spectrum is 2*X: power = P*2^(62 - 2*shift)
+                const int exponent = WHISPER_FIXED_POWER_SHIFT - 62 + 2*shift;
+                for (int j = 0; j < fixed_filters.n_mel; j++) {
+                    const uint16_t * w = fixed_filters.weights.data() + fixed_filters.offset[j];
+                    uint64_t acc = 0;
+                    for (int k = fixed_filters.begin[j]; k < fixed_filters.end[j]; k++) {
+                        acc += power[k]*(*w++);
+                    }
+                    int32_t v = WHISPER_FIXED_LOG2_FLOOR;
+                    if (acc > 0) {
+                        v = whisper_fixed_log2(acc) + ((exponent - fixed_filters.qbits[j]) << kLogScaleLog2);
+                        v = std::max(v, (int32_t) WHISPER_FIXED_LOG2_FLOOR);
+                    }
+                    log2_mel[j*mel.n_len + i] = v;
+                    local_max = std::max(local_max, v);
+                }
+            }
+            frame_max[ith] = local_max;
+        }, iw);
+    }
+
+    for (int iw = 0; iw < n_threads; ++iw) {
+        workers[iw].join();
+    }
+
+    // log_mel_normalize() in log2 Q16, converted to float on the way out
+    int32_t mmax = INT32_MIN;
+    for (int iw = 0; iw < n_threads; ++iw) {
+        mmax = std::max(mmax, frame_max[iw]);
+    }
+    const int32_t floor_q16 = mmax - WHISPER_FIXED_LOG2_RANGE;
+    const float to_log10 = (float) (0.30102999566398/(1 << kLogScaleLog2));
+
+    mel.data.resize(mel.n_mel*mel.n_len);
+    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+        const int32_t v = std::max(log2_mel[i], floor_q16);
+        mel.data[i] = (v*to_log10 + 4.0f)/4.0f;
+    }
+
+    return true;
+}
@@ -0,0 +1,107 @@
+//Frozen execution plan of the decoder step. The first step of a chunk runs
+//through SignatureRunner::Invoke(); when that leaves the step subgraph with
+//no dynamic node output besides the resource handles of the KV cache
+//variables (an id each, never resized), no delegate buffer handle and data
+//in every node input, the (node, registration) pairs of its execution plan
+//are captured. The following steps call the kernels directly, without the per
+//node prepare index, input data, delegate buffer, cancellation and profiler
+//checks of Subgraph::Invoke().
+//Only the public Subgraph accessors are used, so the fast path works with the
+//prebuilt libtensorflowlite.so. A plan lives for one chunk: nothing resizes,
+//reallocates or re-prepares the decoder between the steps of a chunk.
+#include <utility>
+#include <vector>
+
+#include "tensorflow/lite/core/subgraph.h"
+#include "tensorflow/lite/signature_runner.h"
+
+//false runs every step through SignatureRunner::Invoke()
+bool g_whisper_frozen_plan = true;
+
+struct whisper_frozen_plan {
+    bool captured = false; // a capture was tried, the plan stays empty when it failed
+    tflite::Subgraph * subgraph = nullptr;
+    std::vector<std::pair<TfLiteNode *, const TfLiteRegistration *>> nodes;
+};
+
+//subgraph that owns the tensors of a signature runner
+tflite::Subgraph * whisper_frozen_plan_subgraph(tflite::Interpreter & interpreter, tflite::SignatureRunner & runner) {
+    if (runner.input_size() == 0) {
+        return nullptr;
+    }
+    const TfLiteTensor * input = runner.input_tensor(runner.input_names()[0]);
+    for (size_t i = 0; i < interpreter.subgraphs_size(); i++) {
+        tflite::Subgraph * subgraph = interpreter.subgraph(i);
+        if (input >= subgraph->tensors() && input < subgraph->tensors() + subgraph->tensors_size()) {
+            return subgraph;
+        }
+    }
+    return nullptr;
+}
+
+//captures the plan after a successful Invoke(), leaves it empty when a node
+//could change shapes or needs the checks the frozen path skips
+void whisper_frozen_plan_capture(whisper_frozen_plan & plan, tflite::Interpreter & interpreter,
+                                 tflite::SignatureRunner & runner) {
+    plan.captured = true;
+    plan.nodes.clear();
+    plan.subgraph = whisper_frozen_plan_subgraph(interpreter, runner);
+    if (plan.subgraph == nullptr) {
+        return;
+    }
+    tflite::Subgraph & subgraph = *plan.subgraph;
+    //delegate buffers would have to be synced before their readers
+    for (size_t i = 0; i < subgraph.tensors_size(); i++) {
+        if (subgraph.tensor(i)->buffer_handle != kTfLiteNullBufferHandle) {
+            return;
+        }
+    }
+    std::vector<std::pair<TfLiteNode *, const TfLiteRegistration *>> nodes;
+    nodes.reserve(subgraph.execution_plan().size());
+    for (const int index : subgraph.execution_plan()) {
+        const auto * node = subgraph.node_and_registration(index);
+        if (node == nullptr || node->second.invoke == nullptr || node->second.registration_external != nullptr) {
+            return;
+        }
+        const TfLiteIntArray * inputs = node->first.inputs;
+        for (int i = 0; i < inputs->size; i++) {
+            const TfLiteTensor * t = inputs->data[i] != kTfLiteOptionalTensor ? subgraph.tensor(inputs->data[i]) : nullptr;
+            if (t != nullptr && t->bytes > 0 && t->data.raw == nullptr) {
+                return;
+            }
+        }
+        //a dynamic output can change shape and the nodes after it would have
+        //to be prepared again; dynamic temporaries stay inside their node
+        const TfLiteIntArray * outputs = node->first.outputs;
+        for (int i = 0; i < outputs->size; i++) {
+            const TfLiteTensor * t = subgraph.tensor(outputs->data[i]);
+            if (t->allocation_type == kTfLiteDynamic && t->type != kTfLiteResource) {
+                return;
+            }
+        }
+        nodes.emplace_back(const_cast<TfLiteNode *>(&node->first), &node->second);
+    }
+    plan.nodes = std::move(nodes);
+}
+
+//one step through the frozen plan, or through the runner until a plan is captured
+TfLiteStatus whisper_frozen_plan_invoke(whisper_frozen_plan & plan, tflite::Interpreter & interpreter,
+                                        tflite::SignatureRunner & runner) {
+    if (plan.nodes.empty()) {
+        const TfLiteStatus status = runner.Invoke();
+        //the profiler only sees the regular path
+        if (status == kTfLiteOk && !plan.captured && g_whisper_frozen_plan && !g_whisper_profiling) {
+            whisper_frozen_plan_capture(plan, interpreter, runner);
+        }
+        return status;
+    }
+    TfLiteContext * context = plan.subgraph->context();
+    for (const auto & node : plan.nodes) {
+        const TfLiteStatus status = node.second->invoke(context, node.first);
+        if (status != kTfLiteOk) {
+            plan.nodes.clear();
+            return status;
+        }
+    }
+    return kTfLiteOk;
+}
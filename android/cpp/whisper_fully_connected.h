@@ -0,0 +1,250 @@
+//Hybrid FullyConnected (float activations, int8 weights) of the decoder step
+//as the WhisperFullyConnected custom op. The builtin kernel runs a batch-1
+//hybrid layer as one MatrixBatchVectorMultiplyAccumulate call on one thread
+//(only batches of 8 or more go through ruy and its threads), so every step
+//GEMV, the 51865 x 384 vocabulary projection included, used one core. Here the
+//input row is quantized once and the output rows are split over threads, each
+//slice through the same tensor_utils GEMV of the prebuilt library the builtin
+//calls, so every output is computed exactly as before whatever the thread
+//count. Weights pruned by tools/sparsify.cpp take the sparse GEMV of the
+//library the same way, sliced by rows of equal nonzero blocks. tools/fuse_ops.cpp
+//rewrites the batch-1 layers of the models to use it.
+//
+//  WhisperFullyConnected (input, weights[, bias]) -> output
+//    input float [.., k], weights int8 [n, k] with one scale and no zero point,
+//    dense or 1x16 block sparse (dense rows, CSR column blocks, dense 16 columns),
+//    bias float [n]; output [.., n] with keep_num_dims, [rows, n] otherwise,
+//    no fused activation
+//    custom options (flexbuffer map): asymmetric (quantize the input with a zero
+//    point, as asymmetric_quantize_inputs), keep_num_dims
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "flatbuffers/flexbuffers.h"
+#include "tensorflow/lite/kernels/internal/portable_tensor_utils.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/mutable_op_resolver.h"
+
+#define WHISPER_FULLY_CONNECTED_OP "WhisperFullyConnected"
+
+//multiply-accumulates below which another thread does not pay for itself
+#define WHISPER_FC_MIN_MACS_PER_THREAD (1 << 20)
+
+//output rows of a slice are a multiple of this, the GEMV kernels take rows in
+//pairs (NEON sdot) and fours (SSE)
+#define WHISPER_FC_ROW_ALIGN 4
+
+//columns per block of sparse weights
+#define WHISPER_FC_BLOCK 16
+
+struct whisper_fc_data {
+    bool asymmetric = false;
+    bool keep_num_dims = false;
+    std::vector<int8_t> quantized;  // input rows
+    std::vector<float> scales;      // input scale times the weight scale, per input row
+    std::vector<int32_t> offsets;   // input zero points, per input row
+    std::vector<int32_t> row_sums;  // weight row sums for the zero points
+    //sparse weights: per row the number of nonzero blocks and their column
+    //blocks, and where every row starts in it and in the packed blocks
+    std::vector<uint8_t> ledger;
+    std::vector<int32_t> ledger_rows;
+    std::vector<int32_t> block_rows;
+};
+
+//fn(begin, end) over [0, n_rows) in slices of WHISPER_FC_ROW_ALIGN rows on up to n_threads threads
+template <typename F>
+static void whisper_fc_parallel(const int n_rows, const double macs, const int n_threads, const F & fn) {
+    const int n_blocks = (n_rows + WHISPER_FC_ROW_ALIGN - 1)/WHISPER_FC_ROW_ALIGN;
+    const int n_workers = std::max(1, std::min({n_threads, n_blocks, (int) (macs/WHISPER_FC_MIN_MACS_PER_THREAD)}));
+    if (n_workers == 1) {
+        fn(0, n_rows);
+        return;
+    }
+    const int per_worker = (n_blocks + n_workers - 1)/n_workers*WHISPER_FC_ROW_ALIGN;
+    std::vector<std::thread> workers(n_workers - 1);
+    for (int iw = 1; iw < n_workers; ++iw) {
+        workers[iw - 1] = std::thread(fn, std::min(n_rows, iw*per_worker), std::min(n_rows, (iw + 1)*per_worker));
+    }
+    fn(0, std::min(n_rows, per_worker));
+    for (auto & w : workers) {
+        w.join();
+    }
+}
+
+static void * whisper_fc_init(TfLiteContext *, const char * buffer, size_t length) {
+    whisper_fc_data * data = new whisper_fc_data;
+    if (buffer != nullptr && length > 0) {
+        const flexbuffers::Map & m = flexbuffers::GetRoot(reinterpret_cast<const uint8_t *>(buffer), length).AsMap();
+        data->asymmetric = m["asymmetric"].AsBool();
+        data->keep_num_dims = m["keep_num_dims"].AsBool();
+    }
+    return data;
+}
+
+static void whisper_fc_free(TfLiteContext *, void * buffer) {
+    delete reinterpret_cast<whisper_fc_data *>(buffer);
+}
+
+static const TfLiteTensor * whisper_fc_bias(TfLiteContext * context, TfLiteNode * node) {
+    return tflite::NumInputs(node) == 3 ? tflite::GetOptionalInputTensor(context, node, 2) : nullptr;
+}
+
+//the ledger of the sparse kernel from the CSR of the weights, as the builtin
+static TfLiteStatus whisper_fc_ledger(TfLiteContext * context, const TfLiteSparsity & sparsity, const int n,
+                                      const int k, whisper_fc_data & data) {
+    TF_LITE_ENSURE(context, sparsity.dim_metadata_size == 3 && k % WHISPER_FC_BLOCK == 0 &&
+                            sparsity.dim_metadata[0].format == kTfLiteDimDense &&
+                            sparsity.dim_metadata[1].format == kTfLiteDimSparseCSR &&
+                            sparsity.dim_metadata[2].format == kTfLiteDimDense &&
+                            sparsity.dim_metadata[2].dense_size == WHISPER_FC_BLOCK);
+    const TfLiteIntArray * segments = sparsity.dim_metadata[1].array_segments;
+    const TfLiteIntArray * indices = sparsity.dim_metadata[1].array_indices;
+    TF_LITE_ENSURE(context, segments != nullptr && indices != nullptr && segments->size == n + 1);
+    data.ledger.clear();
+    data.ledger_rows.assign(1, 0);
+    data.block_rows.assign(1, 0);
+    for (int row = 0; row < n; row++) {
+        const int begin = segments->data[row];
+        const int end = segments->data[row + 1];
+        TF_LITE_ENSURE(context, begin <= end && end <= indices->size && end - begin <= UINT8_MAX);
+        data.ledger.push_back((uint8_t) (end - begin));
+        for (int j = begin; j < end; j++) {
+            TF_LITE_ENSURE(context, indices->data[j] >= 0 && indices->data[j] < k/WHISPER_FC_BLOCK &&
+                                    indices->data[j] <= UINT8_MAX);
+            data.ledger.push_back((uint8_t) indices->data[j]);
+        }
+        data.ledger_rows.push_back((int32_t) data.ledger.size());
+        data.block_rows.push_back(end);
+    }
+    return kTfLiteOk;
+}
+
+static TfLiteStatus whisper_fc_prepare(TfLiteContext * context, TfLiteNode * node) {
+    auto & data = *reinterpret_cast<whisper_fc_data *>(node->user_data);
+    TF_LITE_ENSURE(context, tflite::NumInputs(node) == 2 || tflite::NumInputs(node) == 3);
+    TF_LITE_ENSURE_EQ(context, tflite::NumOutputs(node), 1);
+    const TfLiteTensor * input;
+    const TfLiteTensor * weights;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &input));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 1, &weights));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    TF_LITE_ENSURE_TYPES_EQ(context, input->type, kTfLiteFloat32);
+    TF_LITE_ENSURE_TYPES_EQ(context, weights->type, kTfLiteInt8);
+    TF_LITE_ENSURE_TYPES_EQ(context, output->type, kTfLiteFloat32);
+    TF_LITE_ENSURE(context, tflite::IsConstantTensor(weights) && weights->dims->size == 2);
+    TF_LITE_ENSURE_EQ(context, weights->params.zero_point, 0);
+    const int n = weights->dims->data[0];
+    const int k = weights->dims->data[1];
+    TF_LITE_ENSURE(context, input->dims->size >= 1 && input->dims->data[input->dims->size - 1] == k);
+    if (const TfLiteTensor * bias = whisper_fc_bias(context, node)) {
+        TF_LITE_ENSURE_TYPES_EQ(context, bias->type, kTfLiteFloat32);
+        TF_LITE_ENSURE_EQ(context, tflite::NumElements(bias), (int64_t) n);
+    }
+    const int rows = k > 0 ? (int) (tflite::NumElements(input)/k) : 0;
+    data.quantized.resize((size_t) rows*k);
+    data.scales.resize(rows);
+    data.offsets.resize(rows);
+    //the weights are constant, their ledger and row sums are taken once
+    if (weights->sparsity != nullptr && data.ledger_rows.empty()) {
+        TF_LITE_ENSURE_OK(context, whisper_fc_ledger(context, *weights->sparsity, n, k, data));
+        TF_LITE_ENSURE(context, weights->bytes >= (size_t) data.block_rows.back()*WHISPER_FC_BLOCK);
+    }
+    if (data.asymmetric && data.row_sums.empty()) {
+        data.row_sums.resize(n);
+        if (weights->sparsity == nullptr) {
+            tflite::tensor_utils::ReductionSumVector(weights->data.int8, data.row_sums.data(), n, k);
+        } else {
+            for (int row = 0; row < n; row++) {
+                const int8_t * w = weights->data.int8 + (size_t) data.block_rows[row]*WHISPER_FC_BLOCK;
+                const int8_t * end = weights->data.int8 + (size_t) data.block_rows[row + 1]*WHISPER_FC_BLOCK;
+                data.row_sums[row] = std::accumulate(w, end, 0);
+            }
+        }
+    }
+    TfLiteIntArray * dims;
+    if (data.keep_num_dims) {
+        dims = TfLiteIntArrayCopy(input->dims);
+        dims->data[dims->size - 1] = n;
+    } else {
+        dims = TfLiteIntArrayCreate(2);
+        dims->data[0] = rows;
+        dims->data[1] = n;
+    }
+    return context->ResizeTensor(context, output, dims);
+}
+
+static TfLiteStatus whisper_fc_eval(TfLiteContext * context, TfLiteNode * node) {
+    auto & data = *reinterpret_cast<whisper_fc_data *>(node->user_data);
+    const TfLiteTensor * input;
+    const TfLiteTensor * weights;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &input));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 1, &weights));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    const TfLiteTensor * bias = whisper_fc_bias(context, node);
+    const int n = weights->dims->data[0];
+    const int k = weights->dims->data[1];
+    const int rows = (int) data.scales.size();
+    float * out = output->data.f;
+    if (bias != nullptr) {
+        tflite::tensor_utils::VectorBatchVectorAssign(bias->data.f, n, rows, out);
+    } else {
+        std::fill_n(out, (size_t) rows*n, 0.0f);
+    }
+    //as the builtin: an all zero input leaves the bias
+    if (tflite::tensor_utils::IsZeroVector(input->data.f, rows*k)) {
+        return kTfLiteOk;
+    }
+    tflite::tensor_utils::BatchQuantizeFloats(input->data.f, rows, k, data.quantized.data(), data.scales.data(),
+                                              data.offsets.data(), data.asymmetric);
+    for (int r = 0; r < rows; r++) {
+        data.scales[r] *= weights->params.scale;
+    }
+    if (weights->sparsity != nullptr) {
+        //pruned rows keep the same number of blocks, slices by rows are even
+        const double macs = (double) rows*data.block_rows.back()*WHISPER_FC_BLOCK;
+        whisper_fc_parallel(n, macs, std::max(1, context->recommended_num_threads), [&](const int r0, const int r1) {
+            for (int r = 0; r < rows; r++) {
+                float * y = out + (size_t) r*n;
+                //the sparse kernel takes no zero points, the builtin corrects first
+                if (data.asymmetric) {
+                    const float scaled_zp = data.scales[r]*data.offsets[r];
+                    for (int row = r0; row < r1; row++) {
+                        y[row] -= scaled_zp*data.row_sums[row];
+                    }
+                }
+                tflite::tensor_utils::SparseMatrixBatchVectorMultiplyAccumulate(
+                    weights->data.int8 + (size_t) data.block_rows[r0]*WHISPER_FC_BLOCK,
+                    data.ledger.data() + data.ledger_rows[r0], r1 - r0, k, data.quantized.data() + (size_t) r*k,
+                    &data.scales[r], 1, y + r0);
+            }
+        });
+        return kTfLiteOk;
+    }
+    whisper_fc_parallel(n, (double) rows*n*k, std::max(1, context->recommended_num_threads),
+                        [&](const int r0, const int r1) {
+        //row sums are ready, no CpuBackendContext: the kernel never takes the ruy path
+        bool compute_row_sums = false;
+        for (int r = 0; r < rows; r++) {
+            tflite::tensor_utils::MatrixBatchVectorMultiplyAccumulate(
+                weights->data.int8 + (size_t) r0*k, r1 - r0, k, data.quantized.data() + (size_t) r*k,
+                &data.scales[r], 1, out + (size_t) r*n + r0, /*per_channel_scale=*/nullptr,
+                data.asymmetric ? &data.offsets[r] : nullptr, /*scratch=*/nullptr,
+                data.asymmetric ? data.row_sums.data() + r0 : nullptr, &compute_row_sums, /*context=*/nullptr);
+        }
+    });
+    return kTfLiteOk;
+}
+
+void whisper_fc_register_ops(tflite::MutableOpResolver & resolver) {
+    TfLiteRegistration fc = {};
+    fc.init = whisper_fc_init;
+    fc.free = whisper_fc_free;
+    fc.prepare = whisper_fc_prepare;
+    fc.invoke = whisper_fc_eval;
+    resolver.AddCustom(WHISPER_FULLY_CONNECTED_OP, &fc);
+}
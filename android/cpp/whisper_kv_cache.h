@@ -0,0 +1,311 @@
+//Decoder KV cache kept in TFLite resource variables and updated in place.
+//The builtin READ_VARIABLE, DYNAMIC_UPDATE_SLICE and ASSIGN_VARIABLE each copy
+//the whole variable, so a cache written through them costs three full copies
+//per layer and token. The two custom ops of whisper-build-decoder --kv inplace
+//work on the variable storage directly:
+//  WhisperKvUpdate    (handle, slot, pos, value)        writes one row of every head
+//  WhisperKvAttention (q, k handle, v handle, slot, n[, heads])  -> softmax(q k^T) v over rows [0, n)
+//                     [, probs [n_heads, n]: softmax(q k^T) of the listed heads, n constant]
+//Variables are [slots, n_head, n_ctx, 64] float, a slot holds the cache of one
+//beam. The host side below resets, forks and reorders the self attention slots
+//for beam search and counts the cache bytes copied per token.
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/core/interpreter.h"
+#include "tensorflow/lite/core/subgraph.h"
+#include "tensorflow/lite/experimental/resource/resource_variable.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/mutable_op_resolver.h"
+#include "whisper_attention.h"
+
+#define WHISPER_KV_UPDATE_OP    "WhisperKvUpdate"
+#define WHISPER_KV_ATTENTION_OP "WhisperKvAttention"
+
+//variables of the self attention caches are named "blocks.N/self_k" and "blocks.N/self_v"
+#define WHISPER_KV_SELF_SUFFIX_K "/self_k"
+#define WHISPER_KV_SELF_SUFFIX_V "/self_v"
+
+//cache tensor of the variable behind a resource handle, nullptr until assigned
+static TfLiteTensor * whisper_kv_variable(TfLiteContext * context, const TfLiteTensor * handle) {
+    auto * subgraph = reinterpret_cast<tflite::Subgraph *>(context->impl_);
+    tflite::resource::ResourceVariable * variable =
+            tflite::resource::GetResourceVariable(&subgraph->resources(), handle->data.i32[0]);
+    if (variable == nullptr) {
+        return nullptr;
+    }
+    TfLiteTensor * tensor = variable->GetTensor();
+    return tensor != nullptr && tensor->type == kTfLiteFloat32 && tensor->dims->size == 4 ? tensor : nullptr;
+}
+
+static TfLiteStatus whisper_kv_update_prepare(TfLiteContext * context, TfLiteNode * node) {
+    TF_LITE_ENSURE_EQ(context, tflite::NumInputs(node), 4);
+    TF_LITE_ENSURE_EQ(context, tflite::NumOutputs(node), 0);
+    return kTfLiteOk;
+}
+
+static TfLiteStatus whisper_kv_update_eval(TfLiteContext * context, TfLiteNode * node) {
+    const TfLiteTensor * handle;
+    const TfLiteTensor * slot;
+    const TfLiteTensor * pos;
+    const TfLiteTensor * value;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &handle));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 1, &slot));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 2, &pos));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 3, &value));
+    TfLiteTensor * cache = whisper_kv_variable(context, handle);
+    TF_LITE_ENSURE(context, cache != nullptr);
+    const int n_slots = cache->dims->data[0];
+    const int n_head = cache->dims->data[1];
+    const int n_ctx = cache->dims->data[2];
+    const int n_dim = cache->dims->data[3];
+    const int s = slot->data.i32[0];
+    const int p = pos->data.i32[0];
+    TF_LITE_ENSURE(context, s >= 0 && s < n_slots && p >= 0 && p < n_ctx);
+    TF_LITE_ENSURE_EQ(context, tflite::NumElements(value), (int64_t) n_head*n_dim);
+    for (int h = 0; h < n_head; h++) {
+        float * row = cache->data.f + (((size_t) s*n_head + h)*n_ctx + p)*n_dim;
+        memcpy(row, value->data.f + (size_t) h*n_dim, n_dim*sizeof(float));
+    }
+    return kTfLiteOk;
+}
+
+static TfLiteStatus whisper_kv_attention_prepare(TfLiteContext * context, TfLiteNode * node) {
+    const bool with_probs = tflite::NumInputs(node) == 6;
+    TF_LITE_ENSURE(context, tflite::NumInputs(node) == 5 || with_probs);
+    TF_LITE_ENSURE_EQ(context, tflite::NumOutputs(node), with_probs ? 2 : 1);
+    const TfLiteTensor * q;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &q));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    TF_LITE_ENSURE_TYPES_EQ(context, q->type, kTfLiteFloat32);
+    if (with_probs) {
+        const TfLiteTensor * length;
+        const TfLiteTensor * heads;
+        TfLiteTensor * probs;
+        TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 4, &length));
+        TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 5, &heads));
+        TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 1, &probs));
+        TF_LITE_ENSURE(context, tflite::IsConstantTensor(length) && heads->type == kTfLiteInt32);
+        TfLiteIntArray * shape = TfLiteIntArrayCreate(2);
+        shape->data[0] = tflite::NumElements(heads);
+        shape->data[1] = length->data.i32[0];
+        TF_LITE_ENSURE_OK(context, context->ResizeTensor(context, probs, shape));
+    }
+    return context->ResizeTensor(context, output, TfLiteIntArrayCopy(q->dims));
+}
+
+//softmax(q k^T) rows of the listed heads over the first n rows of the slot
+static TfLiteStatus whisper_kv_attention_probs(TfLiteContext * context, const float * q, const TfLiteTensor * keys,
+                                               const int s, const int n, const TfLiteTensor * heads,
+                                               TfLiteTensor * probs) {
+    const int n_head = keys->dims->data[1];
+    const int n_ctx = keys->dims->data[2];
+    const int n_dim = keys->dims->data[3];
+    TF_LITE_ENSURE(context, probs->dims->data[1] == n);
+    for (int i = 0; i < tflite::NumElements(heads); i++) {
+        const int h = heads->data.i32[i];
+        TF_LITE_ENSURE(context, h >= 0 && h < n_head);
+        const float * qh = q + (size_t) h*n_dim;
+        const float * k = keys->data.f + ((size_t) s*n_head + h)*n_ctx*n_dim;
+        float * row = probs->data.f + (size_t) i*n;
+        float max = -INFINITY;
+        for (int j = 0; j < n; j++) {
+            float dot = 0.0f;
+            for (int c = 0; c < n_dim; c++) {
+                dot += qh[c]*k[(size_t) j*n_dim + c];
+            }
+            row[j] = dot;
+            max = std::max(max, dot);
+        }
+        float sum = 0.0f;
+        for (int j = 0; j < n; j++) {
+            row[j] = std::exp(row[j] - max);
+            sum += row[j];
+        }
+        for (int j = 0; j < n; j++) {
+            row[j] /= sum;
+        }
+    }
+    return kTfLiteOk;
+}
+
+//q [.., n_head*64] already scaled by 1/sqrt(64), output has the shape of q
+static TfLiteStatus whisper_kv_attention_eval(TfLiteContext * context, TfLiteNode * node) {
+    const TfLiteTensor * q;
+    const TfLiteTensor * k_handle;
+    const TfLiteTensor * v_handle;
+    const TfLiteTensor * slot;
+    const TfLiteTensor * length;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &q));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 1, &k_handle));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 2, &v_handle));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 3, &slot));
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 4, &length));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    const TfLiteTensor * keys = whisper_kv_variable(context, k_handle);
+    const TfLiteTensor * values = whisper_kv_variable(context, v_handle);
+    TF_LITE_ENSURE(context, keys != nullptr && values != nullptr && TfLiteIntArrayEqual(keys->dims, values->dims));
+    const int n_slots = keys->dims->data[0];
+    const int n_head = keys->dims->data[1];
+    const int n_ctx = keys->dims->data[2];
+    const int n_dim = keys->dims->data[3];
+    const int s = slot->data.i32[0];
+    const int n = std::min(length->data.i32[0], n_ctx);
+    TF_LITE_ENSURE(context, s >= 0 && s < n_slots && n > 0);
+    TF_LITE_ENSURE_EQ(context, tflite::NumElements(q), (int64_t) n_head*n_dim);
+
+    //one query row per head over the first n rows of the slot
+    std::vector<whisper_attention_head> heads(n_head);
+    for (int h = 0; h < n_head; h++) {
+        const size_t offset = ((size_t) s*n_head + h)*n_ctx*n_dim;
+        heads[h].q.data = q->data.f + (size_t) h*n_dim;
+        heads[h].k.data = keys->data.f + offset;
+        heads[h].k.row_stride = n_dim;
+        heads[h].v.data = values->data.f + offset;
+        heads[h].v.row_stride = n_dim;
+        heads[h].out = output->data.f + (size_t) h*n_dim;
+    }
+    whisper_attention_run(heads, 1, n, n_dim, 1.0f, std::max(1, context->recommended_num_threads));
+    if (tflite::NumInputs(node) == 6) {
+        const TfLiteTensor * selected;
+        TfLiteTensor * probs;
+        TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 5, &selected));
+        TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 1, &probs));
+        return whisper_kv_attention_probs(context, q->data.f, keys, s, n, selected, probs);
+    }
+    return kTfLiteOk;
+}
+
+void whisper_kv_register_ops(tflite::MutableOpResolver & resolver) {
+    TfLiteRegistration update = {};
+    update.prepare = whisper_kv_update_prepare;
+    update.invoke = whisper_kv_update_eval;
+    TfLiteRegistration attention = {};
+    attention.prepare = whisper_kv_attention_prepare;
+    attention.invoke = whisper_kv_attention_eval;
+    resolver.AddCustom(WHISPER_KV_UPDATE_OP, &update);
+    resolver.AddCustom(WHISPER_KV_ATTENTION_OP, &attention);
+}
+
+static bool whisper_kv_ends_with(const std::string & name, const char * suffix) {
+    const size_t n = strlen(suffix);
+    return name.size() >= n && name.compare(name.size() - n, n, suffix) == 0;
+}
+
+//initialized self attention cache variables of the interpreter, [slots, n_head, n_ctx, 64]
+std::vector<TfLiteTensor *> whisper_kv_self_caches(tflite::Interpreter & interpreter) {
+    std::vector<TfLiteTensor *> caches;
+    tflite::Subgraph & subgraph = *interpreter.subgraph(0);
+    for (const auto & it : subgraph.resource_ids()) {
+        const std::string & name = it.first.second;
+        if (!whisper_kv_ends_with(name, WHISPER_KV_SELF_SUFFIX_K) && !whisper_kv_ends_with(name, WHISPER_KV_SELF_SUFFIX_V)) {
+            continue;
+        }
+        tflite::resource::ResourceVariable * variable =
+                tflite::resource::GetResourceVariable(&subgraph.resources(), it.second);
+        TfLiteTensor * tensor = variable != nullptr ? variable->GetTensor() : nullptr;
+        if (tensor != nullptr && tensor->type == kTfLiteFloat32 && tensor->dims->size == 4) {
+            caches.push_back(tensor);
+        }
+    }
+    return caches;
+}
+
+//beams the self attention caches hold, 0 before the caches are initialized
+int whisper_kv_slots(tflite::Interpreter & interpreter) {
+    const std::vector<TfLiteTensor *> caches = whisper_kv_self_caches(interpreter);
+    return caches.empty() ? 0 : caches[0]->dims->data[0];
+}
+
+//zeroes the self attention cache of every slot, the cross attention one is kept
+bool whisper_kv_reset(tflite::Interpreter & interpreter) {
+    const std::vector<TfLiteTensor *> caches = whisper_kv_self_caches(interpreter);
+    for (TfLiteTensor * cache : caches) {
+        memset(cache->data.raw, 0, cache->bytes);
+    }
+    return !caches.empty();
+}
+
+//copies the self attention cache of slot src into slot dst
+bool whisper_kv_fork(tflite::Interpreter & interpreter, const int src, const int dst) {
+    const std::vector<TfLiteTensor *> caches = whisper_kv_self_caches(interpreter);
+    for (TfLiteTensor * cache : caches) {
+        const int n_slots = cache->dims->data[0];
+        if (src < 0 || src >= n_slots || dst < 0 || dst >= n_slots) {
+            return false;
+        }
+        const size_t slot_bytes = cache->bytes/n_slots;
+        if (src != dst) {
+            memcpy(cache->data.raw + dst*slot_bytes, cache->data.raw + src*slot_bytes, slot_bytes);
+        }
+    }
+    return !caches.empty();
+}
+
+//slot i takes the cache of slot order[i], e.g. the parents of the surviving beams
+bool whisper_kv_reorder(tflite::Interpreter & interpreter, const std::vector<int> & order) {
+    const std::vector<TfLiteTensor *> caches = whisper_kv_self_caches(interpreter);
+    std::vector<char> copy;
+    for (TfLiteTensor * cache : caches) {
+        const int n_slots = cache->dims->data[0];
+        if ((int) order.size() > n_slots) {
+            return false;
+        }
+        const size_t slot_bytes = cache->bytes/n_slots;
+        copy.assign(cache->data.raw, cache->data.raw + cache->bytes);
+        for (size_t i = 0; i < order.size(); i++) {
+            if (order[i] < 0 || order[i] >= n_slots) {
+                return false;
+            }
+            memcpy(cache->data.raw + i*slot_bytes, copy.data() + order[i]*slot_bytes, slot_bytes);
+        }
+    }
+    return !caches.empty();
+}
+
+//KV cache bytes copied by the operators that run once per token (the WHILE
+//body of a loop decoder, the "step" subgraph of a step decoder): whole
+//variables read, sliced and assigned back by the builtin ops, or the rows
+//written by WhisperKvUpdate. Call after AllocateTensors().
+int64_t whisper_kv_bytes_per_token(tflite::Interpreter & interpreter) {
+    int64_t bytes = 0;
+    for (size_t i = 0; i < interpreter.subgraphs_size(); i++) {
+        tflite::Subgraph & subgraph = *interpreter.subgraph(i);
+        if (subgraph.GetName() != "body" && subgraph.GetName() != "step") {
+            continue;
+        }
+        std::vector<bool> read(subgraph.tensors_size(), false);
+        for (const int index : subgraph.execution_plan()) {
+            const auto * node = subgraph.node_and_registration(index);
+            const TfLiteNode & n = node->first;
+            const TfLiteRegistration & r = node->second;
+            switch (r.builtin_code) {
+                case tflite::BuiltinOperator_READ_VARIABLE:
+                    read[n.outputs->data[0]] = true;
+                    bytes += subgraph.tensor(n.outputs->data[0])->bytes;
+                    break;
+                case tflite::BuiltinOperator_DYNAMIC_UPDATE_SLICE:
+                    if (read[n.inputs->data[0]]) {
+                        bytes += subgraph.tensor(n.outputs->data[0])->bytes;
+                    }
+                    break;
+                case tflite::BuiltinOperator_ASSIGN_VARIABLE:
+                    bytes += subgraph.tensor(n.inputs->data[1])->bytes;
+                    break;
+                case tflite::BuiltinOperator_CUSTOM:
+                    if (r.custom_name != nullptr && strcmp(r.custom_name, WHISPER_KV_UPDATE_OP) == 0) {
+                        bytes += subgraph.tensor(n.inputs->data[3])->bytes;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    return bytes;
+}
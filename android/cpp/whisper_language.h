@@ -0,0 +1,65 @@
+//Languages of the multilingual models. Their tokens follow <|startoftranscript|>
+//in this order, <|en|> is token_sot + 1; the English only models have none.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char * whisper_languages[] = {
+    "en", "zh", "de", "es", "ru", "ko", "fr", "ja", "pt", "tr", "pl", "ca", "nl", "ar", "sv", "it", "id", "hi",
+    "fi", "vi", "he", "uk", "el", "ms", "cs", "ro", "da", "hu", "ta", "no", "th", "ur", "hr", "bg", "lt", "la",
+    "mi", "ml", "cy", "sk", "te", "fa", "lv", "bn", "sr", "az", "sl", "kn", "et", "mk", "br", "eu", "is", "hy",
+    "ne", "mn", "bs", "kk", "sq", "sw", "gl", "mr", "pa", "si", "km", "sn", "yo", "so", "af", "oc", "ka", "be",
+    "tg", "sd", "gu", "am", "yi", "lo", "uz", "fo", "ht", "ps", "tk", "nn", "mt", "sa", "lb", "my", "bo", "tl",
+    "mg", "as", "tt", "haw", "ln", "ha", "ba", "jw", "su",
+};
+
+#define WHISPER_N_LANGUAGES ((int) (sizeof(whisper_languages)/sizeof(whisper_languages[0])))
+
+struct whisper_language_prob {
+    int language = 0; // index in whisper_languages
+    float prob = 0.0f;
+};
+
+//index of a language code, -1 when the models do not know it
+inline int whisper_language_from_code(const char * code) {
+    for (int i = 0; i < WHISPER_N_LANGUAGES; i++) {
+        if (strcmp(code, whisper_languages[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//softmax over the logits of the language tokens only, from token_sot + 1 on; best first
+inline void whisper_language_rank(const float * logits, const int token_sot, std::vector<whisper_language_prob> & ranked) {
+    ranked.resize(WHISPER_N_LANGUAGES);
+    const float * lang = logits + token_sot + 1;
+    const float max = *std::max_element(lang, lang + WHISPER_N_LANGUAGES);
+    float sum = 0.0f;
+    for (int i = 0; i < WHISPER_N_LANGUAGES; i++) {
+        ranked[i].language = i;
+        ranked[i].prob = std::exp(lang[i] - max);
+        sum += ranked[i].prob;
+    }
+    for (whisper_language_prob & p : ranked) {
+        p.prob /= sum;
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [](const whisper_language_prob & a, const whisper_language_prob & b) {
+        return a.prob > b.prob;
+    });
+}
+
+//[{"language": "en", "probability": 0.97}, ...] best first
+inline std::string whisper_language_json(const std::vector<whisper_language_prob> & ranked) {
+    std::string json = "[";
+    char entry[64];
+    for (size_t i = 0; i < ranked.size(); i++) {
+        snprintf(entry, sizeof(entry), "%s{\"language\": \"%s\", \"probability\": %.6f}", i > 0 ? ", " : "",
+                 whisper_languages[ranked[i].language], ranked[i].prob);
+        json += entry;
+    }
+    return json + "]";
+}
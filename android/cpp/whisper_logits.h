@@ -0,0 +1,312 @@
+//Logit processing of a decoder step in one pass over the vocabulary, instead
+//of a softmax over all of it followed by a sort: suppressed tokens, the
+//timestamp rules of openai-whisper (ApplyTimestampRules) and whisper.cpp, the
+//log-sum-exp and the top k tokens. The logits are read in chunks that stay in
+//cache while their max, exp sum and top k candidates are taken, nothing is
+//written back. Suppressed tokens and the ranges the timestamp rules exclude
+//are skipped rather than masked.
+//
+//  whisper_logits_process() on the host, or the custom op
+//  WhisperLogits (logits [.., n_vocab][, tokens [.., n] int32]) -> (ids [.., k] int32[, logprobs [.., k]])
+//    tokens  the tokens sampled so far in each row (after the prompt), for the
+//            timestamp rules; negative entries are padding
+//    ids and logprobs are ordered like TOPK_V2: best first, lower ids first on
+//    ties, so k = 1 is the ARG_MAX of the unsuppressed logits; rows with fewer
+//    than k allowed tokens are padded with -1 and -inf
+//    custom options (flexbuffer map): k (default 1), suppress (token ids),
+//    timestamps (bool), token_eot, token_beg, max_initial_timestamp (default 50)
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "flatbuffers/flexbuffers.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/mutable_op_resolver.h"
+#include "whisper_attention.h"
+
+#define WHISPER_LOGITS_OP "WhisperLogits"
+
+//logits whose max, exps and candidates are taken while they are in L1
+#define WHISPER_LOGITS_CHUNK 256
+
+struct whisper_logits_params {
+    int k = 1;
+    std::vector<int32_t> suppress;     // token ids never selected, in any order
+    bool timestamps = false;           // apply the timestamp rules, needs token_eot and token_beg
+    int32_t token_eot = -1;
+    int32_t token_beg = -1;            // first timestamp token, timestamps run to the end of the vocabulary
+    int max_initial_timestamp = 50;    // last timestamp the first token may be (20 ms each), -1 for any
+};
+
+struct whisper_logit {
+    int32_t id;
+    float logprob;
+};
+
+//log-sum-exp and top k of the logits scanned so far, top holds raw logits
+struct whisper_logits_stats {
+    float max = -INFINITY;
+    float sum = 0.0f;  // sum of exp(x - max)
+    std::vector<whisper_logit> top;
+
+    float lse() const {
+        return max + std::log(sum);
+    }
+
+    //keeps the k best, an equal logit of a later id goes behind
+    void offer(const int k, const int32_t id, const float x) {
+        if ((int) top.size() == k && !(x > top.back().logprob)) {
+            return;
+        }
+        auto it = std::upper_bound(top.begin(), top.end(), x,
+                                   [](const float v, const whisper_logit & l) { return v > l.logprob; });
+        top.insert(it, {id, x});
+        if ((int) top.size() > k) {
+            top.pop_back();
+        }
+    }
+};
+
+static inline float whisper_logits_hmax(const whisper_attention_vec v) {
+    float lanes[WHISPER_ATTENTION_LANES];
+    whisper_attention_store(lanes, v);
+    return *std::max_element(lanes, lanes + WHISPER_ATTENTION_LANES);
+}
+
+//x[begin, end) into the stats, chunk by chunk
+static void whisper_logits_scan(const float * x, const int64_t begin, const int64_t end, const int k,
+                                whisper_logits_stats & stats) {
+    const int L = WHISPER_ATTENTION_LANES;
+    float buf[WHISPER_LOGITS_CHUNK];
+    for (int64_t c0 = begin; c0 < end; c0 += WHISPER_LOGITS_CHUNK) {
+        const int n = (int) std::min<int64_t>(WHISPER_LOGITS_CHUNK, end - c0);
+        const float * chunk = x + c0;
+        whisper_attention_vec vmax = whisper_attention_splat(-INFINITY);
+        int i = 0;
+        for (; i + L <= n; i += L) {
+            vmax = whisper_attention_max(vmax, whisper_attention_load(chunk + i));
+        }
+        float cmax = whisper_logits_hmax(vmax);
+        for (; i < n; i++) {
+            cmax = std::max(cmax, chunk[i]);
+        }
+        if (!(cmax > -INFINITY)) {
+            continue;
+        }
+        //exp sum relative to the running max
+        if (cmax > stats.max) {
+            stats.sum *= whisper_attention_exp1(stats.max - cmax);
+            stats.max = cmax;
+        }
+        const whisper_attention_vec m = whisper_attention_splat(stats.max);
+        for (i = 0; i + L <= n; i += L) {
+            whisper_attention_store(buf + i, whisper_attention_sub(whisper_attention_load(chunk + i), m));
+        }
+        for (; i < n; i++) {
+            buf[i] = chunk[i] - stats.max;
+        }
+        whisper_attention_exp(buf, n);
+        whisper_attention_vec acc = whisper_attention_splat(0.0f);
+        for (i = 0; i + L <= n; i += L) {
+            acc = whisper_attention_add(acc, whisper_attention_load(buf + i));
+        }
+        float sum = whisper_attention_sum(acc);
+        for (; i < n; i++) {
+            sum += buf[i];
+        }
+        stats.sum += sum;
+        //candidates only from chunks that beat the current k-th best
+        if ((int) stats.top.size() < k || cmax > stats.top.back().logprob) {
+            for (i = 0; i < n; i++) {
+                stats.offer(k, (int32_t) (c0 + i), chunk[i]);
+            }
+        }
+    }
+}
+
+//token ranges [begin, end) the timestamp rules exclude, given the sampled tokens
+static void whisper_logits_timestamp_rules(const whisper_logits_params & params, const int n_vocab,
+                                           const int32_t * tokens, const int n_tokens,
+                                           std::vector<std::pair<int64_t, int64_t>> & excluded) {
+    const int32_t beg = params.token_beg;
+    std::vector<int32_t> seq;
+    for (int i = 0; i < n_tokens; i++) {
+        if (tokens[i] >= 0) {
+            seq.push_back(tokens[i]);
+        }
+    }
+    const int n = (int) seq.size();
+    //timestamps come in pairs, except directly before EOT
+    const bool last_was_timestamp = n >= 1 && seq[n - 1] >= beg;
+    const bool penultimate_was_timestamp = n < 2 || seq[n - 2] >= beg;
+    if (last_was_timestamp) {
+        if (penultimate_was_timestamp) {
+            excluded.push_back({beg, n_vocab});
+        } else {
+            excluded.push_back({0, params.token_eot});
+        }
+    }
+    //timestamps do not decrease, and a segment is not empty
+    for (int i = n - 1; i >= 0; i--) {
+        if (seq[i] >= beg) {
+            const int64_t last = last_was_timestamp && !penultimate_was_timestamp ? seq[i] : seq[i] + 1;
+            excluded.push_back({beg, last});
+            break;
+        }
+    }
+    //the first token is a timestamp, and not a late one
+    if (n == 0) {
+        excluded.push_back({0, beg});
+        if (params.max_initial_timestamp >= 0) {
+            excluded.push_back({(int64_t) beg + params.max_initial_timestamp + 1, n_vocab});
+        }
+    }
+}
+
+//top k tokens of one row of logits with their log probabilities, best first;
+//tokens/n_tokens are the tokens sampled so far, read by the timestamp rules only
+static void whisper_logits_process(const float * logits, const int n_vocab, const whisper_logits_params & params,
+                                   const int32_t * tokens, const int n_tokens, std::vector<whisper_logit> & top) {
+    const bool timestamps = params.timestamps && params.token_beg >= 0 && params.token_beg < n_vocab;
+    std::vector<std::pair<int64_t, int64_t>> excluded;
+    for (const int32_t id : params.suppress) {
+        excluded.push_back({id, (int64_t) id + 1});
+    }
+    if (timestamps) {
+        whisper_logits_timestamp_rules(params, n_vocab, tokens, n_tokens, excluded);
+    }
+    std::sort(excluded.begin(), excluded.end());
+
+    //the allowed ranges between the excluded ones, text and timestamps apart
+    const int64_t beg = timestamps ? params.token_beg : n_vocab;
+    whisper_logits_stats text;
+    whisper_logits_stats times;
+    int64_t next = 0;
+    auto scan = [&](const int64_t begin, const int64_t end) {
+        whisper_logits_scan(logits, begin, std::min(end, beg), params.k, text);
+        whisper_logits_scan(logits, std::max(begin, beg), end, params.k, times);
+    };
+    for (const auto & range : excluded) {
+        const int64_t end = std::min<int64_t>(range.first, n_vocab);
+        if (end > next) {
+            scan(next, end);
+        }
+        next = std::max(next, range.second);
+    }
+    if (next < n_vocab) {
+        scan(next, n_vocab);
+    }
+
+    //when the timestamps together are likelier than any text token, one of them is next
+    float lse;
+    top.clear();
+    if (timestamps && times.sum > 0.0f && (text.top.empty() || times.lse() > text.max)) {
+        lse = times.lse();
+        top = times.top;
+    } else {
+        const float max = std::max(text.max, times.max);
+        float sum = 0.0f;
+        for (const whisper_logits_stats * s : {&text, &times}) {
+            sum += s->sum > 0.0f ? s->sum*whisper_attention_exp1(s->max - max) : 0.0f;
+        }
+        lse = max + std::log(sum);
+        std::merge(text.top.begin(), text.top.end(), times.top.begin(), times.top.end(), std::back_inserter(top),
+                   [](const whisper_logit & a, const whisper_logit & b) { return a.logprob > b.logprob; });
+        top.resize(std::min<size_t>(top.size(), params.k));
+    }
+    for (whisper_logit & l : top) {
+        l.logprob -= lse;
+    }
+}
+
+static void * whisper_logits_init(TfLiteContext *, const char * buffer, size_t length) {
+    whisper_logits_params * params = new whisper_logits_params;
+    if (buffer != nullptr && length > 0) {
+        const flexbuffers::Map & m = flexbuffers::GetRoot(reinterpret_cast<const uint8_t *>(buffer), length).AsMap();
+        params->k = m["k"].IsNull() ? 1 : m["k"].AsInt32();
+        const flexbuffers::TypedVector suppress = m["suppress"].AsTypedVector();
+        for (size_t i = 0; i < suppress.size(); i++) {
+            params->suppress.push_back(suppress[i].AsInt32());
+        }
+        params->timestamps = m["timestamps"].AsBool();
+        params->token_eot = m["token_eot"].IsNull() ? -1 : m["token_eot"].AsInt32();
+        params->token_beg = m["token_beg"].IsNull() ? -1 : m["token_beg"].AsInt32();
+        params->max_initial_timestamp = m["max_initial_timestamp"].IsNull() ? 50 : m["max_initial_timestamp"].AsInt32();
+    }
+    return params;
+}
+
+static void whisper_logits_free(TfLiteContext *, void * buffer) {
+    delete reinterpret_cast<whisper_logits_params *>(buffer);
+}
+
+static TfLiteStatus whisper_logits_prepare(TfLiteContext * context, TfLiteNode * node) {
+    const auto & params = *reinterpret_cast<const whisper_logits_params *>(node->user_data);
+    TF_LITE_ENSURE(context, tflite::NumInputs(node) == 1 || tflite::NumInputs(node) == 2);
+    TF_LITE_ENSURE(context, tflite::NumOutputs(node) == 1 || tflite::NumOutputs(node) == 2);
+    const TfLiteTensor * logits;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &logits));
+    TF_LITE_ENSURE_TYPES_EQ(context, logits->type, kTfLiteFloat32);
+    const int rank = logits->dims->size;
+    TF_LITE_ENSURE(context, rank >= 1);
+    TF_LITE_ENSURE(context, params.k >= 1 && params.k <= logits->dims->data[rank - 1]);
+    TF_LITE_ENSURE(context, !params.timestamps || (params.token_eot >= 0 && params.token_beg > params.token_eot));
+    if (tflite::NumInputs(node) == 2) {
+        //one row of sampled tokens per row of logits
+        const TfLiteTensor * tokens;
+        TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 1, &tokens));
+        TF_LITE_ENSURE_TYPES_EQ(context, tokens->type, kTfLiteInt32);
+        TF_LITE_ENSURE(context, tokens->dims->size >= 1);
+        const int n = tokens->dims->data[tokens->dims->size - 1];
+        const int n_vocab = logits->dims->data[rank - 1];
+        TF_LITE_ENSURE_EQ(context, n > 0 ? tflite::NumElements(tokens)/n : 0,
+                          n_vocab > 0 ? tflite::NumElements(logits)/n_vocab : 0);
+    }
+    const TfLiteType types[2] = {kTfLiteInt32, kTfLiteFloat32};
+    for (int i = 0; i < tflite::NumOutputs(node); i++) {
+        TfLiteTensor * output;
+        TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, i, &output));
+        TF_LITE_ENSURE_TYPES_EQ(context, output->type, types[i]);
+        TfLiteIntArray * dims = TfLiteIntArrayCopy(logits->dims);
+        dims->data[rank - 1] = params.k;
+        TF_LITE_ENSURE_OK(context, context->ResizeTensor(context, output, dims));
+    }
+    return kTfLiteOk;
+}
+
+static TfLiteStatus whisper_logits_eval(TfLiteContext * context, TfLiteNode * node) {
+    const auto & params = *reinterpret_cast<const whisper_logits_params *>(node->user_data);
+    const TfLiteTensor * logits;
+    TfLiteTensor * ids;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &logits));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &ids));
+    const TfLiteTensor * tokens = tflite::NumInputs(node) == 2 ? tflite::GetInput(context, node, 1) : nullptr;
+    TfLiteTensor * logprobs = tflite::NumOutputs(node) == 2 ? tflite::GetOutput(context, node, 1) : nullptr;
+    const int n_vocab = logits->dims->data[logits->dims->size - 1];
+    const int n_tokens = tokens != nullptr ? tokens->dims->data[tokens->dims->size - 1] : 0;
+    const int64_t n_rows = n_vocab > 0 ? tflite::NumElements(logits)/n_vocab : 0;
+    std::vector<whisper_logit> top;
+    for (int64_t r = 0; r < n_rows; r++) {
+        whisper_logits_process(logits->data.f + r*n_vocab, n_vocab, params,
+                               tokens != nullptr ? tokens->data.i32 + r*n_tokens : nullptr, n_tokens, top);
+        for (int i = 0; i < params.k; i++) {
+            const bool found = i < (int) top.size();
+            ids->data.i32[r*params.k + i] = found ? top[i].id : -1;
+            if (logprobs != nullptr) {
+                logprobs->data.f[r*params.k + i] = found ? top[i].logprob : -INFINITY;
+            }
+        }
+    }
+    return kTfLiteOk;
+}
+
+void whisper_logits_register_ops(tflite::MutableOpResolver & resolver) {
+    TfLiteRegistration logits = {};
+    logits.init = whisper_logits_init;
+    logits.free = whisper_logits_free;
+    logits.prepare = whisper_logits_prepare;
+    logits.invoke = whisper_logits_eval;
+    resolver.AddCustom(WHISPER_LOGITS_OP, &logits);
+}
@@ -0,0 +1,208 @@
+//Model and vocab files mapped from storage instead of copied into the heap.
+//Assets stored uncompressed in the APK (noCompress in android/build.gradle)
+//are mapped in place through AAsset_openFileDescriptor64(). A compressed asset
+//has no file descriptor; it is extracted once into g_whisper_model_cache_dir,
+//the copy is hashed against the asset stream and mapped from then on. A stamp
+//next to the copy keeps the length and hash of the asset stream and
+//g_whisper_model_cache_key; later launches map the copy when the length and
+//the key match the installed app and the copy still hashes to the asset, so
+//they do not read the asset at all.
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android/asset_manager.h>
+#include <android/log.h>
+
+#include "tensorflow/lite/allocation.h"
+#include "tensorflow/lite/stderr_reporter.h"
+
+//directory of the extracted assets, empty only maps the uncompressed ones
+std::string g_whisper_model_cache_dir;
+//changes with every install or update of the app, older copies are extracted again
+std::string g_whisper_model_cache_key;
+//false reads every asset into the heap
+bool g_whisper_mmap_models = true;
+
+//where the files of the last whisper_load() came from
+struct whisper_model_cache_stats {
+    int mapped_apk = 0;   // mapped in place from the APK
+    int mapped_cache = 0; // mapped from an extracted copy
+    int extracted = 0;    // copies written by this load
+    int heap = 0;         // read into the heap
+    int64_t extract_us = 0;
+};
+
+whisper_model_cache_stats g_whisper_model_cache;
+
+static uint64_t whisper_model_cache_hash(uint64_t hash, const char * data, const size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (uint8_t) data[i])*1099511628211ull;
+    }
+    return hash;
+}
+
+#define WHISPER_MODEL_CACHE_HASH_SEED 14695981039346656037ull
+
+//read only mapping of length bytes of fd from offset on, nullptr when it fails
+static std::unique_ptr<tflite::Allocation> whisper_model_cache_map_fd(const int fd, const size_t offset, const size_t length) {
+    std::unique_ptr<tflite::Allocation> mapped(
+        new tflite::MMAPAllocation(fd, offset, length, tflite::DefaultErrorReporter()));
+    if (!static_cast<tflite::MMAPAllocation *>(mapped.get())->valid()) {
+        return nullptr;
+    }
+    return mapped;
+}
+
+static std::unique_ptr<tflite::Allocation> whisper_model_cache_map_file(const std::string & path, const size_t length) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    std::unique_ptr<tflite::Allocation> mapped;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size == length) {
+        mapped = whisper_model_cache_map_fd(fd, 0, length);
+    }
+    close(fd);
+    return mapped;
+}
+
+static std::string whisper_model_cache_stamp(const size_t length, const uint64_t hash) {
+    char stamp[128];
+    snprintf(stamp, sizeof(stamp), "%zu %016llx %s", length, (unsigned long long) hash,
+             g_whisper_model_cache_key.c_str());
+    return stamp;
+}
+
+//the copy mapped when its stamp matches the asset length and the app key and
+//the mapped bytes hash to the asset stream hash stored in the stamp, nullptr
+//when the copy has to be extracted again
+static std::unique_ptr<tflite::Allocation> whisper_model_cache_verified(const std::string & path,
+                                                                      const std::string & stamp_path,
+                                                                      const size_t length) {
+    FILE * file = fopen(stamp_path.c_str(), "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    char stamp[128] = {};
+    const size_t n = fread(stamp, 1, sizeof(stamp) - 1, file);
+    fclose(file);
+    size_t stamp_length = 0;
+    unsigned long long hash = 0;
+    if (sscanf(stamp, "%zu %llx", &stamp_length, &hash) != 2 || stamp_length != length ||
+        std::string(stamp, n) != whisper_model_cache_stamp(length, hash)) {
+        return nullptr;
+    }
+    std::unique_ptr<tflite::Allocation> copy = whisper_model_cache_map_file(path, length);
+    if (copy == nullptr ||
+        whisper_model_cache_hash(WHISPER_MODEL_CACHE_HASH_SEED, (const char *) copy->base(), length) != hash) {
+        return nullptr;
+    }
+    return copy;
+}
+
+//copies the asset to path through a temporary file, checks the copy against
+//the hash of the asset stream, then writes the stamp
+static bool whisper_model_cache_extract(AAsset * asset, const size_t length, const std::string & path,
+                                        const std::string & stamp_path) {
+    const std::string tmp_path = path + ".tmp";
+    unlink(stamp_path.c_str());
+    FILE * file = fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::vector<char> chunk(1 << 20);
+    uint64_t hash = WHISPER_MODEL_CACHE_HASH_SEED;
+    size_t copied = 0;
+    bool ok = true;
+    while (ok && copied < length) {
+        const int n = AAsset_read(asset, chunk.data(), std::min(chunk.size(), length - copied));
+        ok = n > 0 && fwrite(chunk.data(), 1, n, file) == (size_t) n;
+        if (ok) {
+            hash = whisper_model_cache_hash(hash, chunk.data(), n);
+            copied += n;
+        }
+    }
+    ok = fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    if (ok) {
+        std::unique_ptr<tflite::Allocation> copy = whisper_model_cache_map_file(tmp_path, length);
+        ok = copy != nullptr &&
+             whisper_model_cache_hash(WHISPER_MODEL_CACHE_HASH_SEED, (const char *) copy->base(), length) == hash;
+    }
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    file = fopen(stamp_path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    const std::string stamp = whisper_model_cache_stamp(length, hash);
+    ok = fwrite(stamp.data(), 1, stamp.size(), file) == stamp.size();
+    return fclose(file) == 0 && ok;
+}
+
+//maps an asset in place or through its extracted copy; nullptr when neither
+//works, the caller reads it into the heap then
+std::unique_ptr<tflite::Allocation> whisper_model_cache_open(AAssetManager * mgr, const char * name) {
+    if (!g_whisper_mmap_models) {
+        return nullptr;
+    }
+    AAsset * asset = AAssetManager_open(mgr, name, AASSET_MODE_STREAMING);
+    if (asset == nullptr) {
+        return nullptr;
+    }
+    std::unique_ptr<tflite::Allocation> mapped;
+    off64_t start = 0;
+    off64_t length = 0;
+    const int fd = AAsset_openFileDescriptor64(asset, &start, &length);
+    if (fd >= 0) {
+        mapped = whisper_model_cache_map_fd(fd, start, length);
+        close(fd);
+        if (mapped != nullptr) {
+            g_whisper_model_cache.mapped_apk++;
+        }
+    } else if (!g_whisper_model_cache_dir.empty()) {
+        length = AAsset_getLength64(asset);
+        const std::string path = g_whisper_model_cache_dir + "/" + name;
+        const std::string stamp_path = path + ".stamp";
+        mapped = whisper_model_cache_verified(path, stamp_path, length);
+        if (mapped == nullptr) {
+            const auto t_start = std::chrono::steady_clock::now();
+            const bool extracted = whisper_model_cache_extract(asset, length, path, stamp_path);
+            g_whisper_model_cache.extract_us += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - t_start).count();
+            g_whisper_model_cache.extracted += extracted;
+            if (!extracted) {
+                __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: failed to extract '%s' to '%s'\n",
+                                    __func__, name, path.c_str());
+            }
+            mapped = extracted ? whisper_model_cache_map_file(path, length) : nullptr;
+        }
+        if (mapped != nullptr) {
+            g_whisper_model_cache.mapped_cache++;
+        }
+    }
+    AAsset_close(asset);
+    return mapped;
+}
+
+//where the model files come from as JSON
+std::string whisper_model_cache_json() {
+    char json[256];
+    snprintf(json, sizeof(json),
+             "{\"mapped_apk\": %d, \"mapped_cache\": %d, \"extracted\": %d, \"heap\": %d, \"extract_ms\": %.1f}",
+             g_whisper_model_cache.mapped_apk, g_whisper_model_cache.mapped_cache, g_whisper_model_cache.extracted,
+             g_whisper_model_cache.heap, g_whisper_model_cache.extract_us/1000.0);
+    return json;
+}
@@ -0,0 +1,265 @@
+//Fused LayerNorm and GELU of the converted Whisper models as custom ops.
+//The converter leaves each LayerNorm as MEAN -> SUB -> MUL (square) -> MEAN
+//-> ADD eps -> RSQRT -> MUL [-> MUL gamma -> ADD beta] and each GELU as
+//[MUL 1/sqrt(2) ->] FlexErf -> ADD 1 -> MUL [-> MUL 0.5], every op a full
+//pass over the activations with its own arena tensor. Here a LayerNorm row
+//is read from memory once (the statistics are taken over the row while it is
+//in cache) and written once, a GELU element likewise.
+//tools/fuse_ops.cpp rewrites the models to use them.
+//
+//  WhisperLayerNorm (x[, gamma[, beta]]) -> (x - mean)/sqrt(var + eps)*gamma + beta
+//    over the last dim of x, gamma and beta hold one value per column,
+//    custom options (flexbuffer map): eps (default 1e-5)
+//  WhisperGelu (a[, b]) -> alpha*a*(1 + erf(beta*b)), b defaults to a,
+//    custom options (flexbuffer map): alpha, beta (default 0.5 and 1/sqrt(2),
+//    the exact GELU of a)
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "flatbuffers/flexbuffers.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/mutable_op_resolver.h"
+#include "whisper_attention.h"
+
+#define WHISPER_LAYER_NORM_OP "WhisperLayerNorm"
+#define WHISPER_GELU_OP       "WhisperGelu"
+
+//elements below which another thread does not pay for itself
+#define WHISPER_NORM_MIN_ELEMENTS_PER_THREAD (1 << 16)
+
+//erf saturates to +-1 in float beyond this
+#define WHISPER_NORM_ERF_MAX 4.0f
+
+//fn(begin, end) over contiguous ranges of [0, n_rows) on up to n_threads threads
+template <typename F>
+static void whisper_norm_parallel(const int64_t n_rows, const int64_t row_size, const int n_threads, const F & fn) {
+    const int64_t by_size = n_rows*row_size/WHISPER_NORM_MIN_ELEMENTS_PER_THREAD;
+    const int n_workers = (int) std::max<int64_t>(1, std::min<int64_t>({(int64_t) n_threads, n_rows, by_size}));
+    if (n_workers == 1) {
+        fn(0, n_rows);
+        return;
+    }
+    const int64_t per_worker = (n_rows + n_workers - 1)/n_workers;
+    std::vector<std::thread> workers(n_workers - 1);
+    for (int iw = 1; iw < n_workers; ++iw) {
+        workers[iw - 1] = std::thread(fn, std::min(n_rows, iw*per_worker), std::min(n_rows, (iw + 1)*per_worker));
+    }
+    fn(0, std::min(n_rows, per_worker));
+    for (auto & w : workers) {
+        w.join();
+    }
+}
+
+//one row of the layer norm, gamma and beta may be nullptr
+static void whisper_layer_norm_row(const float * x, float * y, const int n, const float eps,
+                                   const float * gamma, const float * beta) {
+    const int L = WHISPER_ATTENTION_LANES;
+    whisper_attention_vec acc = whisper_attention_splat(0.0f);
+    int i = 0;
+    for (; i + L <= n; i += L) {
+        acc = whisper_attention_add(acc, whisper_attention_load(x + i));
+    }
+    float sum = whisper_attention_sum(acc);
+    for (; i < n; i++) {
+        sum += x[i];
+    }
+    const float mean = sum/n;
+    //the variance from the centered values, the row is still in cache
+    const whisper_attention_vec m = whisper_attention_splat(mean);
+    acc = whisper_attention_splat(0.0f);
+    for (i = 0; i + L <= n; i += L) {
+        const whisper_attention_vec d = whisper_attention_sub(whisper_attention_load(x + i), m);
+        acc = whisper_attention_fma(acc, d, d);
+    }
+    float sq = whisper_attention_sum(acc);
+    for (; i < n; i++) {
+        sq += (x[i] - mean)*(x[i] - mean);
+    }
+    const float rstd = 1.0f/std::sqrt(sq/n + eps);
+    const whisper_attention_vec r = whisper_attention_splat(rstd);
+    for (i = 0; i + L <= n; i += L) {
+        whisper_attention_vec v = whisper_attention_mul(whisper_attention_sub(whisper_attention_load(x + i), m), r);
+        if (gamma != nullptr) {
+            v = whisper_attention_mul(v, whisper_attention_load(gamma + i));
+        }
+        if (beta != nullptr) {
+            v = whisper_attention_add(v, whisper_attention_load(beta + i));
+        }
+        whisper_attention_store(y + i, v);
+    }
+    for (; i < n; i++) {
+        float v = (x[i] - mean)*rstd;
+        if (gamma != nullptr) {
+            v *= gamma[i];
+        }
+        if (beta != nullptr) {
+            v += beta[i];
+        }
+        y[i] = v;
+    }
+}
+
+//erf(x) as the odd rational function of Eigen's float erf on [-4, 4]:
+//x*p(x^2)/q(x^2), within 5e-7 of std::erf
+#define WHISPER_NORM_ERF_P { -2.72614225801306e-10f, 2.77068142495902e-08f, -2.10102402082508e-06f, \
+                             -5.69250639462346e-05f, -7.34990630326855e-04f, -2.95459980854025e-03f, \
+                             -1.60960333262415e-02f }
+#define WHISPER_NORM_ERF_Q { -1.45660718464996e-05f, -2.13374055278905e-04f, -1.68282697438203e-03f, \
+                             -7.37332916720468e-03f, -1.42647390514189e-02f }
+
+static inline float whisper_norm_erf1(const float x) {
+    static const float p_coef[] = WHISPER_NORM_ERF_P;
+    static const float q_coef[] = WHISPER_NORM_ERF_Q;
+    const float v = std::min(std::max(x, -WHISPER_NORM_ERF_MAX), WHISPER_NORM_ERF_MAX);
+    const float v2 = v*v;
+    float p = p_coef[0];
+    for (int i = 1; i < 7; i++) {
+        p = p*v2 + p_coef[i];
+    }
+    float q = q_coef[0];
+    for (int i = 1; i < 5; i++) {
+        q = q*v2 + q_coef[i];
+    }
+    return v*p/q;
+}
+
+//y[i] = alpha*a[i]*(1 + erf(beta*b[i])) for i < n
+static void whisper_gelu(const float * a, const float * b, float * y, const int64_t n,
+                         const float alpha, const float beta) {
+    static const float p_coef[] = WHISPER_NORM_ERF_P;
+    static const float q_coef[] = WHISPER_NORM_ERF_Q;
+    const int L = WHISPER_ATTENTION_LANES;
+    const whisper_attention_vec va = whisper_attention_splat(alpha);
+    const whisper_attention_vec vb = whisper_attention_splat(beta);
+    const whisper_attention_vec lo = whisper_attention_splat(-WHISPER_NORM_ERF_MAX);
+    const whisper_attention_vec hi = whisper_attention_splat(WHISPER_NORM_ERF_MAX);
+    int64_t i = 0;
+    for (; i + L <= n; i += L) {
+        const whisper_attention_vec x = whisper_attention_mul(whisper_attention_load(b + i), vb);
+        const whisper_attention_vec v = whisper_attention_min(whisper_attention_max(x, lo), hi);
+        const whisper_attention_vec v2 = whisper_attention_mul(v, v);
+        whisper_attention_vec p = whisper_attention_splat(p_coef[0]);
+        for (int k = 1; k < 7; k++) {
+            p = whisper_attention_fma(whisper_attention_splat(p_coef[k]), p, v2);
+        }
+        whisper_attention_vec q = whisper_attention_splat(q_coef[0]);
+        for (int k = 1; k < 5; k++) {
+            q = whisper_attention_fma(whisper_attention_splat(q_coef[k]), q, v2);
+        }
+        const whisper_attention_vec erf = whisper_attention_div(whisper_attention_mul(v, p), q);
+        const whisper_attention_vec scaled = whisper_attention_mul(va, whisper_attention_load(a + i));
+        whisper_attention_store(y + i, whisper_attention_fma(scaled, scaled, erf));
+    }
+    for (; i < n; i++) {
+        y[i] = alpha*a[i]*(1.0f + whisper_norm_erf1(beta*b[i]));
+    }
+}
+
+struct whisper_norm_params {
+    float eps = 1e-5f;
+    float alpha = 0.5f;
+    float beta = (float) M_SQRT1_2;
+};
+
+static void * whisper_norm_init(TfLiteContext *, const char * buffer, size_t length) {
+    whisper_norm_params * params = new whisper_norm_params;
+    if (buffer != nullptr && length > 0) {
+        const flexbuffers::Map & m = flexbuffers::GetRoot(reinterpret_cast<const uint8_t *>(buffer), length).AsMap();
+        params->eps = m["eps"].IsNull() ? params->eps : m["eps"].AsFloat();
+        params->alpha = m["alpha"].IsNull() ? params->alpha : m["alpha"].AsFloat();
+        params->beta = m["beta"].IsNull() ? params->beta : m["beta"].AsFloat();
+    }
+    return params;
+}
+
+static void whisper_norm_free(TfLiteContext *, void * buffer) {
+    delete reinterpret_cast<whisper_norm_params *>(buffer);
+}
+
+//float inputs, the first one sets the output shape
+static TfLiteStatus whisper_norm_prepare_float(TfLiteContext * context, TfLiteNode * node) {
+    TF_LITE_ENSURE_EQ(context, tflite::NumOutputs(node), 1);
+    for (int i = 0; i < tflite::NumInputs(node); i++) {
+        const TfLiteTensor * input;
+        TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, i, &input));
+        TF_LITE_ENSURE_TYPES_EQ(context, input->type, kTfLiteFloat32);
+    }
+    const TfLiteTensor * x;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &x));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    return context->ResizeTensor(context, output, TfLiteIntArrayCopy(x->dims));
+}
+
+static TfLiteStatus whisper_layer_norm_prepare(TfLiteContext * context, TfLiteNode * node) {
+    TF_LITE_ENSURE(context, tflite::NumInputs(node) >= 1 && tflite::NumInputs(node) <= 3);
+    const TfLiteTensor * x;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &x));
+    TF_LITE_ENSURE(context, x->dims->size >= 1);
+    const int n = x->dims->data[x->dims->size - 1];
+    for (int i = 1; i < tflite::NumInputs(node); i++) {
+        const TfLiteTensor * affine;
+        TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, i, &affine));
+        TF_LITE_ENSURE_EQ(context, tflite::NumElements(affine), (int64_t) n);
+    }
+    return whisper_norm_prepare_float(context, node);
+}
+
+static TfLiteStatus whisper_layer_norm_eval(TfLiteContext * context, TfLiteNode * node) {
+    const auto & params = *reinterpret_cast<const whisper_norm_params *>(node->user_data);
+    const TfLiteTensor * x;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &x));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    const float * gamma = tflite::NumInputs(node) >= 2 ? tflite::GetInput(context, node, 1)->data.f : nullptr;
+    const float * beta = tflite::NumInputs(node) >= 3 ? tflite::GetInput(context, node, 2)->data.f : nullptr;
+    const int n = x->dims->data[x->dims->size - 1];
+    const int64_t n_rows = n > 0 ? tflite::NumElements(x)/n : 0;
+    whisper_norm_parallel(n_rows, n, std::max(1, context->recommended_num_threads),
+                          [&](const int64_t r0, const int64_t r1) {
+        for (int64_t r = r0; r < r1; r++) {
+            whisper_layer_norm_row(x->data.f + r*n, output->data.f + r*n, n, params.eps, gamma, beta);
+        }
+    });
+    return kTfLiteOk;
+}
+
+static TfLiteStatus whisper_gelu_prepare(TfLiteContext * context, TfLiteNode * node) {
+    TF_LITE_ENSURE(context, tflite::NumInputs(node) == 1 || tflite::NumInputs(node) == 2);
+    if (tflite::NumInputs(node) == 2) {
+        TF_LITE_ENSURE(context, TfLiteIntArrayEqual(tflite::GetInput(context, node, 0)->dims,
+                                                    tflite::GetInput(context, node, 1)->dims));
+    }
+    return whisper_norm_prepare_float(context, node);
+}
+
+static TfLiteStatus whisper_gelu_eval(TfLiteContext * context, TfLiteNode * node) {
+    const auto & params = *reinterpret_cast<const whisper_norm_params *>(node->user_data);
+    const TfLiteTensor * a;
+    TfLiteTensor * output;
+    TF_LITE_ENSURE_OK(context, tflite::GetInputSafe(context, node, 0, &a));
+    TF_LITE_ENSURE_OK(context, tflite::GetOutputSafe(context, node, 0, &output));
+    const TfLiteTensor * b = tflite::NumInputs(node) == 2 ? tflite::GetInput(context, node, 1) : a;
+    whisper_norm_parallel(tflite::NumElements(a), 1, std::max(1, context->recommended_num_threads),
+                          [&](const int64_t i0, const int64_t i1) {
+        whisper_gelu(a->data.f + i0, b->data.f + i0, output->data.f + i0, i1 - i0, params.alpha, params.beta);
+    });
+    return kTfLiteOk;
+}
+
+void whisper_norm_register_ops(tflite::MutableOpResolver & resolver) {
+    TfLiteRegistration layer_norm = {};
+    layer_norm.init = whisper_norm_init;
+    layer_norm.free = whisper_norm_free;
+    layer_norm.prepare = whisper_layer_norm_prepare;
+    layer_norm.invoke = whisper_layer_norm_eval;
+    TfLiteRegistration gelu = {};
+    gelu.init = whisper_norm_init;
+    gelu.free = whisper_norm_free;
+    gelu.prepare = whisper_gelu_prepare;
+    gelu.invoke = whisper_gelu_eval;
+    resolver.AddCustom(WHISPER_LAYER_NORM_OP, &layer_norm);
+    resolver.AddCustom(WHISPER_GELU_OP, &gelu);
+}
@@ -0,0 +1,1171 @@
+//Transcription pipeline shared by native-lib.cpp and the host tools:
+//assets -> audio decoding -> mel features -> encoder -> greedy decoder.
+//Only the Android logging and asset APIs are used, tools/stubs provides
+//them for Linux builds. Include after whisper.h and whisper_frontend.h.
+#include <malloc.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android/asset_manager.h>
+#include <android/log.h>
+
+#include "whisper_arena_plan.h"
+#include "whisper_flex_ops.h"
+#include "whisper_fully_connected.h"
+#include "whisper_kv_cache.h"
+#include "whisper_language.h"
+#include "whisper_logits.h"
+#include "whisper_model_cache.h"
+#include "whisper_norm.h"
+#include "whisper_profiler.h"
+#include "whisper_frozen_plan.h"
+#include "whisper_timestamps.h"
+#include "whisper_vocab_file.h"
+
+#define WHISPER_ENCODER_ASSET "whisper-encoder-hybrid.tflite"
+#define WHISPER_DECODER_ASSET "whisper-decoder-language-hybrid.tflite"
+#define WHISPER_VOCAB_ASSET   "filters_vocab_multilingual.bin"
+
+//encoder asset, the converted hybrid encoder (int8 weights, float activations
+//quantized on the fly per layer) or a whisper-quantize one whose activations
+//are int8 or int16 too, so the integer_ops kernels run between its float
+//input and output
+std::string g_whisper_encoder_asset = WHISPER_ENCODER_ASSET;
+
+//decoder asset, the converted decoder (one Invoke() per token), a
+//whisper-build-decoder model (one Invoke() per chunk) or a --step one
+//(one Invoke() per token over a KV cache)
+std::string g_whisper_decoder_asset = WHISPER_DECODER_ASSET;
+
+//longest greedy decode, half of the 448 token text context like whisper.cpp
+#define WHISPER_MAX_DECODE_TOKENS 224
+
+//token selection of the host side decoders (whisper_logits.h); k = 1 without
+//suppressed tokens or timestamp rules is the plain argmax of the logits
+whisper_logits_params g_whisper_logits;
+
+//prompt language of the multilingual models, index in whisper_languages
+int g_whisper_language = 0;
+
+//timestamps of the next transcriptions (whisper_timestamps.h): segments from the
+//timestamp tokens, words from the alignment heads of a --step decoder built with them
+whisper_timestamps_mode g_whisper_timestamps = WHISPER_TIMESTAMPS_NONE;
+//segments of the last whisper_transcribe(), seconds into the file
+std::vector<whisper_segment> g_whisper_segments;
+//DTW of the chunk being decoded, whisper_decode_step() adds a row per aligned token
+whisper_alignment g_whisper_alignment;
+
+//tokens the step decoder may emit, sorted, special tokens included; empty
+//means the full vocabulary. Needs a whisper-build-decoder --shortlist model,
+//set with whisper_set_shortlist()
+std::vector<int32_t> g_whisper_shortlist;
+//shortlist whose rows the decoder variables hold
+std::vector<int32_t> g_whisper_shortlist_built;
+
+int64_t whisper_time_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//stage timings of the last whisper_transcribe() call
+struct whisper_timings {
+    int64_t load_us   = 0; // models, filters and vocab, non zero on the first call only
+    int64_t warmup_us = 0; // whisper_prepare() pass over silence
+    int64_t audio_us  = 0; // file decoding and mono conversion
+    int64_t mel_us    = 0; // mel features, 0 when the encoder computes them
+    int64_t encode_us = 0; // input copy and encoder Invoke()
+    int64_t decode_us = 0; // greedy decoder loop
+    int64_t align_us  = 0; // DTW rows of the word timestamps, part of decode_us, and the path back
+    bool encoder_reused = false; // the chunk was encoded by whisper_detect_language() already
+    int n_samples = 0;     // samples read from the file, before zero padding
+    int n_tokens  = 0;     // tokens generated after the prompt
+};
+
+whisper_timings g_whisper_timings;
+
+//encoder and decoder never run at the same time: with a shared arena each
+//hands its non-persistent tensor arena back after its stage and re-plans it on
+//the next AllocateTensors(), so the peak is the larger of the two arenas
+//instead of their sum. The encoder output is kept in g_whisper_encoder_output
+//for the decoder. Resource variables (KV cache, shortlist rows) stay allocated.
+//It helps the loop decoder (22.5 MB arena next to the 108 MB encoder one: peak
+//RSS 333 -> 273 MB on x86); the step decoder arena is 7.6 MB and its peak did
+//not move.
+bool g_whisper_shared_arena = false;
+
+//builds the encoder and decoder interpreters (InterpreterBuilder, delegates,
+//AllocateTensors()) on two threads at load; the models are mapped first, on one
+bool g_whisper_parallel_load = true;
+
+//binds the tensors of a whisper-plan model to its offline arena plan at load,
+//off plans every tensor online
+bool g_whisper_use_arena_plan = true;
+
+//copy of the encoder output taken before its arena is released
+std::vector<char> g_whisper_encoder_output;
+
+//chunk whose encoder output whisper_detect_language() held (whisper_chunk_key()),
+//empty when none; the next transcription of that chunk skips reading and encoding it
+std::string g_whisper_encoded_key;
+int g_whisper_encoded_samples = 0;
+
+//non-persistent arena bytes of the last encoder and decoder runs
+struct whisper_arenas {
+    size_t encoder = 0;
+    size_t decoder = 0;
+};
+
+whisper_arenas g_whisper_arenas;
+
+//seconds without a transcription after which whisper_release_idle() frees the
+//tensor arenas and scratch buffers, 0 keeps them; the next request plans the
+//arenas again. The models stay loaded.
+int g_whisper_idle_seconds = 0;
+
+//arena releases while idle and what they gave back
+struct whisper_idle_stats {
+    int releases = 0;
+    int64_t rss_before = 0; // resident bytes around the last release
+    int64_t rss_after  = 0;
+    int64_t replan_us  = 0; // arena planning paid by the first request after it
+};
+
+whisper_idle_stats g_whisper_idle;
+bool g_whisper_idle_released = false;
+//whisper_prepare() ran its warm-up pass over the loaded models
+bool g_whisper_warm = false;
+int64_t g_whisper_last_use_us = 0;
+
+//threads for the frontend and the interpreters, 0 = hardware concurrency
+int g_whisper_n_threads = 0;
+
+int whisper_n_threads() {
+    if (g_whisper_n_threads > 0) {
+        return g_whisper_n_threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//copies a whole asset into a malloc'ed buffer owned by params
+bool whisper_read_asset(AAssetManager * mgr, const char * name, whisper_tflite & params) {
+    AAsset * asset = AAssetManager_open(mgr, name, AASSET_MODE_UNKNOWN);
+    if (asset == nullptr) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: failed to open asset '%s'\n", __func__, name);
+        return false;
+    }
+    params.size = AAsset_getLength(asset);
+    params.buffer = (char *) malloc(sizeof(char) * params.size);
+    const bool ok = params.buffer != nullptr && AAsset_read(asset, params.buffer, params.size) == params.size;
+    AAsset_close(asset);
+    g_whisper_model_cache.heap += ok;
+    return ok;
+}
+
+//model of an asset mapped from storage (whisper_model_cache.h), or read into params.buffer
+bool whisper_load_model(AAssetManager * mgr, const char * name, whisper_tflite & params) {
+    std::unique_ptr<tflite::Allocation> mapped = whisper_model_cache_open(mgr, name);
+    if (mapped != nullptr) {
+        params.size = mapped->bytes();
+        params.model = tflite::FlatBufferModel::BuildFromAllocation(std::move(mapped));
+    } else if (whisper_read_asset(mgr, name, params)) {
+        params.model = tflite::FlatBufferModel::BuildFromBuffer(params.buffer, params.size);
+    }
+    return params.model != nullptr;
+}
+
+//special tokens follow the text tokens of the vocab file, n_vocab is the decoder logits size
+void whisper_vocab_set_size(whisper_vocab & vocab, const int n_vocab) {
+    const int n_text = vocab.n_text();
+    vocab.n_vocab = n_vocab;
+    if (vocab.is_multilingual()) {
+        vocab.token_eot++;
+        vocab.token_sot++;
+        vocab.token_translate++;
+        vocab.token_transcribe++;
+        vocab.token_prev++;
+        vocab.token_solm++;
+        vocab.token_not++;
+        vocab.token_beg++;
+    }
+    std::string word;
+    for (int i = n_text; i < vocab.n_vocab; i++) {
+        if (i > vocab.token_beg) {
+            word = "[_TT_" + std::to_string(i - vocab.token_beg) + "]";
+        } else if (i == vocab.token_eot) {
+            word = "[_EOT_]";
+        } else if (i == vocab.token_sot) {
+            word = "[_SOT_]";
+        } else if (i == vocab.token_prev) {
+            word = "[_PREV_]";
+        } else if (i == vocab.token_not) {
+            word = "[_NOT_]";
+        } else if (i == vocab.token_beg) {
+            word = "[_BEG_]";
+        } else {
+            word = "[_extra_token_" + std::to_string(i) + "]";
+        }
+        vocab.id_to_token[i] = word;
+    }
+}
+
+//mel filters and text tokens of filters_vocab_*.bin (v1 or v2, see whisper_vocab_file.h),
+//mapped from storage when possible
+bool whisper_load_filters_vocab(AAssetManager * mgr, const char * name, whisper_filters & filters, whisper_vocab & vocab) {
+    std::unique_ptr<tflite::Allocation> mapped = whisper_model_cache_open(mgr, name);
+    std::vector<char> heap;
+    if (mapped == nullptr) {
+        AAsset * asset = AAssetManager_open(mgr, name, AASSET_MODE_UNKNOWN);
+        if (asset == nullptr) {
+            __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: failed to open asset '%s'\n", __func__, name);
+            return false;
+        }
+        heap.resize(AAsset_getLength(asset));
+        const bool ok = AAsset_read(asset, heap.data(), heap.size()) == (int) heap.size();
+        AAsset_close(asset);
+        if (!ok) {
+            return false;
+        }
+        g_whisper_model_cache.heap++;
+    }
+    const char * data = mapped != nullptr ? (const char *) mapped->base() : heap.data();
+    const size_t size = mapped != nullptr ? mapped->bytes() : heap.size();
+    std::string error;
+    if (!whisper_vocab_file_parse(data, size, filters, vocab, error)) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: invalid vocab file '%s' (%s)\n",
+                            __func__, name, error.c_str());
+        return false;
+    }
+    __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: n_mel:%d n_fft:%d n_vocab:%d\n",
+                        __func__, filters.n_mel, filters.n_fft, vocab.n_vocab);
+    return true;
+}
+
+//interpreter over the model buffer, with the Flex replacements, in-graph frontend ops and fused custom ops
+bool whisper_init_interpreter(whisper_tflite & params, whisper_model_profile & profile, whisper_arena_plan & plan) {
+    //whisper_load_model() maps the model, tools hand over a buffer
+    if (params.model == nullptr) {
+        params.model = tflite::FlatBufferModel::BuildFromBuffer(params.buffer, params.size);
+    }
+    if (params.model == nullptr) {
+        return false;
+    }
+    whisper_attention_register_ops(params.resolver);
+    whisper_fc_register_ops(params.resolver);
+    whisper_flex_register_ops(params.resolver);
+    whisper_frontend_register_ops(params.resolver);
+    whisper_kv_register_ops(params.resolver);
+    whisper_logits_register_ops(params.resolver);
+    whisper_norm_register_ops(params.resolver);
+
+    // Build the interpreter with the InterpreterBuilder.
+    // Note: all Interpreters should be built with the InterpreterBuilder,
+    // which allocates memory for the Interpreter and does various set up
+    // tasks so that the Interpreter can read the provided model.
+    tflite::InterpreterBuilder builder(*(params.model), params.resolver);
+    builder(&(params.interpreter), whisper_n_threads());
+    if (params.interpreter == nullptr) {
+        return false;
+    }
+
+    // NEW: Prepare GPU delegate.
+    //  auto* delegate = TfLiteGpuDelegateV2Create(nullptr);
+    // if (interpreter->ModifyGraphWithDelegate(delegate) != kTfLiteOk) {
+    //     __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "gpu delegate failed \n");
+    // }
+
+    //before the first AllocateTensors(), so delegates see the profiler too
+    if (g_whisper_profiling) {
+        whisper_profile_attach(*params.interpreter, profile);
+    }
+
+    //the offline plan is bound before the first AllocateTensors(), so only the rest is planned online
+    const bool planned = g_whisper_use_arena_plan && !plan.rejected && whisper_arena_plan_read(*params.model, plan);
+    if (planned && !whisper_arena_plan_acquire(*params.interpreter, plan)) {
+        return false;
+    }
+
+    // Allocate tensor buffers.
+    if (params.interpreter->AllocateTensors() != kTfLiteOk) {
+        return false;
+    }
+    //delegates are applied by the first AllocateTensors(), a plan of another graph is dropped
+    if (planned && !whisper_arena_plan_check(*params.interpreter, plan)) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: arena plan does not match the graph, planning online\n", __func__);
+        params.interpreter.reset();
+        whisper_arena_plan_release(plan);
+        plan = whisper_arena_plan();
+        plan.rejected = true;
+        return whisper_init_interpreter(params, profile, plan);
+    }
+    params.input = params.interpreter->typed_input_tensor<float>(0);
+    params.is_whisper_tflite_initialized = true;
+    return true;
+}
+
+//models of whisper-build-decoder output the int32 tokens instead of the logits
+bool whisper_decoder_has_loop(tflite::Interpreter & interpreter) {
+    return interpreter.outputs().size() == 2 && interpreter.output_tensor(0)->type == kTfLiteInt32;
+}
+
+//whisper-build-decoder --step models have "init" and "step" signatures
+bool whisper_decoder_has_steps(tflite::Interpreter & interpreter) {
+    return interpreter.GetSignatureRunner(WHISPER_DECODER_INIT_SIGNATURE) != nullptr &&
+           interpreter.GetSignatureRunner(WHISPER_DECODER_STEP_SIGNATURE) != nullptr;
+}
+
+int whisper_decoder_n_vocab(const whisper_tflite & dec) {
+    if (dec.decode_loop || dec.decode_step) {
+        const std::map<std::string, std::string> metadata = dec.model->ReadAllMetadata();
+        auto it = metadata.find(WHISPER_METADATA_N_VOCAB);
+        return it != metadata.end() ? atoi(it->second.c_str()) : g_vocab.n_vocab;
+    }
+    const TfLiteTensor * logits = dec.interpreter->output_tensor(0);
+    return logits->dims->data[logits->dims->size - 1];
+}
+
+//bytes of the non-persistent arenas of every subgraph and of the bound offline plan, 0 once released
+size_t whisper_arena_bytes(const tflite::Interpreter & interpreter, const whisper_arena_plan & plan) {
+    size_t bytes = plan.pool != nullptr ? plan.pool_bytes : 0;
+    for (size_t i = 0; i < interpreter.subgraphs_size(); i++) {
+        tflite::Subgraph::SubgraphAllocInfo info;
+        interpreter.subgraph(i)->GetMemoryAllocInfo(&info);
+        bytes += info.arena_size;
+    }
+    return bytes;
+}
+
+//frees the non-persistent arenas of every subgraph and the offline plan pool,
+//the next whisper_arena_plan_acquire() and AllocateTensors() allocate them again
+bool whisper_arena_release(tflite::Interpreter & interpreter, whisper_arena_plan & plan) {
+    bool ok = true;
+    for (size_t i = 0; i < interpreter.subgraphs_size(); i++) {
+        ok = interpreter.subgraph(i)->ReleaseNonPersistentMemory() == kTfLiteOk && ok;
+    }
+    whisper_arena_plan_release(plan);
+    return ok;
+}
+
+//switches the shared arena mode, see g_whisper_shared_arena; turning it on
+//releases the arenas the interpreters hold right away
+void whisper_shared_arena_enable(const bool enable) {
+    g_whisper_shared_arena = enable;
+    //the held encoder output moves between the tensor and the copy
+    g_whisper_encoded_key.clear();
+    if (!enable) {
+        std::vector<char>().swap(g_whisper_encoder_output);
+        return;
+    }
+    if (g_whisper_tflite_params.interpreter != nullptr) {
+        whisper_arena_release(*g_whisper_tflite_params.interpreter, g_whisper_encoder_plan);
+    }
+    if (g_whisper_tflite_decoder_params.interpreter != nullptr) {
+        whisper_arena_release(*g_whisper_tflite_decoder_params.interpreter, g_whisper_decoder_plan);
+    }
+}
+
+//resident set size of the process, 0 when /proc is not readable
+int64_t whisper_rss_bytes() {
+    FILE * statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) {
+        return 0;
+    }
+    long pages = 0;
+    long resident = 0;
+    const bool ok = fscanf(statm, "%ld %ld", &pages, &resident) == 2;
+    fclose(statm);
+    return ok ? (int64_t) resident*sysconf(_SC_PAGESIZE) : 0;
+}
+
+//hands the pages the allocator keeps after large frees back to the system
+void whisper_heap_trim() {
+#if defined(__ANDROID__) && defined(M_PURGE)
+    mallopt(M_PURGE, 0);
+#elif defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
+
+//frees the tensor arenas and the scratch buffers once the pipeline has been
+//idle for g_whisper_idle_seconds (now with force); returns whether it did
+bool whisper_release_idle(const bool force = false) {
+    whisper_tflite & enc = g_whisper_tflite_params;
+    whisper_tflite & dec = g_whisper_tflite_decoder_params;
+    if (!enc.is_whisper_tflite_initialized || !dec.is_whisper_tflite_initialized || g_whisper_idle_released) {
+        return false;
+    }
+    if (!force && (g_whisper_idle_seconds <= 0 ||
+                   whisper_time_us() - g_whisper_last_use_us < g_whisper_idle_seconds*1000000LL)) {
+        return false;
+    }
+    g_whisper_idle.rss_before = whisper_rss_bytes();
+    whisper_arena_release(*enc.interpreter, g_whisper_encoder_plan);
+    whisper_arena_release(*dec.interpreter, g_whisper_decoder_plan);
+    std::vector<char>().swap(g_whisper_encoder_output);
+    std::vector<float>().swap(mel.data);
+    g_whisper_encoded_key.clear();
+    whisper_heap_trim();
+    g_whisper_idle.rss_after = whisper_rss_bytes();
+    g_whisper_idle.releases++;
+    g_whisper_idle_released = true;
+    __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: idle release, RSS %.1f -> %.1f MB\n", __func__,
+                        g_whisper_idle.rss_before/1048576.0, g_whisper_idle.rss_after/1048576.0);
+    return true;
+}
+
+//plans the arenas released while idle again, timed into g_whisper_idle.replan_us;
+//in shared arena mode every stage plans its own
+bool whisper_idle_reacquire() {
+    if (!g_whisper_idle_released) {
+        return true;
+    }
+    g_whisper_idle_released = false;
+    if (g_whisper_shared_arena) {
+        g_whisper_idle.replan_us = 0;
+        return true;
+    }
+    const int64_t t_start = whisper_time_us();
+    whisper_tflite & enc = g_whisper_tflite_params;
+    tflite::Interpreter & dec = *g_whisper_tflite_decoder_params.interpreter;
+    if (!whisper_arena_plan_acquire(*enc.interpreter, g_whisper_encoder_plan) ||
+        !whisper_arena_plan_acquire(dec, g_whisper_decoder_plan) ||
+        enc.interpreter->AllocateTensors() != kTfLiteOk || dec.AllocateTensors() != kTfLiteOk) {
+        return false;
+    }
+    enc.input = enc.interpreter->typed_input_tensor<float>(0);
+    if (g_whisper_tflite_decoder_params.decode_step) {
+        if (dec.GetSignatureRunner(WHISPER_DECODER_INIT_SIGNATURE)->AllocateTensors() != kTfLiteOk ||
+            dec.GetSignatureRunner(WHISPER_DECODER_STEP_SIGNATURE)->AllocateTensors() != kTfLiteOk) {
+            return false;
+        }
+    }
+    g_whisper_idle.replan_us = whisper_time_us() - t_start;
+    return true;
+}
+
+//drops the interpreters, models and buffers, the next whisper_load() starts over
+void whisper_free() {
+    for (whisper_tflite * params : {&g_whisper_tflite_params, &g_whisper_tflite_decoder_params}) {
+        params->interpreter.reset();
+        params->model.reset();
+        free(params->buffer);
+        params->buffer = nullptr;
+        params->size = 0;
+        params->input = nullptr;
+        params->is_whisper_tflite_initialized = false;
+        params->pcm_input = false;
+        params->decode_loop = false;
+        params->decode_step = false;
+    }
+    //the tensors bound to the plans are gone with the interpreters
+    for (whisper_arena_plan * plan : {&g_whisper_encoder_plan, &g_whisper_decoder_plan}) {
+        whisper_arena_plan_release(*plan);
+        *plan = whisper_arena_plan();
+    }
+    std::vector<char>().swap(g_whisper_encoder_output);
+    std::vector<float>().swap(mel.data);
+    g_whisper_frontend_filters = whisper_frontend_filters();
+    g_whisper_fixed_filters = whisper_fixed_filters();
+    g_whisper_encoded_key.clear();
+    g_whisper_shortlist_built.clear();
+    g_whisper_idle_released = false;
+    g_whisper_warm = false;
+    whisper_heap_trim();
+    //whisper_vocab_set_size() shifts the special tokens of the file once
+    g_vocab = whisper_vocab();
+}
+
+//resident memory, arena sizes, idle releases and where the models were mapped from as JSON
+std::string whisper_memory_json() {
+    char json[512];
+    snprintf(json, sizeof(json),
+             "{\"rss_mb\": %.1f, \"idle_seconds\": %d, \"released\": %s, \"releases\": %d, "
+             "\"rss_before_mb\": %.1f, \"rss_after_mb\": %.1f, \"replan_ms\": %.3f, "
+             "\"arena_mb\": {\"encoder\": %.1f, \"decoder\": %.1f, \"shared\": %s}, \"models\": ",
+             whisper_rss_bytes()/1048576.0, g_whisper_idle_seconds, g_whisper_idle_released ? "true" : "false",
+             g_whisper_idle.releases, g_whisper_idle.rss_before/1048576.0, g_whisper_idle.rss_after/1048576.0,
+             g_whisper_idle.replan_us/1000.0, g_whisper_arenas.encoder/1048576.0, g_whisper_arenas.decoder/1048576.0,
+             g_whisper_shared_arena ? "true" : "false");
+    return json + whisper_model_cache_json() + "}";
+}
+
+//the encoder output the decoders read: its tensor, or the copy in shared arena mode
+const char * whisper_encoder_output(size_t & bytes) {
+    if (g_whisper_shared_arena) {
+        bytes = g_whisper_encoder_output.size();
+        return g_whisper_encoder_output.data();
+    }
+    const TfLiteTensor * encoder_out = g_whisper_tflite_params.interpreter->output_tensor(0);
+    bytes = encoder_out->bytes;
+    return encoder_out->data.raw;
+}
+
+//turns per operator profiling on or off, collected profiles are dropped;
+//the profilers stay installed once profiling was on
+void whisper_profiling_enable(const bool enable) {
+    g_whisper_profiling = enable;
+    if (enable && g_whisper_tflite_params.interpreter != nullptr) {
+        whisper_profile_attach(*g_whisper_tflite_params.interpreter, g_whisper_encoder_profile);
+    }
+    if (enable && g_whisper_tflite_decoder_params.interpreter != nullptr) {
+        whisper_profile_attach(*g_whisper_tflite_decoder_params.interpreter, g_whisper_decoder_profile);
+    }
+    whisper_profile_reset(g_whisper_encoder_profile);
+    whisper_profile_reset(g_whisper_decoder_profile);
+}
+
+//loads models, filters and vocab on the first call
+bool whisper_load(AAssetManager * mgr) {
+    if (g_whisper_tflite_params.is_whisper_tflite_initialized &&
+        g_whisper_tflite_decoder_params.is_whisper_tflite_initialized) {
+        g_whisper_timings.load_us = 0;
+        return true;
+    }
+    const int64_t t_start = whisper_time_us();
+    g_whisper_model_cache = whisper_model_cache_stats();
+    if (g_whisper_tflite_params.model == nullptr &&
+        !whisper_load_model(mgr, g_whisper_encoder_asset.c_str(), g_whisper_tflite_params)) {
+        return false;
+    }
+    if (g_whisper_tflite_decoder_params.model == nullptr &&
+        !whisper_load_model(mgr, g_whisper_decoder_asset.c_str(), g_whisper_tflite_decoder_params)) {
+        return false;
+    }
+    //Load filters and vocab data from pregenerated filters_vocab_gen.bin file
+    if (!whisper_load_filters_vocab(mgr, WHISPER_VOCAB_ASSET, filters, g_vocab)) {
+        return false;
+    }
+    //with a shared arena the encoder one is released before the decoder plans its own,
+    //otherwise the decoder is built on a second thread while the encoder is
+    bool built = false;
+    if (g_whisper_parallel_load && !g_whisper_shared_arena) {
+        bool decoder_built = false;
+        std::thread decoder_thread([&decoder_built]() {
+            decoder_built = whisper_init_interpreter(g_whisper_tflite_decoder_params, g_whisper_decoder_profile,
+                                                     g_whisper_decoder_plan);
+        });
+        built = whisper_init_interpreter(g_whisper_tflite_params, g_whisper_encoder_profile, g_whisper_encoder_plan);
+        decoder_thread.join();
+        built = built && decoder_built;
+    } else {
+        built = whisper_init_interpreter(g_whisper_tflite_params, g_whisper_encoder_profile, g_whisper_encoder_plan) &&
+                (!g_whisper_shared_arena || whisper_arena_release(*g_whisper_tflite_params.interpreter, g_whisper_encoder_plan)) &&
+                whisper_init_interpreter(g_whisper_tflite_decoder_params, g_whisper_decoder_profile, g_whisper_decoder_plan);
+    }
+    if (!built) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: failed to build the interpreters\n", __func__);
+        return false;
+    }
+    g_whisper_tflite_params.pcm_input = whisper_encoder_takes_pcm(*g_whisper_tflite_params.interpreter);
+
+    g_whisper_tflite_decoder_params.decode_loop = whisper_decoder_has_loop(*g_whisper_tflite_decoder_params.interpreter);
+    g_whisper_tflite_decoder_params.decode_step = whisper_decoder_has_steps(*g_whisper_tflite_decoder_params.interpreter);
+
+    //logits size tells multilingual (51865) and English only (51864) models apart
+    whisper_vocab_set_size(g_vocab, whisper_decoder_n_vocab(g_whisper_tflite_decoder_params));
+    if (g_whisper_shared_arena) {
+        whisper_arena_release(*g_whisper_tflite_decoder_params.interpreter, g_whisper_decoder_plan);
+    }
+
+    g_whisper_timings.load_us = whisper_time_us() - t_start;
+    __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: model load time %.1f ms, n_vocab %d\n",
+                        __func__, g_whisper_timings.load_us/1000.0, g_vocab.n_vocab);
+    return true;
+}
+
+//30 seconds of a WAV/MP3 file from from_time on, mono float and int16, zero padded;
+//returns the number of samples read or -1
+int whisper_read_audio(const char * path, const float from_time,
+                       std::vector<float> & pcmf32, std::vector<int16_t> & pcm16mono) {
+    const int n = WHISPER_SAMPLE_RATE * WHISPER_CHUNK_SIZE;
+    const drmp3_uint64 indexPCM = floor(WHISPER_SAMPLE_RATE * from_time);
+    std::vector<int16_t> pcm16;
+    int channels = 0;
+    size_t frames = 0;
+    if (strstr(path, ".mp3") != NULL) {
+        drmp3 mp3;
+        if (!drmp3_init_file(&mp3, path, NULL)) {
+            __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR",
+                                "failed to open MP3 file '%s' - check your input\n", path);
+            return -1;
+        }
+        channels = mp3.channels;
+        pcm16.resize(n*channels);
+        drmp3_seek_to_pcm_frame(&mp3, indexPCM);
+        frames = drmp3_read_pcm_frames_s16(&mp3, n, pcm16.data());
+        drmp3_uninit(&mp3);
+    } else {
+        drwav wav;
+        if (!drwav_init_file(&wav, path, NULL)) {
+            __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR",
+                                "failed to open WAV file '%s' - check your input\n", path);
+            return -1;
+        }
+        channels = wav.channels;
+        pcm16.resize(n*channels);
+        drwav_seek_to_pcm_frame(&wav, indexPCM);
+        frames = drwav_read_pcm_frames_s16(&wav, n, pcm16.data());
+        drwav_uninit(&wav);
+    }
+    // convert to mono, float; shorter chunks are padded with 0's
+    pcmf32.assign(n, 0.0f);
+    pcm16mono.assign(n, 0);
+    for (size_t i = 0; i < frames; i++) {
+        if (channels == 1) {
+            pcmf32[i] = float(pcm16[i])/32768.0f;
+            pcm16mono[i] = pcm16[i];
+        } else {
+            pcmf32[i] = float(pcm16[2*i] + pcm16[2*i + 1])/65536.0f;
+            pcm16mono[i] = (int16_t) ((pcm16[2*i] + pcm16[2*i + 1])/2);
+        }
+    }
+    return (int) frames;
+}
+
+//features (unless the encoder computes them) and encoder Invoke()
+bool whisper_encode(const std::vector<float> & pcmf32, const std::vector<int16_t> & pcm16mono) {
+    whisper_tflite & enc = g_whisper_tflite_params;
+    int64_t t_start = whisper_time_us();
+    g_whisper_timings.mel_us = 0;
+    g_whisper_encoded_key.clear();
+    if (g_whisper_shared_arena) {
+        //the arena was released after the previous chunk, the input may move
+        if (!whisper_arena_plan_acquire(*enc.interpreter, g_whisper_encoder_plan) ||
+            enc.interpreter->AllocateTensors() != kTfLiteOk) {
+            return false;
+        }
+        enc.input = enc.interpreter->typed_input_tensor<float>(0);
+    }
+    if (!enc.pcm_input) {
+        //the fixed point frontend reads the int16 samples directly
+        const bool mel_ok = g_whisper_frontend == WHISPER_FRONTEND_FIXED
+                ? whisper_compute_mel(g_whisper_frontend, pcm16mono.data(), pcm16mono.size(), whisper_n_threads(), filters, mel)
+                : whisper_compute_mel(g_whisper_frontend, pcmf32.data(), pcmf32.size(), whisper_n_threads(), filters, mel);
+        if (!mel_ok) {
+            __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: failed to compute mel spectrogram\n", __func__);
+            return false;
+        }
+        g_whisper_timings.mel_us = whisper_time_us() - t_start;
+        t_start = whisper_time_us();
+        memcpy(enc.input, mel.data.data(), mel.n_mel*mel.n_len*sizeof(float));
+    } else {
+        //features are computed inside the encoder graph
+        memcpy(enc.input, pcmf32.data(), pcmf32.size()*sizeof(float));
+    }
+    whisper_profile_begin(g_whisper_encoder_profile);
+    const bool ok = enc.interpreter->Invoke() == kTfLiteOk;
+    whisper_profile_end(*enc.interpreter, g_whisper_encoder_profile);
+    g_whisper_arenas.encoder = whisper_arena_bytes(*enc.interpreter, g_whisper_encoder_plan);
+    if (ok && g_whisper_shared_arena) {
+        const TfLiteTensor * encoder_out = enc.interpreter->output_tensor(0);
+        g_whisper_encoder_output.assign(encoder_out->data.raw, encoder_out->data.raw + encoder_out->bytes);
+        whisper_arena_release(*enc.interpreter, g_whisper_encoder_plan);
+    }
+    g_whisper_timings.encode_us = whisper_time_us() - t_start;
+    return ok;
+}
+
+//best next token of a row of logits under g_whisper_logits, tokens[n_prompt..]
+//are the ones sampled so far; EOT when every token is suppressed
+whisper_vocab::id whisper_next_token(const float * logits, const int n_vocab,
+                                     const std::vector<whisper_vocab::id> & tokens, const size_t n_prompt) {
+    std::vector<whisper_logit> top;
+    whisper_logits_process(logits, n_vocab, g_whisper_logits, tokens.data() + n_prompt,
+                           (int) (tokens.size() - n_prompt), top);
+    return top.empty() ? g_vocab.token_eot : top[0].id;
+}
+
+//restricts the step decoder to `ids` and the special tokens, an empty list
+//falls back to the full vocabulary; the rows are gathered on the next decode
+void whisper_set_shortlist(const std::vector<whisper_vocab::id> & ids) {
+    g_whisper_shortlist.clear();
+    if (ids.empty()) {
+        return;
+    }
+    for (const whisper_vocab::id id : ids) {
+        if (id >= 0 && id < g_vocab.token_eot) {
+            g_whisper_shortlist.push_back(id);
+        }
+    }
+    for (int id = g_vocab.token_eot; id < g_vocab.n_vocab; id++) {
+        g_whisper_shortlist.push_back(id);
+    }
+    std::sort(g_whisper_shortlist.begin(), g_whisper_shortlist.end());
+    g_whisper_shortlist.erase(std::unique(g_whisper_shortlist.begin(), g_whisper_shortlist.end()),
+                              g_whisper_shortlist.end());
+}
+
+//"step_shortlist" over the rows of g_whisper_shortlist, gathered when it
+//changed; nullptr for the full vocabulary
+tflite::SignatureRunner * whisper_shortlist_runner(tflite::Interpreter & interpreter) {
+    tflite::SignatureRunner * shortlist = interpreter.GetSignatureRunner(WHISPER_DECODER_SHORTLIST_SIGNATURE);
+    tflite::SignatureRunner * step = interpreter.GetSignatureRunner(WHISPER_DECODER_STEP_SHORTLIST_SIGNATURE);
+    if (g_whisper_shortlist.empty() || shortlist == nullptr || step == nullptr) {
+        return nullptr;
+    }
+    if (g_whisper_shortlist != g_whisper_shortlist_built) {
+        g_whisper_shortlist_built.clear();
+        if (shortlist->ResizeInputTensor("ids", {(int) g_whisper_shortlist.size()}) != kTfLiteOk ||
+            shortlist->AllocateTensors() != kTfLiteOk) {
+            return nullptr;
+        }
+        std::copy(g_whisper_shortlist.begin(), g_whisper_shortlist.end(), shortlist->input_tensor("ids")->data.i32);
+        if (shortlist->Invoke() != kTfLiteOk) {
+            return nullptr;
+        }
+        g_whisper_shortlist_built = g_whisper_shortlist;
+    }
+    return step->AllocateTensors() == kTfLiteOk ? step : nullptr;
+}
+
+//argmax decoding over the encoder output until EOT; tokens holds the prompt on entry
+bool whisper_decode_greedy(std::vector<whisper_vocab::id> & tokens, const int max_tokens) {
+    whisper_tflite & dec = g_whisper_tflite_decoder_params;
+    tflite::Interpreter & interpreter = *dec.interpreter;
+    const int64_t t_start = whisper_time_us();
+    //hidden_states [1, 1500, n_state] float and tokens [1, n] int64
+    int input_hidden = interpreter.inputs()[0];
+    int input_tokens = interpreter.inputs()[1];
+    if (interpreter.tensor(input_hidden)->type == kTfLiteInt64) {
+        std::swap(input_hidden, input_tokens);
+    }
+    size_t encoder_bytes = 0;
+    const char * encoder_out = whisper_encoder_output(encoder_bytes);
+    const size_t n_prompt = tokens.size();
+    g_whisper_timings.n_tokens = 0;
+    while ((int) (tokens.size() - n_prompt) < max_tokens) {
+        if (interpreter.ResizeInputTensor(input_tokens, {1, (int) tokens.size()}) != kTfLiteOk ||
+            interpreter.AllocateTensors() != kTfLiteOk) {
+            return false;
+        }
+        memcpy(interpreter.tensor(input_hidden)->data.raw, encoder_out, encoder_bytes);
+        int64_t * ids = interpreter.tensor(input_tokens)->data.i64;
+        for (size_t i = 0; i < tokens.size(); i++) {
+            ids[i] = tokens[i];
+        }
+        whisper_profile_begin(g_whisper_decoder_profile);
+        const bool ok = interpreter.Invoke() == kTfLiteOk;
+        whisper_profile_end(interpreter, g_whisper_decoder_profile);
+        if (!ok) {
+            return false;
+        }
+        //logits [1, n, n_vocab], the last row predicts the next token
+        const TfLiteTensor * logits = interpreter.output_tensor(0);
+        const int n_vocab = logits->dims->data[2];
+        const float * last = logits->data.f + (size_t) (logits->dims->data[1] - 1)*n_vocab;
+        const whisper_vocab::id next = whisper_next_token(last, n_vocab, tokens, n_prompt);
+        tokens.push_back(next);
+        g_whisper_timings.n_tokens++;
+        if (next == g_vocab.token_eot) {
+            break;
+        }
+    }
+    g_whisper_timings.decode_us = whisper_time_us() - t_start;
+    return true;
+}
+
+//one Invoke() of a whisper-build-decoder model, the greedy loop and the KV
+//cache live in the graph; tokens holds the prompt on entry
+bool whisper_decode_loop(std::vector<whisper_vocab::id> & tokens, const int max_tokens) {
+    whisper_tflite & dec = g_whisper_tflite_decoder_params;
+    tflite::Interpreter & interpreter = *dec.interpreter;
+    const int64_t t_start = whisper_time_us();
+    //hidden_states [1, 1500, n_state] float, prompt [n] int32, limit [1] int32
+    const int input_prompt = interpreter.inputs()[1];
+    if (interpreter.tensor(input_prompt)->dims->data[0] != (int) tokens.size() &&
+        interpreter.ResizeInputTensor(input_prompt, {(int) tokens.size()}) != kTfLiteOk) {
+        return false;
+    }
+    //plans the arena again after a resize or a shared arena release, a no-op otherwise
+    if (interpreter.AllocateTensors() != kTfLiteOk) {
+        return false;
+    }
+    size_t encoder_bytes = 0;
+    const char * encoder_out = whisper_encoder_output(encoder_bytes);
+    memcpy(interpreter.input_tensor(0)->data.raw, encoder_out, encoder_bytes);
+    std::copy(tokens.begin(), tokens.end(), interpreter.typed_input_tensor<int32_t>(1));
+    const int n_text_ctx = interpreter.output_tensor(0)->dims->data[0];
+    interpreter.typed_input_tensor<int32_t>(2)[0] = std::min<int>(tokens.size() + max_tokens, n_text_ctx);
+
+    whisper_profile_begin(g_whisper_decoder_profile);
+    const bool ok = interpreter.Invoke() == kTfLiteOk;
+    whisper_profile_end(interpreter, g_whisper_decoder_profile);
+    if (!ok) {
+        return false;
+    }
+    //tokens [n_text_ctx], the prompt followed by the generated ones up to index last
+    const int32_t * out = interpreter.typed_output_tensor<int32_t>(0);
+    const int last = interpreter.typed_output_tensor<int32_t>(1)[0];
+    g_whisper_timings.n_tokens = last + 1 - (int) tokens.size();
+    tokens.assign(out, out + last + 1);
+    g_whisper_timings.decode_us = whisper_time_us() - t_start;
+    return true;
+}
+
+//greedy decoding with a whisper-build-decoder --step model: "init" fills the
+//cross attention cache, then one "step" per token on beam 0; tokens holds the
+//prompt on entry. whisper_kv_fork()/whisper_kv_reorder() move caches between beams.
+//With a shortlist "step_shortlist" computes its logits only, the others stay -inf.
+bool whisper_decode_step(std::vector<whisper_vocab::id> & tokens, const int max_tokens) {
+    tflite::Interpreter & interpreter = *g_whisper_tflite_decoder_params.interpreter;
+    const int64_t t_start = whisper_time_us();
+    tflite::SignatureRunner * init = interpreter.GetSignatureRunner(WHISPER_DECODER_INIT_SIGNATURE);
+    tflite::SignatureRunner * step_shortlist = whisper_shortlist_runner(interpreter);
+    tflite::SignatureRunner * step = step_shortlist != nullptr ? step_shortlist
+                                   : interpreter.GetSignatureRunner(WHISPER_DECODER_STEP_SIGNATURE);
+    if (init->AllocateTensors() != kTfLiteOk || step->AllocateTensors() != kTfLiteOk) {
+        return false;
+    }
+    //cross attention rows of the alignment heads, when words are timed and the model has them
+    const TfLiteTensor * alignment = nullptr;
+    if (g_whisper_timestamps == WHISPER_TIMESTAMPS_WORDS) {
+        for (const char * name : step->output_names()) {
+            if (strcmp(name, WHISPER_DECODER_ALIGNMENT_OUTPUT) == 0) {
+                alignment = step->output_tensor(name);
+            }
+        }
+    }
+    std::vector<float> scattered;
+    if (step_shortlist != nullptr) {
+        scattered.assign(g_vocab.n_vocab, -INFINITY);
+    }
+    size_t encoder_bytes = 0;
+    const char * encoder_out = whisper_encoder_output(encoder_bytes);
+    memcpy(init->input_tensor("hidden_states")->data.raw, encoder_out, encoder_bytes);
+    whisper_profile_begin(g_whisper_decoder_profile);
+    bool ok = init->Invoke() == kTfLiteOk;
+    whisper_profile_end(interpreter, g_whisper_decoder_profile);
+
+    //prompt tokens are stepped through the cache, generation starts after the last one
+    const std::vector<whisper_vocab::id> prompt = tokens;
+    tokens.assign(1, prompt[0]);
+    step->input_tensor("beam")->data.i32[0] = 0;
+    whisper_frozen_plan frozen;
+    g_whisper_timings.n_tokens = 0;
+    while (ok && g_whisper_timings.n_tokens < max_tokens) {
+        step->input_tensor("token")->data.i32[0] = tokens.back();
+        step->input_tensor("position")->data.i32[0] = tokens.size() - 1;
+        whisper_profile_begin(g_whisper_decoder_profile);
+        ok = whisper_frozen_plan_invoke(frozen, interpreter, *step) == kTfLiteOk;
+        whisper_profile_end(interpreter, g_whisper_decoder_profile);
+        if (!ok) {
+            break;
+        }
+        if (tokens.size() < prompt.size()) {
+            tokens.push_back(prompt[tokens.size()]);
+            continue;
+        }
+        //logits [1, n_vocab], [1, n] of the shortlist
+        const TfLiteTensor * logits = step->output_tensor("logits");
+        if (step_shortlist != nullptr) {
+            for (size_t i = 0; i < g_whisper_shortlist_built.size(); i++) {
+                scattered[g_whisper_shortlist_built[i]] = logits->data.f[i];
+            }
+            tokens.push_back(whisper_next_token(scattered.data(), scattered.size(), tokens, prompt.size()));
+        } else {
+            const int n_vocab = logits->dims->data[1];
+            tokens.push_back(whisper_next_token(logits->data.f, n_vocab, tokens, prompt.size()));
+        }
+        g_whisper_timings.n_tokens++;
+        if (alignment != nullptr && whisper_alignment_wants(tokens, prompt.size(), tokens.size() - 1)) {
+            const int64_t t_align = whisper_time_us();
+            whisper_alignment_add(g_whisper_alignment, alignment->data.f, alignment->dims->data[0],
+                                  alignment->dims->data[1], (int) tokens.size() - 1);
+            g_whisper_timings.align_us += whisper_time_us() - t_align;
+        }
+        if (tokens.back() == g_vocab.token_eot) {
+            break;
+        }
+    }
+    g_whisper_timings.decode_us = whisper_time_us() - t_start;
+    return ok;
+}
+
+//text of the generated tokens, special tokens are skipped
+std::string whisper_tokens_to_text(const std::vector<whisper_vocab::id> & tokens, const size_t n_prompt) {
+    std::string text;
+    for (size_t i = n_prompt; i < tokens.size(); i++) {
+        if (tokens[i] >= g_vocab.token_eot) {
+            continue;
+        }
+        text += whisper_token_to_str(tokens[i]);
+    }
+    return text;
+}
+
+//greedy decoder over the held encoder output of a chunk whose first n_samples
+//are audio; fills g_whisper_segments (seconds into the chunk) under g_whisper_timestamps
+bool whisper_decode_chunk(const int n_samples, const int max_tokens, std::string & text) {
+    //<|startoftranscript|><|lang|><|transcribe|>, <|notimestamps|> unless timestamps are decoded;
+    //the English only models have no language and task tokens
+    const bool timestamps = g_whisper_timestamps != WHISPER_TIMESTAMPS_NONE;
+    std::vector<whisper_vocab::id> tokens = {g_vocab.token_sot};
+    if (g_vocab.is_multilingual()) {
+        tokens.push_back(g_vocab.token_sot + 1 + g_whisper_language);
+        tokens.push_back(g_vocab.token_transcribe);
+    }
+    if (!timestamps) {
+        tokens.push_back(g_vocab.token_not);
+    }
+    g_whisper_logits.timestamps = timestamps;
+    g_whisper_logits.token_eot = g_vocab.token_eot;
+    g_whisper_logits.token_beg = g_vocab.token_beg;
+    const int n_frames = std::min<int>(WHISPER_FRAMES_PER_SECOND*WHISPER_CHUNK_SIZE,
+                                       (n_samples*WHISPER_FRAMES_PER_SECOND + WHISPER_SAMPLE_RATE - 1)/WHISPER_SAMPLE_RATE);
+    whisper_alignment_begin(g_whisper_alignment, n_frames);
+    g_whisper_timings.align_us = 0;
+    const size_t n_prompt = tokens.size();
+    const whisper_tflite & dec = g_whisper_tflite_decoder_params;
+    //the decoders plan their arenas again after a shared arena release
+    if (g_whisper_shared_arena && !whisper_arena_plan_acquire(*dec.interpreter, g_whisper_decoder_plan)) {
+        return false;
+    }
+    const bool decoded = dec.decode_loop ? whisper_decode_loop(tokens, max_tokens)
+                       : dec.decode_step ? whisper_decode_step(tokens, max_tokens)
+                       : whisper_decode_greedy(tokens, max_tokens);
+    g_whisper_arenas.decoder = whisper_arena_bytes(*dec.interpreter, g_whisper_decoder_plan);
+    if (g_whisper_shared_arena) {
+        whisper_arena_release(*dec.interpreter, g_whisper_decoder_plan);
+    }
+    if (!decoded) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: decoder failed\n", __func__);
+        return false;
+    }
+    text = whisper_tokens_to_text(tokens, n_prompt);
+    g_whisper_segments.clear();
+    if (timestamps) {
+        const int64_t t_align = whisper_time_us();
+        whisper_timestamps_segments(tokens, n_prompt, n_frames, &g_whisper_alignment, g_whisper_segments);
+        g_whisper_timings.align_us += whisper_time_us() - t_align;
+    }
+    return true;
+}
+
+//encoder and greedy decoder over one 30 second chunk of samples, the first
+//n_samples of them audio
+bool whisper_transcribe_pcm(const std::vector<float> & pcmf32, const std::vector<int16_t> & pcm16mono,
+                            const int n_samples, const int max_tokens, std::string & text) {
+    if (!whisper_encode(pcmf32, pcm16mono)) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: encoder failed\n", __func__);
+        return false;
+    }
+    return whisper_decode_chunk(n_samples, max_tokens, text);
+}
+
+//identifies the encoder input of a chunk: file, size, modification time, offset
+//and mel frontend; empty when the file cannot be read
+std::string whisper_chunk_key(const char * path, const float from_time) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return std::string();
+    }
+    char key[64];
+    snprintf(key, sizeof(key), "|%lld|%lld|%.6f|%d", (long long) st.st_size, (long long) st.st_mtime,
+             from_time, (int) g_whisper_frontend);
+    return path + std::string(key);
+}
+
+//reads and encodes one 30 second chunk of the file unless its encoder output
+//is still held, fills the audio and encoder timings; with hold the output is
+//kept for the next request on the same chunk
+bool whisper_encode_chunk(const char * path, const float from_time, const bool hold) {
+    const std::string key = whisper_chunk_key(path, from_time);
+    g_whisper_timings.encoder_reused = !key.empty() && key == g_whisper_encoded_key;
+    if (g_whisper_timings.encoder_reused) {
+        g_whisper_timings.n_samples = g_whisper_encoded_samples;
+        g_whisper_timings.audio_us = 0;
+        g_whisper_timings.mel_us = 0;
+        g_whisper_timings.encode_us = 0;
+        return true;
+    }
+    std::vector<float> pcmf32;
+    // mono 16 bit copy for the fixed point frontend
+    std::vector<int16_t> pcm16mono;
+    int64_t t_start = whisper_time_us();
+    g_whisper_timings.n_samples = whisper_read_audio(path, from_time, pcmf32, pcm16mono);
+    if (g_whisper_timings.n_samples < 0) {
+        return false;
+    }
+    g_whisper_timings.audio_us = whisper_time_us() - t_start;
+    if (!whisper_encode(pcmf32, pcm16mono)) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: encoder failed\n", __func__);
+        return false;
+    }
+    if (hold) {
+        g_whisper_encoded_key = key;
+        g_whisper_encoded_samples = g_whisper_timings.n_samples;
+    }
+    return true;
+}
+
+//decodes one 30 second chunk of the file, fills g_whisper_timings
+bool whisper_transcribe(const char * path, const float from_time, std::string & text) {
+    g_whisper_last_use_us = whisper_time_us();
+    if (!whisper_idle_reacquire()) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: failed to plan the arenas again\n", __func__);
+        return false;
+    }
+    if (!whisper_encode_chunk(path, from_time, false)) {
+        return false;
+    }
+    //the held output serves one transcription
+    g_whisper_encoded_key.clear();
+    if (!whisper_decode_chunk(g_whisper_timings.n_samples, WHISPER_MAX_DECODE_TOKENS, text)) {
+        return false;
+    }
+    for (whisper_segment & segment : g_whisper_segments) {
+        segment.start += from_time;
+        segment.end += from_time;
+        for (whisper_word & word : segment.words) {
+            word.start += from_time;
+            word.end += from_time;
+        }
+    }
+
+    __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR",
+                        "%s: audio %.1f ms, mel (%s) %.1f ms, encoder %.1f ms%s, decoder %.1f ms (%d tokens)\n",
+                        __func__, g_whisper_timings.audio_us/1000.0,
+                        g_whisper_tflite_params.pcm_input ? "graph" : whisper_frontend_name(g_whisper_frontend),
+                        g_whisper_timings.mel_us/1000.0, g_whisper_timings.encode_us/1000.0,
+                        g_whisper_timings.encoder_reused ? " (reused)" : "",
+                        g_whisper_timings.decode_us/1000.0, g_whisper_timings.n_tokens);
+    g_whisper_last_use_us = whisper_time_us();
+    return true;
+}
+
+//logits [n_vocab] of one decoder step from <|startoftranscript|> over the held
+//encoder output; the in-graph loop decoder outputs no logits
+bool whisper_decode_first_step(std::vector<float> & logits) {
+    whisper_tflite & dec = g_whisper_tflite_decoder_params;
+    tflite::Interpreter & interpreter = *dec.interpreter;
+    if (dec.decode_loop) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: the loop decoder outputs no logits\n", __func__);
+        return false;
+    }
+    size_t encoder_bytes = 0;
+    const char * encoder_out = whisper_encoder_output(encoder_bytes);
+    bool ok = false;
+    whisper_profile_begin(g_whisper_decoder_profile);
+    if (dec.decode_step) {
+        tflite::SignatureRunner * init = interpreter.GetSignatureRunner(WHISPER_DECODER_INIT_SIGNATURE);
+        tflite::SignatureRunner * step = interpreter.GetSignatureRunner(WHISPER_DECODER_STEP_SIGNATURE);
+        ok = init->AllocateTensors() == kTfLiteOk && step->AllocateTensors() == kTfLiteOk;
+        if (ok) {
+            memcpy(init->input_tensor("hidden_states")->data.raw, encoder_out, encoder_bytes);
+            step->input_tensor("token")->data.i32[0] = g_vocab.token_sot;
+            step->input_tensor("position")->data.i32[0] = 0;
+            step->input_tensor("beam")->data.i32[0] = 0;
+            ok = init->Invoke() == kTfLiteOk && step->Invoke() == kTfLiteOk;
+        }
+        if (ok) {
+            //logits [1, n_vocab]
+            const TfLiteTensor * out = step->output_tensor("logits");
+            logits.assign(out->data.f, out->data.f + out->dims->data[1]);
+        }
+    } else {
+        //hidden_states [1, 1500, n_state] float and tokens [1, 1] int64
+        int input_hidden = interpreter.inputs()[0];
+        int input_tokens = interpreter.inputs()[1];
+        if (interpreter.tensor(input_hidden)->type == kTfLiteInt64) {
+            std::swap(input_hidden, input_tokens);
+        }
+        ok = interpreter.ResizeInputTensor(input_tokens, {1, 1}) == kTfLiteOk &&
+             interpreter.AllocateTensors() == kTfLiteOk;
+        if (ok) {
+            memcpy(interpreter.tensor(input_hidden)->data.raw, encoder_out, encoder_bytes);
+            interpreter.tensor(input_tokens)->data.i64[0] = g_vocab.token_sot;
+            ok = interpreter.Invoke() == kTfLiteOk;
+        }
+        if (ok) {
+            //logits [1, 1, n_vocab]
+            const TfLiteTensor * out = interpreter.output_tensor(0);
+            logits.assign(out->data.f, out->data.f + out->dims->data[2]);
+        }
+    }
+    whisper_profile_end(interpreter, g_whisper_decoder_profile);
+    return ok;
+}
+
+//languages of one 30 second chunk of the file, best first: the encoder runs
+//once, its output is held for a transcription of the same chunk, then one
+//decoder step from <|startoftranscript|> and a softmax over the language
+//tokens only. Fills g_whisper_timings, decode_us is the step.
+bool whisper_detect_language(const char * path, const float from_time, std::vector<whisper_language_prob> & ranked) {
+    if (!g_vocab.is_multilingual()) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: the English only models have no languages\n", __func__);
+        return false;
+    }
+    g_whisper_last_use_us = whisper_time_us();
+    if (!whisper_idle_reacquire()) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: failed to plan the arenas again\n", __func__);
+        return false;
+    }
+    if (!whisper_encode_chunk(path, from_time, true)) {
+        return false;
+    }
+    const int64_t t_start = whisper_time_us();
+    const whisper_tflite & dec = g_whisper_tflite_decoder_params;
+    if (g_whisper_shared_arena && !whisper_arena_plan_acquire(*dec.interpreter, g_whisper_decoder_plan)) {
+        return false;
+    }
+    std::vector<float> logits;
+    const bool ok = whisper_decode_first_step(logits);
+    g_whisper_arenas.decoder = whisper_arena_bytes(*dec.interpreter, g_whisper_decoder_plan);
+    if (g_whisper_shared_arena) {
+        whisper_arena_release(*dec.interpreter, g_whisper_decoder_plan);
+    }
+    if (!ok || (int) logits.size() < g_vocab.token_sot + 1 + WHISPER_N_LANGUAGES) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: decoder step failed\n", __func__);
+        return false;
+    }
+    whisper_language_rank(logits.data(), g_vocab.token_sot, ranked);
+    g_whisper_timings.decode_us = whisper_time_us() - t_start;
+    g_whisper_timings.n_tokens = 0;
+    __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: %s (%.3f), encoder %.1f ms%s, decoder step %.1f ms\n",
+                        __func__, whisper_languages[ranked[0].language], ranked[0].prob,
+                        g_whisper_timings.encode_us/1000.0, g_whisper_timings.encoder_reused ? " (reused)" : "",
+                        g_whisper_timings.decode_us/1000.0);
+    g_whisper_last_use_us = whisper_time_us();
+    return true;
+}
+
+//decoder tokens of the whisper_prepare() pass, each step reads every decoder weight
+#define WHISPER_WARMUP_TOKENS 4
+
+
+//loads the models and runs them once over silence, so the first request finds
+//the weights paged in, the delegates prepared and the arenas planned
+bool whisper_prepare(AAssetManager * mgr) {
+    if (!whisper_load(mgr)) {
+        return false;
+    }
+    if (g_whisper_warm) {
+        return true;
+    }
+    const int64_t load_us = g_whisper_timings.load_us;
+    const int64_t t_start = whisper_time_us();
+    const std::vector<float> pcmf32(WHISPER_SAMPLE_RATE*WHISPER_CHUNK_SIZE, 0.0f);
+    const std::vector<int16_t> pcm16mono(pcmf32.size(), 0);
+    std::string text;
+    if (!whisper_idle_reacquire() || !whisper_transcribe_pcm(pcmf32, pcm16mono, pcmf32.size(), WHISPER_WARMUP_TOKENS, text)) {
+        __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: warm-up pass failed\n", __func__);
+        return false;
+    }
+    g_whisper_timings = whisper_timings();
+    g_whisper_timings.load_us = load_us;
+    g_whisper_timings.warmup_us = whisper_time_us() - t_start;
+    //the profiles cover requests only
+    whisper_profile_reset(g_whisper_encoder_profile);
+    whisper_profile_reset(g_whisper_decoder_profile);
+    g_whisper_last_use_us = whisper_time_us();
+    g_whisper_warm = true;
+    __android_log_print(ANDROID_LOG_VERBOSE, "Whisper ASR", "%s: load %.1f ms, warm-up %.1f ms\n",
+                        __func__, load_us/1000.0, g_whisper_timings.warmup_us/1000.0);
+    return true;
+}
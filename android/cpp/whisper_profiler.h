@@ -0,0 +1,203 @@
+//Opt-in per operator profiling of the encoder and decoder interpreters.
+//A tflite::profiling::BufferedProfiler is attached to each interpreter, its
+//events are folded after every Invoke() into per node and per op type
+//totals. ProfileSummarizer needs tensorflow/tsl StatsCalculator, which is
+//not part of the vendored sources, so the summary is built here and
+//reported as JSON (whisper_profile_json()).
+//Nodes of a delegate kernel (e.g. TfLiteXNNPackDelegate) and the internal ops
+//a delegate reports are flagged "delegate". Memory is the output tensor
+//size of each node plus the heap growth measured around Invoke().
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tensorflow/lite/profiling/buffered_profiler.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+
+//initial event capacity, the buffer grows when a graph emits more per Invoke()
+#define WHISPER_PROFILER_EVENTS 2048
+
+struct whisper_op_stats {
+    std::string name;        // "<type>:<node index>" or the delegate op tag
+    std::string type;
+    bool delegate = false;
+    int64_t count = 0;
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+    int64_t out_bytes = 0;   // output tensors of the node, 0 for delegate internal ops
+};
+
+struct whisper_model_profile {
+    std::unique_ptr<tflite::profiling::BufferedProfiler> profiler;
+    std::map<std::string, whisper_op_stats> ops;
+    int64_t invokes = 0;
+    uint64_t invoke_us = 0;
+    int64_t heap_growth_max_bytes = 0; // largest in use heap growth over one Invoke()
+    int64_t footprint_kb = 0;          // process footprint after the last Invoke()
+};
+
+bool g_whisper_profiling = false;
+whisper_model_profile g_whisper_encoder_profile;
+whisper_model_profile g_whisper_decoder_profile;
+
+static std::string whisper_profile_op_type(const TfLiteRegistration & registration, bool & delegate) {
+    delegate = registration.builtin_code == tflite::BuiltinOperator_DELEGATE;
+    if (registration.custom_name != nullptr &&
+        (delegate || registration.builtin_code == tflite::BuiltinOperator_CUSTOM)) {
+        return registration.custom_name;
+    }
+    return tflite::EnumNameBuiltinOperator((tflite::BuiltinOperator) registration.builtin_code);
+}
+
+//installs the profiler of an interpreter for the rest of its life: the
+//prebuilt Interpreter::SetProfiler(nullptr) only drops the root profiler and
+//the subgraphs keep calling it. Turning profiling off stops the recording in
+//whisper_profile_begin() instead.
+void whisper_profile_attach(tflite::Interpreter & interpreter, whisper_model_profile & profile) {
+    if (profile.profiler == nullptr) {
+        profile.profiler.reset(new tflite::profiling::BufferedProfiler(WHISPER_PROFILER_EVENTS, true));
+    }
+    interpreter.SetProfiler(profile.profiler.get());
+}
+
+void whisper_profile_reset(whisper_model_profile & profile) {
+    profile.ops.clear();
+    profile.invokes = 0;
+    profile.invoke_us = 0;
+    profile.heap_growth_max_bytes = 0;
+    profile.footprint_kb = 0;
+}
+
+void whisper_profile_begin(whisper_model_profile & profile) {
+    if (g_whisper_profiling && profile.profiler != nullptr) {
+        profile.profiler->Reset();
+        profile.profiler->StartProfiling();
+    }
+}
+
+//folds the events of the Invoke() that just finished
+void whisper_profile_end(tflite::Interpreter & interpreter, whisper_model_profile & profile) {
+    if (!g_whisper_profiling || profile.profiler == nullptr) {
+        return;
+    }
+    using tflite::profiling::ProfileEvent;
+    profile.profiler->StopProfiling();
+    profile.invokes++;
+    for (const ProfileEvent * event : profile.profiler->GetProfileEvents()) {
+        if (event == nullptr) {
+            continue;
+        }
+        if (event->event_type == ProfileEvent::EventType::OPERATOR_INVOKE_EVENT) {
+            const auto * node = interpreter.node_and_registration(event->extra_event_metadata, event->event_metadata);
+            if (node == nullptr) {
+                continue;
+            }
+            bool delegate = false;
+            const std::string type = whisper_profile_op_type(node->second, delegate);
+            const std::string name = type + ":" + std::to_string(event->event_metadata) +
+                    (event->extra_event_metadata > 0 ? "@" + std::to_string(event->extra_event_metadata) : "");
+            whisper_op_stats & op = profile.ops[name];
+            if (op.count == 0) {
+                op.name = name;
+                op.type = type;
+                op.delegate = delegate;
+                const TfLiteIntArray * outputs = node->first.outputs;
+                for (int i = 0; outputs != nullptr && i < outputs->size; i++) {
+                    const TfLiteTensor * t = interpreter.subgraph(event->extra_event_metadata)->tensor(outputs->data[i]);
+                    op.out_bytes += t != nullptr ? t->bytes : 0;
+                }
+            }
+            op.count++;
+            op.total_us += event->elapsed_time;
+            op.max_us = std::max<uint64_t>(op.max_us, event->elapsed_time);
+            profile.invoke_us += event->elapsed_time;
+        } else if (event->event_type == ProfileEvent::EventType::DELEGATE_OPERATOR_INVOKE_EVENT) {
+            //already counted in the time of the delegate node that ran it
+            const std::string name = "delegate/" + event->tag;
+            whisper_op_stats & op = profile.ops[name];
+            op.name = name;
+            op.type = event->tag;
+            op.delegate = true;
+            op.count++;
+            op.total_us += event->elapsed_time;
+            op.max_us = std::max<uint64_t>(op.max_us, event->elapsed_time);
+        } else if (event->tag == "Invoke" &&
+                   event->end_mem_usage.in_use_allocated_bytes != tflite::profiling::memory::MemoryUsage::kValueNotSet) {
+            const int64_t growth = (int64_t) event->end_mem_usage.in_use_allocated_bytes -
+                                   (int64_t) event->begin_mem_usage.in_use_allocated_bytes;
+            profile.heap_growth_max_bytes = std::max(profile.heap_growth_max_bytes, growth);
+            profile.footprint_kb = event->end_mem_usage.mem_footprint_kb;
+        }
+    }
+    profile.profiler->Reset();
+}
+
+static void whisper_profile_json_model(std::ostringstream & out, const whisper_model_profile & profile) {
+    std::vector<const whisper_op_stats *> ops;
+    std::map<std::string, whisper_op_stats> by_type;
+    uint64_t delegate_us = 0;
+    for (const auto & it : profile.ops) {
+        const whisper_op_stats & op = it.second;
+        ops.push_back(&op);
+        if (op.name.compare(0, 9, "delegate/") == 0) {
+            continue;
+        }
+        whisper_op_stats & t = by_type[op.type];
+        t.type = op.type;
+        t.delegate = op.delegate;
+        t.count += op.count;
+        t.total_us += op.total_us;
+        t.out_bytes += op.out_bytes;
+        if (op.delegate) {
+            delegate_us += op.total_us;
+        }
+    }
+    std::sort(ops.begin(), ops.end(), [](const whisper_op_stats * a, const whisper_op_stats * b) {
+        return a->total_us > b->total_us;
+    });
+    std::vector<const whisper_op_stats *> types;
+    for (const auto & it : by_type) {
+        types.push_back(&it.second);
+    }
+    std::sort(types.begin(), types.end(), [](const whisper_op_stats * a, const whisper_op_stats * b) {
+        return a->total_us > b->total_us;
+    });
+
+    const double total = profile.invoke_us > 0 ? (double) profile.invoke_us : 1.0;
+    out << "{\"invokes\": " << profile.invokes
+        << ", \"total_ms\": " << profile.invoke_us/1000.0
+        << ", \"delegate_ms\": " << delegate_us/1000.0
+        << ", \"heap_growth_max_kb\": " << profile.heap_growth_max_bytes/1024
+        << ", \"footprint_kb\": " << profile.footprint_kb
+        << ", \"by_type\": [";
+    for (size_t i = 0; i < types.size(); i++) {
+        const whisper_op_stats & t = *types[i];
+        out << (i ? ", " : "") << "{\"type\": \"" << t.type << "\", \"delegate\": " << (t.delegate ? "true" : "false")
+            << ", \"count\": " << t.count << ", \"total_ms\": " << t.total_us/1000.0
+            << ", \"percent\": " << 100.0*t.total_us/total << ", \"out_kb\": " << t.out_bytes/1024 << "}";
+    }
+    out << "], \"ops\": [";
+    for (size_t i = 0; i < ops.size(); i++) {
+        const whisper_op_stats & op = *ops[i];
+        out << (i ? ", " : "") << "{\"name\": \"" << op.name << "\", \"type\": \"" << op.type
+            << "\", \"delegate\": " << (op.delegate ? "true" : "false") << ", \"count\": " << op.count
+            << ", \"avg_us\": " << (op.count ? op.total_us/op.count : 0) << ", \"max_us\": " << op.max_us
+            << ", \"total_ms\": " << op.total_us/1000.0 << ", \"percent\": " << 100.0*op.total_us/total
+            << ", \"out_kb\": " << op.out_bytes/1024 << "}";
+    }
+    out << "]}";
+}
+
+//profiles collected since profiling was enabled
+std::string whisper_profile_json() {
+    std::ostringstream out;
+    out << "{\"enabled\": " << (g_whisper_profiling ? "true" : "false") << ", \"encoder\": ";
+    whisper_profile_json_model(out, g_whisper_encoder_profile);
+    out << ", \"decoder\": ";
+    whisper_profile_json_model(out, g_whisper_decoder_profile);
+    out << "}";
+    return out.str();
+}
@@ -0,0 +1,297 @@
+//Segment and word timestamps of a transcription. Include after whisper.h.
+//
+//Segments come from the timestamp tokens (token_beg + i, i*20 ms into the
+//chunk) the decoder emits once the prompt leaves out <|notimestamps|>; the
+//timestamp rules of whisper_logits.h keep them in pairs around the text.
+//
+//Words come from the cross attention of the alignment heads, the "alignment"
+//output of a whisper-build-decoder --alignment-heads step model, aligned to the
+//audio frames with dynamic time warping. OpenAI's find_alignment() runs the
+//decoder a second time over the finished text; here every step adds its row to
+//the DTW as it is decoded, so the end of the chunk only walks the path back.
+//A row only knows its own step, so each head is standardized and median
+//filtered over the frames of its row instead of over all tokens of a frame.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//encoder frames per second of audio, 1500 per 30 second chunk
+#define WHISPER_FRAMES_PER_SECOND 50
+//width of the median filter over the frames of a row, as in OpenAI's
+#define WHISPER_ALIGNMENT_MEDIAN_WIDTH 7
+
+enum whisper_timestamps_mode {
+    WHISPER_TIMESTAMPS_NONE = 0,
+    WHISPER_TIMESTAMPS_SEGMENTS,
+    WHISPER_TIMESTAMPS_WORDS, // segments, and words when the decoder has alignment heads
+};
+
+//"none", "segments" or "words"
+inline bool whisper_timestamps_from_name(const char * name, whisper_timestamps_mode * mode) {
+    static const char * names[] = {"none", "segments", "words"};
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *mode = (whisper_timestamps_mode) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct whisper_word {
+    std::string text;
+    float start = 0.0f; // seconds
+    float end = 0.0f;
+};
+
+struct whisper_segment {
+    std::string text;
+    float start = 0.0f; // seconds
+    float end = 0.0f;
+    std::vector<whisper_word> words;
+};
+
+//DTW between the aligned decoder steps (rows) and the audio frames (columns)
+struct whisper_alignment {
+    int n_frames = 0;
+    int n_rows = 0;
+    std::vector<float> cost;    // of the last row, n_frames + 1 columns
+    std::vector<uint8_t> trace; // step into each cell, n_rows x n_frames
+    std::vector<int> tokens;    // index of the token each row decoded
+    std::vector<float> row;     // scratch: mean over the heads of one row
+    std::vector<float> head;    // scratch: one standardized head
+};
+
+//starts the alignment of a chunk with n_frames frames of audio, the rest is padding
+inline void whisper_alignment_begin(whisper_alignment & al, const int n_frames) {
+    al.n_frames = std::max(1, n_frames);
+    al.n_rows = 0;
+    al.cost.assign(al.n_frames + 1, INFINITY);
+    al.cost[0] = 0.0f;
+    al.trace.clear();
+    al.tokens.clear();
+    al.row.assign(al.n_frames, 0.0f);
+    al.head.resize(al.n_frames);
+}
+
+//adds the step that decoded tokens[token]: weights [n_heads, n_audio] of its
+//alignment heads, the first n_frames columns are aligned
+inline void whisper_alignment_add(whisper_alignment & al, const float * weights, const int n_heads, const int n_audio,
+                                  const int token) {
+    const int n = std::min(al.n_frames, n_audio);
+    const int half = WHISPER_ALIGNMENT_MEDIAN_WIDTH/2;
+    std::fill(al.row.begin(), al.row.end(), 0.0f);
+    for (int h = 0; h < n_heads; h++) {
+        const float * w = weights + (size_t) h*n_audio;
+        double sum = 0.0;
+        double sum2 = 0.0;
+        for (int j = 0; j < n; j++) {
+            sum += w[j];
+            sum2 += (double) w[j]*w[j];
+        }
+        const double mean = sum/n;
+        const float rstd = 1.0f/(float) std::sqrt(std::max(sum2/n - mean*mean, 0.0) + 1e-10);
+        for (int j = 0; j < n; j++) {
+            al.head[j] = (w[j] - (float) mean)*rstd;
+        }
+        //median over the window, reflected at the edges
+        float window[WHISPER_ALIGNMENT_MEDIAN_WIDTH];
+        for (int j = 0; j < n; j++) {
+            for (int k = -half; k <= half; k++) {
+                int c = j + k;
+                c = c < 0 ? -c : c >= n ? 2*(n - 1) - c : c;
+                window[k + half] = al.head[std::min(std::max(c, 0), n - 1)];
+            }
+            std::nth_element(window, window + half, window + WHISPER_ALIGNMENT_MEDIAN_WIDTH);
+            al.row[j] += window[half]/n_heads;
+        }
+    }
+    //cost[i][j] = -row[j] + min(cost[i-1][j-1], cost[i-1][j], cost[i][j-1]),
+    //traced as 0 diagonal, 1 from the row above, 2 from the left
+    const std::vector<float> above = al.cost;
+    al.trace.resize((size_t) (al.n_rows + 1)*al.n_frames);
+    uint8_t * trace = al.trace.data() + (size_t) al.n_rows*al.n_frames;
+    al.cost[0] = INFINITY;
+    for (int j = 1; j <= al.n_frames; j++) {
+        const float c0 = above[j - 1];
+        const float c1 = above[j];
+        const float c2 = al.cost[j - 1];
+        uint8_t t = 0;
+        float c = c0;
+        if (c1 < c) {
+            c = c1;
+            t = 1;
+        }
+        if (c2 < c) {
+            c = c2;
+            t = 2;
+        }
+        al.cost[j] = c - al.row[j - 1];
+        trace[j - 1] = t;
+    }
+    al.n_rows++;
+    al.tokens.push_back(token);
+}
+
+//first frame of every row on the path back from the last cell
+inline void whisper_alignment_end(const whisper_alignment & al, std::vector<int> & start_frames) {
+    start_frames.assign(al.n_rows, 0);
+    int i = al.n_rows;
+    int j = al.n_frames;
+    while (i > 0 && j > 0) {
+        start_frames[i - 1] = j - 1;
+        const uint8_t t = al.trace[(size_t) (i - 1)*al.n_frames + j - 1];
+        if (t == 0) {
+            i--;
+            j--;
+        } else if (t == 1) {
+            i--;
+        } else {
+            j--;
+        }
+    }
+    //rows above the first frame start with it
+    for (; i > 0; i--) {
+        start_frames[i - 1] = 0;
+    }
+}
+
+//whether a decoded token is text, as opposed to EOT, timestamps and other special tokens
+inline bool whisper_token_is_text(const whisper_vocab::id token) {
+    return token >= 0 && token < g_vocab.token_eot;
+}
+
+//whether the step that decoded tokens[i] gets an alignment row: text tokens,
+//and the first other token after text, which closes the last word
+inline bool whisper_alignment_wants(const std::vector<whisper_vocab::id> & tokens, const size_t n_prompt,
+                                    const size_t i) {
+    return whisper_token_is_text(tokens[i]) || (i > n_prompt && whisper_token_is_text(tokens[i - 1]));
+}
+
+//segments of the tokens generated after n_prompt; words too when the
+//alignment has a row for each text token. Times are seconds into the chunk,
+//n_frames ends a segment cut off before its closing timestamp.
+inline void whisper_timestamps_segments(const std::vector<whisper_vocab::id> & tokens, const size_t n_prompt,
+                                        const int n_frames, const whisper_alignment * al,
+                                        std::vector<whisper_segment> & segments) {
+    segments.clear();
+    const float frame_s = 1.0f/WHISPER_FRAMES_PER_SECOND;
+    //start frame of the row of every token, -1 without one
+    std::vector<int> token_frame(tokens.size(), -1);
+    bool words = al != nullptr && al->n_rows > 0;
+    if (words) {
+        std::vector<int> start_frames;
+        whisper_alignment_end(*al, start_frames);
+        for (int r = 0; r < al->n_rows; r++) {
+            if (al->tokens[r] >= 0 && al->tokens[r] < (int) tokens.size()) {
+                token_frame[al->tokens[r]] = start_frames[r];
+            }
+        }
+        for (size_t i = n_prompt; i < tokens.size(); i++) {
+            words = words && (token_frame[i] >= 0 || !whisper_token_is_text(tokens[i]));
+        }
+    }
+    whisper_segment segment;
+    bool open = false;        // a timestamp started the segment
+    float last_end = 0.0f;
+    auto close_word = [&](const int frame) {
+        if (!segment.words.empty() && frame >= 0) {
+            segment.words.back().end = frame*frame_s;
+        }
+    };
+    auto close = [&](const float end) {
+        segment.end = std::max(end, segment.start);
+        //words stay inside their segment and do not run backwards
+        float t = segment.start;
+        for (whisper_word & w : segment.words) {
+            w.start = std::min(std::max(w.start, t), segment.end);
+            w.end = std::min(std::max(w.end, w.start), segment.end);
+            t = w.end;
+        }
+        segments.push_back(segment);
+        last_end = segment.end;
+        segment = whisper_segment();
+        open = false;
+    };
+    for (size_t i = n_prompt; i < tokens.size(); i++) {
+        const whisper_vocab::id token = tokens[i];
+        if (whisper_token_is_text(token)) {
+            if (segment.text.empty() && !open) {
+                segment.start = last_end;
+            }
+            const std::string piece = whisper_token_to_str(token);
+            segment.text += piece;
+            if (words) {
+                //a leading space starts a word, punctuation stays with the one before
+                const bool starts = segment.words.empty() || piece[0] == ' ';
+                if (starts) {
+                    close_word(token_frame[i]);
+                    segment.words.push_back(whisper_word());
+                    segment.words.back().start = token_frame[i]*frame_s;
+                }
+                segment.words.back().text += starts && piece[0] == ' ' ? piece.substr(1) : piece;
+            }
+            continue;
+        }
+        if (words && i > n_prompt && whisper_token_is_text(tokens[i - 1])) {
+            close_word(token_frame[i]);
+        }
+        if (token >= g_vocab.token_beg) {
+            const float t = (token - g_vocab.token_beg)*frame_s;
+            if (!segment.text.empty()) {
+                close(t);
+            } else {
+                segment.start = t;
+                open = true;
+            }
+        } else if (token == g_vocab.token_eot) {
+            break;
+        }
+    }
+    if (!segment.text.empty()) {
+        if (words && !segment.words.empty() && segment.words.back().end <= segment.words.back().start) {
+            segment.words.back().end = n_frames*frame_s;
+        }
+        close(n_frames*frame_s);
+    }
+}
+
+inline std::string whisper_timestamps_escape(const std::string & s) {
+    std::string out;
+    for (const char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char) c < 0x20) {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\u%04x", c);
+            out += hex;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+//{"segments": [{"start", "end", "text", "words": [{"word", "start", "end"}]}]}
+inline std::string whisper_timestamps_json(const std::vector<whisper_segment> & segments) {
+    std::string json = "{\"segments\": [";
+    char times[64];
+    for (size_t s = 0; s < segments.size(); s++) {
+        const whisper_segment & segment = segments[s];
+        snprintf(times, sizeof(times), "{\"start\": %.2f, \"end\": %.2f, ", segment.start, segment.end);
+        json += (s > 0 ? ", " : "") + std::string(times) + "\"text\": \"" +
+                whisper_timestamps_escape(segment.text) + "\", \"words\": [";
+        for (size_t w = 0; w < segment.words.size(); w++) {
+            const whisper_word & word = segment.words[w];
+            snprintf(times, sizeof(times), "\", \"start\": %.2f, \"end\": %.2f}", word.start, word.end);
+            json += (w > 0 ? ", " : "") + std::string("{\"word\": \"") + whisper_timestamps_escape(word.text) + times;
+        }
+        json += "]}";
+    }
+    return json + "]}";
+}
@@ -0,0 +1,225 @@
+//filters_vocab_*.bin, the mel filters and the text tokens. Include after whisper.h.
+//
+//v1 (magic USEN): n_mel, n_fft, n_mel*n_fft float filters, n_vocab, then
+//per token its uint32 length and bytes.
+//v2 (magic USE2, tools/vocab_convert.cpp) is laid out to be used from one read
+//or a mapping: a 64 byte header, then 64 byte aligned blocks
+//  filters  n_mel*n_fft float
+//  bands    n_mel (begin, end) int32, the non-zero bins of each filter
+//  offsets  n_vocab + 1 uint32 into the blob, token i ends at offsets[i + 1] - 1
+//  blob     the NUL terminated tokens
+//and an FNV-1a checksum over the 32 bit words after the header.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define WHISPER_VOCAB_MAGIC_V1 0x5553454e
+#define WHISPER_VOCAB_MAGIC_V2 0x55534532
+#define WHISPER_VOCAB_ALIGNMENT 64
+
+struct whisper_vocab_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_bytes;
+    uint32_t checksum;
+    int32_t n_mel;
+    int32_t n_fft;
+    int32_t n_vocab;
+    uint32_t filters_offset;
+    uint32_t bands_offset;
+    uint32_t offsets_offset;
+    uint32_t blob_offset;
+    uint32_t blob_bytes;
+    uint32_t reserved[4];
+};
+
+static_assert(sizeof(whisper_vocab_file_header) == WHISPER_VOCAB_ALIGNMENT, "v2 header is one aligned block");
+
+inline size_t whisper_vocab_file_align(const size_t bytes) {
+    return (bytes + WHISPER_VOCAB_ALIGNMENT - 1)/WHISPER_VOCAB_ALIGNMENT*WHISPER_VOCAB_ALIGNMENT;
+}
+
+//over whole words, the v2 blocks are padded to the alignment
+inline uint32_t whisper_vocab_file_checksum(const char * data, const size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t)) {
+        uint32_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word)*16777619u;
+    }
+    return hash;
+}
+
+//[begin, end) of the non-zero weights of each filter, v1 files do not store them
+inline void whisper_filters_set_bands(whisper_filters & filters) {
+    filters.begin.assign(filters.n_mel, 0);
+    filters.end.assign(filters.n_mel, 0);
+    for (int j = 0; j < filters.n_mel; j++) {
+        const float * w = filters.data.data() + j*filters.n_fft;
+        int b = filters.n_fft;
+        int e = 0;
+        for (int k = 0; k < filters.n_fft; k++) {
+            if (w[k] != 0.0f) {
+                b = std::min(b, k);
+                e = k + 1;
+            }
+        }
+        filters.begin[j] = b < e ? b : 0;
+        filters.end[j] = e;
+    }
+}
+
+inline bool whisper_vocab_file_parse_v1(const char * data, const size_t size, whisper_filters & filters,
+                                        whisper_vocab & vocab, std::string & error) {
+    size_t pos = sizeof(uint32_t);
+    auto read = [&](void * dst, const size_t n) {
+        if (pos + n > size) {
+            return false;
+        }
+        memcpy(dst, data + pos, n);
+        pos += n;
+        return true;
+    };
+    if (!read(&filters.n_mel, sizeof(filters.n_mel)) || !read(&filters.n_fft, sizeof(filters.n_fft)) ||
+        filters.n_mel < 0 || filters.n_fft < 0) {
+        error = "truncated filters";
+        return false;
+    }
+    if ((uint64_t) filters.n_mel*filters.n_fft*sizeof(float) > size - pos) {
+        error = "truncated filters";
+        return false;
+    }
+    filters.data.resize((size_t) filters.n_mel*filters.n_fft);
+    if (!read(filters.data.data(), filters.data.size()*sizeof(float))) {
+        error = "truncated filters";
+        return false;
+    }
+    whisper_filters_set_bands(filters);
+    int32_t n_vocab = 0;
+    if (!read(&n_vocab, sizeof(n_vocab)) || n_vocab < 0) {
+        error = "truncated vocab";
+        return false;
+    }
+    vocab.n_vocab = n_vocab;
+    vocab.token_offsets.assign(1, 0);
+    vocab.token_blob.clear();
+    for (int i = 0; i < n_vocab; i++) {
+        uint32_t len = 0;
+        if (!read(&len, sizeof(len)) || pos + len > size) {
+            error = "truncated vocab";
+            return false;
+        }
+        vocab.token_blob.insert(vocab.token_blob.end(), data + pos, data + pos + len);
+        vocab.token_blob.push_back('\0');
+        vocab.token_offsets.push_back(vocab.token_blob.size());
+        pos += len;
+    }
+    return true;
+}
+
+inline bool whisper_vocab_file_parse_v2(const char * data, const size_t size, whisper_filters & filters,
+                                        whisper_vocab & vocab, std::string & error) {
+    whisper_vocab_file_header h;
+    if (size < sizeof(h)) {
+        error = "truncated header";
+        return false;
+    }
+    memcpy(&h, data, sizeof(h));
+    const uint64_t filters_bytes = (uint64_t) h.n_mel*h.n_fft*sizeof(float);
+    const uint64_t bands_bytes = (uint64_t) h.n_mel*2*sizeof(int32_t);
+    const uint64_t offsets_bytes = ((uint64_t) h.n_vocab + 1)*sizeof(uint32_t);
+    auto block_ok = [&](const uint32_t offset, const uint64_t bytes) {
+        return offset % WHISPER_VOCAB_ALIGNMENT == 0 && offset >= sizeof(h) && (uint64_t) offset + bytes <= h.file_bytes;
+    };
+    if (h.version != 2 || h.file_bytes != size || h.n_mel < 0 || h.n_fft < 0 || h.n_vocab < 0 ||
+        !block_ok(h.filters_offset, filters_bytes) || !block_ok(h.bands_offset, bands_bytes) ||
+        !block_ok(h.offsets_offset, offsets_bytes) || !block_ok(h.blob_offset, h.blob_bytes)) {
+        error = "malformed header";
+        return false;
+    }
+    if (whisper_vocab_file_checksum(data + sizeof(h), size - sizeof(h)) != h.checksum) {
+        error = "checksum mismatch";
+        return false;
+    }
+    filters.n_mel = h.n_mel;
+    filters.n_fft = h.n_fft;
+    filters.data.resize((size_t) h.n_mel*h.n_fft);
+    memcpy(filters.data.data(), data + h.filters_offset, filters_bytes);
+    std::vector<int32_t> bands(2*h.n_mel);
+    memcpy(bands.data(), data + h.bands_offset, bands_bytes);
+    filters.begin.resize(h.n_mel);
+    filters.end.resize(h.n_mel);
+    for (int j = 0; j < h.n_mel; j++) {
+        filters.begin[j] = bands[2*j];
+        filters.end[j] = bands[2*j + 1];
+        if (filters.begin[j] < 0 || filters.begin[j] > filters.end[j] || filters.end[j] > h.n_fft) {
+            error = "malformed filter bands";
+            return false;
+        }
+    }
+    vocab.n_vocab = h.n_vocab;
+    vocab.token_offsets.resize(h.n_vocab + 1);
+    memcpy(vocab.token_offsets.data(), data + h.offsets_offset, offsets_bytes);
+    vocab.token_blob.assign(data + h.blob_offset, data + h.blob_offset + h.blob_bytes);
+    //every token lies in the blob and ends with its NUL
+    if (vocab.token_offsets[0] != 0 || vocab.token_offsets[h.n_vocab] != h.blob_bytes) {
+        error = "malformed token offsets";
+        return false;
+    }
+    for (int i = 0; i < h.n_vocab; i++) {
+        const uint32_t end = vocab.token_offsets[i + 1];
+        if (end <= vocab.token_offsets[i] || vocab.token_blob[end - 1] != '\0') {
+            error = "malformed token offsets";
+            return false;
+        }
+    }
+    return true;
+}
+
+//either version, error tells why it was rejected
+inline bool whisper_vocab_file_parse(const char * data, const size_t size, whisper_filters & filters,
+                                     whisper_vocab & vocab, std::string & error) {
+    uint32_t magic = 0;
+    if (size >= sizeof(magic)) {
+        memcpy(&magic, data, sizeof(magic));
+    }
+    vocab.id_to_token.clear();
+    if (magic == WHISPER_VOCAB_MAGIC_V1) {
+        return whisper_vocab_file_parse_v1(data, size, filters, vocab, error);
+    }
+    if (magic == WHISPER_VOCAB_MAGIC_V2) {
+        return whisper_vocab_file_parse_v2(data, size, filters, vocab, error);
+    }
+    error = "bad magic";
+    return false;
+}
+
+inline std::string whisper_vocab_file_write_v2(const whisper_filters & filters, const whisper_vocab & vocab) {
+    whisper_vocab_file_header h = {};
+    h.magic = WHISPER_VOCAB_MAGIC_V2;
+    h.version = 2;
+    h.n_mel = filters.n_mel;
+    h.n_fft = filters.n_fft;
+    h.n_vocab = vocab.n_text();
+    h.blob_bytes = vocab.token_blob.size();
+    h.filters_offset = sizeof(h);
+    h.bands_offset = whisper_vocab_file_align(h.filters_offset + filters.data.size()*sizeof(float));
+    h.offsets_offset = whisper_vocab_file_align(h.bands_offset + 2*filters.n_mel*sizeof(int32_t));
+    h.blob_offset = whisper_vocab_file_align(h.offsets_offset + (h.n_vocab + 1)*sizeof(uint32_t));
+    h.file_bytes = whisper_vocab_file_align(h.blob_offset + h.blob_bytes);
+    std::string out(h.file_bytes, '\0');
+    memcpy(&out[h.filters_offset], filters.data.data(), filters.data.size()*sizeof(float));
+    for (int j = 0; j < filters.n_mel; j++) {
+        const int32_t band[2] = {filters.begin[j], filters.end[j]};
+        memcpy(&out[h.bands_offset + j*sizeof(band)], band, sizeof(band));
+    }
+    memcpy(&out[h.offsets_offset], vocab.token_offsets.data(), (h.n_vocab + 1)*sizeof(uint32_t));
+    memcpy(&out[h.blob_offset], vocab.token_blob.data(), h.blob_bytes);
+    h.checksum = whisper_vocab_file_checksum(out.data() + sizeof(h), out.size() - sizeof(h));
+    memcpy(&out[0], &h, sizeof(h));
+    return out;
+}
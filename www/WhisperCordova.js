@@ -16,6 +16,62 @@ DecodeChunkAudio: function (localImagePath, isBase64, fromTime, successCallback,
 
     return exec(
         successCallback, failureCallback, 'WhisperCordova', 'decodeChunkAudio', [this._getLocalImagePathWithoutPrefix(localImagePath), (isBase64==true? 1 : 0), fromTime]);
+    },
+    SetFrontend: function (frontendName, successCallback, failureCallback) {
+    return exec(
+        successCallback, failureCallback, 'WhisperCordova', 'setFrontend', [frontendName]);
+    },
+    SetProfiling: function (enabled, successCallback, failureCallback) {
+    return exec(
+        successCallback, failureCallback, 'WhisperCordova', 'setProfiling', [enabled === true]);
+    },
+    GetProfile: function (successCallback, failureCallback) {
+    return exec(
+        function (json) { successCallback(JSON.parse(json)); }, failureCallback, 'WhisperCordova', 'getProfile', []);
+    },
+    SetSharedArena: function (enabled, successCallback, failureCallback) {
+    //frees the encoder tensor arena while the decoder runs and the other way round; it lowers the
+    //peak memory of a loop decoder (the default decoder asset), the arena of a whisper-build-decoder
+    //--step model is too small next to the encoder one to gain anything
+    return exec(
+        successCallback, failureCallback, 'WhisperCordova', 'setSharedArena', [enabled === true]);
+    },
+    SetIdleRelease: function (seconds, successCallback, failureCallback) {
+    return exec(
+        successCallback, failureCallback, 'WhisperCordova', 'setIdleRelease', [seconds | 0]);
+    },
+    GetMemoryStats: function (successCallback, failureCallback) {
+    return exec(
+        function (json) { successCallback(JSON.parse(json)); }, failureCallback, 'WhisperCordova', 'getMemoryStats', []);
+    },
+    SetTimestamps: function (mode, successCallback, failureCallback) {
+    //"none", "segments" or "words", GetTimestamps returns those of the last DecodeChunkAudio
+    return exec(
+        successCallback, failureCallback, 'WhisperCordova', 'setTimestamps', [mode]);
+    },
+    GetTimestamps: function (successCallback, failureCallback) {
+    return exec(
+        function (json) { successCallback(JSON.parse(json)); }, failureCallback, 'WhisperCordova', 'getTimestamps', []);
+    },
+    DetectLanguage: function (localPath, fromTime, successCallback, failureCallback) {
+    //ranked [{language, probability}], a DecodeChunkAudio of the same chunk reuses its encoder output
+    return exec(
+        function (json) { successCallback(JSON.parse(json)); }, failureCallback, 'WhisperCordova', 'detectLanguage',
+        [this._getLocalImagePathWithoutPrefix(localPath), fromTime]);
+    },
+    SetLanguage: function (languageCode, successCallback, failureCallback) {
+    return exec(
+        successCallback, failureCallback, 'WhisperCordova', 'setLanguage', [languageCode]);
+    },
+    Prepare: function (successCallback, failureCallback) {
+    //resolves once the models are loaded and warmed up, the callbacks are optional
+    var ready = new Promise(function (resolve, reject) {
+        exec(resolve, reject, 'WhisperCordova', 'prepare', []);
+    });
+    if (typeof successCallback == 'function' || typeof failureCallback == 'function') {
+        ready.then(successCallback, failureCallback);
+    }
+    return ready;
     },
      _getLocalImagePathWithoutPrefix: function(localImagePath) {
         if (localImagePath.indexOf('file:///') === 0) {